@@ -71,15 +71,39 @@ struct option options[] =
 {
 	{ "verbosity", &paxos_config.verbosity, option_verbosity },
 	{ "tcp-nodelay", &paxos_config.tcp_nodelay, option_boolean },
+	{ "binary-codec", &paxos_config.binary_codec, option_boolean },
+	{ "max-frame-size", &paxos_config.max_frame_size, option_bytes },
+	{ "replica-loopback", &paxos_config.replica_loopback, option_boolean },
+	{ "shm-transport", &paxos_config.shm_transport, option_boolean },
+	{ "shm-path", &paxos_config.shm_path, option_string },
+	{ "io-threads", &paxos_config.io_threads, option_integer },
+	{ "io-threads-pin", &paxos_config.io_threads_pin, option_boolean },
 	{ "quorum-1", &paxos_config.quorum_1, option_integer },
 	{ "quorum-2", &paxos_config.quorum_2, option_integer },
 	{ "group-1", &paxos_config.group_1, option_integer },
 	{ "group-2", &paxos_config.group_2, option_integer },
+	{ "fast-paxos", &paxos_config.fast_paxos, option_boolean },
 	{ "learner-catch-up", &paxos_config.learner_catch_up, option_boolean },
+	{ "learner-log-size", &paxos_config.learner_log_size, option_integer },
+	{ "learner-cursor-path", &paxos_config.learner_cursor_path, option_string },
+	{ "learner-cursor-interval", &paxos_config.learner_cursor_interval, option_integer },
+	{ "learner-cursor-sync", &paxos_config.learner_cursor_sync, option_boolean },
+	{ "learner-stall-deadline", &paxos_config.learner_stall_deadline, option_integer },
+	{ "learner-snapshot-max-size", &paxos_config.learner_snapshot_max_size, option_bytes },
 	{ "proposer-timeout", &paxos_config.proposer_timeout, option_integer },
 	{ "proposer-preexec-window", &paxos_config.proposer_preexec_window, option_integer },
+	{ "proposer-accept-batch", &paxos_config.proposer_accept_batch, option_integer },
+	{ "proposer-leader-timeout", &paxos_config.proposer_leader_timeout, option_integer },
+	{ "proposer-takeover-backoff", &paxos_config.proposer_takeover_backoff, option_integer },
+	{ "proposer-lease", &paxos_config.proposer_lease, option_integer },
+	{ "proposer-partition", &paxos_config.proposer_partition, option_boolean },
+	{ "proposer-max-requests", &paxos_config.proposer_max_requests, option_integer },
+	{ "client-timeout", &paxos_config.client_timeout, option_integer },
 	{ "storage-backend", &paxos_config.storage_backend, option_backend },
 	{ "acceptor-trash-files", &paxos_config.trash_files, option_boolean },
+	{ "acceptor-cache-size", &paxos_config.acceptor_cache_size, option_bytes },
+	{ "acceptor-shards", &paxos_config.acceptor_shards, option_integer },
+	{ "acceptor-ring", &paxos_config.acceptor_ring, option_boolean },
 	{ "lmdb-sync", &paxos_config.lmdb_sync, option_boolean },
 	{ "lmdb-env-path", &paxos_config.lmdb_env_path, option_string },
 	{ "lmdb-mapsize", &paxos_config.lmdb_mapsize, option_bytes },
@@ -135,6 +159,15 @@ evpaxos_config_read(const char* path)
 		linenumber++;
 	}
 
+	/* Acceptor shards drop the values of the fast round, which then could
+	   never gather a fast quorum, made of every acceptor. */
+	if (paxos_config.fast_paxos && paxos_config.acceptor_shards > 1) {
+		paxos_log_error("fast-paxos cannot be used with acceptor-shards\n");
+		evpaxos_config_free(c);
+		fclose(f);
+		return NULL;
+	}
+
 	fclose(f);
 	return c;
 
@@ -155,6 +188,12 @@ evpaxos_config_free(struct evpaxos_config* config)
 	free(config);
 }
 
+int
+evpaxos_proposer_count(struct evpaxos_config* config)
+{
+	return config->proposers_count;
+}
+
 struct sockaddr_in
 evpaxos_proposer_address(struct evpaxos_config* config, int i)
 {
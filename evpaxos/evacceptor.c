@@ -30,25 +30,163 @@
 #include "peers.h"
 #include "acceptor.h"
 #include "message.h"
+#include "io_thread.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <sys/time.h>
 #include <event2/event.h>
 
 
+/*
+	With acceptor-shards > 1 instances are partitioned by iid across worker
+	threads, each owning its own acceptor state and storage. Requests are
+	routed to the owning shard and its replies are handed back to the event
+	loop thread, which sends them.
+*/
+struct shard
+{
+	int index;
+	struct acceptor* state;
+	struct io_thread* thread;
+};
+
 struct evacceptor
 {
+	int id;
+	uint32_t log;
 	struct peers* peers;
 	struct acceptor* state;
+	int shards_count;
+	struct shard* shards;
+	struct task_queue* replies;
+	iid_t trim_iid;
 	struct event* timer_ev;
 	struct timeval timer_tv;
+	struct peer* leader;        /* Last promised, or confirmed by heartbeat */
+	ballot_t leader_ballot;
+	struct timeval lease_until; /* No other peer is promised before then */
+	int ring;                   /* Passes accepteds on to the next acceptor */
+	iid_t accepted_iid;         /* Highest accepted, sent in heartbeat acks */
+};
+
+struct shard_task
+{
+	struct task task;
+	struct evacceptor* acceptor;
+	struct shard* shard;
+	struct peer* peer;
+	paxos_message req;
+	int replies_count;
+	paxos_message* replies;
 };
 
 
 static void
-peer_send_paxos_message(struct peer* p, void* arg)
+evacceptor_set_leader(struct evacceptor* a, struct peer* p, ballot_t ballot)
 {
-	send_paxos_message(peer_get_buffer(p), arg);
+	if (p != a->leader) {
+		peer_retain(p);
+		if (a->leader != NULL)
+			peer_release(a->leader);
+		a->leader = p;
+	}
+	a->leader_ballot = ballot;
+}
+
+static int
+evacceptor_lease_active(struct evacceptor* a)
+{
+	struct timeval now;
+	if (paxos_config.proposer_lease <= 0 || a->leader == NULL)
+		return 0;
+	gettimeofday(&now, NULL);
+	return timercmp(&now, &a->lease_until, <);
+}
+
+/*
+	While the lease of the leader lasts, prepares and accepts from any other
+	peer are dropped, for the leader to serve reads without a round of
+	Paxos: no other proposer may take over, nor decide values with the
+	instances it prepared before, without the leader hearing of it.
+*/
+static int
+evacceptor_admit(struct evacceptor* a, struct peer* p, iid_t iid)
+{
+	if (p != a->leader && evacceptor_lease_active(a)) {
+		paxos_log_debug("Request for iid %d dropped, lease held by peer %d",
+			iid, peer_get_id(a->leader));
+		return 0;
+	}
+	return 1;
+}
+
+/*
+	The peer last promised a ballot is taken to be the leader, whatever the
+	ballots promised to others for other instances, as proposers draw their
+	ballots independently.
+*/
+static void
+evacceptor_promised(struct evacceptor* a, struct peer* p,
+	paxos_prepare* prepare, paxos_message* out)
+{
+	if (out->type == PAXOS_PROMISE && out->u.promise.ballot == prepare->ballot)
+		evacceptor_set_leader(a, p, prepare->ballot);
+}
+
+static void
+evacceptor_set_accepted(struct evacceptor* a, paxos_message* out)
+{
+	int i;
+	if (out->type == PAXOS_ACCEPTED) {
+		if (out->u.accepted.iid > a->accepted_iid)
+			a->accepted_iid = out->u.accepted.iid;
+		return;
+	}
+	for (i = 0; i < out->u.accepted_batch.entries_len; i++)
+		if (out->u.accepted_batch.entries_val[i].iid > a->accepted_iid)
+			a->accepted_iid = out->u.accepted_batch.entries_val[i].iid;
+}
+
+/*
+	The leader's lease is renewed by its accepts and heartbeats.
+*/
+static void
+evacceptor_renew_lease(struct evacceptor* a, struct peer* p)
+{
+	struct timeval lease;
+	if (p != a->leader || paxos_config.proposer_lease <= 0)
+		return;
+	lease.tv_sec = paxos_config.proposer_lease / 1000;
+	lease.tv_usec = (paxos_config.proposer_lease % 1000) * 1000;
+	gettimeofday(&a->lease_until, NULL);
+	timeradd(&a->lease_until, &lease, &a->lease_until);
+}
+
+/*
+	Heartbeats are acknowledged to the leader only, confirming that no other
+	proposer has been promised a ballot in the meantime. A leader elected
+	again may have all the instances it needs prepared already, it is then
+	adopted on its heartbeats, once the lease of the current leader is over.
+	Acks carry the highest instance accepted, for the leader to learn of
+	every instance decided before it serves a read.
+*/
+static void
+evacceptor_handle_heartbeat(struct peer* p, paxos_message* msg, void* arg)
+{
+	struct evacceptor* a = (struct evacceptor*)arg;
+	paxos_heartbeat* hb = &msg->u.heartbeat;
+	if (p != a->leader && !evacceptor_lease_active(a))
+		evacceptor_set_leader(a, p, hb->ballot);
+	if (p != a->leader)
+		return;
+	evacceptor_renew_lease(a, p);
+	paxos_message ack = {
+		.type = PAXOS_HEARTBEAT_ACK,
+		.log = a->log,
+		.u.heartbeat_ack = { a->id, hb->seq, a->accepted_iid } };
+	peer_send_message(p, &ack);
 }
 
 /*
@@ -62,31 +200,184 @@ evacceptor_handle_prepare(struct peer* p, paxos_message* msg, void* arg)
 	struct evacceptor* a = (struct evacceptor*)arg;
 	paxos_log_debug("Handle prepare for iid %d ballot %d",
 		prepare->iid, prepare->ballot);
+	if (!evacceptor_admit(a, p, prepare->iid))
+		return;
 	if (acceptor_receive_prepare(a->state, prepare, &out) != 0) {
-		send_paxos_message(peer_get_buffer(p), &out);
+		evacceptor_promised(a, p, prepare, &out);
+		out.log = a->log;
+		peer_send_message(p, &out);
 		paxos_message_destroy(&out);
 	}
 }
 
+/*
+	Received a ranged prepare, from the owner of the instances, when
+	partitioned among replicas.
+*/
+static void
+evacceptor_handle_prepare_range(struct peer* p, paxos_message* msg, void* arg)
+{
+	paxos_message out;
+	struct evacceptor* a = (struct evacceptor*)arg;
+	if (acceptor_receive_prepare_range(a->state, &msg->u.prepare_range,
+		&out) != 0) {
+		out.log = a->log;
+		peer_send_message(p, &out);
+	}
+}
+
+static void
+evacceptor_send_chosen(struct evacceptor* a, paxos_chosen* chosen)
+{
+	paxos_message msg = {
+		.type = PAXOS_CHOSEN,
+		.log = a->log,
+		.u.chosen = *chosen };
+	peers_broadcast_clients(a->peers, &msg);
+}
+
+/*
+	Accepteds go to every client. With acceptor-ring, the acceptors of
+	group 2 rather pass them on to the next one, and the last one tells the
+	clients that the values are chosen: acceptors take as accepts the
+	accepteds of the acceptor before them only, so that all those before
+	the last one accepted the values as well.
+*/
+static void
+evacceptor_send_accepted(struct evacceptor* a, paxos_message* out)
+{
+	int i;
+	struct peer* next;
+	evacceptor_set_accepted(a, out);
+	if (!a->ring) {
+		peers_broadcast_clients(a->peers, out);
+		return;
+	}
+	if (a->id < paxos_config.group_2 - 1) {
+		next = peers_get_acceptor(a->peers, a->id + 1);
+		if (next != NULL)
+			peer_send_message(next, out);
+		return;
+	}
+	if (out->type == PAXOS_ACCEPTED) {
+		paxos_accepted* acc = &out->u.accepted;
+		paxos_chosen chosen = {acc->iid, acc->ballot, acc->value,
+			acc->timestamp};
+		evacceptor_send_chosen(a, &chosen);
+		return;
+	}
+	for (i = 0; i < out->u.accepted_batch.entries_len; i++) {
+		paxos_accepted_entry* e = &out->u.accepted_batch.entries_val[i];
+		paxos_chosen chosen = {e->iid, e->ballot, e->value, e->timestamp};
+		evacceptor_send_chosen(a, &chosen);
+	}
+}
+
+/*
+	Preemptions go back to the proposer, or to every client when the accept
+	came from the previous acceptor on the ring, in which case p is NULL.
+*/
+static void
+evacceptor_send_preempted(struct evacceptor* a, struct peer* p,
+	paxos_message* out)
+{
+	if (p == NULL)
+		peers_broadcast_clients(a->peers, out);
+	else
+		peer_send_message(p, out);
+}
+
+/*
+	Values of the fast round come without an instance id. Their accepteds
+	go to every client, even along a ring, as each acceptor received the
+	value itself.
+*/
+static void
+evacceptor_fast_accept(struct evacceptor* a, paxos_accept* accept)
+{
+	paxos_message out;
+	if (acceptor_receive_fast_accept(a->state, accept, &out) != 0) {
+		out.log = a->log;
+		evacceptor_set_accepted(a, &out);
+		peers_broadcast_clients(a->peers, &out);
+		paxos_message_destroy(&out);
+	}
+}
+
+static void
+evacceptor_accept(struct evacceptor* a, struct peer* p, paxos_accept* accept)
+{
+	paxos_message out;
+	if (accept->iid == 0 && paxos_config.fast_paxos) {
+		evacceptor_fast_accept(a, accept);
+		return;
+	}
+	if (acceptor_receive_accept(a->state, accept, &out) != 0) {
+		out.log = a->log;
+		if (out.type == PAXOS_ACCEPTED)
+			evacceptor_send_accepted(a, &out);
+		else if (out.type == PAXOS_PREEMPTED)
+			evacceptor_send_preempted(a, p, &out);
+		paxos_message_destroy(&out);
+	}
+}
+
+/*
+	A batch of accept requests is acknowledged with a single
+	PAXOS_ACCEPTED_BATCH.
+*/
+static void
+evacceptor_accept_batch(struct evacceptor* a, struct peer* p,
+	paxos_accept_batch* batch)
+{
+	int i, count;
+	paxos_message out;
+	paxos_preempted* preempted;
+	preempted = malloc(batch->entries_len * sizeof(paxos_preempted));
+	if (acceptor_receive_accept_batch(a->state, batch, &out,
+		preempted, &count) != 0) {
+		out.log = a->log;
+		if (out.u.accepted_batch.entries_len > 0)
+			evacceptor_send_accepted(a, &out);
+		for (i = 0; i < count; i++) {
+			paxos_message m = {
+				.type = PAXOS_PREEMPTED,
+				.log = a->log,
+				.u.preempted = preempted[i] };
+			evacceptor_send_preempted(a, p, &m);
+		}
+		paxos_message_destroy(&out);
+	}
+	free(preempted);
+}
+
 /*
 	Received a accept request (phase 2a).
 */
 static void 
 evacceptor_handle_accept(struct peer* p, paxos_message* msg, void* arg)
 {	
-	paxos_message out;
 	paxos_accept* accept = &msg->u.accept;
 	struct evacceptor* a = (struct evacceptor*)arg;
 	paxos_log_debug("Handle accept for iid %d bal %d", 
 		accept->iid, accept->ballot);
-	if (acceptor_receive_accept(a->state, accept, &out) != 0) {
-		if (out.type == PAXOS_ACCEPTED) {
-			peers_foreach_client(a->peers, peer_send_paxos_message, &out);
-		} else if (out.type == PAXOS_PREEMPTED) {
-			send_paxos_message(peer_get_buffer(p), &out);
-		}
-		paxos_message_destroy(&out);
-	}
+	if (accept->iid != 0 && !evacceptor_admit(a, p, accept->iid))
+		return;
+	evacceptor_renew_lease(a, p);
+	evacceptor_accept(a, p, accept);
+}
+
+static void
+evacceptor_handle_accept_batch(struct peer* p, paxos_message* msg, void* arg)
+{
+	paxos_accept_batch* batch = &msg->u.accept_batch;
+	struct evacceptor* a = (struct evacceptor*)arg;
+	paxos_log_debug("Handle accept batch of %d instances", batch->entries_len);
+	if (batch->entries_len > 0 &&
+		!evacceptor_admit(a, p, batch->entries_val[0].iid))
+		return;
+	evacceptor_renew_lease(a, p);
+	evacceptor_accept_batch(a, p, batch);
 }
 
 static void
@@ -99,7 +390,11 @@ evacceptor_handle_repeat(struct peer* p, paxos_message* msg, void* arg)
 	paxos_log_debug("Handle repeat for iids %d-%d", repeat->from, repeat->to);
 	for (iid = repeat->from; iid <= repeat->to; ++iid) {
 		if (acceptor_receive_repeat(a->state, iid, &accepted)) {
-			send_paxos_accepted(peer_get_buffer(p), &accepted);
+			paxos_message out = {
+				.type = PAXOS_ACCEPTED,
+				.log = a->log,
+				.u.accepted = accepted };
+			peer_send_message(p, &out);
 			paxos_accepted_destroy(&accepted);
 		}
 	}
@@ -113,31 +408,355 @@ evacceptor_handle_trim(struct peer* p, paxos_message* msg, void* arg)
 	acceptor_receive_trim(a->state, trim);
 }
 
+static struct shard*
+shard_of(struct evacceptor* a, iid_t iid)
+{
+	return &a->shards[iid % a->shards_count];
+}
+
+static void
+shard_task_free(struct shard_task* t)
+{
+	if (t->peer != NULL)
+		peer_release(t->peer);
+	free(t->replies);
+	free(t);
+}
+
+static void
+shard_add_reply(struct shard_task* t, paxos_message* m)
+{
+	t->replies = realloc(t->replies,
+		(t->replies_count + 1) * sizeof(paxos_message));
+	t->replies[t->replies_count++] = *m;
+}
+
+/*
+	Runs on the shard's thread, the counterpart of the handlers above.
+*/
+static void
+shard_handle_request(struct shard_task* t)
+{
+	int i, count;
+	iid_t iid;
+	paxos_message out;
+	paxos_accepted accepted;
+	paxos_preempted* preempted;
+	paxos_message* req = &t->req;
+	struct shard* s = t->shard;
+	int shards = t->acceptor->shards_count;
+
+	switch (req->type) {
+	case PAXOS_PREPARE:
+		if (acceptor_receive_prepare(s->state, &req->u.prepare, &out) != 0)
+			shard_add_reply(t, &out);
+		break;
+	case PAXOS_ACCEPT:
+		if (acceptor_receive_accept(s->state, &req->u.accept, &out) != 0)
+			shard_add_reply(t, &out);
+		break;
+	case PAXOS_ACCEPT_BATCH:
+		preempted = malloc(req->u.accept_batch.entries_len *
+			sizeof(paxos_preempted));
+		if (acceptor_receive_accept_batch(s->state, &req->u.accept_batch,
+			&out, preempted, &count) != 0) {
+			if (out.u.accepted_batch.entries_len > 0)
+				shard_add_reply(t, &out);
+			else
+				paxos_message_destroy(&out);
+			for (i = 0; i < count; i++) {
+				paxos_message m = {
+					.type = PAXOS_PREEMPTED,
+					.u.preempted = preempted[i] };
+				shard_add_reply(t, &m);
+			}
+		}
+		free(preempted);
+		break;
+	case PAXOS_REPEAT:
+		iid = req->u.repeat.from;
+		iid += (s->index + shards - iid % shards) % shards;
+		for (; iid <= req->u.repeat.to; iid += shards) {
+			if (acceptor_receive_repeat(s->state, iid, &accepted)) {
+				paxos_message m = {
+					.type = PAXOS_ACCEPTED,
+					.u.accepted = accepted };
+				shard_add_reply(t, &m);
+			}
+		}
+		break;
+	case PAXOS_TRIM:
+		acceptor_receive_trim(s->state, &req->u.trim);
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+	Runs on the event loop thread once the shard is done with the request.
+	Acknowledgements of accepts go to every client, or along the ring,
+	everything else back to the peer the request came from.
+*/
+static void
+shard_run_reply(struct task* task, int discard)
+{
+	int i;
+	struct shard_task* t = (struct shard_task*)task;
+	int accept = t->req.type == PAXOS_ACCEPT ||
+		t->req.type == PAXOS_ACCEPT_BATCH;
+	for (i = 0; i < t->replies_count; i++) {
+		paxos_message* m = &t->replies[i];
+		m->log = t->acceptor->log;
+		if (!discard && t->req.type == PAXOS_PREPARE)
+			evacceptor_promised(t->acceptor, t->peer, &t->req.u.prepare, m);
+		if (!discard) {
+			if (accept && (m->type == PAXOS_ACCEPTED ||
+				m->type == PAXOS_ACCEPTED_BATCH))
+				evacceptor_send_accepted(t->acceptor, m);
+			else if (m->type == PAXOS_PREEMPTED)
+				evacceptor_send_preempted(t->acceptor, t->peer, m);
+			else
+				peer_send_message(t->peer, m);
+		}
+		paxos_message_destroy(m);
+	}
+	shard_task_free(t);
+}
+
+static void
+shard_run_request(struct task* task, int discard)
+{
+	struct shard_task* t = (struct shard_task*)task;
+	if (!discard)
+		shard_handle_request(t);
+	paxos_message_destroy(&t->req);
+	if (discard) {
+		shard_task_free(t);
+		return;
+	}
+	t->task.run = shard_run_reply;
+	task_queue_push(t->acceptor->replies, &t->task);
+}
+
+static void
+shard_push(struct evacceptor* a, struct shard* s, struct peer* p,
+	paxos_message* req)
+{
+	struct shard_task* t = calloc(1, sizeof(struct shard_task));
+	t->task.run = shard_run_request;
+	t->acceptor = a;
+	t->shard = s;
+	t->peer = p;
+	t->req = *req;
+	if (p != NULL)
+		peer_retain(p);
+	io_thread_push(s->thread, &t->task);
+}
+
+/*
+	Decoded values may point into the peer's input buffer, the shard needs
+	its own copy.
+*/
+static void
+evacceptor_route_batch(struct evacceptor* a, struct peer* p,
+	paxos_accept_batch* batch)
+{
+	int i, j;
+	for (i = 0; i < a->shards_count; i++) {
+		paxos_message req = {.type = PAXOS_ACCEPT_BATCH};
+		paxos_accept_batch* sub = &req.u.accept_batch;
+		sub->entries_len = 0;
+		sub->entries_val = malloc(batch->entries_len *
+			sizeof(paxos_accept_entry));
+		for (j = 0; j < batch->entries_len; j++) {
+			paxos_accept_entry* e = &batch->entries_val[j];
+			if (shard_of(a, e->iid) != &a->shards[i])
+				continue;
+			sub->entries_val[sub->entries_len] = *e;
+			paxos_value_copy(&sub->entries_val[sub->entries_len++].value,
+				&e->value);
+		}
+		if (sub->entries_len > 0)
+			shard_push(a, &a->shards[i], p, &req);
+		else
+			free(sub->entries_val);
+	}
+}
+
+static void
+evacceptor_route(struct peer* p, paxos_message* msg, void* arg)
+{
+	int i;
+	paxos_message req = *msg;
+	struct evacceptor* a = (struct evacceptor*)arg;
+	switch (msg->type) {
+	case PAXOS_PREPARE:
+		if (evacceptor_admit(a, p, msg->u.prepare.iid))
+			shard_push(a, shard_of(a, msg->u.prepare.iid), p, &req);
+		break;
+	case PAXOS_ACCEPT:
+		if (!evacceptor_admit(a, p, msg->u.accept.iid))
+			break;
+		evacceptor_renew_lease(a, p);
+		paxos_value_copy(&req.u.accept.value, &msg->u.accept.value);
+		shard_push(a, shard_of(a, msg->u.accept.iid), p, &req);
+		break;
+	case PAXOS_ACCEPT_BATCH:
+		if (msg->u.accept_batch.entries_len > 0 &&
+			!evacceptor_admit(a, p, msg->u.accept_batch.entries_val[0].iid))
+			break;
+		evacceptor_renew_lease(a, p);
+		evacceptor_route_batch(a, p, &msg->u.accept_batch);
+		break;
+	case PAXOS_TRIM:
+		if (msg->u.trim.iid > a->trim_iid)
+			a->trim_iid = msg->u.trim.iid;
+		/* fall through */
+	case PAXOS_REPEAT:
+		for (i = 0; i < a->shards_count; i++)
+			shard_push(a, &a->shards[i], p, &req);
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+	Received the accepted of the previous acceptor on the ring, which is
+	accepted in turn, at the ballot of the value.
+*/
+static void
+evacceptor_handle_accepted(struct peer* p, paxos_message* msg, void* arg)
+{
+	struct evacceptor* a = (struct evacceptor*)arg;
+	paxos_accepted* acc = &msg->u.accepted;
+	paxos_message req = {.type = PAXOS_ACCEPT, .log = msg->log};
+	if (acc->aid != a->id - 1 || acc->value_ballot == 0)
+		return;
+	req.u.accept = (paxos_accept) {acc->iid, acc->value_ballot, acc->value,
+		acc->timestamp};
+	if (a->shards_count == 0) {
+		evacceptor_accept(a, NULL, &req.u.accept);
+		return;
+	}
+	paxos_value_copy(&req.u.accept.value, &acc->value);
+	shard_push(a, shard_of(a, acc->iid), NULL, &req);
+}
+
+static void
+evacceptor_handle_accepted_batch(struct peer* p, paxos_message* msg,
+	void* arg)
+{
+	int i;
+	struct evacceptor* a = (struct evacceptor*)arg;
+	paxos_accepted_batch* batch = &msg->u.accepted_batch;
+	paxos_accept_batch accepts = {0, NULL};
+	if (batch->aid != a->id - 1)
+		return;
+	accepts.entries_val = malloc(batch->entries_len *
+		sizeof(paxos_accept_entry));
+	for (i = 0; i < batch->entries_len; i++) {
+		paxos_accepted_entry* e = &batch->entries_val[i];
+		if (e->value_ballot == 0)
+			continue;
+		accepts.entries_val[accepts.entries_len++] = (paxos_accept_entry) {
+			e->iid, e->value_ballot, e->value, e->timestamp };
+	}
+	if (accepts.entries_len > 0 && a->shards_count > 0)
+		evacceptor_route_batch(a, NULL, &accepts);
+	else if (accepts.entries_len > 0)
+		evacceptor_accept_batch(a, NULL, &accepts);
+	free(accepts.entries_val);
+}
+
 static void
 send_acceptor_state(int fd, short ev, void* arg)
 {
 	struct evacceptor* a = (struct evacceptor*)arg;
-	paxos_message msg = {.type = PAXOS_ACCEPTOR_STATE};
-	acceptor_set_current_state(a->state, &msg.u.state);
-	peers_foreach_client(a->peers, peer_send_paxos_message, &msg);
+	paxos_message msg = {.type = PAXOS_ACCEPTOR_STATE, .log = a->log};
+	if (a->shards_count > 0) {
+		msg.u.state.aid = a->id;
+		msg.u.state.trim_iid = a->trim_iid;
+	} else {
+		acceptor_set_current_state(a->state, &msg.u.state);
+	}
+	peers_broadcast_clients(a->peers, &msg);
 	event_add(a->timer_ev, &a->timer_tv);
 }
 
+static void
+evacceptor_init_shards(struct evacceptor* a, int count, struct event_base* b)
+{
+	int i;
+	paxos_acceptor_state state;
+	a->shards_count = count;
+	a->shards = calloc(count, sizeof(struct shard));
+	a->replies = task_queue_new(b);
+	for (i = 0; i < count; i++) {
+		struct shard* s = &a->shards[i];
+		s->index = i;
+		s->state = acceptor_new_shard(a->id, i, a->log);
+		acceptor_set_current_state(s->state, &state);
+		if (i == 0 || state.trim_iid < a->trim_iid)
+			a->trim_iid = state.trim_iid;
+		if (acceptor_get_max_instance(s->state) > a->accepted_iid)
+			a->accepted_iid = acceptor_get_max_instance(s->state);
+		s->thread = io_thread_new(paxos_config.io_threads + i);
+		io_thread_start(s->thread);
+	}
+	paxos_log_info("Acceptor %d running %d shards", a->id, count);
+}
+
 struct evacceptor*
-evacceptor_init_internal(int id, struct evpaxos_config* c, struct peers* p)
+evacceptor_init_internal(int id, struct evpaxos_config* c, struct peers* p,
+	uint32_t log)
 {
 	struct evacceptor* acceptor;
+	struct event_base* base = peers_get_event_base(p);
 	
 	acceptor = calloc(1, sizeof(struct evacceptor));
-	acceptor->state = acceptor_new(id);
+	acceptor->id = id;
+	acceptor->log = log;
 	acceptor->peers = p;
+	acceptor->ring = paxos_config.acceptor_ring && id < paxos_config.group_2;
 	
-	peers_subscribe(p, PAXOS_PREPARE, evacceptor_handle_prepare, acceptor);
-	peers_subscribe(p, PAXOS_ACCEPT, evacceptor_handle_accept, acceptor);
-	peers_subscribe(p, PAXOS_REPEAT, evacceptor_handle_repeat, acceptor);
-	peers_subscribe(p, PAXOS_TRIM, evacceptor_handle_trim, acceptor);
+	if (paxos_config.acceptor_shards > 1) {
+		evacceptor_init_shards(acceptor, paxos_config.acceptor_shards, base);
+		peers_subscribe_log(p, log, PAXOS_PREPARE, evacceptor_route,
+			acceptor);
+		peers_subscribe_log(p, log, PAXOS_ACCEPT, evacceptor_route, acceptor);
+		peers_subscribe_log(p, log, PAXOS_ACCEPT_BATCH, evacceptor_route,
+			acceptor);
+		peers_subscribe_log(p, log, PAXOS_REPEAT, evacceptor_route, acceptor);
+		peers_subscribe_log(p, log, PAXOS_TRIM, evacceptor_route, acceptor);
+	} else {
+		acceptor->state = acceptor_new_shard(id, 0, log);
+		/* records held may be promises only, erring on the safe side */
+		acceptor->accepted_iid = acceptor_get_max_instance(acceptor->state);
+		peers_subscribe_log(p, log, PAXOS_PREPARE, evacceptor_handle_prepare,
+			acceptor);
+		peers_subscribe_log(p, log, PAXOS_PREPARE_RANGE,
+			evacceptor_handle_prepare_range, acceptor);
+		peers_subscribe_log(p, log, PAXOS_ACCEPT, evacceptor_handle_accept,
+			acceptor);
+		peers_subscribe_log(p, log, PAXOS_ACCEPT_BATCH,
+			evacceptor_handle_accept_batch, acceptor);
+		peers_subscribe_log(p, log, PAXOS_REPEAT, evacceptor_handle_repeat,
+			acceptor);
+		peers_subscribe_log(p, log, PAXOS_TRIM, evacceptor_handle_trim,
+			acceptor);
+	}
+	
+	peers_subscribe_log(p, log, PAXOS_HEARTBEAT, evacceptor_handle_heartbeat,
+		acceptor);
+	if (acceptor->ring && id > 0) {
+		peers_subscribe_log(p, log, PAXOS_ACCEPTED, evacceptor_handle_accepted,
+			acceptor);
+		peers_subscribe_log(p, log, PAXOS_ACCEPTED_BATCH,
+			evacceptor_handle_accepted_batch, acceptor);
+	}
 	
-	struct event_base* base = peers_get_event_base(p);
 	acceptor->timer_ev = evtimer_new(base, send_acceptor_state, acceptor);
 	acceptor->timer_tv = (struct timeval){1, 0};
 	event_add(acceptor->timer_ev, &acceptor->timer_tv);
@@ -164,7 +783,9 @@ evacceptor_init(int id, const char* config_file, struct event_base* base)
 	int port = evpaxos_acceptor_listen_port(config, id);
 	if (peers_listen(peers, port) == 0)
 		return NULL;
-	struct evacceptor* acceptor = evacceptor_init_internal(id, config, peers);
+	struct evacceptor* acceptor = evacceptor_init_internal(id, config, peers, 0);
+	if (acceptor->ring && id < paxos_config.group_2 - 1)
+		peers_connect_to_acceptor(peers, id + 1);
 	evpaxos_config_free(config);
 	return acceptor;
 }
@@ -172,8 +793,22 @@ evacceptor_init(int id, const char* config_file, struct event_base* base)
 void
 evacceptor_free_internal(struct evacceptor* a)
 {
+	int i;
 	event_free(a->timer_ev);
-	acceptor_free(a->state);
+	if (a->leader != NULL)
+		peer_release(a->leader);
+	if (a->shards_count > 0) {
+		for (i = 0; i < a->shards_count; i++)
+			io_thread_stop(a->shards[i].thread);
+		task_queue_free(a->replies);
+		for (i = 0; i < a->shards_count; i++) {
+			io_thread_free(a->shards[i].thread);
+			acceptor_free(a->shards[i].state);
+		}
+		free(a->shards);
+	} else {
+		acceptor_free(a->state);
+	}
 	free(a);
 }
 
@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2013-2015, University of Lugano
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holders nor the names of it
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "evpaxos.h"
+#include "peers.h"
+#include "khash.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <event2/event.h>
+
+/*
+	Every value submitted is kept until the proposer acknowledges it with a
+	PAXOS_CLIENT_REPLY carrying its id, and submitted again if no reply
+	came after client-timeout seconds, e.g. because the connection to the
+	proposer was lost in the meantime.
+
+	Clients are connected to all proposers and submit to the one they
+	believe is the leader, as told by the replies, or to the next one
+	connected when the leader they know of is not. Values submitted while
+	no proposer is connected are kept, unsent, until one connects.
+*/
+struct request
+{
+	uint32_t id;
+	void* arg;
+	struct timeval sent_at;  /* Zero until sent */
+	paxos_value value;
+};
+
+KHASH_MAP_INIT_INT(request, struct request*)
+
+struct evpaxos_client
+{
+	struct peers* peers;
+	int proposers;
+	int leader;
+	uint32_t next_id;
+	khash_t(request)* requests;
+	reply_function reply;
+	void* arg;
+	struct timeval tv;
+	struct event* timeout_ev;
+};
+
+
+static struct peer*
+leader_peer(struct evpaxos_client* c)
+{
+	int i;
+	struct peer* p;
+	for (i = 0; i < c->proposers; i++) {
+		p = peers_get_acceptor(c->peers, (c->leader + i) % c->proposers);
+		if (peer_connected(p)) {
+			c->leader = peer_get_id(p);
+			return p;
+		}
+	}
+	return peers_get_acceptor(c->peers, c->leader);
+}
+
+static void
+send_request(struct evpaxos_client* c, struct request* r)
+{
+	struct peer* p = leader_peer(c);
+	paxos_message msg = {
+		.type = PAXOS_CLIENT_VALUE,
+		.u.client_value = { r->id, r->value } };
+	if (!peer_connected(p))
+		return;
+	peer_send_message(p, &msg);
+	gettimeofday(&r->sent_at, NULL);
+}
+
+static void
+request_free(struct request* r)
+{
+	free(r->value.paxos_value_val);
+	free(r);
+}
+
+static void
+evpaxos_client_handle_reply(struct peer* p, paxos_message* msg, void* arg)
+{
+	struct request* r;
+	struct evpaxos_client* c = arg;
+	paxos_client_reply* reply = &msg->u.client_reply;
+	khiter_t k = kh_get_request(c->requests, reply->id);
+	if (reply->leader < c->proposers)
+		c->leader = reply->leader;
+	if (k == kh_end(c->requests))
+		return;
+	r = kh_value(c->requests, k);
+	kh_del_request(c->requests, k);
+	c->reply(reply->iid, r->arg, c->arg);
+	request_free(r);
+}
+
+static void
+evpaxos_client_check_timeouts(evutil_socket_t fd, short event, void* arg)
+{
+	struct request* r;
+	struct timeval now;
+	struct evpaxos_client* c = arg;
+	gettimeofday(&now, NULL);
+	kh_foreach_value(c->requests, r, {
+		if (now.tv_sec - r->sent_at.tv_sec >= paxos_config.client_timeout) {
+			paxos_log_debug("Request %u timed out, submitting again", r->id);
+			send_request(c, r);
+		}
+	});
+	event_add(c->timeout_ev, &c->tv);
+}
+
+static void
+evpaxos_client_connected(struct peer* p, void* arg)
+{
+	struct request* r;
+	struct evpaxos_client* c = arg;
+	kh_foreach_value(c->requests, r, {
+		if (r->sent_at.tv_sec == 0)
+			send_request(c, r);
+	});
+}
+
+struct evpaxos_client*
+evpaxos_client_init(const char* config_file, int proposer_id,
+	reply_function f, void* arg, struct event_base* base)
+{
+	int i;
+	struct evpaxos_client* c;
+	struct evpaxos_config* config = evpaxos_config_read(config_file);
+	if (config == NULL)
+		return NULL;
+	if (proposer_id < 0 || proposer_id >= evpaxos_proposer_count(config)) {
+		paxos_log_error("Invalid proposer id: %d", proposer_id);
+		evpaxos_config_free(config);
+		return NULL;
+	}
+
+	c = malloc(sizeof(struct evpaxos_client));
+	c->peers = peers_new(base, config);
+	c->proposers = evpaxos_proposer_count(config);
+	c->leader = proposer_id;
+	for (i = 0; i < c->proposers; i++)
+		peers_connect_to_proposer(c->peers, i);
+	peers_subscribe(c->peers, PAXOS_CLIENT_REPLY,
+		evpaxos_client_handle_reply, c);
+	peers_on_connect(c->peers, evpaxos_client_connected, c);
+	c->next_id = 0;
+	c->requests = kh_init(request);
+	c->reply = f;
+	c->arg = arg;
+	c->tv = (struct timeval){1, 0};
+	c->timeout_ev = evtimer_new(base, evpaxos_client_check_timeouts, c);
+	event_add(c->timeout_ev, &c->tv);
+	evpaxos_config_free(config);
+	return c;
+}
+
+void
+evpaxos_client_free(struct evpaxos_client* c)
+{
+	struct request* r;
+	kh_foreach_value(c->requests, r, request_free(r));
+	kh_destroy(request, c->requests);
+	event_free(c->timeout_ev);
+	peers_free(c->peers);
+	free(c);
+}
+
+void
+evpaxos_client_submit(struct evpaxos_client* c, char* value, int size,
+	void* arg)
+{
+	int rv;
+	khiter_t k;
+	struct request* r = malloc(sizeof(struct request));
+	if (++c->next_id == 0)
+		++c->next_id;
+	r->id = c->next_id;
+	r->arg = arg;
+	r->sent_at = (struct timeval){0, 0};
+	r->value.paxos_value_len = size;
+	r->value.paxos_value_val = malloc(size);
+	memcpy(r->value.paxos_value_val, value, size);
+	k = kh_put_request(c->requests, r->id, &rv);
+	kh_value(c->requests, k) = r;
+	send_request(c, r);
+}
+
+int
+evpaxos_client_outstanding(struct evpaxos_client* c)
+{
+	return kh_size(c->requests);
+}
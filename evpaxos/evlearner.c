@@ -30,10 +30,17 @@
 #include "learner.h"
 #include "peers.h"
 #include "message.h"
+#include "evpaxos_internal.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
 #include <event2/event.h>
 
+#define CURSOR_SIZE 11
+
 struct evlearner
 {
 	struct learner* state;      /* The actual learner */
@@ -42,41 +49,227 @@ struct evlearner
 	struct event* hole_timer;   /* Timer to check for holes */
 	struct timeval tv;          /* Check for holes every tv units of time */
 	struct peers* acceptors;    /* Connections to acceptors */
+	uint32_t log_id;            /* Log whose instances are learned */
+	paxos_accepted* log;        /* Recently delivered instances */
+	int log_size;               /* Number of instances kept in the log */
+	iid_t catchup_iid;          /* First missing instance we asked for */
+	int catchup_tries;          /* Peers asked for catchup_iid so far */
+	int catchup_peer;           /* Next peer to ask for missing instances */
+	int replica_id;             /* Our replica id, -1 if not in a replica */
+	int cursor_fd;              /* File holding the last delivered iid */
+	iid_t cursor_iid;           /* Last delivered iid */
+	int cursor_pending;         /* Deliveries since the cursor was written */
+	iid_t hole_iid;             /* First missing instance, if any */
+	struct timeval hole_since;  /* When hole_iid was found missing */
+	stall_function stallfun;    /* Called when hole_iid is not filled */
+	void* stallarg;
+	int noops;                  /* Deliver no-ops as well */
+	iid_t applied_iid;          /* Last instance delivered */
+	uint64_t applied_timestamp; /* Latest commit or safe time delivered */
+	paxos_safe_time safe_time;  /* Safe time reached once iid is delivered */
+	speculate_function specfun; /* Called with values not yet decided */
+	speculation_function confirmfun;
+	speculation_function retractfun;
+	void* specarg;
+	paxos_accepted speculated;  /* Value speculated on, if iid is not 0 */
 };
 
 
+/*
+	Asks one of the other replicas' learners for the missing instances,
+	trying each peer once before falling back to the acceptors. Returns 0
+	when all the peers have been tried already.
+*/
+static int
+evlearner_send_catchup(struct evlearner* l, paxos_catchup* msg)
+{
+	int i, id, count = peers_count(l->acceptors);
+	struct peer* p;
+
+	if (msg->from != l->catchup_iid) {
+		l->catchup_iid = msg->from;
+		l->catchup_tries = 0;
+	}
+
+	for (i = 0; i < count && l->catchup_tries < count; ++i) {
+		id = l->catchup_peer++ % count;
+		p = peers_get_acceptor(l->acceptors, id);
+		l->catchup_tries++;
+		if (id != l->replica_id && peer_connected(p)) {
+			paxos_message m = {
+				.type = PAXOS_CATCHUP,
+				.log = l->log_id,
+				.u.catchup = *msg };
+			peer_send_message(p, &m);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+	Reports the missing instances to the stall function once the first of
+	them has been missing for longer than the learner stall deadline, which
+	happens when no acceptor holds the value for it.
+*/
 static void
-peer_send_repeat(struct peer* p, void* arg)
+evlearner_check_stall(struct evlearner* l, iid_t from, iid_t to)
 {
-	send_paxos_repeat(peer_get_buffer(p), arg);
+	long elapsed;
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	if (from != l->hole_iid) {
+		l->hole_iid = from;
+		l->hole_since = now;
+		return;
+	}
+	elapsed = (now.tv_sec - l->hole_since.tv_sec) * 1000 +
+		(now.tv_usec - l->hole_since.tv_usec) / 1000;
+	if (l->stallfun != NULL && paxos_config.learner_stall_deadline > 0 &&
+		elapsed >= paxos_config.learner_stall_deadline) {
+		paxos_log_debug("Instances %u-%u stalled for %ld ms", from, to, elapsed);
+		l->stallfun(from, to, l->stallarg);
+	}
 }
 
 static void
 evlearner_check_holes(evutil_socket_t fd, short event, void *arg)
 {
-	paxos_repeat msg;
-	int chunks = 10;
 	struct evlearner* l = arg;
-	if (learner_has_holes(l->state, &msg.from, &msg.to)) {
-		if ((msg.to - msg.from) > chunks)
-			msg.to = msg.from + chunks;
-		peers_foreach_acceptor(l->acceptors, peer_send_repeat, &msg);
+	paxos_message msg = {.type = PAXOS_REPEAT, .log = l->log_id};
+	paxos_repeat* repeat = &msg.u.repeat;
+	int chunks = 10;
+	if (learner_has_holes(l->state, &repeat->from, &repeat->to)) {
+		if ((repeat->to - repeat->from) > chunks)
+			repeat->to = repeat->from + chunks;
+		evlearner_check_stall(l, repeat->from, repeat->to);
+		paxos_catchup catchup = {repeat->from, repeat->to};
+		if (l->log_size == 0 || l->replica_id < 0 ||
+			!evlearner_send_catchup(l, &catchup))
+			peers_broadcast_acceptors(l->acceptors, &msg);
 	}
 	event_add(l->hole_timer, &l->tv);
 }
 
+static void
+evlearner_log_append(struct evlearner* l, paxos_accepted* deliver)
+{
+	paxos_accepted* slot = &l->log[deliver->iid % l->log_size];
+	paxos_accepted_destroy(slot);
+	*slot = *deliver;
+}
+
+static void
+evlearner_cursor_write(struct evlearner* l)
+{
+	char buf[CURSOR_SIZE+1];
+	snprintf(buf, sizeof(buf), "%010u\n", l->cursor_iid);
+	if (pwrite(l->cursor_fd, buf, CURSOR_SIZE, 0) != CURSOR_SIZE) {
+		paxos_log_error("Failed to write learner cursor");
+		return;
+	}
+	if (paxos_config.learner_cursor_sync)
+		fsync(l->cursor_fd);
+	l->cursor_pending = 0;
+}
+
+/*
+	Opens the cursor file and, if it holds a valid instance id, makes the
+	learner start from the following instance.
+	Returns 0 on success, -1 if the file could not be opened.
+*/
+static int
+evlearner_cursor_open(struct evlearner* l, const char* path)
+{
+	ssize_t n;
+	unsigned iid;
+	char buf[CURSOR_SIZE+1];
+	l->cursor_fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (l->cursor_fd < 0) {
+		paxos_log_error("Failed to open learner cursor %s", path);
+		return -1;
+	}
+	n = pread(l->cursor_fd, buf, CURSOR_SIZE, 0);
+	if (n == CURSOR_SIZE) {
+		buf[n] = '\0';
+		if (sscanf(buf, "%u", &iid) == 1) {
+			paxos_log_info("Learner resuming after instance %u", iid);
+			l->cursor_iid = iid;
+			learner_set_instance_id(l->state, iid);
+		}
+	}
+	return 0;
+}
+
+/*
+	Speculates on the next instance, unless it is speculated on already.
+*/
+static void
+evlearner_speculate(struct evlearner* l)
+{
+	paxos_accepted* s = &l->speculated;
+	if (l->specfun == NULL || s->iid != 0 ||
+		!learner_speculate_next(l->state, s))
+		return;
+	if (s->value.paxos_value_len == 0 && !l->noops) {
+		paxos_accepted_destroy(s);
+		s->iid = 0;
+		return;
+	}
+	l->specfun(s->iid, s->value.paxos_value_val, s->value.paxos_value_len,
+		l->specarg);
+}
+
+/*
+	Confirms or retracts the value speculated on, if any, once its instance
+	is decided, or skipped, along with all those up to the given one.
+*/
+static void
+evlearner_settle(struct evlearner* l, paxos_accepted* decided, iid_t iid)
+{
+	paxos_accepted* s = &l->speculated;
+	if (s->iid == 0 || s->iid > iid)
+		return;
+	if (decided != NULL && decided->iid == s->iid &&
+		decided->value.paxos_value_len == s->value.paxos_value_len &&
+		memcmp(decided->value.paxos_value_val, s->value.paxos_value_val,
+			s->value.paxos_value_len) == 0)
+		l->confirmfun(s->iid, l->specarg);
+	else
+		l->retractfun(s->iid, l->specarg);
+	paxos_accepted_destroy(s);
+	s->iid = 0;
+}
+
 static void 
 evlearner_deliver_next_closed(struct evlearner* l)
 {
 	paxos_accepted deliver;
 	while (learner_deliver_next(l->state, &deliver)) {
-		l->delfun(
-			deliver.iid,
-			deliver.value.paxos_value_val,
-			deliver.value.paxos_value_len,
-			l->delarg);
-		paxos_accepted_destroy(&deliver);
+		evlearner_settle(l, &deliver, deliver.iid);
+		l->applied_iid = deliver.iid;
+		if (deliver.timestamp > l->applied_timestamp)
+			l->applied_timestamp = deliver.timestamp;
+		if (l->safe_time.timestamp > l->applied_timestamp &&
+			l->safe_time.iid <= l->applied_iid)
+			l->applied_timestamp = l->safe_time.timestamp;
+		if (deliver.value.paxos_value_len > 0 || l->noops)
+			l->delfun(
+				deliver.iid,
+				deliver.value.paxos_value_val,
+				deliver.value.paxos_value_len,
+				l->delarg);
+		if (l->cursor_fd >= 0) {
+			l->cursor_iid = deliver.iid;
+			if (++l->cursor_pending >= paxos_config.learner_cursor_interval)
+				evlearner_cursor_write(l);
+		}
+		if (l->log_size > 0)
+			evlearner_log_append(l, &deliver);
+		else
+			paxos_accepted_destroy(&deliver);
 	}
+	evlearner_speculate(l);
 }
 
 /*
@@ -91,9 +284,73 @@ evlearner_handle_accepted(struct peer* p, paxos_message* msg, void* arg)
 	evlearner_deliver_next_closed(l);
 }
 
+static void
+evlearner_handle_accepted_batch(struct peer* p, paxos_message* msg, void* arg)
+{
+	int i;
+	struct evlearner* l = arg;
+	paxos_accepted_batch* batch = &msg->u.accepted_batch;
+	for (i = 0; i < batch->entries_len; i++) {
+		paxos_accepted_entry* e = &batch->entries_val[i];
+		paxos_accepted acc = { batch->aid, e->iid, e->ballot,
+			e->value_ballot, e->value, e->timestamp };
+		learner_receive_accepted(l->state, &acc);
+	}
+	evlearner_deliver_next_closed(l);
+}
+
+static void
+evlearner_handle_chosen(struct peer* p, paxos_message* msg, void* arg)
+{
+	struct evlearner* l = arg;
+	learner_receive_chosen(l->state, &msg->u.chosen);
+	evlearner_deliver_next_closed(l);
+}
+
+/*
+	Serves the instances still found in our log to a lagging learner, the
+	ones we no longer have are left to the acceptors.
+*/
+static void
+evlearner_handle_catchup(struct peer* p, paxos_message* msg, void* arg)
+{
+	iid_t iid;
+	paxos_accepted* slot;
+	struct evlearner* l = arg;
+	paxos_catchup* catchup = &msg->u.catchup;
+	if (l->log_size == 0)
+		return;
+	for (iid = catchup->from; iid <= catchup->to; ++iid) {
+		slot = &l->log[iid % l->log_size];
+		if (slot->iid != iid)
+			continue;
+		paxos_message chosen = {
+			.type = PAXOS_CHOSEN,
+			.log = l->log_id,
+			.u.chosen = {iid, slot->ballot, slot->value, slot->timestamp} };
+		peer_send_message(p, &chosen);
+	}
+}
+
+/*
+	The leader tells the safe time of the replicas now and then, which the
+	learner reaches once it delivered up to its iid. Only the latest is kept.
+*/
+static void
+evlearner_handle_safe_time(struct peer* p, paxos_message* msg, void* arg)
+{
+	struct evlearner* l = arg;
+	paxos_safe_time* st = &msg->u.safe_time;
+	if (st->timestamp <= l->safe_time.timestamp)
+		return;
+	l->safe_time = *st;
+	if (st->iid <= l->applied_iid && st->timestamp > l->applied_timestamp)
+		l->applied_timestamp = st->timestamp;
+}
+
 struct evlearner*
 evlearner_init_internal(struct evpaxos_config* config, struct peers* peers,
-	deliver_function f, void* arg)
+	uint32_t log, deliver_function f, void* arg)
 {
 	int acceptor_count = evpaxos_acceptor_count(config);
 	struct event_base* base = peers_get_event_base(peers);
@@ -103,8 +360,41 @@ evlearner_init_internal(struct evpaxos_config* config, struct peers* peers,
 	learner->delarg = arg;
 	learner->state = learner_new(acceptor_count);
 	learner->acceptors = peers;
+	learner->log_id = log;
+	learner->log_size = paxos_config.learner_log_size;
+	learner->log = NULL;
+	if (learner->log_size > 0)
+		learner->log = calloc(learner->log_size, sizeof(paxos_accepted));
+	learner->catchup_iid = 0;
+	learner->catchup_tries = 0;
+	learner->catchup_peer = 0;
+	learner->replica_id = -1;
+	learner->cursor_fd = -1;
+	learner->cursor_iid = 0;
+	learner->cursor_pending = 0;
+	learner->hole_iid = 0;
+	learner->stallfun = NULL;
+	learner->stallarg = NULL;
+	learner->noops = 0;
+	learner->applied_iid = 0;
+	learner->applied_timestamp = 0;
+	memset(&learner->safe_time, 0, sizeof(paxos_safe_time));
+	learner->specfun = NULL;
+	learner->confirmfun = NULL;
+	learner->retractfun = NULL;
+	learner->specarg = NULL;
+	memset(&learner->speculated, 0, sizeof(paxos_accepted));
 	
-	peers_subscribe(peers, PAXOS_ACCEPTED, evlearner_handle_accepted, learner);
+	peers_subscribe_log(peers, log, PAXOS_ACCEPTED,
+		evlearner_handle_accepted, learner);
+	peers_subscribe_log(peers, log, PAXOS_ACCEPTED_BATCH,
+		evlearner_handle_accepted_batch, learner);
+	peers_subscribe_log(peers, log, PAXOS_CHOSEN,
+		evlearner_handle_chosen, learner);
+	peers_subscribe_log(peers, log, PAXOS_CATCHUP,
+		evlearner_handle_catchup, learner);
+	peers_subscribe_log(peers, log, PAXOS_SAFE_TIME,
+		evlearner_handle_safe_time, learner);
 	
 	// setup hole checking timer
 	learner->tv.tv_sec = 0;
@@ -124,7 +414,12 @@ evlearner_init(const char* config_file, deliver_function f, void* arg,
 
 	struct peers* peers = peers_new(b, c);
 	peers_connect_to_acceptors(peers);
-	struct evlearner* l = evlearner_init_internal(c, peers, f, arg);
+	struct evlearner* l = evlearner_init_internal(c, peers, 0, f, arg);
+	if (paxos_config.learner_cursor_path != NULL &&
+		evlearner_cursor_open(l, paxos_config.learner_cursor_path) != 0) {
+		evlearner_free(l);
+		l = NULL;
+	}
 
 	evpaxos_config_free(c);
 	return l;
@@ -133,6 +428,16 @@ evlearner_init(const char* config_file, deliver_function f, void* arg,
 void
 evlearner_free_internal(struct evlearner* l)
 {
+	int i;
+	if (l->cursor_fd >= 0) {
+		if (l->cursor_pending > 0)
+			evlearner_cursor_write(l);
+		close(l->cursor_fd);
+	}
+	for (i = 0; i < l->log_size; ++i)
+		paxos_accepted_destroy(&l->log[i]);
+	free(l->log);
+	paxos_accepted_destroy(&l->speculated);
 	event_free(l->hole_timer);
 	learner_free(l->state);
 	free(l);
@@ -145,21 +450,64 @@ evlearner_free(struct evlearner* l)
 	evlearner_free_internal(l);
 }
 
+void
+evlearner_set_stall_function(struct evlearner* l, stall_function f, void* arg)
+{
+	l->stallfun = f;
+	l->stallarg = arg;
+}
+
+/*
+	Makes the learner deliver no-ops too, for the replica to keep track of
+	the instances delivered.
+*/
+void
+evlearner_deliver_noops(struct evlearner* l)
+{
+	l->noops = 1;
+}
+
+/*
+	Lets the learner of replica id catch up from the other replicas, whose
+	learners serve their logs. Plain acceptors do not.
+*/
+void
+evlearner_catch_up_from_replicas(struct evlearner* l, int id)
+{
+	l->replica_id = id;
+}
+
+void
+evlearner_set_speculation(struct evlearner* l, speculate_function speculate,
+	speculation_function confirm, speculation_function retract, void* arg)
+{
+	l->specfun = speculate;
+	l->confirmfun = confirm;
+	l->retractfun = retract;
+	l->specarg = arg;
+}
+
 void
 evlearner_set_instance_id(struct evlearner* l, unsigned iid)
 {
+	evlearner_settle(l, NULL, iid);
 	learner_set_instance_id(l->state, iid);
+	l->applied_iid = iid;
 }
 
-static void
-peer_send_trim(struct peer* p, void* arg)
+void
+evlearner_applied(struct evlearner* l, unsigned* iid, uint64_t* timestamp)
 {
-	send_paxos_trim(peer_get_buffer(p), arg);
+	*iid = l->applied_iid;
+	*timestamp = l->applied_timestamp;
 }
 
 void
 evlearner_send_trim(struct evlearner* l, unsigned iid)
 {
-	paxos_trim trim = {iid};
-	peers_foreach_acceptor(l->acceptors, peer_send_trim, &trim);
+	paxos_message msg = {
+		.type = PAXOS_TRIM,
+		.log = l->log_id,
+		.u.trim.iid = iid };
+	peers_broadcast_acceptors(l->acceptors, &msg);
 }
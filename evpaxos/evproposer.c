@@ -30,54 +30,300 @@
 #include "peers.h"
 #include "message.h"
 #include "proposer.h"
+#include "quorum.h"
+#include "khash.h"
+#include "evpaxos_internal.h"
 #include <string.h>
 #include <stdlib.h>
+#include <sys/time.h>
 #include <event2/event.h>
 
+/*
+	A client value submitted with an id is acknowledged to the client that
+	sent it with a PAXOS_CLIENT_REPLY, once decided. Requests are forgotten
+	when their client goes away, or after client-timeout, by which time the
+	client submitted the value again.
+*/
+struct client_request
+{
+	struct peer* peer;
+	uint32_t id;
+	struct timeval received;
+};
+
+KHASH_MAP_INIT_INT(request, struct client_request)
+
 struct evproposer
 {
 	int id;
+	uint32_t log;
 	int preexec_window;
 	struct proposer* state;
 	struct peers* peers;
 	struct timeval tv;
 	struct event* timeout_ev;
+	int batch_size;
+	paxos_accept_entry* batch; /* Accepts not yet sent by try_accept() */
+	unsigned next_request;
+	khash_t(request)* requests;  /* Client requests not yet decided */
+	unsigned next_forward;
+	khash_t(request)* forwards;  /* Requests forwarded, not yet decided */
+	int election;                /* Elect a leader among the replicas */
+	int partitioned;             /* Share the instances among replicas */
+	int fast;                    /* Values go straight to the acceptors */
+	int active;                  /* Runs phase 1 and 2, if the leader */
+	int leader;
+	ballot_t ballot;             /* Highest ballot sent in phase 1 */
+	int acceptors_count;
+	struct timeval* heard;       /* Last acceptor state from each replica */
+	struct timeval election_tv;
+	struct event* election_ev;
+	struct event* takeover_ev;
+	unsigned heartbeat_seq;      /* Last heartbeat round started */
+	unsigned confirmed_seq;      /* Last round acknowledged by a quorum */
+	int heartbeat_next;          /* Start a round once this one is over */
+	struct timeval heartbeat_sent;
+	struct quorum heartbeat_acks;
+	iid_t heartbeat_iid;         /* Highest accepted iid acked in the round */
+	iid_t confirmed_iid;         /* The same, in the last round confirmed */
+	struct timeval heartbeat_tv;
+	struct event* heartbeat_ev;
+	struct timeval lease_until;
+	confirm_function confirm;
+	void* confirm_arg;
 };
 
 
 static void
-peer_send_prepare(struct peer* p, void* arg)
+send_prepare(struct evproposer* p, paxos_prepare* pr)
 {
-	send_paxos_prepare(peer_get_buffer(p), arg);
+	paxos_message msg = {
+		.type = PAXOS_PREPARE,
+		.log = p->log,
+		.u.prepare = *pr };
+	if (pr->ballot > p->ballot)
+		p->ballot = pr->ballot;
+	peers_broadcast_n_acceptors(p->peers, &msg, paxos_config.group_1);
 }
 
 static void
-peer_send_accept(struct peer* p, void* arg)
+send_prepare_range(struct evproposer* p, paxos_prepare_range* pr)
+{
+	paxos_message msg = {
+		.type = PAXOS_PREPARE_RANGE,
+		.log = p->log,
+		.u.prepare_range = *pr };
+	peers_broadcast_acceptors(p->peers, &msg);
+}
+
+/*
+	With acceptor-ring, accepts go to the first acceptor of the ring only,
+	the acceptors pass them on to each other.
+*/
+static int
+accept_group(void)
 {
-	send_paxos_accept(peer_get_buffer(p), arg);
+	return paxos_config.acceptor_ring ? 1 : paxos_config.group_2;
 }
 
 static void
+send_accept(struct evproposer* p, paxos_accept* ar)
+{
+	paxos_message msg = {
+		.type = PAXOS_ACCEPT,
+		.log = p->log,
+		.u.accept = *ar };
+	peers_broadcast_n_acceptors(p->peers, &msg, accept_group());
+}
+
+static void
+send_accept_batch(struct evproposer* p, int count)
+{
+	paxos_accept accept;
+	paxos_accept_entry* e = p->batch;
+	if (count == 1) {
+		accept = (paxos_accept) { e->iid, e->ballot, e->value, e->timestamp };
+		send_accept(p, &accept);
+		return;
+	}
+	paxos_message msg = {
+		.type = PAXOS_ACCEPT_BATCH,
+		.log = p->log,
+		.u.accept_batch = { count, p->batch } };
+	peers_broadcast_n_acceptors(p->peers, &msg, accept_group());
+}
+
+/*
+	Sends the value to every acceptor, at the fast ballot, leaving it to
+	them to pick the instance.
+*/
+static void
+send_fast_accept(struct evproposer* p, paxos_value* v)
+{
+	paxos_message msg = {
+		.type = PAXOS_ACCEPT,
+		.log = p->log,
+		.u.accept = { 0, PAXOS_FAST_BALLOT, *v, paxos_timestamp() } };
+	peers_broadcast_acceptors(p->peers, &msg);
+}
+
+/*
+	Opens instances up to the preexecution window. Returns the number of
+	instances opened that are prepared already, being owned by this
+	proposer. In the fast round only the values queued get an instance, as
+	acceptors keep the instances opened for those of the classic round.
+	Owners open none before their ranged phase 1 is over.
+*/
+static int
 proposer_preexecute(struct evproposer* p)
 {
-	int i;
+	int i, owned = 0;
 	paxos_prepare pr;
-	int count = p->preexec_window - proposer_prepared_count(p->state);
-	if (count <= 0) return;
+	int window = p->preexec_window;
+	if (p->fast && proposer_queued_count(p->state) < window)
+		window = proposer_queued_count(p->state);
+	int count = window - proposer_prepared_count(p->state);
+	if (!p->active || count <= 0 || !proposer_range_prepared(p->state))
+		return 0;
 	for (i = 0; i < count; i++) {
-		proposer_prepare(p->state, &pr);
-		peers_for_n_acceptor(p->peers, peer_send_prepare, &pr, paxos_config.group_1);
+		if (proposer_prepare(p->state, &pr))
+			send_prepare(p, &pr);
+		else
+			owned++;
 	}
 	paxos_log_debug("Opened %d new instances", count);
+	return owned;
 }
 
+/*
+	Sends the accepts that can be sent right away, in batches of up to
+	batch_size accepts. Values are not copied, they belong to the instances
+	held by the proposer.
+*/
 static void
 try_accept(struct evproposer* p)
 {
+	int count = 0;
 	paxos_accept accept;
-	while (proposer_accept(p->state, &accept))
-		peers_for_n_acceptor(p->peers, peer_send_accept, &accept, paxos_config.group_2);
-	proposer_preexecute(p);
+	if (!p->active) return;
+	do {
+		while (proposer_accept(p->state, &accept)) {
+			p->batch[count++] = (paxos_accept_entry) {
+				accept.iid, accept.ballot, accept.value, accept.timestamp };
+			if (count == p->batch_size) {
+				send_accept_batch(p, count);
+				count = 0;
+			}
+		}
+	} while (proposer_preexecute(p) > 0);
+	if (count > 0)
+		send_accept_batch(p, count);
+}
+
+/*
+	With an election, proposers are those of replicas, sharing the ids of the
+	acceptors they are connected to. The leader is the replica with the
+	lowest id among those whose acceptor state was heard of within the
+	leader timeout, this one included.
+*/
+int
+evproposer_leader(struct evproposer* p)
+{
+	if (!p->election)
+		return p->id;
+	return p->leader;
+}
+
+static int
+elect_leader(struct evproposer* p)
+{
+	int i;
+	long elapsed;
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	for (i = 0; i < p->id && i < p->acceptors_count; i++) {
+		elapsed = (now.tv_sec - p->heard[i].tv_sec) * 1000 +
+			(now.tv_usec - p->heard[i].tv_usec) / 1000;
+		if (elapsed < paxos_config.proposer_leader_timeout)
+			return i;
+	}
+	return p->id;
+}
+
+/*
+	Only the leader runs phase 1, the others stay passive, so that proposers
+	do not preempt each other's ballots over and over. A proposer that finds
+	itself the leader waits a random backoff before taking over, in case
+	the former leader, or some other replica, has not given up yet.
+*/
+static void
+evproposer_elect(struct evproposer* p)
+{
+	struct timeval tv = {0, 0};
+	int leader = elect_leader(p);
+	if (leader == p->leader)
+		return;
+	paxos_log_info("Proposer %d: replica %d is the leader", p->id, leader);
+	p->leader = leader;
+	if (leader != p->id) {
+		p->active = 0;
+		event_del(p->takeover_ev);
+		return;
+	}
+	if (paxos_config.proposer_takeover_backoff > 0)
+		tv.tv_usec = (random() % paxos_config.proposer_takeover_backoff) * 1000;
+	event_add(p->takeover_ev, &tv);
+}
+
+static void
+send_client_reply(struct evproposer* p, struct client_request* r, iid_t iid)
+{
+	paxos_message msg = {
+		.type = PAXOS_CLIENT_REPLY,
+		.log = p->log,
+		.u.client_reply = { r->id, iid, evproposer_leader(p) } };
+	peer_send_message(r->peer, &msg);
+	peer_release(r->peer);
+}
+
+static void
+forget_requests_of(khash_t(request)* h, struct peer* peer)
+{
+	khiter_t k;
+	for (k = kh_begin(h); k != kh_end(h); ++k) {
+		if (kh_exist(h, k) && kh_value(h, k).peer == peer) {
+			peer_release(peer);
+			kh_del_request(h, k);
+		}
+	}
+}
+
+static void
+forget_expired_requests(khash_t(request)* h, struct timeval* now)
+{
+	khiter_t k;
+	for (k = kh_begin(h); k != kh_end(h); ++k) {
+		if (kh_exist(h, k) && now->tv_sec - kh_value(h, k).received.tv_sec >=
+			paxos_config.client_timeout) {
+			peer_release(kh_value(h, k).peer);
+			kh_del_request(h, k);
+		}
+	}
+}
+
+static void
+send_client_replies(struct evproposer* p)
+{
+	iid_t iid;
+	khiter_t k;
+	unsigned request;
+	while (proposer_take_decided(p->state, &request, &iid)) {
+		k = kh_get_request(p->requests, request);
+		if (k == kh_end(p->requests))
+			continue;
+		send_client_reply(p, &kh_value(p->requests, k), iid);
+		kh_del_request(p->requests, k);
+	}
 }
 
 static void
@@ -87,8 +333,19 @@ evproposer_handle_promise(struct peer* p, paxos_message* msg, void* arg)
 	paxos_prepare prepare;
 	paxos_promise* pro = &msg->u.promise;
 	int preempted = proposer_receive_promise(proposer->state, pro, &prepare);
-	if (preempted)
-		peers_for_n_acceptor(proposer->peers, peer_send_prepare, &prepare, paxos_config.group_1);
+	if (preempted && proposer->active)
+		send_prepare(proposer, &prepare);
+	try_accept(proposer);
+}
+
+static void
+evproposer_handle_promise_range(struct peer* p, paxos_message* msg, void* arg)
+{
+	struct evproposer* proposer = arg;
+	paxos_prepare_range prepare;
+	paxos_promise_range* pro = &msg->u.promise_range;
+	if (proposer_receive_promise_range(proposer->state, pro, &prepare))
+		send_prepare_range(proposer, &prepare);
 	try_accept(proposer);
 }
 
@@ -97,7 +354,42 @@ evproposer_handle_accepted(struct peer* p, paxos_message* msg, void* arg)
 {
 	struct evproposer* proposer = arg;
 	paxos_accepted* acc = &msg->u.accepted;
-	if (proposer_receive_accepted(proposer->state, acc))
+	if (proposer_receive_accepted(proposer->state, acc)) {
+		send_client_replies(proposer);
+		try_accept(proposer);
+	} else if (proposer->partitioned)
+		try_accept(proposer);
+	else if (proposer->fast && proposer->active &&
+		proposer_receive_fast_accepted(proposer->state, acc))
+		evproposer_fill(proposer, acc->iid, acc->iid);
+}
+
+static void
+evproposer_handle_accepted_batch(struct peer* p, paxos_message* msg, void* arg)
+{
+	int i, accepted = 0;
+	struct evproposer* proposer = arg;
+	paxos_accepted_batch* batch = &msg->u.accepted_batch;
+	for (i = 0; i < batch->entries_len; i++) {
+		paxos_accepted_entry* e = &batch->entries_val[i];
+		paxos_accepted acc = { batch->aid, e->iid, e->ballot,
+			e->value_ballot, e->value, e->timestamp };
+		accepted |= proposer_receive_accepted(proposer->state, &acc);
+	}
+	if (accepted)
+		send_client_replies(proposer);
+	if (accepted || proposer->partitioned)
+		try_accept(proposer);
+}
+
+static void
+evproposer_handle_chosen(struct peer* p, paxos_message* msg, void* arg)
+{
+	struct evproposer* proposer = arg;
+	if (proposer_receive_chosen(proposer->state, &msg->u.chosen)) {
+		send_client_replies(proposer);
+		try_accept(proposer);
+	} else if (proposer->partitioned)
 		try_accept(proposer);
 }
 
@@ -108,20 +400,94 @@ evproposer_handle_preempted(struct peer* p, paxos_message* msg, void* arg)
 	paxos_prepare prepare;
 	int preempted = proposer_receive_preempted(proposer->state,
 		&msg->u.preempted, &prepare);
-	if (preempted) {
-		peers_for_n_acceptor(proposer->peers, peer_send_prepare, &prepare, paxos_config.group_1);
+	if (preempted && proposer->active) {
+		send_prepare(proposer, &prepare);
 		try_accept(proposer);
 	}
 }
 
+/*
+	Hands the client value over to the leader, through the connection to its
+	acceptor, remembering who to relay the reply to. Forwarded values
+	queued during a turn of the event loop go out with a single write.
+	Forwards are forgotten like requests are, the reply may never come if
+	the leader fails meanwhile.
+*/
+static int
+forward_client_value(struct evproposer* p, struct peer* from,
+	paxos_client_value* v)
+{
+	int rv;
+	khiter_t k;
+	struct peer* leader;
+	int id = evproposer_leader(p);
+	if (id == p->id)
+		return 0;
+	leader = peers_get_acceptor(p->peers, id);
+	paxos_message msg = {
+		.type = PAXOS_CLIENT_VALUE,
+		.log = p->log,
+		.u.client_value = { 0, v->value } };
+	if (v->id != 0) {
+		if (kh_size(p->forwards) >= paxos_config.proposer_max_requests) {
+			paxos_log_debug("Dropped client value %u, too many forwards", v->id);
+			return 1;
+		}
+		if (++p->next_forward == 0)
+			++p->next_forward;
+		msg.u.client_value.id = p->next_forward;
+		k = kh_put_request(p->forwards, p->next_forward, &rv);
+		kh_value(p->forwards, k) = (struct client_request) { from, v->id };
+		gettimeofday(&kh_value(p->forwards, k).received, NULL);
+		peer_retain(from);
+	}
+	peer_send_message(leader, &msg);
+	return 1;
+}
+
+static void
+evproposer_handle_client_reply(struct peer* p, paxos_message* msg, void* arg)
+{
+	struct evproposer* proposer = arg;
+	paxos_client_reply* reply = &msg->u.client_reply;
+	khiter_t k = kh_get_request(proposer->forwards, reply->id);
+	if (k == kh_end(proposer->forwards))
+		return;
+	send_client_reply(proposer, &kh_value(proposer->forwards, k), reply->iid);
+	kh_del_request(proposer->forwards, k);
+}
+
 static void
 evproposer_handle_client_value(struct peer* p, paxos_message* msg, void* arg)
 {
+	int rv;
+	khiter_t k;
+	unsigned request = 0;
 	struct evproposer* proposer = arg;
 	struct paxos_client_value* v = &msg->u.client_value;
-	proposer_propose(proposer->state,
+	if (proposer->fast && v->id == 0) {
+		send_fast_accept(proposer, &v->value);
+		return;
+	}
+	if (proposer->election && forward_client_value(proposer, p, v))
+		return;
+	if (v->id != 0) {
+		if (kh_size(proposer->requests) >= paxos_config.proposer_max_requests) {
+			paxos_log_debug("Dropped client value %u, too many requests", v->id);
+			return;
+		}
+		if (++proposer->next_request == 0)
+			++proposer->next_request;
+		request = proposer->next_request;
+		k = kh_put_request(proposer->requests, request, &rv);
+		kh_value(proposer->requests, k) = (struct client_request) { p, v->id };
+		gettimeofday(&kh_value(proposer->requests, k).received, NULL);
+		peer_retain(p);
+	}
+	proposer_propose_request(proposer->state,
 		v->value.paxos_value_val,
-		v->value.paxos_value_len);
+		v->value.paxos_value_len,
+		request);
 	try_accept(proposer);
 }
 
@@ -131,24 +497,164 @@ evproposer_handle_acceptor_state(struct peer* p, paxos_message* msg, void* arg)
 	struct evproposer* proposer = arg;
 	struct paxos_acceptor_state* acc_state = &msg->u.state;
 	proposer_receive_acceptor_state(proposer->state, acc_state);
+	if (proposer->election && acc_state->aid < proposer->acceptors_count) {
+		gettimeofday(&proposer->heard[acc_state->aid], NULL);
+		evproposer_elect(proposer);
+	}
+}
+
+/*
+	A heartbeat round confirms that a quorum of acceptors still regard this
+	proposer as the leader, acceptors answering only the peer they promised
+	last. The quorum is the larger of those of phase 1 and 2, intersecting
+	any quorum another proposer would need to complete phase 1, as well as
+	any quorum that accepted a value: the highest instance accepted by the
+	acceptors of the round is at least that of every value decided before.
+*/
+static void
+evproposer_start_heartbeat(struct evproposer* p)
+{
+	paxos_message msg = {
+		.type = PAXOS_HEARTBEAT,
+		.log = p->log,
+		.u.heartbeat = { ++p->heartbeat_seq, p->ballot } };
+	gettimeofday(&p->heartbeat_sent, NULL);
+	quorum_clear(&p->heartbeat_acks);
+	p->heartbeat_iid = 0;
+	peers_broadcast_acceptors(p->peers, &msg);
+}
+
+/*
+	Every value decided before the heartbeat round was sent is at or below
+	the read index it confirmed. Learners that delivered up to it learn that
+	their state was current then, even if no value was decided since.
+*/
+static void
+evproposer_send_safe_time(struct evproposer* p)
+{
+	paxos_message msg = {
+		.type = PAXOS_SAFE_TIME,
+		.log = p->log,
+		.u.safe_time = { evproposer_read_index(p),
+			(uint64_t)p->heartbeat_sent.tv_sec * 1000 +
+			p->heartbeat_sent.tv_usec / 1000 } };
+	peers_broadcast_acceptors(p->peers, &msg);
+}
+
+static void
+evproposer_handle_heartbeat_ack(struct peer* p, paxos_message* msg, void* arg)
+{
+	struct timeval lease;
+	struct evproposer* proposer = arg;
+	paxos_heartbeat_ack* ack = &msg->u.heartbeat_ack;
+	if (ack->seq != proposer->heartbeat_seq ||
+		proposer->confirmed_seq == proposer->heartbeat_seq)
+		return;
+	if (!quorum_add(&proposer->heartbeat_acks, ack->aid))
+		return;
+	if (ack->accepted_iid > proposer->heartbeat_iid)
+		proposer->heartbeat_iid = ack->accepted_iid;
+	if (!quorum_reached(&proposer->heartbeat_acks))
+		return;
+	proposer->confirmed_seq = ack->seq;
+	proposer->confirmed_iid = proposer->heartbeat_iid;
+	if (proposer->election)
+		evproposer_send_safe_time(proposer);
+	if (paxos_config.proposer_lease > 0) {
+		lease.tv_sec = paxos_config.proposer_lease / 1000;
+		lease.tv_usec = (paxos_config.proposer_lease % 1000) * 1000;
+		timeradd(&proposer->heartbeat_sent, &lease, &proposer->lease_until);
+	}
+	if (proposer->heartbeat_next) {
+		proposer->heartbeat_next = 0;
+		evproposer_start_heartbeat(proposer);
+	}
+	if (proposer->confirm != NULL)
+		proposer->confirm(ack->seq, proposer->confirm_arg);
+}
+
+/*
+	With leases, the leader renews its lease a few times per lease period.
+	The leader of replicas starts a round every time as well, for their
+	learners to keep track of the safe time while no value is decided.
+	Otherwise, rounds still unconfirmed are started again, in case their
+	heartbeats were lost.
+*/
+static void
+evproposer_check_heartbeat(evutil_socket_t fd, short event, void *arg)
+{
+	struct evproposer* p = arg;
+	if (evproposer_leader(p) == p->id && (paxos_config.proposer_lease > 0 ||
+		p->election || p->confirmed_seq != p->heartbeat_seq))
+		evproposer_start_heartbeat(p);
+	event_add(p->heartbeat_ev, &p->heartbeat_tv);
+}
+
+static void
+evproposer_check_leader(evutil_socket_t fd, short event, void *arg)
+{
+	struct evproposer* p = arg;
+	evproposer_elect(p);
+	event_add(p->election_ev, &p->election_tv);
+}
+
+static void
+evproposer_take_over(evutil_socket_t fd, short event, void *arg)
+{
+	struct evproposer* p = arg;
+	if (p->leader != p->id)
+		return;
+	paxos_log_info("Proposer %d taking over as the leader", p->id);
+	p->active = 1;
+	try_accept(p);
+}
+
+static void
+evproposer_handle_disconnect(struct peer* peer, void* arg)
+{
+	struct evproposer* p = arg;
+	forget_requests_of(p->requests, peer);
+	forget_requests_of(p->forwards, peer);
 }
 
 static void
 evproposer_check_timeouts(evutil_socket_t fd, short event, void *arg)
 {
+	struct timeval now;
 	struct evproposer* p = arg;
+	gettimeofday(&now, NULL);
+	forget_expired_requests(p->requests, &now);
+	forget_expired_requests(p->forwards, &now);
+	if (!p->active) {
+		event_add(p->timeout_ev, &p->tv);
+		return;
+	}
+
 	struct timeout_iterator* iter = proposer_timeout_iterator(p->state);
 
 	paxos_prepare pr;
 	while (timeout_iterator_prepare(iter, &pr)) {
 		paxos_log_info("Instance %d timed out in phase 1.", pr.iid);
-		peers_for_n_acceptor(p->peers, peer_send_prepare, &pr, paxos_config.group_1);
+		send_prepare(p, &pr);
 	}
 
 	paxos_accept ar;
 	while (timeout_iterator_accept(iter, &ar)) {
 		paxos_log_info("Instance %d timed out in phase 2.", ar.iid);
-		peers_for_n_acceptor(p->peers, peer_send_accept, &ar, paxos_config.group_2);
+		send_accept(p, &ar);
+	}
+
+	iid_t iid;
+	while (timeout_iterator_fast(iter, &iid)) {
+		paxos_log_info("Instance %d timed out in the fast round.", iid);
+		evproposer_fill(p, iid, iid);
+	}
+
+	paxos_prepare_range range;
+	if (timeout_iterator_range(iter, &range)) {
+		paxos_log_info("Instances from %d timed out in ranged phase 1.",
+			range.from);
+		send_prepare_range(p, &range);
 	}
 
 	timeout_iterator_free(iter);
@@ -163,21 +669,56 @@ evproposer_preexec_once(evutil_socket_t fd, short event, void *arg)
 }
 
 struct evproposer*
-evproposer_init_internal(int id, struct evpaxos_config* c, struct peers* peers)
+evproposer_init_internal(int id, struct evpaxos_config* c, struct peers* peers,
+	uint32_t log)
 {
 	struct evproposer* p;
 	int acceptor_count = evpaxos_acceptor_count(c);
 
 	p = malloc(sizeof(struct evproposer));
 	p->id = id;
+	p->log = log;
 	p->preexec_window = paxos_config.proposer_preexec_window;
-
-	peers_subscribe(peers, PAXOS_PROMISE, evproposer_handle_promise, p);
-	peers_subscribe(peers, PAXOS_ACCEPTED, evproposer_handle_accepted, p);
-	peers_subscribe(peers, PAXOS_PREEMPTED, evproposer_handle_preempted, p);
-	peers_subscribe(peers, PAXOS_CLIENT_VALUE, evproposer_handle_client_value, p);
-	peers_subscribe(peers, PAXOS_ACCEPTOR_STATE,
+	p->batch_size = paxos_config.proposer_accept_batch;
+	if (p->batch_size < 1)
+		p->batch_size = 1;
+	p->batch = malloc(p->batch_size * sizeof(paxos_accept_entry));
+	p->next_request = 0;
+	p->requests = kh_init(request);
+	p->next_forward = 0;
+	p->forwards = kh_init(request);
+	p->election = 0;
+	p->partitioned = 0;
+	p->fast = paxos_config.fast_paxos;
+	p->active = 1;
+	p->leader = id;
+	p->ballot = 0;
+	p->acceptors_count = acceptor_count;
+	p->heard = NULL;
+	p->election_ev = NULL;
+	p->takeover_ev = NULL;
+
+	peers_subscribe_log(peers, log, PAXOS_PROMISE,
+		evproposer_handle_promise, p);
+	peers_subscribe_log(peers, log, PAXOS_PROMISE_RANGE,
+		evproposer_handle_promise_range, p);
+	peers_subscribe_log(peers, log, PAXOS_ACCEPTED,
+		evproposer_handle_accepted, p);
+	peers_subscribe_log(peers, log, PAXOS_ACCEPTED_BATCH,
+		evproposer_handle_accepted_batch, p);
+	peers_subscribe_log(peers, log, PAXOS_CHOSEN,
+		evproposer_handle_chosen, p);
+	peers_subscribe_log(peers, log, PAXOS_PREEMPTED,
+		evproposer_handle_preempted, p);
+	peers_subscribe_log(peers, log, PAXOS_CLIENT_VALUE,
+		evproposer_handle_client_value, p);
+	peers_subscribe_log(peers, log, PAXOS_ACCEPTOR_STATE,
 		evproposer_handle_acceptor_state, p);
+	peers_subscribe_log(peers, log, PAXOS_CLIENT_REPLY,
+		evproposer_handle_client_reply, p);
+	peers_subscribe_log(peers, log, PAXOS_HEARTBEAT_ACK,
+		evproposer_handle_heartbeat_ack, p);
+	peers_on_disconnect_log(peers, log, evproposer_handle_disconnect, p);
 
 	// Setup timeout
 	struct event_base* base = peers_get_event_base(peers);
@@ -186,6 +727,26 @@ evproposer_init_internal(int id, struct evpaxos_config* c, struct peers* peers)
 	p->timeout_ev = evtimer_new(base, evproposer_check_timeouts, p);
 	event_add(p->timeout_ev, &p->tv);
 
+	p->heartbeat_seq = 0;
+	p->confirmed_seq = 0;
+	p->heartbeat_next = 0;
+	p->heartbeat_iid = 0;
+	p->confirmed_iid = 0;
+	p->lease_until = (struct timeval){0, 0};
+	p->confirm = NULL;
+	p->confirm_arg = NULL;
+	quorum_init(&p->heartbeat_acks, acceptor_count,
+		paxos_config.quorum_1 > paxos_config.quorum_2 ?
+		paxos_config.quorum_1 : paxos_config.quorum_2);
+	if (paxos_config.proposer_lease > 0)
+		p->heartbeat_tv = (struct timeval){
+			paxos_config.proposer_lease / 4000,
+			(paxos_config.proposer_lease / 4 % 1000) * 1000 };
+	else
+		p->heartbeat_tv = p->tv;
+	p->heartbeat_ev = evtimer_new(base, evproposer_check_heartbeat, p);
+	event_add(p->heartbeat_ev, &p->heartbeat_tv);
+
 	p->state = proposer_new(p->id, acceptor_count,paxos_config.quorum_1,paxos_config.quorum_2);
 	p->peers = peers;
 
@@ -214,7 +775,7 @@ evproposer_init(int id, const char* config_file, struct event_base* base)
 	int rv = peers_listen(peers, port);
 	if (rv == 0)
 		return NULL;
-	struct evproposer* p = evproposer_init_internal(id, config, peers);
+	struct evproposer* p = evproposer_init_internal(id, config, peers, 0);
 	evpaxos_config_free(config);
 	return p;
 }
@@ -222,8 +783,21 @@ evproposer_init(int id, const char* config_file, struct event_base* base)
 void
 evproposer_free_internal(struct evproposer* p)
 {
+	struct client_request r;
 	event_free(p->timeout_ev);
+	event_free(p->heartbeat_ev);
+	quorum_destroy(&p->heartbeat_acks);
+	if (p->election) {
+		event_free(p->election_ev);
+		event_free(p->takeover_ev);
+		free(p->heard);
+	}
 	proposer_free(p->state);
+	kh_foreach_value(p->requests, r, peer_release(r.peer));
+	kh_destroy(request, p->requests);
+	kh_foreach_value(p->forwards, r, peer_release(r.peer));
+	kh_destroy(request, p->forwards);
+	free(p->batch);
 	free(p);
 }
 
@@ -234,6 +808,143 @@ evproposer_free(struct evproposer* p)
 	evproposer_free_internal(p);
 }
 
+/*
+	Makes the proposer, that of a replica, take part in the election of a
+	leader and forward the client values it receives to it. Every replica
+	counts as alive until the leader timeout expires, so that at startup
+	replicas agree on the one with the lowest id.
+*/
+void
+evproposer_join_election(struct evproposer* p)
+{
+	int i;
+	long timeout = paxos_config.proposer_leader_timeout;
+	struct event_base* base = peers_get_event_base(p->peers);
+	p->election = 1;
+	p->active = 0;
+	p->leader = -1;
+	p->heard = malloc(p->acceptors_count * sizeof(struct timeval));
+	for (i = 0; i < p->acceptors_count; i++)
+		gettimeofday(&p->heard[i], NULL);
+	p->election_tv = (struct timeval){ timeout / 4000, (timeout / 4 % 1000) * 1000 };
+	p->election_ev = evtimer_new(base, evproposer_check_leader, p);
+	p->takeover_ev = evtimer_new(base, evproposer_take_over, p);
+	event_add(p->election_ev, &p->election_tv);
+	evproposer_elect(p);
+}
+
+/*
+	Makes the proposer, that of a replica, decide its own share of the
+	instances, out of those of all the replicas, rather than elect a leader.
+	Accepteds seen for the instances of the other replicas make it skip its
+	own earlier ones that are still idle. Its own instances are prepared at
+	once, by a ranged phase 1 that acceptors handle without shards.
+	Returns 0 on success, -1 if there are too many replicas, if acceptors
+	are sharded, or if values go through the fast round, where acceptors
+	pick the instances.
+*/
+int
+evproposer_partition(struct evproposer* p, int replicas)
+{
+	paxos_prepare_range range;
+	if (p->fast) {
+		paxos_log_error("Cannot partition instances with fast-paxos");
+		return -1;
+	}
+	if (paxos_config.acceptor_shards > 1) {
+		paxos_log_error("Cannot partition instances with acceptor-shards");
+		return -1;
+	}
+	if (paxos_config.proposer_lease > 0) {
+		paxos_log_error("Cannot partition instances with proposer-lease");
+		return -1;
+	}
+	if (replicas >= MAX_N_OF_PROPOSERS) {
+		paxos_log_error("Cannot partition instances among %d replicas",
+			replicas);
+		return -1;
+	}
+	p->partitioned = 1;
+	proposer_set_partition(p->state, replicas);
+	if (proposer_prepare_range(p->state, &range))
+		send_prepare_range(p, &range);
+	return 0;
+}
+
+/*
+	Decides the given instances, with the values accepted for them, if any,
+	or with no-ops, so that the learners can deliver the later ones.
+*/
+void
+evproposer_fill(struct evproposer* p, unsigned from, unsigned to)
+{
+	iid_t iid;
+	paxos_prepare pr;
+	if (!p->active)
+		return;
+	for (iid = from; iid <= to; iid++)
+		if (proposer_prepare_fill(p->state, iid, &pr))
+			send_prepare(p, &pr);
+	try_accept(p);
+}
+
+/*
+	Returns the sequence number of a heartbeat round started no earlier than
+	now, whose confirmation is reported to the confirm function.
+*/
+unsigned
+evproposer_confirm_leadership(struct evproposer* p)
+{
+	if (p->confirmed_seq == p->heartbeat_seq) {
+		evproposer_start_heartbeat(p);
+		return p->heartbeat_seq;
+	}
+	p->heartbeat_next = 1;
+	return p->heartbeat_seq + 1;
+}
+
+unsigned
+evproposer_confirmed(struct evproposer* p)
+{
+	return p->confirmed_seq;
+}
+
+int
+evproposer_active(struct evproposer* p)
+{
+	return p->active;
+}
+
+int
+evproposer_has_lease(struct evproposer* p)
+{
+	struct timeval now;
+	if (!p->active || paxos_config.proposer_lease <= 0)
+		return 0;
+	gettimeofday(&now, NULL);
+	return timercmp(&now, &p->lease_until, <);
+}
+
+/*
+	Instances up to the read index must be delivered before the state is
+	read: those this proposer knows accepted, and those the acceptors of the
+	last heartbeat round confirmed had accepted.
+*/
+unsigned
+evproposer_read_index(struct evproposer* p)
+{
+	iid_t iid = proposer_commit_iid(p->state);
+	return iid > p->confirmed_iid ? iid : p->confirmed_iid;
+}
+
+void
+evproposer_set_confirm_function(struct evproposer* p, confirm_function f,
+	void* arg)
+{
+	p->confirm = f;
+	p->confirm_arg = arg;
+}
+
 void
 evproposer_set_instance_id(struct evproposer* p, unsigned iid)
 {
@@ -28,25 +28,442 @@
 
 #include "evpaxos_internal.h"
 #include "message.h"
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <event2/event.h>
+
+#define SNAPSHOT_CHUNK_SIZE (64*1024)
+
+struct snapshot_transfer
+{
+	struct peer* from;   /* Peer we requested the snapshot from, or NULL */
+	iid_t min_iid;       /* Lowest instance id the snapshot must cover */
+	iid_t iid;           /* Instance id covered by the incoming snapshot */
+	char* buffer;
+	size_t size;
+	size_t received;
+};
+
+/*
+	A snapshot being sent to a replica, a chunk at a time: the next one is
+	queued once the previous left the output buffer of the peer, so that a
+	large snapshot is never held in the output buffer as a whole.
+*/
+struct snapshot_upload
+{
+	struct evpaxos_replica* replica;
+	struct peer* to;
+	iid_t iid;
+	char* buffer;
+	size_t size;
+	size_t sent;
+	struct event* timeout_ev;  /* Gives up when the peer stops draining */
+	struct snapshot_upload* next;
+};
+
+/*
+	A read is served once the leadership of the replica is confirmed by the
+	heartbeat round seq, or right away under a lease (seq 0), and its state
+	reflects every value decided when the read was issued, up to iid. The
+	round confirmed raises iid to the read index it found.
+*/
+struct read_request
+{
+	read_function f;
+	void* arg;
+	iid_t iid;
+	unsigned seq;
+	struct read_request* next;
+};
 
 struct evpaxos_replica
 {
-	struct peers* peers;
+	int id;
+	uint32_t log;
+	struct evpaxos_config* config;  /* Owned by the replica of log 0 */
+	struct peers* peers;            /* Shared by all logs, owned by log 0 */
 	struct evlearner* learner;
 	struct evproposer* proposer;
 	struct evacceptor* acceptor;
 	deliver_function deliver;
 	void* arg;
+	iid_t delivered_iid;
+	snapshot_save_function save;
+	snapshot_load_function load;
+	int next_snapshot_peer;
+	struct snapshot_transfer transfer;
+	struct event* transfer_ev;
+	struct timeval transfer_tv;
+	struct snapshot_upload* uploads;  /* Snapshots being sent */
+	iid_t* checkpoints;          /* Last checkpoint known of each replica */
+	iid_t trim_iid;              /* Highest trim we sent to the acceptors */
+	struct event* state_ev;
+	struct timeval state_tv;
+	struct read_request* reads;       /* Pending reads, oldest first */
+	struct read_request* reads_tail;
 };
 
+/*
+	Serves the pending reads that can be, in order. They all fail, with iid
+	0, once the replica is no longer the leader.
+*/
+static void
+evpaxos_replica_serve_reads(struct evpaxos_replica* r)
+{
+	struct read_request* read;
+	int leader = evproposer_leader(r->proposer) == r->id;
+	while ((read = r->reads) != NULL) {
+		if (leader && read->seq > evproposer_confirmed(r->proposer))
+			break;
+		if (leader && read->seq > 0) {
+			if (evproposer_read_index(r->proposer) > read->iid)
+				read->iid = evproposer_read_index(r->proposer);
+			read->seq = 0;
+		}
+		if (leader && read->iid > r->delivered_iid)
+			break;
+		r->reads = read->next;
+		if (r->reads == NULL)
+			r->reads_tail = NULL;
+		read->f(leader ? r->delivered_iid : 0, read->arg);
+		free(read);
+	}
+}
+
+static void
+evpaxos_replica_confirmed(unsigned seq, void* arg)
+{
+	evpaxos_replica_serve_reads(arg);
+}
+
 static void
 evpaxos_replica_deliver(unsigned iid, char* value, size_t size, void* arg)
 {
 	struct evpaxos_replica* r = arg;
+	r->delivered_iid = iid;
 	evproposer_set_instance_id(r->proposer, iid);
-	if (r->deliver)
+	if (r->deliver && size > 0)
 		r->deliver(iid, value, size, r->arg);
+	if (r->reads != NULL)
+		evpaxos_replica_serve_reads(r);
+}
+
+static void
+snapshot_transfer_reset(struct evpaxos_replica* r)
+{
+	free(r->transfer.buffer);
+	memset(&r->transfer, 0, sizeof(struct snapshot_transfer));
+	if (r->transfer_ev != NULL)
+		event_del(r->transfer_ev);
+}
+
+static void
+evpaxos_replica_request_snapshot(struct evpaxos_replica* r, iid_t iid)
+{
+	int i, id, count = peers_count(r->peers);
+	struct peer* p;
+	for (i = 0; i < count; ++i) {
+		id = (r->next_snapshot_peer + i) % count;
+		p = peers_get_acceptor(r->peers, id);
+		if (id == r->id || !peer_connected(p))
+			continue;
+		paxos_message req = {
+			.type = PAXOS_SNAPSHOT_REQUEST,
+			.log = r->log,
+			.u.snapshot_request = {iid} };
+		paxos_log_info("Requesting snapshot covering inst %u from replica %d",
+			iid, id);
+		peer_send_message(p, &req);
+		r->transfer.from = p;
+		r->transfer.min_iid = iid;
+		r->next_snapshot_peer = id + 1;
+		event_add(r->transfer_ev, &r->transfer_tv);
+		return;
+	}
+}
+
+static void
+evpaxos_replica_transfer_timeout(evutil_socket_t fd, short ev, void* arg)
+{
+	struct evpaxos_replica* r = arg;
+	paxos_log_info("Snapshot transfer from replica %d timed out",
+		peer_get_id(r->transfer.from));
+	snapshot_transfer_reset(r);
+}
+
+static void
+evpaxos_replica_install_snapshot(struct evpaxos_replica* r)
+{
+	struct snapshot_transfer* t = &r->transfer;
+	if (t->iid > r->delivered_iid) {
+		paxos_log_info("Installing snapshot of %zu bytes covering inst %u",
+			t->size, t->iid);
+		r->load(t->iid, t->buffer, t->size, r->arg);
+		evpaxos_replica_set_instance_id(r, t->iid);
+		evpaxos_replica_serve_reads(r);
+	}
+	snapshot_transfer_reset(r);
+}
+
+/*
+	Acceptors periodically advertise their trim instance id, if we did not
+	deliver up to that point the missing instances are gone for good and
+	the only way forward is a snapshot from one of the other replicas.
+*/
+static void
+evpaxos_replica_handle_acceptor_state(struct peer* p, paxos_message* msg,
+	void* arg)
+{
+	struct evpaxos_replica* r = arg;
+	paxos_acceptor_state* state = &msg->u.state;
+	if (r->load == NULL || r->learner == NULL)
+		return;
+	if (r->transfer.from != NULL || state->trim_iid <= r->delivered_iid)
+		return;
+	evpaxos_replica_request_snapshot(r, state->trim_iid);
+}
+
+static void
+snapshot_upload_free(struct snapshot_upload* u)
+{
+	struct snapshot_upload** prev = &u->replica->uploads;
+	while (*prev != u)
+		prev = &(*prev)->next;
+	*prev = u->next;
+	peer_on_drained(u->to, NULL, NULL);
+	peer_release(u->to);
+	event_free(u->timeout_ev);
+	free(u->buffer);
+	free(u);
+}
+
+static void
+evpaxos_replica_upload_timeout(evutil_socket_t fd, short ev, void* arg)
+{
+	struct snapshot_upload* u = arg;
+	paxos_log_info("Snapshot upload to replica stalled at %zu of %zu bytes",
+		u->sent, u->size);
+	snapshot_upload_free(u);
+}
+
+static void
+evpaxos_replica_send_chunk(struct peer* p, void* arg)
+{
+	struct snapshot_upload* u = arg;
+	paxos_message m = {
+		.type = PAXOS_SNAPSHOT_CHUNK,
+		.log = u->replica->log,
+		.u.snapshot_chunk = {u->iid, u->sent, u->size} };
+	paxos_snapshot_chunk* chunk = &m.u.snapshot_chunk;
+	chunk->data.paxos_value_len = u->size - u->sent;
+	if (chunk->data.paxos_value_len > SNAPSHOT_CHUNK_SIZE)
+		chunk->data.paxos_value_len = SNAPSHOT_CHUNK_SIZE;
+	chunk->data.paxos_value_val = u->buffer + u->sent;
+	peer_send_message(p, &m);
+	u->sent += chunk->data.paxos_value_len;
+	if (u->sent == u->size) {
+		snapshot_upload_free(u);
+		return;
+	}
+	event_add(u->timeout_ev, &u->replica->transfer_tv);
+	peer_on_drained(p, evpaxos_replica_send_chunk, u);
+}
+
+/*
+	A replica asking again gave up on the snapshot we were sending it, which
+	is sent anew.
+*/
+static void
+evpaxos_replica_handle_snapshot_request(struct peer* p, paxos_message* msg,
+	void* arg)
+{
+	struct snapshot_upload* u;
+	struct evpaxos_replica* r = arg;
+	paxos_snapshot_request* req = &msg->u.snapshot_request;
+
+	for (u = r->uploads; u != NULL; u = u->next) {
+		if (u->to == p) {
+			snapshot_upload_free(u);
+			break;
+		}
+	}
+
+	u = calloc(1, sizeof(struct snapshot_upload));
+	if (r->save == NULL || r->save(&u->iid, &u->buffer, &u->size, r->arg)) {
+		free(u);
+		return;
+	}
+
+	if (u->iid < req->iid) {
+		paxos_log_info("Snapshot at inst %u does not cover requested inst %u",
+			u->iid, req->iid);
+		free(u->buffer);
+		free(u);
+		return;
+	}
+
+	// chunks carry the offset and size of the snapshot in 32 bits
+	if (u->size > UINT32_MAX) {
+		paxos_log_error("Snapshot of %zu bytes is too large to be sent",
+			u->size);
+		free(u->buffer);
+		free(u);
+		return;
+	}
+
+	u->replica = r;
+	u->to = p;
+	peer_retain(p);
+	u->timeout_ev = evtimer_new(peers_get_event_base(r->peers),
+		evpaxos_replica_upload_timeout, u);
+	u->next = r->uploads;
+	r->uploads = u;
+	evpaxos_replica_send_chunk(p, u);
+}
+
+static void
+evpaxos_replica_handle_snapshot_chunk(struct peer* p, paxos_message* msg,
+	void* arg)
+{
+	struct evpaxos_replica* r = arg;
+	struct snapshot_transfer* t = &r->transfer;
+	paxos_snapshot_chunk* chunk = &msg->u.snapshot_chunk;
+	size_t len = chunk->data.paxos_value_len;
+
+	if (t->from != p)
+		return;
+
+	if (chunk->offset == 0 && t->buffer == NULL) {
+		if (chunk->iid < t->min_iid)
+			return;
+		if (chunk->size > paxos_config.learner_snapshot_max_size) {
+			paxos_log_error("Refused snapshot of %u bytes for inst %u",
+				chunk->size, chunk->iid);
+			snapshot_transfer_reset(r);
+			return;
+		}
+		t->buffer = malloc((size_t)chunk->size + 1);
+		if (t->buffer == NULL) {
+			paxos_log_error("No memory for snapshot of %u bytes", chunk->size);
+			snapshot_transfer_reset(r);
+			return;
+		}
+		t->iid = chunk->iid;
+		t->size = chunk->size;
+		t->received = 0;
+	}
+
+	if (chunk->iid != t->iid || chunk->size != t->size
+		|| chunk->offset != t->received || t->received + len > t->size) {
+		paxos_log_error("Dropped snapshot chunk for inst %u offset %u",
+			chunk->iid, chunk->offset);
+		snapshot_transfer_reset(r);
+		return;
+	}
+
+	memcpy(t->buffer + t->received, chunk->data.paxos_value_val, len);
+	t->received += len;
+	event_add(r->transfer_ev, &r->transfer_tv);
+
+	if (t->received == t->size)
+		evpaxos_replica_install_snapshot(r);
+}
+
+/*
+	Every replica periodically tells the others up to which instance its
+	state is checkpointed. The log can be trimmed up to the lowest of these.
+*/
+static void
+evpaxos_replica_send_state(evutil_socket_t fd, short ev, void* arg)
+{
+	struct evpaxos_replica* r = arg;
+	paxos_message msg = {
+		.type = PAXOS_REPLICA_STATE,
+		.log = r->log,
+		.u.replica_state.rid = r->id,
+		.u.replica_state.checkpoint_iid = r->checkpoints[r->id] };
+	if (msg.u.replica_state.checkpoint_iid > 0)
+		peers_broadcast_acceptors(r->peers, &msg);
+	if (r->reads != NULL)
+		evpaxos_replica_serve_reads(r);
+	event_add(r->state_ev, &r->state_tv);
+}
+
+static void
+evpaxos_replica_update_trim(struct evpaxos_replica* r)
+{
+	int i;
+	iid_t min = r->checkpoints[0];
+	for (i = 1; i < peers_count(r->peers); ++i)
+		if (r->checkpoints[i] < min)
+			min = r->checkpoints[i];
+	if (min > r->trim_iid) {
+		r->trim_iid = min;
+		evpaxos_replica_send_trim(r, min);
+	}
+}
+
+static void
+evpaxos_replica_handle_replica_state(struct peer* p, paxos_message* msg,
+	void* arg)
+{
+	struct evpaxos_replica* r = arg;
+	paxos_replica_state* state = &msg->u.replica_state;
+	if (state->rid >= (unsigned)peers_count(r->peers))
+		return;
+	if (state->checkpoint_iid > r->checkpoints[state->rid]) {
+		r->checkpoints[state->rid] = state->checkpoint_iid;
+		evpaxos_replica_update_trim(r);
+	}
+}
+
+/*
+	The learner has been missing instances for too long, the proposer, if
+	the leader, decides them.
+*/
+static void
+evpaxos_replica_stalled(unsigned from, unsigned to, void* arg)
+{
+	struct evpaxos_replica* r = arg;
+	evproposer_fill(r->proposer, from, to);
+}
+
+/*
+	Sets up the proposer, acceptor and learner of the log of the given
+	replica, along with the replica's own subscriptions and timers.
+*/
+static void
+evpaxos_replica_start(struct evpaxos_replica* r, struct event_base* base)
+{
+	struct peers* peers = r->peers;
+	r->acceptor = evacceptor_init_internal(r->id, r->config, peers, r->log);
+	r->proposer = evproposer_init_internal(r->id, r->config, peers, r->log);
+	if (!paxos_config.proposer_partition || evproposer_partition(r->proposer,
+		evpaxos_acceptor_count(r->config)) != 0)
+		evproposer_join_election(r->proposer);
+	evproposer_set_confirm_function(r->proposer, evpaxos_replica_confirmed, r);
+	r->learner  = evlearner_init_internal(r->config, peers, r->log,
+		evpaxos_replica_deliver, r);
+	evlearner_set_stall_function(r->learner, evpaxos_replica_stalled, r);
+	evlearner_deliver_noops(r->learner);
+	evlearner_catch_up_from_replicas(r->learner, r->id);
+	
+	r->transfer_ev = evtimer_new(base, evpaxos_replica_transfer_timeout, r);
+	r->transfer_tv = (struct timeval){5, 0};
+	peers_subscribe_log(peers, r->log, PAXOS_ACCEPTOR_STATE,
+		evpaxos_replica_handle_acceptor_state, r);
+	peers_subscribe_log(peers, r->log, PAXOS_SNAPSHOT_REQUEST,
+		evpaxos_replica_handle_snapshot_request, r);
+	peers_subscribe_log(peers, r->log, PAXOS_SNAPSHOT_CHUNK,
+		evpaxos_replica_handle_snapshot_chunk, r);
+	
+	r->checkpoints = calloc(peers_count(peers), sizeof(iid_t));
+	r->state_ev = evtimer_new(base, evpaxos_replica_send_state, r);
+	r->state_tv = (struct timeval){1, 0};
+	event_add(r->state_ev, &r->state_tv);
+	peers_subscribe_log(peers, r->log, PAXOS_REPLICA_STATE,
+		evpaxos_replica_handle_replica_state, r);
 }
 
 struct evpaxos_replica*
@@ -55,75 +472,192 @@ evpaxos_replica_init(int id, const char* config_file, deliver_function f,
 {
 	struct evpaxos_replica* r;
 	struct evpaxos_config* config;
-	r = malloc(sizeof(struct evpaxos_replica));
+	r = calloc(1, sizeof(struct evpaxos_replica));
 	
 	config = evpaxos_config_read(config_file);
 	
 	r->peers = peers_new(base, config);
-	peers_connect_to_acceptors(r->peers);
+	if (paxos_config.replica_loopback)
+		peers_connect_to_acceptors_local(r->peers, id);
+	else
+		peers_connect_to_acceptors(r->peers);
 	
-	r->acceptor = evacceptor_init_internal(id, config, r->peers);
-	r->proposer = evproposer_init_internal(id, config, r->peers);
-	r->learner  = evlearner_init_internal(config, r->peers,
-		evpaxos_replica_deliver, r);
+	r->id = id;
+	r->log = 0;
+	r->config = config;
 	r->deliver = f;
 	r->arg = arg;
+	evpaxos_replica_start(r, base);
 
 	int port = evpaxos_acceptor_listen_port(config, id);
 	if (peers_listen(r->peers, port) == 0) {
-		evpaxos_config_free(config);
 		evpaxos_replica_free(r);
 		return NULL;
 	}
 	
-	evpaxos_config_free(config);
+	return r;
+}
+
+struct evpaxos_replica*
+evpaxos_replica_init_log(struct evpaxos_replica* replica, unsigned log,
+	deliver_function f, void* arg)
+{
+	struct evpaxos_replica* r;
+	if (replica->log != 0 || log == 0)
+		return NULL;
+	r = calloc(1, sizeof(struct evpaxos_replica));
+	r->id = replica->id;
+	r->log = log;
+	r->config = replica->config;
+	r->peers = replica->peers;
+	r->deliver = f;
+	r->arg = arg;
+	evpaxos_replica_start(r, peers_get_event_base(r->peers));
 	return r;
 }
 
 void
 evpaxos_replica_free(struct evpaxos_replica* r)
 {
+	struct read_request* read;
+	while ((read = r->reads) != NULL) {
+		r->reads = read->next;
+		free(read);
+	}
+	if (r->log != 0)
+		peers_unsubscribe_log(r->peers, r->log);
 	if (r->learner)
 		evlearner_free_internal(r->learner);
 	evproposer_free_internal(r->proposer);
 	evacceptor_free_internal(r->acceptor);
-	peers_free(r->peers);
+	snapshot_transfer_reset(r);
+	while (r->uploads != NULL)
+		snapshot_upload_free(r->uploads);
+	event_free(r->transfer_ev);
+	event_free(r->state_ev);
+	free(r->checkpoints);
+	if (r->log == 0) {
+		peers_free(r->peers);
+		evpaxos_config_free(r->config);
+	}
 	free(r);
 }
 
 void
 evpaxos_replica_set_instance_id(struct evpaxos_replica* r, unsigned iid)
 {
+	r->delivered_iid = iid;
 	if (r->learner)
 		evlearner_set_instance_id(r->learner, iid);
 	evproposer_set_instance_id(r->proposer, iid);
 }
 
-static void
-peer_send_trim(struct peer* p, void* arg)
+void
+evpaxos_replica_checkpoint(struct evpaxos_replica* r, unsigned iid)
+{
+	if (iid > r->checkpoints[r->id]) {
+		r->checkpoints[r->id] = iid;
+		evpaxos_replica_update_trim(r);
+	}
+}
+
+void
+evpaxos_replica_set_snapshot(struct evpaxos_replica* r,
+	snapshot_save_function save, snapshot_load_function load)
 {
-	send_paxos_trim(peer_get_buffer(p), arg);
+	r->save = save;
+	r->load = load;
 }
 
 void
 evpaxos_replica_send_trim(struct evpaxos_replica* r, unsigned iid)
 {
-	paxos_trim trim = {iid};
-	peers_foreach_acceptor(r->peers, peer_send_trim, &trim);
+	paxos_message msg = {
+		.type = PAXOS_TRIM,
+		.log = r->log,
+		.u.trim.iid = iid };
+	peers_broadcast_acceptors(r->peers, &msg);
 }
 
+/*
+	Values are submitted to the leader, which is this replica's own proposer
+	or one it is connected to. With partitioned instances every replica is
+	its own leader. With fast-paxos they are sent to every acceptor instead.
+*/
 void
 evpaxos_replica_submit(struct evpaxos_replica* r, char* value, int size)
 {
-	int i;
-	struct peer* p;
-	for (i = 0; i < peers_count(r->peers); ++i) {
-		p = peers_get_acceptor(r->peers, i);
-		if (peer_connected(p)) {
-			paxos_submit(peer_get_buffer(p), value, size);
-			return;
-		}
+	struct peer* p = peers_get_acceptor(r->peers,
+		evproposer_leader(r->proposer));
+	paxos_message msg = {
+		.type = PAXOS_CLIENT_VALUE,
+		.log = r->log,
+		.u.client_value.value = {size, value} };
+	if (paxos_config.fast_paxos) {
+		msg.type = PAXOS_ACCEPT;
+		msg.u.accept = (paxos_accept) { 0, PAXOS_FAST_BALLOT, {size, value},
+			paxos_timestamp() };
+		peers_broadcast_acceptors(r->peers, &msg);
+		return;
 	}
+	if (p != NULL)
+		peer_send_message(p, &msg);
+}
+
+/*
+	Under a lease the leader knows that no other replica can have decided
+	anything it has not heard of, otherwise it confirms its leadership with
+	a round of heartbeats issued after the read, whose acks tell up to which
+	instance values may have been decided. Either way the acceptors are not
+	written to. A leader still waiting to take over serves no reads.
+*/
+int
+evpaxos_replica_read(struct evpaxos_replica* r, read_function f, void* arg)
+{
+	struct read_request* read;
+	if (paxos_config.proposer_partition ||
+		evproposer_leader(r->proposer) != r->id ||
+		!evproposer_active(r->proposer))
+		return -1;
+	read = malloc(sizeof(struct read_request));
+	read->f = f;
+	read->arg = arg;
+	read->iid = evproposer_read_index(r->proposer);
+	read->seq = 0;
+	if (!evproposer_has_lease(r->proposer))
+		read->seq = evproposer_confirm_leadership(r->proposer);
+	read->next = NULL;
+	if (r->reads_tail != NULL)
+		r->reads_tail->next = read;
+	else
+		r->reads = read;
+	r->reads_tail = read;
+	evpaxos_replica_serve_reads(r);
+	return 0;
+}
+
+unsigned
+evpaxos_replica_read_stale(struct evpaxos_replica* r, unsigned max_staleness)
+{
+	unsigned iid;
+	uint64_t timestamp, now = paxos_timestamp();
+	evlearner_applied(r->learner, &iid, &timestamp);
+	if (iid == 0 || timestamp + max_staleness < now)
+		return 0;
+	return iid;
+}
+
+void
+evpaxos_replica_applied(struct evpaxos_replica* r, unsigned* iid,
+	uint64_t* timestamp)
+{
+	evlearner_applied(r->learner, iid, timestamp);
+}
+
+int
+evpaxos_replica_leader(struct evpaxos_replica* r)
+{
+	return evproposer_leader(r->proposer);
 }
 
 int
@@ -29,6 +29,7 @@
 #ifndef _EVPAXOS_H_
 #define _EVPAXOS_H_
 
+#include <stdint.h>
 #include <sys/types.h>
 #include <event2/event.h>
 #include <event2/bufferevent.h>
@@ -41,10 +42,13 @@ struct evlearner;
 struct evproposer;
 struct evacceptor;
 struct evpaxos_replica;
+struct evpaxos_client;
 
 /**
  * When starting a learner you must pass a callback to be invoked whenever
- * a value has been learned.
+ * a value has been learned. Empty values are no-ops, which proposers use to
+ * fill instances that would otherwise block later ones, and are not
+ * delivered.
  */
 typedef void (*deliver_function)(
 	unsigned int,
@@ -52,6 +56,48 @@ typedef void (*deliver_function)(
 	size_t size,
 	void* arg);
 
+/**
+ * Callbacks of a learner that speculates on the next instance. The speculate
+ * function is called with a value accepted for the next instance to be
+ * delivered as soon as the first acceptor accepted it, before the instance
+ * is decided. Once decided, the confirm function is called if the value
+ * decided is the same, the retract function otherwise, and only then is the
+ * value decided passed to the deliver function.
+ */
+typedef void (*speculate_function)(
+	unsigned int iid,
+	char* value,
+	size_t size,
+	void* arg);
+
+typedef void (*speculation_function)(unsigned int iid, void* arg);
+
+/**
+ * Snapshot callbacks of a replica. The save function must store in value a
+ * malloc'ed buffer holding the serialized application state, in size its
+ * length, and in iid the highest instance id covered by the state. The buffer
+ * is freed by the library. Returns 0 on success, -1 if no snapshot is
+ * available. The load function replaces the application state with the one
+ * found in value, covering all instances up to iid.
+ */
+typedef int (*snapshot_save_function)(
+	unsigned int* iid,
+	char** value,
+	size_t* size,
+	void* arg);
+
+typedef void (*snapshot_load_function)(
+	unsigned int iid,
+	char* value,
+	size_t size,
+	void* arg);
+
+/**
+ * Called once a replica's state may be read, with the id of the last
+ * instance delivered, or with 0 if the read failed.
+ */
+typedef void (*read_function)(unsigned int iid, void* arg);
+
 /**
  * Create a Paxos replica, consisting of a collocated Acceptor, Proposer,
  * and Learner.
@@ -70,6 +116,25 @@ typedef void (*deliver_function)(
 struct evpaxos_replica* evpaxos_replica_init(int id, const char* config,
 	deliver_function cb, void* arg, struct event_base* base);
 
+/**
+ * Create another replicated log on top of the given replica. Each log has
+ * its own proposer, acceptor and learner state, delivers its own sequence
+ * of values and is trimmed independently, while all logs share the
+ * replica's connections and acceptor storage. Every node must attach the
+ * same logs to its replica.
+ *
+ * @param replica the replica created by evpaxos_replica_init()
+ * @param log the id of the log, which must be greater than 0 and unique
+ * @param cb the callback function to be called whenever the log delivers
+ * @param arg an optional argument that is passed to the callback
+ *
+ * @return a new evpaxos_replica on success, or NULL on failure. It must be
+ * freed before the replica it is attached to.
+ */
+struct evpaxos_replica* evpaxos_replica_init_log(
+	struct evpaxos_replica* replica, unsigned log, deliver_function cb,
+	void* arg);
+
 /**
  * Destroy a Paxos replica and free all its memory.
  *
@@ -87,6 +152,29 @@ void evpaxos_replica_free(struct evpaxos_replica* replica);
 void evpaxos_replica_set_instance_id(struct evpaxos_replica* replica,
 	unsigned iid);
 
+/**
+ * Enable snapshots on the given replica. The replica serves snapshots to
+ * peers that fell behind the acceptors' trimmed log and, when it falls behind
+ * itself, fetches a snapshot from a peer, loads it and resumes delivery from
+ * the instance following it. Both callbacks receive the argument passed to
+ * evpaxos_replica_init().
+ *
+ * @param save serializes the application state
+ * @param load restores the application state
+ */
+void evpaxos_replica_set_snapshot(struct evpaxos_replica* replica,
+	snapshot_save_function save, snapshot_load_function load);
+
+/**
+ * Tell the replica that the application state is durably checkpointed up to
+ * the given instance id. Replicas exchange their checkpoints and trim the
+ * acceptors' log up to the lowest checkpoint of all replicas, so instances
+ * are discarded only when no replica needs them to recover.
+ *
+ * @param iid the highest instance id covered by the checkpoint
+ */
+void evpaxos_replica_checkpoint(struct evpaxos_replica* replica, unsigned iid);
+
 /**
  * Send a trim message to all acceptors/replicas. Acceptors will trim their log
  * up the the given instance id.
@@ -101,6 +189,58 @@ void evpaxos_replica_send_trim(struct evpaxos_replica* replica, unsigned iid);
 void evpaxos_replica_submit(struct evpaxos_replica* replica,
 	char* value, int size);
 
+/**
+ * Reads from the state of the leader replica without submitting a value.
+ * The read function is called once the values delivered include every value
+ * decided before the call, the state of the replica may then be read
+ * linearizably. With proposer-lease set, the leader serves reads from its
+ * own state while its lease lasts, otherwise it confirms its leadership
+ * with a round of heartbeats to the acceptors first, which also tell it of
+ * the values decided it has not heard of yet.
+ *
+ * @param f the function to be called once the state may be read
+ * @param arg an optional argument that is passed to the function
+ *
+ * @return 0 if the read is pending, -1 if this replica is not the leader or
+ * has not taken over yet, or if the instances are partitioned among the
+ * replicas.
+ */
+int evpaxos_replica_read(struct evpaxos_replica* replica, read_function f,
+	void* arg);
+
+/**
+ * Reads from the state of any replica, provided it is no staler than the
+ * given bound. The state of a replica reflects every value decided with a
+ * commit timestamp up to the one reported by evpaxos_replica_applied(), the
+ * bound is checked against the time elapsed since then. While no value is
+ * decided, the leader's heartbeats keep that timestamp advancing. Timestamps
+ * are taken from the clock of the leader, the bound should allow for the
+ * skew between the clocks of the replicas.
+ *
+ * @param max_staleness the staleness bound, in milliseconds
+ *
+ * @return the id of the last instance delivered if the state may be read,
+ * 0 if it is staler than the bound.
+ */
+unsigned evpaxos_replica_read_stale(struct evpaxos_replica* replica,
+	unsigned max_staleness);
+
+/**
+ * Returns the id of the last instance delivered by the replica, and the
+ * latest commit timestamp among the instances delivered, or the latest safe
+ * time the leader confirmed the state was current at, if later.
+ *
+ * @see evlearner_applied()
+ */
+void evpaxos_replica_applied(struct evpaxos_replica* replica, unsigned* iid,
+	uint64_t* timestamp);
+
+/**
+ * Returns the id of the replica currently believed to be the leader. Values
+ * submitted to any other replica are forwarded to it.
+ */
+int evpaxos_replica_leader(struct evpaxos_replica* replica);
+
 /**
  * Returns the number of replicas in the configuration.
  */
@@ -128,6 +268,33 @@ void evlearner_free(struct evlearner* l);
  */
 void evlearner_set_instance_id(struct evlearner* l, unsigned iid);
 
+/**
+ * Returns the id of the last instance delivered by the learner, and the
+ * latest commit timestamp among the instances delivered, in milliseconds
+ * since the epoch. The leader assigns increasing timestamps to the values
+ * as it proposes them. Within replicas, the timestamp also advances to the
+ * safe times the leader sends while no value is decided. It may be called
+ * from within the deliver function, in which case it reports the instance
+ * being delivered.
+ */
+void evlearner_applied(struct evlearner* l, unsigned* iid,
+	uint64_t* timestamp);
+
+/**
+ * Makes the learner speculate on the next instance to be delivered, letting
+ * the application process a value during the rest of the round trip to the
+ * acceptors. A single instance is speculated on at a time.
+ *
+ * @param speculate called with the first value accepted for the instance
+ * @param confirm called once the instance is decided with that value
+ * @param retract called once the instance is decided with another value,
+ * or is skipped by evlearner_set_instance_id()
+ * @param arg an argument passed to the three callbacks
+ */
+void evlearner_set_speculation(struct evlearner* l,
+	speculate_function speculate, speculation_function confirm,
+	speculation_function retract, void* arg);
+
 /**
  * Send a trim message to all acceptors/replicas. Acceptors will trim their log
  * up the the given instance id.
@@ -175,6 +342,62 @@ void evproposer_set_instance_id(struct evproposer* p, unsigned iid);
  */
 void paxos_submit(struct bufferevent* bev, char* value, int size);
 
+/**
+ * Used by clients to submit values to the given log.
+ *
+ * @see evpaxos_replica_init_log()
+ */
+void paxos_submit_log(struct bufferevent* bev, unsigned log, char* value,
+	int size);
+
+/**
+ * Invoked when a value submitted by a client is decided, with the instance
+ * id it was decided in and the argument given to evpaxos_client_submit().
+ */
+typedef void (*reply_function)(
+	unsigned int iid,
+	void* request,
+	void* arg);
+
+/**
+ * Initializes a client submitting values to proposers, which acknowledge
+ * each of them once decided, so that clients need not run a learner.
+ * Replies tell the client which proposer is the leader, values are then
+ * submitted to it. A value not acknowledged within client-timeout seconds
+ * is submitted again, it may therefore be decided more than once, while
+ * the reply callback is invoked only once.
+ *
+ * @param id the id of the proposer, or replica, values are first submitted
+ * to
+ * @param f the callback invoked whenever a value is acknowledged
+ * @param arg an optional argument that is passed to the callback
+ *
+ * @return a new evpaxos_client on success, or NULL on failure.
+ */
+struct evpaxos_client* evpaxos_client_init(const char* config, int id,
+	reply_function f, void* arg, struct event_base* base);
+
+/**
+ * Release the memory allocated by the client, outstanding requests are
+ * dropped. Their request arguments are left to the caller.
+ */
+void evpaxos_client_free(struct evpaxos_client* c);
+
+/**
+ * Submits a value, which is copied. Values submitted while no proposer is
+ * connected, e.g. right after evpaxos_client_init(), are sent as soon as
+ * one connects.
+ *
+ * @param request an optional argument passed to the reply callback
+ */
+void evpaxos_client_submit(struct evpaxos_client* c, char* value, int size,
+	void* request);
+
+/**
+ * Returns the number of values submitted and not yet acknowledged.
+ */
+int evpaxos_client_outstanding(struct evpaxos_client* c);
+
 #ifdef __cplusplus
 }
 #endif
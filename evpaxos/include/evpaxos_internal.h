@@ -32,19 +32,53 @@
 #include "peers.h"
 #include "evpaxos.h"
 
+/* Called with the instances a learner has been missing for too long */
+typedef void (*stall_function)(unsigned from, unsigned to, void* arg);
+
+/* Called once a heartbeat round of the leader is acknowledged by a quorum */
+typedef void (*confirm_function)(unsigned seq, void* arg);
+
 struct evlearner* evlearner_init_internal(struct evpaxos_config* config,
-	struct peers* peers, deliver_function f, void* arg);
+	struct peers* peers, uint32_t log, deliver_function f, void* arg);
 
 void evlearner_free_internal(struct evlearner* l);
+
+void evlearner_set_stall_function(struct evlearner* l, stall_function f,
+	void* arg);
+
+void evlearner_deliver_noops(struct evlearner* l);
+
+void evlearner_catch_up_from_replicas(struct evlearner* l, int id);
 		
 struct evacceptor* evacceptor_init_internal(int id,
-	struct evpaxos_config* config, struct peers* peers);
+	struct evpaxos_config* config, struct peers* peers, uint32_t log);
 	
 void evacceptor_free_internal(struct evacceptor* a);
 
 struct evproposer* evproposer_init_internal(int id,
-	struct evpaxos_config* config, struct peers* peers);
+	struct evpaxos_config* config, struct peers* peers, uint32_t log);
 
 void evproposer_free_internal(struct evproposer* p);
 
+void evproposer_join_election(struct evproposer* p);
+
+int evproposer_partition(struct evproposer* p, int replicas);
+
+int evproposer_leader(struct evproposer* p);
+
+void evproposer_fill(struct evproposer* p, unsigned from, unsigned to);
+
+unsigned evproposer_confirm_leadership(struct evproposer* p);
+
+unsigned evproposer_confirmed(struct evproposer* p);
+
+int evproposer_active(struct evproposer* p);
+
+int evproposer_has_lease(struct evproposer* p);
+
+unsigned evproposer_read_index(struct evproposer* p);
+
+void evproposer_set_confirm_function(struct evproposer* p, confirm_function f,
+	void* arg);
+
 #endif
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2013-2015, University of Lugano
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holders nor the names of it
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef _IO_THREAD_H_
+#define _IO_THREAD_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <event2/event.h>
+
+/*
+	A task is a unit of work handed over to another thread. Tasks are
+	embedded in the structure carrying their arguments and are run with
+	discard set when the queue holding them is freed before they ran, in
+	which case they only release their resources.
+*/
+struct task
+{
+	struct task* next;
+	void (*run)(struct task* t, int discard);
+};
+
+struct task_queue;
+struct io_thread;
+
+struct task_queue* task_queue_new(struct event_base* base);
+void task_queue_free(struct task_queue* q);
+void task_queue_push(struct task_queue* q, struct task* t);
+
+struct io_thread* io_thread_new(int index);
+void io_thread_free(struct io_thread* t);
+int io_thread_start(struct io_thread* t);
+void io_thread_stop(struct io_thread* t);
+struct event_base* io_thread_get_base(struct io_thread* t);
+void io_thread_push(struct io_thread* t, struct task* task);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
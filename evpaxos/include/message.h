@@ -37,6 +37,22 @@ extern "C" {
 #include <event2/buffer.h>
 #include <event2/bufferevent.h>
 
+struct paxos_decoder;
+struct paxos_frame;
+
+typedef enum
+{
+	PAXOS_CODEC_HELLO = 0,
+	PAXOS_CODEC_MSGPACK = 1,
+	PAXOS_CODEC_BINARY = 2
+} paxos_codec;
+
+paxos_codec paxos_local_codec(void);
+struct paxos_frame* paxos_frame_new(paxos_message* msg, paxos_codec codec);
+struct paxos_frame* paxos_frame_retain(struct paxos_frame* f);
+void paxos_frame_release(struct paxos_frame* f);
+void send_paxos_frame(struct bufferevent* bev, struct paxos_frame* f);
+void send_paxos_hello(struct bufferevent* bev);
 void send_paxos_message(struct bufferevent* bev, paxos_message* msg);
 void send_paxos_prepare(struct bufferevent* bev, paxos_prepare* msg);
 void send_paxos_promise(struct bufferevent* bev, paxos_promise* msg);
@@ -45,7 +61,16 @@ void send_paxos_accepted(struct bufferevent* bev, paxos_accepted* msg);
 void send_paxos_preempted(struct bufferevent* bev, paxos_preempted* msg);
 void send_paxos_repeat(struct bufferevent* bev, paxos_repeat* msg);
 void send_paxos_trim(struct bufferevent* bev, paxos_trim* msg);
-int recv_paxos_message(struct evbuffer* in, paxos_message* out);
+struct paxos_decoder* paxos_decoder_new(void);
+void paxos_decoder_free(struct paxos_decoder* d);
+void paxos_decoder_reset(struct paxos_decoder* d);
+paxos_codec paxos_decoder_codec(struct paxos_decoder* d);
+int recv_paxos_message(struct paxos_decoder* d, struct evbuffer* in,
+	paxos_message* out);
+void paxos_decoder_release(struct paxos_decoder* d, struct evbuffer* in,
+	paxos_message* msg);
+void paxos_decoder_detach(struct paxos_decoder* d, struct evbuffer* in,
+	paxos_message* msg);
 
 #ifdef __cplusplus
 }
@@ -54,6 +54,32 @@ void msgpack_pack_paxos_acceptor_state(msgpack_packer* p, paxos_acceptor_state*
 void msgpack_unpack_paxos_acceptor_state(msgpack_object* o, paxos_acceptor_state* v);
 void msgpack_pack_paxos_client_value(msgpack_packer* p, paxos_client_value* v);
 void msgpack_unpack_paxos_client_value(msgpack_object* o, paxos_client_value* v);
+void msgpack_pack_paxos_snapshot_request(msgpack_packer* p, paxos_snapshot_request* v);
+void msgpack_unpack_paxos_snapshot_request(msgpack_object* o, paxos_snapshot_request* v);
+void msgpack_pack_paxos_snapshot_chunk(msgpack_packer* p, paxos_snapshot_chunk* v);
+void msgpack_unpack_paxos_snapshot_chunk(msgpack_object* o, paxos_snapshot_chunk* v);
+void msgpack_pack_paxos_catchup(msgpack_packer* p, paxos_catchup* v);
+void msgpack_unpack_paxos_catchup(msgpack_object* o, paxos_catchup* v);
+void msgpack_pack_paxos_chosen(msgpack_packer* p, paxos_chosen* v);
+void msgpack_unpack_paxos_chosen(msgpack_object* o, paxos_chosen* v);
+void msgpack_pack_paxos_replica_state(msgpack_packer* p, paxos_replica_state* v);
+void msgpack_unpack_paxos_replica_state(msgpack_object* o, paxos_replica_state* v);
+void msgpack_pack_paxos_accept_batch(msgpack_packer* p, paxos_accept_batch* v);
+void msgpack_unpack_paxos_accept_batch(msgpack_object* o, paxos_accept_batch* v);
+void msgpack_pack_paxos_accepted_batch(msgpack_packer* p, paxos_accepted_batch* v);
+void msgpack_unpack_paxos_accepted_batch(msgpack_object* o, paxos_accepted_batch* v);
+void msgpack_pack_paxos_client_reply(msgpack_packer* p, paxos_client_reply* v);
+void msgpack_unpack_paxos_client_reply(msgpack_object* o, paxos_client_reply* v);
+void msgpack_pack_paxos_heartbeat(msgpack_packer* p, paxos_heartbeat* v);
+void msgpack_unpack_paxos_heartbeat(msgpack_object* o, paxos_heartbeat* v);
+void msgpack_pack_paxos_heartbeat_ack(msgpack_packer* p, paxos_heartbeat_ack* v);
+void msgpack_unpack_paxos_heartbeat_ack(msgpack_object* o, paxos_heartbeat_ack* v);
+void msgpack_pack_paxos_prepare_range(msgpack_packer* p, paxos_prepare_range* v);
+void msgpack_unpack_paxos_prepare_range(msgpack_object* o, paxos_prepare_range* v);
+void msgpack_pack_paxos_promise_range(msgpack_packer* p, paxos_promise_range* v);
+void msgpack_unpack_paxos_promise_range(msgpack_object* o, paxos_promise_range* v);
+void msgpack_pack_paxos_safe_time(msgpack_packer* p, paxos_safe_time* v);
+void msgpack_unpack_paxos_safe_time(msgpack_object* o, paxos_safe_time* v);
 void msgpack_pack_paxos_message(msgpack_packer* p, paxos_message* v);
 void msgpack_unpack_paxos_message(msgpack_object* o, paxos_message* v);
 
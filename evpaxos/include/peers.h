@@ -48,16 +48,31 @@ struct peers* peers_new(struct event_base* base, struct evpaxos_config* config);
 void peers_free(struct peers* p);
 int peers_count(struct peers* p);
 void peers_connect_to_acceptors(struct peers* p);
+void peers_connect_to_acceptors_local(struct peers* p, int local_id);
+void peers_connect_to_acceptor(struct peers* p, int id);
+void peers_connect_to_proposer(struct peers* p, int id);
 int peers_listen(struct peers* p, int port);
 void peers_subscribe(struct peers* p, paxos_message_type t, peer_cb cb, void*);
+void peers_subscribe_log(struct peers* p, uint32_t log, paxos_message_type t,
+	peer_cb cb, void* arg);
+void peers_unsubscribe_log(struct peers* p, uint32_t log);
+void peers_on_connect(struct peers* p, peer_iter_cb cb, void* arg);
+void peers_on_disconnect_log(struct peers* p, uint32_t log, peer_iter_cb cb,
+	void* arg);
 void peers_foreach_acceptor(struct peers* p, peer_iter_cb cb, void* arg);
 void peers_for_n_acceptor(struct peers* p, peer_iter_cb cb, void* arg, int n);
 void peers_foreach_client(struct peers* p, peer_iter_cb cb, void* arg);
+void peers_broadcast_acceptors(struct peers* p, paxos_message* msg);
+void peers_broadcast_n_acceptors(struct peers* p, paxos_message* msg, int n);
+void peers_broadcast_clients(struct peers* p, paxos_message* msg);
 struct peer* peers_get_acceptor(struct peers* p, int id);
 struct event_base* peers_get_event_base(struct peers* p);
 int peer_get_id(struct peer* p);
-struct bufferevent* peer_get_buffer(struct peer* p);
 int peer_connected(struct peer* p);
+void peer_send_message(struct peer* p, paxos_message* msg);
+void peer_on_drained(struct peer* p, peer_iter_cb cb, void* arg);
+void peer_retain(struct peer* p);
+void peer_release(struct peer* p);
 
 #ifdef __cplusplus
 }
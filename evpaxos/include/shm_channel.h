@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2013-2015, University of Lugano
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holders nor the names of it
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef _SHM_CHANNEL_H_
+#define _SHM_CHANNEL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <event2/event.h>
+#include <event2/bufferevent.h>
+
+/*
+	A shared memory channel connects two processes on the same host through
+	a pair of single producer, single consumer rings, one per direction.
+	Each side is handed a bufferevent which behaves like the one of a
+	connected socket: what is written to it comes out of the other side,
+	and its event callback is run with BEV_EVENT_EOF when the other side
+	goes away. The bufferevent is owned by the channel.
+*/
+struct shm_channel;
+struct shm_listener;
+
+typedef void (*shm_accept_cb)(struct shm_channel* c, void* arg);
+
+struct shm_listener* shm_listener_new(struct event_base* base, int port,
+	shm_accept_cb cb, void* arg);
+void shm_listener_free(struct shm_listener* l);
+struct shm_channel* shm_channel_connect(struct event_base* base, int port);
+void shm_channel_free(struct shm_channel* c);
+struct bufferevent* shm_channel_get_bufferevent(struct shm_channel* c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
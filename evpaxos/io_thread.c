@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2013-2015, University of Lugano
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holders nor the names of it
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#define _GNU_SOURCE
+#include "io_thread.h"
+#include "paxos.h"
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/*
+	Tasks go through an intrusive, multiple producers and single consumer
+	queue: producers swap their task in as the new head and then link the
+	previous head to it, while the consumer pops from the tail, none of
+	them taking locks. The consumer's event loop is woken up by a pipe,
+	which is written only by the producer finding it not yet notified.
+*/
+struct task_queue
+{
+	struct task* head;     /* Last task pushed, swapped in by producers */
+	struct task* tail;     /* Next task to run, owned by the consumer */
+	struct task stub;
+	int notified;          /* The pipe has been written since the last run */
+	int fds[2];
+	struct event* ev;
+};
+
+struct io_thread
+{
+	int index;
+	int started;
+	pthread_t thread;
+	struct event_base* base;
+	struct task_queue* tasks;
+};
+
+struct stop_task
+{
+	struct task task;
+	struct event_base* base;
+};
+
+static void on_wakeup(evutil_socket_t fd, short ev, void* arg);
+
+
+struct task_queue*
+task_queue_new(struct event_base* base)
+{
+	struct task_queue* q = calloc(1, sizeof(struct task_queue));
+	if (pipe(q->fds) != 0) {
+		paxos_log_error("Failed to create pipe: %s", strerror(errno));
+		free(q);
+		return NULL;
+	}
+	evutil_make_socket_nonblocking(q->fds[0]);
+	evutil_make_socket_nonblocking(q->fds[1]);
+	evutil_make_socket_closeonexec(q->fds[0]);
+	evutil_make_socket_closeonexec(q->fds[1]);
+	q->head = q->tail = &q->stub;
+	q->ev = event_new(base, q->fds[0], EV_READ|EV_PERSIST, on_wakeup, q);
+	event_add(q->ev, NULL);
+	return q;
+}
+
+static void
+task_queue_enqueue(struct task_queue* q, struct task* t)
+{
+	struct task* prev;
+	__atomic_store_n(&t->next, NULL, __ATOMIC_RELAXED);
+	prev = __atomic_exchange_n(&q->head, t, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&prev->next, t, __ATOMIC_RELEASE);
+}
+
+/*
+	Returns the next task, or NULL if the queue is empty or if the next task
+	is still being linked, in which case its producer wakes the consumer up.
+*/
+static struct task*
+task_queue_pop(struct task_queue* q)
+{
+	struct task* tail = q->tail;
+	struct task* next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	if (tail == &q->stub) {
+		if (next == NULL)
+			return NULL;
+		q->tail = tail = next;
+		next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	}
+	if (next == NULL) {
+		if (tail != __atomic_load_n(&q->head, __ATOMIC_ACQUIRE))
+			return NULL;
+		task_queue_enqueue(q, &q->stub);
+		next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+		if (next == NULL)
+			return NULL;
+	}
+	q->tail = next;
+	return tail;
+}
+
+void
+task_queue_free(struct task_queue* q)
+{
+	struct task* t;
+	while ((t = task_queue_pop(q)) != NULL)
+		t->run(t, 1);
+	event_free(q->ev);
+	close(q->fds[0]);
+	close(q->fds[1]);
+	free(q);
+}
+
+/*
+	Pushes a task to the queue, can be called from any thread. The task is
+	run by the thread running the event loop the queue was created with.
+*/
+void
+task_queue_push(struct task_queue* q, struct task* t)
+{
+	char c = 0;
+	task_queue_enqueue(q, t);
+	if (__atomic_exchange_n(&q->notified, 1, __ATOMIC_SEQ_CST) == 0)
+		if (write(q->fds[1], &c, 1) < 0 && errno != EAGAIN)
+			paxos_log_error("Failed to wake up thread: %s", strerror(errno));
+}
+
+static void
+on_wakeup(evutil_socket_t fd, short ev, void* arg)
+{
+	char buf[64];
+	struct task* t;
+	struct task_queue* q = arg;
+	while (read(fd, buf, sizeof(buf)) > 0);
+	__atomic_store_n(&q->notified, 0, __ATOMIC_SEQ_CST);
+	while ((t = task_queue_pop(q)) != NULL)
+		t->run(t, 0);
+}
+
+struct io_thread*
+io_thread_new(int index)
+{
+	struct io_thread* t = calloc(1, sizeof(struct io_thread));
+	t->index = index;
+	t->base = event_base_new();
+	t->tasks = task_queue_new(t->base);
+	if (t->tasks == NULL) {
+		event_base_free(t->base);
+		free(t);
+		return NULL;
+	}
+	return t;
+}
+
+void
+io_thread_free(struct io_thread* t)
+{
+	io_thread_stop(t);
+	task_queue_free(t->tasks);
+	event_base_free(t->base);
+	free(t);
+}
+
+static void
+io_thread_pin(struct io_thread* t)
+{
+#ifdef __linux__
+	cpu_set_t set;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	CPU_ZERO(&set);
+	CPU_SET((t->index + 1) % cpus, &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set) != 0)
+		paxos_log_error("Failed to pin I/O thread %d", t->index);
+#endif
+}
+
+static void*
+io_thread_main(void* arg)
+{
+	struct io_thread* t = arg;
+	if (paxos_config.io_threads_pin)
+		io_thread_pin(t);
+	event_base_dispatch(t->base);
+	return NULL;
+}
+
+int
+io_thread_start(struct io_thread* t)
+{
+	if (pthread_create(&t->thread, NULL, io_thread_main, t) != 0) {
+		paxos_log_error("Failed to start I/O thread %d", t->index);
+		return 0;
+	}
+	t->started = 1;
+	return 1;
+}
+
+static void
+run_stop(struct task* t, int discard)
+{
+	struct stop_task* s = (struct stop_task*)t;
+	if (!discard)
+		event_base_loopbreak(s->base);
+	free(s);
+}
+
+/*
+	Stops the thread once the tasks already pushed have run.
+*/
+void
+io_thread_stop(struct io_thread* t)
+{
+	struct stop_task* s;
+	if (!t->started)
+		return;
+	s = malloc(sizeof(struct stop_task));
+	s->task.run = run_stop;
+	s->base = t->base;
+	io_thread_push(t, &s->task);
+	pthread_join(t->thread, NULL);
+	t->started = 0;
+}
+
+struct event_base*
+io_thread_get_base(struct io_thread* t)
+{
+	return t->base;
+}
+
+void
+io_thread_push(struct io_thread* t, struct task* task)
+{
+	task_queue_push(t->tasks, task);
+}
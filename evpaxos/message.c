@@ -29,24 +29,176 @@
 #include "paxos.h"
 #include "message.h"
 #include "paxos_types_pack.h"
+#include "paxos_types_binary.h"
+#include <stdlib.h>
 #include <string.h>
+#include <arpa/inet.h>
 
+/*
+	Every message is sent as a frame made of a 32 bit length, a codec byte
+	and the encoded message. The length covers the codec byte and the
+	message. Hello frames carry the highest codec known by the sender.
+	Messages of logs other than 0 set the high bit of the codec byte, which
+	is then followed by the 32 bit log id.
+*/
+#define FRAME_LENGTH_SIZE sizeof(uint32_t)
+#define FRAME_HEADER_SIZE (FRAME_LENGTH_SIZE + 1)
+#define FRAME_LOG_SIZE sizeof(uint32_t)
+#define FRAME_LOG_FLAG 0x80
 
-static int
-bufferevent_pack_data(void* data, const char* buf, size_t len)
+/*
+	Frames up to this size are copied into the output buffer, where they
+	pack into the same chain and are written with a single iovec, larger
+	frames are referenced.
+*/
+#define FRAME_COPY_SIZE 512
+
+struct paxos_decoder
 {
-	struct bufferevent* bev = (struct bufferevent*)data;
-	bufferevent_write(bev, buf, len);
-	return 0;
+	msgpack_zone* zone;    /* Reused for every message of a connection */
+	paxos_codec remote;    /* Highest codec known by the remote end, read
+	                          by the thread encoding for this connection */
+	size_t frame_size;     /* Size of the frame last decoded */
+	int borrowed;          /* Values of the last message point into its frame */
+};
+
+struct paxos_frame
+{
+	int refs;            /* Output buffers still referencing the frame,
+	                        updated atomically as frames may be handed
+	                        over to I/O threads */
+	size_t size;
+	char* data;
+};
+
+static void paxos_frame_cleanup(const void* data, size_t len, void* arg);
+
+
+static size_t
+frame_header_size(uint32_t log)
+{
+	return FRAME_HEADER_SIZE + (log != 0 ? FRAME_LOG_SIZE : 0);
+}
+
+static char*
+frame_header(char* data, size_t size, paxos_codec codec, uint32_t log)
+{
+	uint32_t len = htonl(size - FRAME_LENGTH_SIZE);
+	memcpy(data, &len, FRAME_LENGTH_SIZE);
+	data[FRAME_LENGTH_SIZE] = codec;
+	if (log != 0) {
+		data[FRAME_LENGTH_SIZE] |= FRAME_LOG_FLAG;
+		log = htonl(log);
+		memcpy(data + FRAME_HEADER_SIZE, &log, FRAME_LOG_SIZE);
+	}
+	return data;
+}
+
+static char*
+encode_msgpack(paxos_message* msg, size_t* size)
+{
+	char header[FRAME_HEADER_SIZE + FRAME_LOG_SIZE];
+	msgpack_packer packer;
+	msgpack_sbuffer buffer;
+	msgpack_sbuffer_init(&buffer);
+	msgpack_packer_init(&packer, &buffer, msgpack_sbuffer_write);
+	msgpack_sbuffer_write(&buffer, header, frame_header_size(msg->log));
+	msgpack_pack_paxos_message(&packer, msg);
+	*size = buffer.size;
+	return frame_header(msgpack_sbuffer_release(&buffer), *size,
+		PAXOS_CODEC_MSGPACK, msg->log);
+}
+
+static char*
+encode_binary(paxos_message* msg, size_t* size)
+{
+	char* data;
+	size_t header_size = frame_header_size(msg->log);
+	*size = header_size + paxos_binary_size(msg);
+	data = malloc(*size);
+	paxos_binary_encode(msg, data + header_size);
+	return frame_header(data, *size, PAXOS_CODEC_BINARY, msg->log);
+}
+
+/*
+	Returns the highest codec this node speaks.
+*/
+paxos_codec
+paxos_local_codec(void)
+{
+	return paxos_config.binary_codec ? PAXOS_CODEC_BINARY : PAXOS_CODEC_MSGPACK;
+}
+
+/*
+	Encodes the given message with the given codec. Messages that have no
+	binary encoding fall back to msgpack.
+*/
+struct paxos_frame*
+paxos_frame_new(paxos_message* msg, paxos_codec codec)
+{
+	struct paxos_frame* f = malloc(sizeof(struct paxos_frame));
+	if (codec == PAXOS_CODEC_BINARY && paxos_binary_size(msg) > 0)
+		f->data = encode_binary(msg, &f->size);
+	else
+		f->data = encode_msgpack(msg, &f->size);
+	f->refs = 1;
+	return f;
+}
+
+struct paxos_frame*
+paxos_frame_retain(struct paxos_frame* f)
+{
+	__atomic_add_fetch(&f->refs, 1, __ATOMIC_RELAXED);
+	return f;
+}
+
+void
+paxos_frame_release(struct paxos_frame* f)
+{
+	if (__atomic_sub_fetch(&f->refs, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+	free(f->data);
+	free(f);
+}
+
+/*
+	Appends the frame to the output of the given bufferevent, large frames
+	are not copied and are released once libevent is done writing them.
+*/
+void
+send_paxos_frame(struct bufferevent* bev, struct paxos_frame* f)
+{
+	if (f->size <= FRAME_COPY_SIZE) {
+		bufferevent_write(bev, f->data, f->size);
+		return;
+	}
+	paxos_frame_retain(f);
+	if (evbuffer_add_reference(bufferevent_get_output(bev), f->data, f->size,
+		paxos_frame_cleanup, f) != 0)
+		paxos_frame_release(f);
+}
+
+static void
+paxos_frame_cleanup(const void* data, size_t len, void* arg)
+{
+	paxos_frame_release(arg);
+}
+
+void
+send_paxos_hello(struct bufferevent* bev)
+{
+	char data[FRAME_HEADER_SIZE + 1];
+	frame_header(data, sizeof(data), PAXOS_CODEC_HELLO, 0);
+	data[FRAME_HEADER_SIZE] = paxos_local_codec();
+	bufferevent_write(bev, data, sizeof(data));
 }
 
 void
 send_paxos_message(struct bufferevent* bev, paxos_message* msg)
 {
-	msgpack_packer* packer;
-	packer = msgpack_packer_new(bev, bufferevent_pack_data);
-	msgpack_pack_paxos_message(packer, msg);
-	msgpack_packer_free(packer);
+	struct paxos_frame* f = paxos_frame_new(msg, PAXOS_CODEC_MSGPACK);
+	send_paxos_frame(bev, f);
+	paxos_frame_release(f);
 }
 
 void
@@ -120,34 +272,168 @@ send_paxos_trim(struct bufferevent* bev, paxos_trim* t)
 }
 
 void
-paxos_submit(struct bufferevent* bev, char* data, int size)
+paxos_submit_log(struct bufferevent* bev, unsigned log, char* data, int size)
 {
 	paxos_message msg = {
 		.type = PAXOS_CLIENT_VALUE,
+		.log = log,
 		.u.client_value.value.paxos_value_len = size,
 		.u.client_value.value.paxos_value_val = data };
 	send_paxos_message(bev, &msg);
 }
 
-int
-recv_paxos_message(struct evbuffer* in, paxos_message* out)
+void
+paxos_submit(struct bufferevent* bev, char* data, int size)
+{
+	paxos_submit_log(bev, 0, data, size);
+}
+
+struct paxos_decoder*
+paxos_decoder_new(void)
+{
+	struct paxos_decoder* d = malloc(sizeof(struct paxos_decoder));
+	d->zone = msgpack_zone_new(MSGPACK_ZONE_CHUNK_SIZE);
+	paxos_decoder_reset(d);
+	return d;
+}
+
+void
+paxos_decoder_free(struct paxos_decoder* d)
+{
+	msgpack_zone_free(d->zone);
+	free(d);
+}
+
+/*
+	Forgets what was negotiated with the remote end, to be called when the
+	underlying connection is replaced.
+*/
+void
+paxos_decoder_reset(struct paxos_decoder* d)
+{
+	__atomic_store_n(&d->remote, PAXOS_CODEC_MSGPACK, __ATOMIC_RELAXED);
+	d->frame_size = 0;
+	d->borrowed = 0;
+}
+
+/*
+	Returns the codec to be used when sending to the remote end.
+*/
+paxos_codec
+paxos_decoder_codec(struct paxos_decoder* d)
 {
+	paxos_codec local = paxos_local_codec();
+	paxos_codec remote = __atomic_load_n(&d->remote, __ATOMIC_RELAXED);
+	return remote < local ? remote : local;
+}
+
+static int
+decode_frame(struct paxos_decoder* d, char* data, size_t size,
+	paxos_message* out)
+{
+	size_t offset = 0;
+	msgpack_object obj;
+	uint32_t log = 0;
 	int rv = 0;
-	char* buffer;
-	size_t size, offset = 0;
-	msgpack_unpacked msg;
-	
-	size = evbuffer_get_length(in);
-	if (size == 0) 
-		return rv;
-	
-	msgpack_unpacked_init(&msg);
-	buffer = (char*)evbuffer_pullup(in, size);	
-	if (msgpack_unpack_next(&msg, buffer, size, &offset)) {
-		msgpack_unpack_paxos_message(&msg.data, out);
-		evbuffer_drain(in, offset);
-		rv = 1;
+	char codec = data[0] & ~FRAME_LOG_FLAG;
+	if (data[0] & FRAME_LOG_FLAG) {
+		if (size < 1 + FRAME_LOG_SIZE) {
+			paxos_log_error("Dropped malformed frame of %zu bytes", size);
+			return 0;
+		}
+		memcpy(&log, data + 1, FRAME_LOG_SIZE);
+		log = ntohl(log);
+		data += FRAME_LOG_SIZE;
+		size -= FRAME_LOG_SIZE;
+	}
+	switch (codec) {
+	case PAXOS_CODEC_HELLO:
+		if (size == 2)
+			__atomic_store_n(&d->remote, data[1], __ATOMIC_RELAXED);
+		break;
+	case PAXOS_CODEC_MSGPACK:
+		if (msgpack_unpack(data + 1, size - 1, &offset, d->zone, &obj)
+			== MSGPACK_UNPACK_SUCCESS) {
+			msgpack_unpack_paxos_message(&obj, out);
+			rv = 1;
+		}
+		msgpack_zone_clear(d->zone);
+		break;
+	case PAXOS_CODEC_BINARY:
+		rv = d->borrowed = paxos_binary_decode(data + 1, size - 1, out);
+		break;
 	}
-	msgpack_unpacked_destroy(&msg);
+	if (rv != 0)
+		out->log = log;
+	else if (codec != PAXOS_CODEC_HELLO)
+		paxos_log_error("Dropped malformed frame of %zu bytes", size);
 	return rv;
 }
+
+/*
+	Decodes the next complete frame found in the given buffer, only the
+	frame being decoded is made contiguous. Frames that cannot be decoded
+	are logged and skipped. The frame stays in the buffer until released
+	with paxos_decoder_release().
+	Returns 1 if a message was decoded, 0 if no complete frame is available,
+	-1 if the next frame is longer than max-frame-size, in which case the
+	connection is to be closed.
+*/
+int
+recv_paxos_message(struct paxos_decoder* d, struct evbuffer* in,
+	paxos_message* out)
+{
+	char* frame;
+	uint32_t size;
+
+	while (evbuffer_get_length(in) >= FRAME_HEADER_SIZE) {
+		evbuffer_copyout(in, &size, FRAME_LENGTH_SIZE);
+		size = ntohl(size);
+		if (size == 0) {
+			evbuffer_drain(in, FRAME_LENGTH_SIZE);
+			continue;
+		}
+		if (size > paxos_config.max_frame_size) {
+			paxos_log_error("Frame of %u bytes exceeds max-frame-size", size);
+			return -1;
+		}
+		if (evbuffer_get_length(in) < FRAME_LENGTH_SIZE + size)
+			return 0;
+		frame = (char*)evbuffer_pullup(in, FRAME_LENGTH_SIZE + size);
+		d->borrowed = 0;
+		d->frame_size = FRAME_LENGTH_SIZE + size;
+		if (decode_frame(d, frame + FRAME_LENGTH_SIZE, size, out))
+			return 1;
+		evbuffer_drain(in, d->frame_size);
+	}
+	return 0;
+}
+
+/*
+	Releases a message returned by recv_paxos_message() and drains its frame
+	from the buffer.
+*/
+void
+paxos_decoder_release(struct paxos_decoder* d, struct evbuffer* in,
+	paxos_message* msg)
+{
+	if (!d->borrowed)
+		paxos_message_destroy(msg);
+	evbuffer_drain(in, d->frame_size);
+	d->frame_size = 0;
+}
+
+/*
+	Like paxos_decoder_release(), but the message is kept: values still
+	pointing into the frame are copied before the frame is drained. The
+	message is then released with paxos_message_destroy().
+*/
+void
+paxos_decoder_detach(struct paxos_decoder* d, struct evbuffer* in,
+	paxos_message* msg)
+{
+	if (d->borrowed)
+		paxos_binary_copy_values(msg);
+	evbuffer_drain(in, d->frame_size);
+	d->frame_size = 0;
+}
@@ -0,0 +1,255 @@
+/*
+ * Copyright (c) 2013-2015, University of Lugano
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holders nor the names of it
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+	Fixed layout encoding of the messages on the critical path. Every field
+	is a little-endian 32 bit word, the message type comes first and values
+	are stored as their length followed by their bytes. Timestamps take two
+	words, the low one first, and precede the value. Decoded values point
+	into the given buffer rather than being copied.
+*/
+
+#include "paxos_types_binary.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define WORD sizeof(uint32_t)
+
+
+static uint32_t
+le32(const char* p)
+{
+	const unsigned char* b = (const unsigned char*)p;
+	return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static uint32_t
+load32(char** p)
+{
+	uint32_t v = le32(*p);
+	*p += WORD;
+	return v;
+}
+
+static void
+store32(char** p, uint32_t v)
+{
+	unsigned char* b = (unsigned char*)*p;
+	b[0] = v;
+	b[1] = v >> 8;
+	b[2] = v >> 16;
+	b[3] = v >> 24;
+	*p += WORD;
+}
+
+static uint64_t
+load64(char** p)
+{
+	uint64_t low = load32(p);
+	return low | ((uint64_t)load32(p) << 32);
+}
+
+static void
+store64(char** p, uint64_t v)
+{
+	store32(p, (uint32_t)v);
+	store32(p, (uint32_t)(v >> 32));
+}
+
+static void
+load_value(char** p, paxos_value* v)
+{
+	v->paxos_value_len = load32(p);
+	v->paxos_value_val = v->paxos_value_len > 0 ? *p : NULL;
+	*p += v->paxos_value_len;
+}
+
+static void
+store_value(char** p, paxos_value* v)
+{
+	store32(p, v->paxos_value_len);
+	if (v->paxos_value_len > 0)
+		memcpy(*p, v->paxos_value_val, v->paxos_value_len);
+	*p += v->paxos_value_len;
+}
+
+static void
+copy_value(paxos_value* v)
+{
+	char* value = NULL;
+	if (v->paxos_value_len > 0) {
+		value = malloc(v->paxos_value_len);
+		memcpy(value, v->paxos_value_val, v->paxos_value_len);
+	}
+	v->paxos_value_val = value;
+}
+
+/*
+	Returns the size of the encoded message, or 0 if the message type has
+	no binary encoding.
+*/
+size_t
+paxos_binary_size(paxos_message* m)
+{
+	switch (m->type) {
+	case PAXOS_PREPARE:
+		return 3*WORD;
+	case PAXOS_PROMISE:
+		return 6*WORD + m->u.promise.value.paxos_value_len;
+	case PAXOS_ACCEPT:
+		return 6*WORD + m->u.accept.value.paxos_value_len;
+	case PAXOS_ACCEPTED:
+		return 8*WORD + m->u.accepted.value.paxos_value_len;
+	case PAXOS_PREEMPTED:
+		return 4*WORD;
+	default:
+		return 0;
+	}
+}
+
+void
+paxos_binary_encode(paxos_message* m, char* p)
+{
+	store32(&p, m->type);
+	switch (m->type) {
+	case PAXOS_PREPARE:
+		store32(&p, m->u.prepare.iid);
+		store32(&p, m->u.prepare.ballot);
+		break;
+	case PAXOS_PROMISE:
+		store32(&p, m->u.promise.aid);
+		store32(&p, m->u.promise.iid);
+		store32(&p, m->u.promise.ballot);
+		store32(&p, m->u.promise.value_ballot);
+		store_value(&p, &m->u.promise.value);
+		break;
+	case PAXOS_ACCEPT:
+		store32(&p, m->u.accept.iid);
+		store32(&p, m->u.accept.ballot);
+		store64(&p, m->u.accept.timestamp);
+		store_value(&p, &m->u.accept.value);
+		break;
+	case PAXOS_ACCEPTED:
+		store32(&p, m->u.accepted.aid);
+		store32(&p, m->u.accepted.iid);
+		store32(&p, m->u.accepted.ballot);
+		store32(&p, m->u.accepted.value_ballot);
+		store64(&p, m->u.accepted.timestamp);
+		store_value(&p, &m->u.accepted.value);
+		break;
+	case PAXOS_PREEMPTED:
+		store32(&p, m->u.preempted.aid);
+		store32(&p, m->u.preempted.iid);
+		store32(&p, m->u.preempted.ballot);
+		break;
+	default: break;
+	}
+}
+
+/*
+	Decodes a message of the given size.
+	Returns 1 on success, 0 if the buffer does not hold a valid message.
+*/
+int
+paxos_binary_decode(char* p, size_t size, paxos_message* out)
+{
+	uint32_t len = 0;
+	size_t header, len_offset = 0;
+	if (size < WORD)
+		return 0;
+	out->type = load32(&p);
+	switch (out->type) {
+	case PAXOS_PREPARE: header = 3*WORD; break;
+	case PAXOS_PROMISE: header = 6*WORD; len_offset = 4*WORD; break;
+	case PAXOS_ACCEPT: header = 6*WORD; len_offset = 4*WORD; break;
+	case PAXOS_ACCEPTED: header = 8*WORD; len_offset = 6*WORD; break;
+	case PAXOS_PREEMPTED: header = 4*WORD; break;
+	default: return 0;
+	}
+	if (size < header)
+		return 0;
+	if (len_offset > 0)
+		len = le32(p + len_offset);
+	if (size - header != len)
+		return 0;
+	switch (out->type) {
+	case PAXOS_PREPARE:
+		out->u.prepare.iid = load32(&p);
+		out->u.prepare.ballot = load32(&p);
+		break;
+	case PAXOS_PROMISE:
+		out->u.promise.aid = load32(&p);
+		out->u.promise.iid = load32(&p);
+		out->u.promise.ballot = load32(&p);
+		out->u.promise.value_ballot = load32(&p);
+		load_value(&p, &out->u.promise.value);
+		break;
+	case PAXOS_ACCEPT:
+		out->u.accept.iid = load32(&p);
+		out->u.accept.ballot = load32(&p);
+		out->u.accept.timestamp = load64(&p);
+		load_value(&p, &out->u.accept.value);
+		break;
+	case PAXOS_ACCEPTED:
+		out->u.accepted.aid = load32(&p);
+		out->u.accepted.iid = load32(&p);
+		out->u.accepted.ballot = load32(&p);
+		out->u.accepted.value_ballot = load32(&p);
+		out->u.accepted.timestamp = load64(&p);
+		load_value(&p, &out->u.accepted.value);
+		break;
+	case PAXOS_PREEMPTED:
+		out->u.preempted.aid = load32(&p);
+		out->u.preempted.iid = load32(&p);
+		out->u.preempted.ballot = load32(&p);
+		break;
+	default: break;
+	}
+	return 1;
+}
+
+/*
+	Copies the values of a decoded message out of the buffer it was decoded
+	from, so that the message can outlive the buffer.
+*/
+void
+paxos_binary_copy_values(paxos_message* m)
+{
+	switch (m->type) {
+	case PAXOS_PROMISE:
+		copy_value(&m->u.promise.value);
+		break;
+	case PAXOS_ACCEPT:
+		copy_value(&m->u.accept.value);
+		break;
+	case PAXOS_ACCEPTED:
+		copy_value(&m->u.accepted.value);
+		break;
+	default: break;
+	}
+}
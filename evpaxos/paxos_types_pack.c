@@ -48,6 +48,12 @@ static void msgpack_unpack_uint32_at(msgpack_object* o, uint32_t* v, int* i)
 	(*i)++;
 }
 
+static void msgpack_unpack_uint64_at(msgpack_object* o, uint64_t* v, int* i)
+{
+	*v = MSGPACK_OBJECT_AT(o,*i).u64;
+	(*i)++;
+}
+
 static void msgpack_unpack_string_at(msgpack_object* o, char** buffer, int* len, int* i)
 {
 	*buffer = NULL;
@@ -75,6 +81,86 @@ static void msgpack_unpack_paxos_value_at(msgpack_object* o, paxos_value* v, int
 	msgpack_unpack_string_at(o, &v->paxos_value_val, &v->paxos_value_len, i);
 }
 
+static void msgpack_pack_paxos_accept_entry(msgpack_packer* p, paxos_accept_entry* v)
+{
+	msgpack_pack_array(p, 4);
+	msgpack_pack_uint32(p, v->iid);
+	msgpack_pack_uint32(p, v->ballot);
+	msgpack_pack_paxos_value(p, &v->value);
+	msgpack_pack_uint64(p, v->timestamp);
+}
+
+static void msgpack_unpack_paxos_accept_entry(msgpack_object* o, paxos_accept_entry* v)
+{
+	int i = 0;
+	msgpack_unpack_uint32_at(o, &v->iid, &i);
+	msgpack_unpack_uint32_at(o, &v->ballot, &i);
+	msgpack_unpack_paxos_value_at(o, &v->value, &i);
+	msgpack_unpack_uint64_at(o, &v->timestamp, &i);
+}
+
+static void msgpack_pack_paxos_accept_entry_array(msgpack_packer* p, paxos_accept_entry* v, int len)
+{
+	int k;
+	msgpack_pack_array(p, len);
+	for (k = 0; k < len; k++)
+		msgpack_pack_paxos_accept_entry(p, &v[k]);
+}
+
+static void msgpack_unpack_paxos_accept_entry_array_at(msgpack_object* o, paxos_accept_entry** v, int* len, int* i)
+{
+	int k;
+	msgpack_object* a = &o->via.array.ptr[*i];
+	*len = a->via.array.size;
+	*v = NULL;
+	if (*len > 0)
+		*v = malloc(*len * sizeof(paxos_accept_entry));
+	for (k = 0; k < *len; k++)
+		msgpack_unpack_paxos_accept_entry(&a->via.array.ptr[k], &(*v)[k]);
+	(*i)++;
+}
+
+static void msgpack_pack_paxos_accepted_entry(msgpack_packer* p, paxos_accepted_entry* v)
+{
+	msgpack_pack_array(p, 5);
+	msgpack_pack_uint32(p, v->iid);
+	msgpack_pack_uint32(p, v->ballot);
+	msgpack_pack_uint32(p, v->value_ballot);
+	msgpack_pack_paxos_value(p, &v->value);
+	msgpack_pack_uint64(p, v->timestamp);
+}
+
+static void msgpack_unpack_paxos_accepted_entry(msgpack_object* o, paxos_accepted_entry* v)
+{
+	int i = 0;
+	msgpack_unpack_uint32_at(o, &v->iid, &i);
+	msgpack_unpack_uint32_at(o, &v->ballot, &i);
+	msgpack_unpack_uint32_at(o, &v->value_ballot, &i);
+	msgpack_unpack_paxos_value_at(o, &v->value, &i);
+	msgpack_unpack_uint64_at(o, &v->timestamp, &i);
+}
+
+static void msgpack_pack_paxos_accepted_entry_array(msgpack_packer* p, paxos_accepted_entry* v, int len)
+{
+	int k;
+	msgpack_pack_array(p, len);
+	for (k = 0; k < len; k++)
+		msgpack_pack_paxos_accepted_entry(p, &v[k]);
+}
+
+static void msgpack_unpack_paxos_accepted_entry_array_at(msgpack_object* o, paxos_accepted_entry** v, int* len, int* i)
+{
+	int k;
+	msgpack_object* a = &o->via.array.ptr[*i];
+	*len = a->via.array.size;
+	*v = NULL;
+	if (*len > 0)
+		*v = malloc(*len * sizeof(paxos_accepted_entry));
+	for (k = 0; k < *len; k++)
+		msgpack_unpack_paxos_accepted_entry(&a->via.array.ptr[k], &(*v)[k]);
+	(*i)++;
+}
+
 void msgpack_pack_paxos_prepare(msgpack_packer* p, paxos_prepare* v)
 {
 	msgpack_pack_array(p, 3);
@@ -113,11 +199,12 @@ void msgpack_unpack_paxos_promise(msgpack_object* o, paxos_promise* v)
 
 void msgpack_pack_paxos_accept(msgpack_packer* p, paxos_accept* v)
 {
-	msgpack_pack_array(p, 4);
+	msgpack_pack_array(p, 5);
 	msgpack_pack_int32(p, PAXOS_ACCEPT);
 	msgpack_pack_uint32(p, v->iid);
 	msgpack_pack_uint32(p, v->ballot);
 	msgpack_pack_paxos_value(p, &v->value);
+	msgpack_pack_uint64(p, v->timestamp);
 }
 
 void msgpack_unpack_paxos_accept(msgpack_object* o, paxos_accept* v)
@@ -126,17 +213,19 @@ void msgpack_unpack_paxos_accept(msgpack_object* o, paxos_accept* v)
 	msgpack_unpack_uint32_at(o, &v->iid, &i);
 	msgpack_unpack_uint32_at(o, &v->ballot, &i);
 	msgpack_unpack_paxos_value_at(o, &v->value, &i);
+	msgpack_unpack_uint64_at(o, &v->timestamp, &i);
 }
 
 void msgpack_pack_paxos_accepted(msgpack_packer* p, paxos_accepted* v)
 {
-	msgpack_pack_array(p, 6);
+	msgpack_pack_array(p, 7);
 	msgpack_pack_int32(p, PAXOS_ACCEPTED);
 	msgpack_pack_uint32(p, v->aid);
 	msgpack_pack_uint32(p, v->iid);
 	msgpack_pack_uint32(p, v->ballot);
 	msgpack_pack_uint32(p, v->value_ballot);
 	msgpack_pack_paxos_value(p, &v->value);
+	msgpack_pack_uint64(p, v->timestamp);
 }
 
 void msgpack_unpack_paxos_accepted(msgpack_object* o, paxos_accepted* v)
@@ -147,6 +236,7 @@ void msgpack_unpack_paxos_accepted(msgpack_object* o, paxos_accepted* v)
 	msgpack_unpack_uint32_at(o, &v->ballot, &i);
 	msgpack_unpack_uint32_at(o, &v->value_ballot, &i);
 	msgpack_unpack_paxos_value_at(o, &v->value, &i);
+	msgpack_unpack_uint64_at(o, &v->timestamp, &i);
 }
 
 void msgpack_pack_paxos_preempted(msgpack_packer* p, paxos_preempted* v)
@@ -211,15 +301,228 @@ void msgpack_unpack_paxos_acceptor_state(msgpack_object* o, paxos_acceptor_state
 
 void msgpack_pack_paxos_client_value(msgpack_packer* p, paxos_client_value* v)
 {
-	msgpack_pack_array(p, 2);
+	msgpack_pack_array(p, 3);
 	msgpack_pack_int32(p, PAXOS_CLIENT_VALUE);
+	msgpack_pack_uint32(p, v->id);
 	msgpack_pack_paxos_value(p, &v->value);
 }
 
 void msgpack_unpack_paxos_client_value(msgpack_object* o, paxos_client_value* v)
 {
 	int i = 1;
+	msgpack_unpack_uint32_at(o, &v->id, &i);
+	msgpack_unpack_paxos_value_at(o, &v->value, &i);
+}
+
+void msgpack_pack_paxos_snapshot_request(msgpack_packer* p, paxos_snapshot_request* v)
+{
+	msgpack_pack_array(p, 2);
+	msgpack_pack_int32(p, PAXOS_SNAPSHOT_REQUEST);
+	msgpack_pack_uint32(p, v->iid);
+}
+
+void msgpack_unpack_paxos_snapshot_request(msgpack_object* o, paxos_snapshot_request* v)
+{
+	int i = 1;
+	msgpack_unpack_uint32_at(o, &v->iid, &i);
+}
+
+void msgpack_pack_paxos_snapshot_chunk(msgpack_packer* p, paxos_snapshot_chunk* v)
+{
+	msgpack_pack_array(p, 5);
+	msgpack_pack_int32(p, PAXOS_SNAPSHOT_CHUNK);
+	msgpack_pack_uint32(p, v->iid);
+	msgpack_pack_uint32(p, v->offset);
+	msgpack_pack_uint32(p, v->size);
+	msgpack_pack_paxos_value(p, &v->data);
+}
+
+void msgpack_unpack_paxos_snapshot_chunk(msgpack_object* o, paxos_snapshot_chunk* v)
+{
+	int i = 1;
+	msgpack_unpack_uint32_at(o, &v->iid, &i);
+	msgpack_unpack_uint32_at(o, &v->offset, &i);
+	msgpack_unpack_uint32_at(o, &v->size, &i);
+	msgpack_unpack_paxos_value_at(o, &v->data, &i);
+}
+
+void msgpack_pack_paxos_catchup(msgpack_packer* p, paxos_catchup* v)
+{
+	msgpack_pack_array(p, 3);
+	msgpack_pack_int32(p, PAXOS_CATCHUP);
+	msgpack_pack_uint32(p, v->from);
+	msgpack_pack_uint32(p, v->to);
+}
+
+void msgpack_unpack_paxos_catchup(msgpack_object* o, paxos_catchup* v)
+{
+	int i = 1;
+	msgpack_unpack_uint32_at(o, &v->from, &i);
+	msgpack_unpack_uint32_at(o, &v->to, &i);
+}
+
+void msgpack_pack_paxos_chosen(msgpack_packer* p, paxos_chosen* v)
+{
+	msgpack_pack_array(p, 5);
+	msgpack_pack_int32(p, PAXOS_CHOSEN);
+	msgpack_pack_uint32(p, v->iid);
+	msgpack_pack_uint32(p, v->ballot);
+	msgpack_pack_paxos_value(p, &v->value);
+	msgpack_pack_uint64(p, v->timestamp);
+}
+
+void msgpack_unpack_paxos_chosen(msgpack_object* o, paxos_chosen* v)
+{
+	int i = 1;
+	msgpack_unpack_uint32_at(o, &v->iid, &i);
+	msgpack_unpack_uint32_at(o, &v->ballot, &i);
 	msgpack_unpack_paxos_value_at(o, &v->value, &i);
+	msgpack_unpack_uint64_at(o, &v->timestamp, &i);
+}
+
+void msgpack_pack_paxos_replica_state(msgpack_packer* p, paxos_replica_state* v)
+{
+	msgpack_pack_array(p, 3);
+	msgpack_pack_int32(p, PAXOS_REPLICA_STATE);
+	msgpack_pack_uint32(p, v->rid);
+	msgpack_pack_uint32(p, v->checkpoint_iid);
+}
+
+void msgpack_unpack_paxos_replica_state(msgpack_object* o, paxos_replica_state* v)
+{
+	int i = 1;
+	msgpack_unpack_uint32_at(o, &v->rid, &i);
+	msgpack_unpack_uint32_at(o, &v->checkpoint_iid, &i);
+}
+
+void msgpack_pack_paxos_accept_batch(msgpack_packer* p, paxos_accept_batch* v)
+{
+	msgpack_pack_array(p, 2);
+	msgpack_pack_int32(p, PAXOS_ACCEPT_BATCH);
+	msgpack_pack_paxos_accept_entry_array(p, v->entries_val, v->entries_len);
+}
+
+void msgpack_unpack_paxos_accept_batch(msgpack_object* o, paxos_accept_batch* v)
+{
+	int i = 1;
+	msgpack_unpack_paxos_accept_entry_array_at(o, &v->entries_val, &v->entries_len, &i);
+}
+
+void msgpack_pack_paxos_accepted_batch(msgpack_packer* p, paxos_accepted_batch* v)
+{
+	msgpack_pack_array(p, 3);
+	msgpack_pack_int32(p, PAXOS_ACCEPTED_BATCH);
+	msgpack_pack_uint32(p, v->aid);
+	msgpack_pack_paxos_accepted_entry_array(p, v->entries_val, v->entries_len);
+}
+
+void msgpack_unpack_paxos_accepted_batch(msgpack_object* o, paxos_accepted_batch* v)
+{
+	int i = 1;
+	msgpack_unpack_uint32_at(o, &v->aid, &i);
+	msgpack_unpack_paxos_accepted_entry_array_at(o, &v->entries_val, &v->entries_len, &i);
+}
+
+void msgpack_pack_paxos_client_reply(msgpack_packer* p, paxos_client_reply* v)
+{
+	msgpack_pack_array(p, 4);
+	msgpack_pack_int32(p, PAXOS_CLIENT_REPLY);
+	msgpack_pack_uint32(p, v->id);
+	msgpack_pack_uint32(p, v->iid);
+	msgpack_pack_uint32(p, v->leader);
+}
+
+void msgpack_unpack_paxos_client_reply(msgpack_object* o, paxos_client_reply* v)
+{
+	int i = 1;
+	msgpack_unpack_uint32_at(o, &v->id, &i);
+	msgpack_unpack_uint32_at(o, &v->iid, &i);
+	msgpack_unpack_uint32_at(o, &v->leader, &i);
+}
+
+void msgpack_pack_paxos_heartbeat(msgpack_packer* p, paxos_heartbeat* v)
+{
+	msgpack_pack_array(p, 3);
+	msgpack_pack_int32(p, PAXOS_HEARTBEAT);
+	msgpack_pack_uint32(p, v->seq);
+	msgpack_pack_uint32(p, v->ballot);
+}
+
+void msgpack_unpack_paxos_heartbeat(msgpack_object* o, paxos_heartbeat* v)
+{
+	int i = 1;
+	msgpack_unpack_uint32_at(o, &v->seq, &i);
+	msgpack_unpack_uint32_at(o, &v->ballot, &i);
+}
+
+void msgpack_pack_paxos_heartbeat_ack(msgpack_packer* p, paxos_heartbeat_ack* v)
+{
+	msgpack_pack_array(p, 4);
+	msgpack_pack_int32(p, PAXOS_HEARTBEAT_ACK);
+	msgpack_pack_uint32(p, v->aid);
+	msgpack_pack_uint32(p, v->seq);
+	msgpack_pack_uint32(p, v->accepted_iid);
+}
+
+void msgpack_unpack_paxos_heartbeat_ack(msgpack_object* o, paxos_heartbeat_ack* v)
+{
+	int i = 1;
+	msgpack_unpack_uint32_at(o, &v->aid, &i);
+	msgpack_unpack_uint32_at(o, &v->seq, &i);
+	msgpack_unpack_uint32_at(o, &v->accepted_iid, &i);
+}
+
+void msgpack_pack_paxos_prepare_range(msgpack_packer* p, paxos_prepare_range* v)
+{
+	msgpack_pack_array(p, 4);
+	msgpack_pack_int32(p, PAXOS_PREPARE_RANGE);
+	msgpack_pack_uint32(p, v->from);
+	msgpack_pack_uint32(p, v->ballot);
+	msgpack_pack_uint32(p, v->stride);
+}
+
+void msgpack_unpack_paxos_prepare_range(msgpack_object* o, paxos_prepare_range* v)
+{
+	int i = 1;
+	msgpack_unpack_uint32_at(o, &v->from, &i);
+	msgpack_unpack_uint32_at(o, &v->ballot, &i);
+	msgpack_unpack_uint32_at(o, &v->stride, &i);
+}
+
+void msgpack_pack_paxos_promise_range(msgpack_packer* p, paxos_promise_range* v)
+{
+	msgpack_pack_array(p, 6);
+	msgpack_pack_int32(p, PAXOS_PROMISE_RANGE);
+	msgpack_pack_uint32(p, v->aid);
+	msgpack_pack_uint32(p, v->from);
+	msgpack_pack_uint32(p, v->ballot);
+	msgpack_pack_uint32(p, v->prev_ballot);
+	msgpack_pack_uint32(p, v->max_iid);
+}
+
+void msgpack_unpack_paxos_promise_range(msgpack_object* o, paxos_promise_range* v)
+{
+	int i = 1;
+	msgpack_unpack_uint32_at(o, &v->aid, &i);
+	msgpack_unpack_uint32_at(o, &v->from, &i);
+	msgpack_unpack_uint32_at(o, &v->ballot, &i);
+	msgpack_unpack_uint32_at(o, &v->prev_ballot, &i);
+	msgpack_unpack_uint32_at(o, &v->max_iid, &i);
+}
+
+void msgpack_pack_paxos_safe_time(msgpack_packer* p, paxos_safe_time* v)
+{
+	msgpack_pack_array(p, 3);
+	msgpack_pack_int32(p, PAXOS_SAFE_TIME);
+	msgpack_pack_uint32(p, v->iid);
+	msgpack_pack_uint64(p, v->timestamp);
+}
+
+void msgpack_unpack_paxos_safe_time(msgpack_object* o, paxos_safe_time* v)
+{
+	int i = 1;
+	msgpack_unpack_uint32_at(o, &v->iid, &i);
+	msgpack_unpack_uint64_at(o, &v->timestamp, &i);
 }
 
 void msgpack_pack_paxos_message(msgpack_packer* p, paxos_message* v)
@@ -252,6 +555,45 @@ void msgpack_pack_paxos_message(msgpack_packer* p, paxos_message* v)
 	case PAXOS_CLIENT_VALUE:
 		msgpack_pack_paxos_client_value(p, &v->u.client_value);
 		break;
+	case PAXOS_SNAPSHOT_REQUEST:
+		msgpack_pack_paxos_snapshot_request(p, &v->u.snapshot_request);
+		break;
+	case PAXOS_SNAPSHOT_CHUNK:
+		msgpack_pack_paxos_snapshot_chunk(p, &v->u.snapshot_chunk);
+		break;
+	case PAXOS_CATCHUP:
+		msgpack_pack_paxos_catchup(p, &v->u.catchup);
+		break;
+	case PAXOS_CHOSEN:
+		msgpack_pack_paxos_chosen(p, &v->u.chosen);
+		break;
+	case PAXOS_REPLICA_STATE:
+		msgpack_pack_paxos_replica_state(p, &v->u.replica_state);
+		break;
+	case PAXOS_ACCEPT_BATCH:
+		msgpack_pack_paxos_accept_batch(p, &v->u.accept_batch);
+		break;
+	case PAXOS_ACCEPTED_BATCH:
+		msgpack_pack_paxos_accepted_batch(p, &v->u.accepted_batch);
+		break;
+	case PAXOS_CLIENT_REPLY:
+		msgpack_pack_paxos_client_reply(p, &v->u.client_reply);
+		break;
+	case PAXOS_HEARTBEAT:
+		msgpack_pack_paxos_heartbeat(p, &v->u.heartbeat);
+		break;
+	case PAXOS_HEARTBEAT_ACK:
+		msgpack_pack_paxos_heartbeat_ack(p, &v->u.heartbeat_ack);
+		break;
+	case PAXOS_PREPARE_RANGE:
+		msgpack_pack_paxos_prepare_range(p, &v->u.prepare_range);
+		break;
+	case PAXOS_PROMISE_RANGE:
+		msgpack_pack_paxos_promise_range(p, &v->u.promise_range);
+		break;
+	case PAXOS_SAFE_TIME:
+		msgpack_pack_paxos_safe_time(p, &v->u.safe_time);
+		break;
 	}
 }
 
@@ -286,5 +628,44 @@ void msgpack_unpack_paxos_message(msgpack_object* o, paxos_message* v)
 	case PAXOS_CLIENT_VALUE:
 		msgpack_unpack_paxos_client_value(o, &v->u.client_value);
 		break;
+	case PAXOS_SNAPSHOT_REQUEST:
+		msgpack_unpack_paxos_snapshot_request(o, &v->u.snapshot_request);
+		break;
+	case PAXOS_SNAPSHOT_CHUNK:
+		msgpack_unpack_paxos_snapshot_chunk(o, &v->u.snapshot_chunk);
+		break;
+	case PAXOS_CATCHUP:
+		msgpack_unpack_paxos_catchup(o, &v->u.catchup);
+		break;
+	case PAXOS_CHOSEN:
+		msgpack_unpack_paxos_chosen(o, &v->u.chosen);
+		break;
+	case PAXOS_REPLICA_STATE:
+		msgpack_unpack_paxos_replica_state(o, &v->u.replica_state);
+		break;
+	case PAXOS_ACCEPT_BATCH:
+		msgpack_unpack_paxos_accept_batch(o, &v->u.accept_batch);
+		break;
+	case PAXOS_ACCEPTED_BATCH:
+		msgpack_unpack_paxos_accepted_batch(o, &v->u.accepted_batch);
+		break;
+	case PAXOS_CLIENT_REPLY:
+		msgpack_unpack_paxos_client_reply(o, &v->u.client_reply);
+		break;
+	case PAXOS_HEARTBEAT:
+		msgpack_unpack_paxos_heartbeat(o, &v->u.heartbeat);
+		break;
+	case PAXOS_HEARTBEAT_ACK:
+		msgpack_unpack_paxos_heartbeat_ack(o, &v->u.heartbeat_ack);
+		break;
+	case PAXOS_PREPARE_RANGE:
+		msgpack_unpack_paxos_prepare_range(o, &v->u.prepare_range);
+		break;
+	case PAXOS_PROMISE_RANGE:
+		msgpack_unpack_paxos_promise_range(o, &v->u.promise_range);
+		break;
+	case PAXOS_SAFE_TIME:
+		msgpack_unpack_paxos_safe_time(o, &v->u.safe_time);
+		break;
 	}
 }
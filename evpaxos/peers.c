@@ -28,6 +28,9 @@
 
 #include "peers.h"
 #include "message.h"
+#include "io_thread.h"
+#include "shm_channel.h"
+#include "khash.h"
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
@@ -43,9 +46,41 @@ struct peer
 	int id;
 	int status;
 	struct bufferevent* bev;
+	struct paxos_decoder* decoder;
 	struct event* reconnect_ev;
+	int corked;            /* Writes held back until the end of the turn */
 	struct sockaddr_in addr;
 	struct peers* peers;
+	struct io_thread* io;  /* Thread owning the socket, NULL if owned by
+	                          the event loop of peers */
+	int closed;            /* Removed from the clients, sends are dropped */
+	int refs;              /* The peer is freed when the last one goes */
+	struct peer* loopback; /* Other end of an in-process connection */
+	struct shm_channel* shm;  /* Owns bev when connected through shared
+	                             memory */
+	struct event* shm_ev;  /* Reports the shared memory connection */
+	peer_iter_cb drained;  /* Called once the output is written, if set */
+	void* drained_arg;
+	struct event* drained_ev;  /* Runs drained, NULL with an I/O thread */
+	int drain_wanted;      /* Set until the owner of bev saw it drained */
+};
+
+/*
+	Messages between the two ends of an in-process connection are copied
+	into a queue, instead of going through a socket, and dispatched by a
+	later turn of the event loop in the order they were sent.
+*/
+struct loopback_message
+{
+	struct peer* peer;     /* Receiving end */
+	paxos_message msg;
+	struct loopback_message* next;
+};
+
+struct broadcast
+{
+	paxos_message* msg;
+	struct paxos_frame* frames[PAXOS_CODEC_BINARY+1];  /* One per codec */
 };
 
 struct subscription
@@ -55,24 +90,88 @@ struct subscription
 	void* arg;
 };
 
+/*
+	Several logs may share the same peers, messages are dispatched to the
+	subscriptions of the log they belong to.
+*/
+struct subscriptions
+{
+	int count;
+	struct subscription subs[32];
+	peer_iter_cb disconnected;  /* Called when a client goes away */
+	void* disconnected_arg;
+};
+
+KHASH_MAP_INIT_INT(log, struct subscriptions*)
+
 struct peers
 {
 	int peers_count, clients_count;
 	struct peer** peers;   /* peers we connected to */
 	struct peer** clients; /* peers we accepted connections from */
-	struct evconnlistener* listener;
+	int listeners_count;
+	struct evconnlistener** listeners;
 	struct event_base* base;
 	struct evpaxos_config* config;
-	int subs_count;
-	struct subscription subs[32];
+	khash_t(log)* logs;        /* Subscriptions of each log */
+	struct event* flush_ev;  /* Uncorks all peers at the end of a loop turn */
+	int flush_pending;
+	int io_count;
+	struct io_thread** io;     /* Threads doing the I/O of peers, if any */
+	struct task_queue* inbox;  /* Tasks handed over by the I/O threads */
+	struct event* start_ev;    /* Starts the I/O threads */
+	struct loopback_message* loopback_head;
+	struct loopback_message* loopback_tail;
+	struct event* loopback_ev;  /* Dispatches the loopback messages */
+	struct shm_listener* shm_listener;
+	peer_iter_cb connected;     /* Called when a peer we connect to is up */
+	void* connected_arg;
+};
+
+/*
+	When I/O threads are configured every socket, outgoing connections as
+	well as accepted ones, belongs to one of them. I/O threads decode the
+	messages they receive and hand them over to the thread running the
+	event loop of peers through its inbox, which in turn hands over the
+	frames to be sent to the queue of the I/O thread owning the socket.
+	The lists of peers and clients are only modified by the event loop.
+*/
+struct peer_task
+{
+	struct task task;
+	struct peer* peer;
+};
+
+struct recv_task
+{
+	struct task task;
+	struct peer* peer;
+	paxos_message msg;
+};
+
+struct send_task
+{
+	struct task task;
+	struct peer* peer;
+	struct paxos_frame* frame;
+};
+
+struct peers_task
+{
+	struct task task;
+	struct peers* peers;
 };
 
 static struct timeval reconnect_timeout = {2,0};
-static struct peer* make_peer(struct peers* p, int id, struct sockaddr_in* in);
+static struct peer* make_peer(struct peers* p, int id, struct sockaddr_in* in,
+	struct io_thread* io);
 static void free_peer(struct peer* p);
 static void free_all_peers(struct peer** p, int count);
 static void connect_peer(struct peer* p);
 static void peers_connect(struct peers* p, int id, struct sockaddr_in* addr);
+static void peers_connect_loopback(struct peers* p, int id,
+	struct sockaddr_in* addr);
+static void add_client(struct peers* peers, struct peer* p);
 static void on_read(struct bufferevent* bev, void* arg);
 static void on_peer_event(struct bufferevent* bev, short ev, void *arg);
 static void on_client_event(struct bufferevent* bev, short events, void *arg);
@@ -80,7 +179,24 @@ static void on_connection_timeout(int fd, short ev, void* arg);
 static void on_listener_error(struct evconnlistener* l, void* arg);
 static void on_accept(struct evconnlistener *l, evutil_socket_t fd,
 	struct sockaddr* addr, int socklen, void *arg);
+static void on_shm_accept(struct shm_channel* c, void* arg);
+static void on_shm_connected(evutil_socket_t fd, short ev, void* arg);
+static int shm_candidate(struct sockaddr_in* addr);
+static void free_peer_bev(struct peer* p);
 static void socket_set_nodelay(int fd);
+static void cork_peer_output(struct peer* p);
+static void on_output(struct evbuffer* b, const struct evbuffer_cb_info* info,
+	void* arg);
+static void on_flush(evutil_socket_t fd, short ev, void* arg);
+static void on_loopback(evutil_socket_t fd, short ev, void* arg);
+static void on_drained(evutil_socket_t fd, short ev, void* arg);
+static void run_connected(struct task* t, int discard);
+static void notify_drained(struct peer* p);
+static void loopback_send(struct peer* p, paxos_message* msg);
+static void peers_init_io(struct peers* p);
+static void on_start(evutil_socket_t fd, short ev, void* arg);
+static struct task* peer_task_new(struct peer* p,
+	void (*run)(struct task*, int));
 
 struct peers*
 peers_new(struct event_base* base, struct evpaxos_config* config)
@@ -88,22 +204,106 @@ peers_new(struct event_base* base, struct evpaxos_config* config)
 	struct peers* p = malloc(sizeof(struct peers));
 	p->peers_count = 0;
 	p->clients_count = 0;
-	p->subs_count = 0;
+	p->logs = kh_init(log);
 	p->peers = NULL;
 	p->clients = NULL;
-	p->listener = NULL;
+	p->listeners_count = 0;
+	p->listeners = NULL;
 	p->base = base;
 	p->config = config;
+	p->flush_ev = event_new(base, -1, 0, on_flush, p);
+	p->flush_pending = 0;
+	p->io_count = 0;
+	p->io = NULL;
+	p->inbox = NULL;
+	p->start_ev = NULL;
+	p->loopback_head = NULL;
+	p->loopback_tail = NULL;
+	p->loopback_ev = event_new(base, -1, 0, on_loopback, p);
+	p->shm_listener = NULL;
+	p->connected = NULL;
+	p->connected_arg = NULL;
+	if (paxos_config.io_threads > 0)
+		peers_init_io(p);
 	return p;
 }
 
+/*
+	Creates the I/O threads, they are started by the first turn of the event
+	loop so that peers can be connected and listeners bound in the meantime.
+*/
+static void
+peers_init_io(struct peers* p)
+{
+	int i;
+	p->io = calloc(paxos_config.io_threads, sizeof(struct io_thread*));
+	for (i = 0; i < paxos_config.io_threads; i++) {
+		p->io[i] = io_thread_new(i);
+		if (p->io[i] == NULL)
+			break;
+		p->io_count++;
+	}
+	p->inbox = task_queue_new(p->base);
+	if (p->io_count < paxos_config.io_threads || p->inbox == NULL) {
+		paxos_log_error("Failed to create I/O threads, doing I/O in the "
+			"event loop");
+		for (i = 0; i < p->io_count; i++)
+			io_thread_free(p->io[i]);
+		if (p->inbox != NULL)
+			task_queue_free(p->inbox);
+		free(p->io);
+		p->io_count = 0;
+		p->io = NULL;
+		p->inbox = NULL;
+		return;
+	}
+	p->start_ev = event_new(p->base, -1, 0, on_start, p);
+	event_active(p->start_ev, EV_TIMEOUT, 1);
+}
+
+static void
+on_start(evutil_socket_t fd, short ev, void* arg)
+{
+	int i;
+	struct peers* p = arg;
+	for (i = 0; i < p->io_count; i++)
+		io_thread_start(p->io[i]);
+	paxos_log_info("Started %d I/O threads", p->io_count);
+}
+
 void
 peers_free(struct peers* p)
 {
+	int i;
+	khiter_t k;
+	struct loopback_message* m;
+	for (i = 0; i < p->io_count; i++)
+		io_thread_stop(p->io[i]);
+	while ((m = p->loopback_head) != NULL) {
+		p->loopback_head = m->next;
+		paxos_message_destroy(&m->msg);
+		free(m);
+	}
+	event_free(p->loopback_ev);
+	if (p->inbox != NULL)
+		task_queue_free(p->inbox);
 	free_all_peers(p->peers, p->peers_count);
 	free_all_peers(p->clients, p->clients_count);
-	if (p->listener != NULL)
-		evconnlistener_free(p->listener);
+	for (i = 0; i < p->listeners_count; i++)
+		evconnlistener_free(p->listeners[i]);
+	free(p->listeners);
+	if (p->shm_listener != NULL)
+		shm_listener_free(p->shm_listener);
+	for (i = 0; i < p->io_count; i++)
+		io_thread_free(p->io[i]);
+	free(p->io);
+	if (p->start_ev != NULL)
+		event_free(p->start_ev);
+	event_free(p->flush_ev);
+	for (k = kh_begin(p->logs); k != kh_end(p->logs); ++k)
+		if (kh_exist(p->logs, k))
+			free(kh_value(p->logs, k));
+	kh_destroy(log, p->logs);
 	free(p);
 }
 
@@ -116,12 +316,17 @@ peers_count(struct peers* p)
 static void
 peers_connect(struct peers* p, int id, struct sockaddr_in* addr)
 {
+	struct io_thread* io = NULL;
+	if (p->io_count > 0 && !shm_candidate(addr))
+		io = p->io[id % p->io_count];
 	p->peers = realloc(p->peers, sizeof(struct peer*) * (p->peers_count+1));
-	p->peers[p->peers_count] = make_peer(p, id, addr);
+	p->peers[p->peers_count] = make_peer(p, id, addr, io);
 
 	struct peer* peer = p->peers[p->peers_count];
 	bufferevent_setcb(peer->bev, on_read, NULL, on_peer_event, peer);
-	peer->reconnect_ev = evtimer_new(p->base, on_connection_timeout, peer);
+	cork_peer_output(peer);
+	peer->reconnect_ev = evtimer_new(bufferevent_get_base(peer->bev),
+		on_connection_timeout, peer);
 	connect_peer(peer);
 
 	p->peers_count++;
@@ -129,14 +334,63 @@ peers_connect(struct peers* p, int id, struct sockaddr_in* addr)
 
 void
 peers_connect_to_acceptors(struct peers* p)
+{
+	peers_connect_to_acceptors_local(p, -1);
+}
+
+/*
+	Connects to all acceptors, but the one with the given id, which runs in
+	this process and listens on these same peers: it is reached through an
+	in-process connection that skips encoding and the kernel altogether.
+*/
+void
+peers_connect_to_acceptors_local(struct peers* p, int local_id)
 {
 	int i;
 	for (i = 0; i < evpaxos_acceptor_count(p->config); i++) {
 		struct sockaddr_in addr = evpaxos_acceptor_address(p->config, i);
-		peers_connect(p, i, &addr);
+		if (i == local_id)
+			peers_connect_loopback(p, i, &addr);
+		else
+			peers_connect(p, i, &addr);
 	}
 }
 
+void
+peers_connect_to_acceptor(struct peers* p, int id)
+{
+	struct sockaddr_in addr = evpaxos_acceptor_address(p->config, id);
+	peers_connect(p, id, &addr);
+}
+
+void
+peers_connect_to_proposer(struct peers* p, int id)
+{
+	struct sockaddr_in addr = evpaxos_proposer_address(p->config, id);
+	peers_connect(p, id, &addr);
+}
+
+/*
+	Creates both ends of an in-process connection: the one we connect from,
+	among the peers, and the one accepted by the local acceptor, among the
+	clients. Both run in the event loop, regardless of I/O threads.
+*/
+static void
+peers_connect_loopback(struct peers* p, int id, struct sockaddr_in* addr)
+{
+	struct peer* local;
+	struct peer* remote;
+	p->peers = realloc(p->peers, sizeof(struct peer*) * (p->peers_count+1));
+	local = make_peer(p, id, addr, NULL);
+	remote = make_peer(p, -1, addr, NULL);
+	local->loopback = remote;
+	remote->loopback = local;
+	local->status = remote->status = BEV_EVENT_CONNECTED;
+	p->peers[p->peers_count++] = local;
+	add_client(p, remote);
+	paxos_log_info("Connected to local acceptor %d", id);
+}
+
 void
 peers_foreach_acceptor(struct peers* p, peer_iter_cb cb, void* arg)
 {
@@ -163,66 +417,265 @@ peers_foreach_client(struct peers* p, peer_iter_cb cb, void* arg)
 		cb(p->clients[i], arg);
 }
 
+static void
+run_send(struct task* t, int discard)
+{
+	struct send_task* s = (struct send_task*)t;
+	if (!discard)
+		send_paxos_frame(s->peer->bev, s->frame);
+	paxos_frame_release(s->frame);
+	free(s);
+}
+
+static void
+peer_send_frame(struct peer* p, struct paxos_frame* f)
+{
+	struct send_task* s;
+	if (p->io == NULL) {
+		send_paxos_frame(p->bev, f);
+		return;
+	}
+	s = malloc(sizeof(struct send_task));
+	s->task.run = run_send;
+	s->peer = p;
+	s->frame = paxos_frame_retain(f);
+	io_thread_push(p->io, &s->task);
+}
+
+static void
+peer_send_broadcast(struct peer* p, void* arg)
+{
+	struct broadcast* b = arg;
+	if (p->closed)
+		return;
+	if (p->loopback != NULL) {
+		loopback_send(p, b->msg);
+		return;
+	}
+	paxos_codec codec = paxos_decoder_codec(p->decoder);
+	if (b->frames[codec] == NULL)
+		b->frames[codec] = paxos_frame_new(b->msg, codec);
+	peer_send_frame(p, b->frames[codec]);
+}
+
+static void
+broadcast_release(struct broadcast* b)
+{
+	int i;
+	for (i = 0; i <= PAXOS_CODEC_BINARY; ++i)
+		if (b->frames[i] != NULL)
+			paxos_frame_release(b->frames[i]);
+}
+
+/*
+	The broadcast functions encode the message once per codec in use and
+	share the encoded frame among the output buffers of all destinations.
+*/
+void
+peers_broadcast_acceptors(struct peers* p, paxos_message* msg)
+{
+	peers_broadcast_n_acceptors(p, msg, p->peers_count);
+}
+
+void
+peers_broadcast_n_acceptors(struct peers* p, paxos_message* msg, int n)
+{
+	struct broadcast b = {msg};
+	peers_for_n_acceptor(p, peer_send_broadcast, &b, n);
+	broadcast_release(&b);
+}
+
+void
+peers_broadcast_clients(struct peers* p, paxos_message* msg)
+{
+	struct broadcast b = {msg};
+	peers_foreach_client(p, peer_send_broadcast, &b);
+	broadcast_release(&b);
+}
+
 struct peer*
 peers_get_acceptor(struct peers* p, int id)
 {
 	int i;
-	for (i = 0; p->peers_count; ++i)
+	for (i = 0; i < p->peers_count; ++i)
 		if (p->peers[i]->id == id)
 			return p->peers[i];
 	return NULL;
 }
 
-struct bufferevent*
-peer_get_buffer(struct peer* p)
-{
-	return p->bev;
-}
-
 int
 peer_get_id(struct peer* p)
 {
 	return p->id;
 }
 
+void
+peer_send_message(struct peer* p, paxos_message* msg)
+{
+	struct broadcast b = {msg};
+	peer_send_broadcast(p, &b);
+	broadcast_release(&b);
+}
+
+/*
+	Keeps the peer allocated after it disconnects, for those replying to it
+	later on. Messages sent to a disconnected peer are dropped.
+*/
+void
+peer_retain(struct peer* p)
+{
+	__atomic_add_fetch(&p->refs, 1, __ATOMIC_RELAXED);
+}
+
+void
+peer_release(struct peer* p)
+{
+	if (__atomic_sub_fetch(&p->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		free(p);
+}
+
 int peer_connected(struct peer* p)
 {
-	return p->status == BEV_EVENT_CONNECTED;
+	return __atomic_load_n(&p->status, __ATOMIC_RELAXED) == BEV_EVENT_CONNECTED;
+}
+
+static void
+run_check_drained(struct task* t, int discard)
+{
+	struct peer_task* pt = (struct peer_task*)t;
+	if (!discard &&
+		evbuffer_get_length(bufferevent_get_output(pt->peer->bev)) == 0)
+		notify_drained(pt->peer);
+	peer_release(pt->peer);
+	free(pt);
+}
+
+/*
+	Calls cb once everything sent to the peer so far left its output buffer,
+	or was dispatched for in-process connections, from a later turn of the
+	event loop. A NULL cb cancels the call. The call never comes once the
+	peer disconnected, those waiting for it should give up after a while.
+*/
+void
+peer_on_drained(struct peer* p, peer_iter_cb cb, void* arg)
+{
+	if (p->closed)
+		return;
+	p->drained = cb;
+	p->drained_arg = arg;
+	if (cb == NULL)
+		return;
+	__atomic_store_n(&p->drain_wanted, 1, __ATOMIC_RELEASE);
+	if (p->loopback != NULL) {
+		notify_drained(p);
+	} else if (p->io == NULL) {
+		if (evbuffer_get_length(bufferevent_get_output(p->bev)) == 0)
+			notify_drained(p);
+	} else {
+		peer_retain(p);
+		io_thread_push(p->io, peer_task_new(p, run_check_drained));
+	}
 }
 
 int
 peers_listen(struct peers* p, int port)
 {
+	int i, count = 1;
 	struct sockaddr_in addr;
+	struct event_base* base;
+	struct evconnlistener* l;
 	unsigned flags = LEV_OPT_CLOSE_ON_EXEC
 		| LEV_OPT_CLOSE_ON_FREE
 		| LEV_OPT_REUSEABLE;
 
+	/* with I/O threads, each one accepts on its own socket bound to the
+	   same port if the system allows it, otherwise the first one accepts
+	   all the connections */
+#ifdef LEV_OPT_REUSEABLE_PORT
+	if (p->io_count > 1) {
+		count = p->io_count;
+		flags |= LEV_OPT_REUSEABLE_PORT;
+	}
+#endif
+
 	/* listen on the given port at address 0.0.0.0 */
 	memset(&addr, 0, sizeof(struct sockaddr_in));
 	addr.sin_family = AF_INET;
 	addr.sin_addr.s_addr = htonl(0);
 	addr.sin_port = htons(port);
 
-	p->listener = evconnlistener_new_bind(p->base, on_accept, p, flags, -1,
-		(struct sockaddr*)&addr, sizeof(addr));
-	if (p->listener == NULL) {
-		paxos_log_error("Failed to bind on port %d", port);
-		return 0;
+	p->listeners = realloc(p->listeners,
+		sizeof(struct evconnlistener*) * (p->listeners_count + count));
+	for (i = 0; i < count; i++) {
+		base = p->io_count > 0 ? io_thread_get_base(p->io[i]) : p->base;
+		l = evconnlistener_new_bind(base, on_accept, p, flags, -1,
+			(struct sockaddr*)&addr, sizeof(addr));
+		if (l == NULL) {
+			paxos_log_error("Failed to bind on port %d", port);
+			return 0;
+		}
+		evconnlistener_set_error_cb(l, on_listener_error);
+		p->listeners[p->listeners_count++] = l;
 	}
-	evconnlistener_set_error_cb(p->listener, on_listener_error);
 	paxos_log_info("Listening on port %d", port);
+	if (paxos_config.shm_transport && p->shm_listener == NULL)
+		p->shm_listener = shm_listener_new(p->base, port, on_shm_accept, p);
 	return 1;
 }
 
+static struct subscriptions*
+log_subscriptions(struct peers* p, uint32_t log)
+{
+	int rv;
+	khiter_t k = kh_put_log(p->logs, log, &rv);
+	if (rv > 0)
+		kh_value(p->logs, k) = calloc(1, sizeof(struct subscriptions));
+	return kh_value(p->logs, k);
+}
+
 void
 peers_subscribe(struct peers* p, paxos_message_type type, peer_cb cb, void* arg)
 {
-	struct subscription* sub = &p->subs[p->subs_count];
-	sub->type = type;
-	sub->callback = cb;
-	sub->arg = arg;
-	p->subs_count++;
+	peers_subscribe_log(p, 0, type, cb, arg);
+}
+
+void
+peers_subscribe_log(struct peers* p, uint32_t log, paxos_message_type type,
+	peer_cb cb, void* arg)
+{
+	struct subscriptions* s = log_subscriptions(p, log);
+	s->subs[s->count].type = type;
+	s->subs[s->count].callback = cb;
+	s->subs[s->count].arg = arg;
+	s->count++;
+}
+
+/*
+	Calls cb from the event loop of peers whenever one of the peers that
+	connected to us goes away, for the log to forget about it. Dropped
+	along with the other subscriptions of the log.
+*/
+void
+peers_on_disconnect_log(struct peers* p, uint32_t log, peer_iter_cb cb,
+	void* arg)
+{
+	struct subscriptions* s = log_subscriptions(p, log);
+	s->disconnected = cb;
+	s->disconnected_arg = arg;
+}
+
+/*
+	Drops all the subscriptions of the given log, its messages are ignored
+	from now on.
+*/
+void
+peers_unsubscribe_log(struct peers* p, uint32_t log)
+{
+	khiter_t k = kh_get_log(p->logs, log);
+	if (k == kh_end(p->logs))
+		return;
+	free(kh_value(p->logs, k));
+	kh_del_log(p->logs, k);
 }
 
 struct event_base*
@@ -235,22 +688,67 @@ static void
 dispatch_message(struct peer* p, paxos_message* msg)
 {
 	int i;
-	for (i = 0; i < p->peers->subs_count; ++i) {
-		struct subscription* sub = &p->peers->subs[i];
+	struct subscriptions* s;
+	khiter_t k = kh_get_log(p->peers->logs, msg->log);
+	if (k == kh_end(p->peers->logs)) {
+		paxos_log_debug("Dropped message for unknown log %u", msg->log);
+		return;
+	}
+	s = kh_value(p->peers->logs, k);
+	for (i = 0; i < s->count; ++i) {
+		struct subscription* sub = &s->subs[i];
 		if (sub->type == msg->type)
 			sub->callback(p, msg, sub->arg);
 	}
 }
 
+static void
+run_recv(struct task* t, int discard)
+{
+	struct recv_task* r = (struct recv_task*)t;
+	if (!discard)
+		dispatch_message(r->peer, &r->msg);
+	paxos_message_destroy(&r->msg);
+	free(r);
+}
+
+/*
+	Handles the connection as if it failed, through its event callback,
+	which reconnects to acceptors and forgets clients.
+*/
+static void
+close_on_error(struct bufferevent* bev)
+{
+	void* arg;
+	bufferevent_event_cb event;
+	bufferevent_getcb(bev, NULL, NULL, &event, &arg);
+	event(bev, BEV_EVENT_ERROR, arg);
+}
+
 static void
 on_read(struct bufferevent* bev, void* arg)
 {
+	int rv;
+	struct recv_task* r;
 	paxos_message msg;
 	struct peer* p = (struct peer*)arg;
 	struct evbuffer* in = bufferevent_get_input(bev);
-	while (recv_paxos_message(in, &msg)) {
-		dispatch_message(p, &msg);
-		paxos_message_destroy(&msg);
+	while ((rv = recv_paxos_message(p->decoder, in, &msg)) != 0) {
+		if (rv < 0) {
+			close_on_error(bev);
+			return;
+		}
+		if (p->io == NULL) {
+			dispatch_message(p, &msg);
+			paxos_decoder_release(p->decoder, in, &msg);
+			continue;
+		}
+		paxos_decoder_detach(p->decoder, in, &msg);
+		r = malloc(sizeof(struct recv_task));
+		r->task.run = run_recv;
+		r->peer = p;
+		r->msg = msg;
+		task_queue_push(p->peers->inbox, &r->task);
 	}
 }
 
@@ -262,38 +760,207 @@ on_peer_event(struct bufferevent* bev, short ev, void *arg)
 	if (ev & BEV_EVENT_CONNECTED) {
 		paxos_log_info("Connected to %s:%d",
 			inet_ntoa(p->addr.sin_addr), ntohs(p->addr.sin_port));
-		p->status = ev;
+		__atomic_store_n(&p->status, ev, __ATOMIC_RELAXED);
+		if (p->io != NULL)
+			task_queue_push(p->peers->inbox, peer_task_new(p, run_connected));
+		else if (p->peers->connected != NULL)
+			p->peers->connected(p, p->peers->connected_arg);
 	} else if (ev & BEV_EVENT_ERROR || ev & BEV_EVENT_EOF) {
 		struct event_base* base;
 		int err = EVUTIL_SOCKET_ERROR();
 		paxos_log_error("%s (%s:%d)", evutil_socket_error_to_string(err),
 			inet_ntoa(p->addr.sin_addr), ntohs(p->addr.sin_port));
 		base = bufferevent_get_base(p->bev);
-		bufferevent_free(p->bev);
+		free_peer_bev(p);
 		p->bev = bufferevent_socket_new(base, -1, BEV_OPT_CLOSE_ON_FREE);
 		bufferevent_setcb(p->bev, on_read, NULL, on_peer_event, p);
+		cork_peer_output(p);
+		paxos_decoder_reset(p->decoder);
 		event_add(p->reconnect_ev, &reconnect_timeout);
-		p->status = ev;
+		__atomic_store_n(&p->status, ev, __ATOMIC_RELAXED);
 	} else {
 		paxos_log_error("Event %d not handled", ev);
 	}
 }
 
+static void
+loopback_send(struct peer* p, paxos_message* msg)
+{
+	struct peers* peers = p->peers;
+	struct loopback_message* m = malloc(sizeof(struct loopback_message));
+	m->peer = p->loopback;
+	m->next = NULL;
+	paxos_message_copy(&m->msg, msg);
+	if (peers->loopback_tail == NULL) {
+		peers->loopback_head = m;
+		event_active(peers->loopback_ev, EV_TIMEOUT, 1);
+	} else {
+		peers->loopback_tail->next = m;
+	}
+	peers->loopback_tail = m;
+}
+
+/*
+	Dispatches the messages queued so far, those sent in the meantime are
+	left to the next turn.
+*/
+static void
+on_loopback(evutil_socket_t fd, short ev, void* arg)
+{
+	struct peers* p = arg;
+	struct loopback_message* m = p->loopback_head;
+	p->loopback_head = p->loopback_tail = NULL;
+	while (m != NULL) {
+		struct loopback_message* next = m->next;
+		dispatch_message(m->peer, &m->msg);
+		paxos_message_destroy(&m->msg);
+		free(m);
+		m = next;
+	}
+}
+
+/*
+	Calls cb from the event loop of peers whenever one of the peers we
+	connect to gets connected, or connected again.
+*/
+void
+peers_on_connect(struct peers* p, peer_iter_cb cb, void* arg)
+{
+	p->connected = cb;
+	p->connected_arg = arg;
+}
+
+static void
+run_connected(struct task* t, int discard)
+{
+	struct peer_task* pt = (struct peer_task*)t;
+	struct peers* p = pt->peer->peers;
+	if (!discard && p->connected != NULL && peer_connected(pt->peer))
+		p->connected(pt->peer, p->connected_arg);
+	free(pt);
+}
+
+static void
+on_drained(evutil_socket_t fd, short ev, void* arg)
+{
+	struct peer* p = arg;
+	peer_iter_cb cb = p->drained;
+	p->drained = NULL;
+	if (cb != NULL && !p->closed)
+		cb(p, p->drained_arg);
+}
+
+static void
+run_drained(struct task* t, int discard)
+{
+	struct peer_task* pt = (struct peer_task*)t;
+	if (!discard)
+		on_drained(-1, EV_TIMEOUT, pt->peer);
+	peer_release(pt->peer);
+	free(pt);
+}
+
+/*
+	Runs the drained callback of the peer in the event loop of peers, at
+	most once per call to peer_on_drained. Called by the thread owning bev.
+*/
+static void
+notify_drained(struct peer* p)
+{
+	if (!__atomic_exchange_n(&p->drain_wanted, 0, __ATOMIC_ACQ_REL))
+		return;
+	if (p->io == NULL) {
+		event_active(p->drained_ev, EV_TIMEOUT, 1);
+		return;
+	}
+	peer_retain(p);
+	task_queue_push(p->peers->inbox, peer_task_new(p, run_drained));
+}
+
+static void
+add_client(struct peers* peers, struct peer* p)
+{
+	peers->clients = realloc(peers->clients,
+		sizeof(struct peer*) * (peers->clients_count+1));
+	p->id = peers->clients_count;
+	peers->clients[peers->clients_count++] = p;
+}
+
+static void
+remove_client(struct peer* p)
+{
+	int i;
+	struct subscriptions* s;
+	struct peer** clients = p->peers->clients;
+	for (i = p->id; i < p->peers->clients_count-1; ++i) {
+		clients[i] = clients[i+1];
+		clients[i]->id = i;
+	}
+	p->peers->clients_count--;
+	p->peers->clients = realloc(p->peers->clients,
+		sizeof(struct peer*) * (p->peers->clients_count));
+	p->closed = 1;
+	kh_foreach_value(p->peers->logs, s,
+		if (s->disconnected != NULL)
+			s->disconnected(p, s->disconnected_arg));
+}
+
+static void
+run_add_client(struct task* t, int discard)
+{
+	struct peer_task* pt = (struct peer_task*)t;
+	if (discard)
+		free_peer(pt->peer);
+	else
+		add_client(pt->peer->peers, pt->peer);
+	free(pt);
+}
+
+static void
+run_free_peer(struct task* t, int discard)
+{
+	struct peer_task* pt = (struct peer_task*)t;
+	free_peer(pt->peer);
+	free(pt);
+}
+
+/*
+	Once removed from the clients, no more frames are sent to the peer and
+	it is freed by its I/O thread after the ones already pushed.
+*/
+static void
+run_remove_client(struct task* t, int discard)
+{
+	struct peer_task* pt = (struct peer_task*)t;
+	if (!discard) {
+		remove_client(pt->peer);
+		io_thread_push(pt->peer->io, peer_task_new(pt->peer, run_free_peer));
+	}
+	free(pt);
+}
+
+static struct task*
+peer_task_new(struct peer* p, void (*run)(struct task*, int))
+{
+	struct peer_task* pt = malloc(sizeof(struct peer_task));
+	pt->task.run = run;
+	pt->peer = p;
+	return &pt->task;
+}
+
 static void
 on_client_event(struct bufferevent* bev, short ev, void *arg)
 {
 	struct peer* p = (struct peer*)arg;
 	if (ev & BEV_EVENT_EOF || ev & BEV_EVENT_ERROR) {
-		int i;
-		struct peer** clients = p->peers->clients;
-		for (i = p->id; i < p->peers->clients_count-1; ++i) {
-			clients[i] = clients[i+1];
-			clients[i]->id = i;
+		if (p->io == NULL) {
+			remove_client(p);
+			free_peer(p);
+		} else {
+			bufferevent_disable(p->bev, EV_READ|EV_WRITE);
+			task_queue_push(p->peers->inbox,
+				peer_task_new(p, run_remove_client));
 		}
-		p->peers->clients_count--;
-		p->peers->clients = realloc(p->peers->clients,
-			sizeof(struct peer*) * (p->peers->clients_count));
-		free_peer(p);
 	} else {
 		paxos_log_error("Event %d not handled", ev);
 	}
@@ -305,14 +972,44 @@ on_connection_timeout(int fd, short ev, void* arg)
 	connect_peer((struct peer*)arg);
 }
 
+static void
+run_loopexit(struct task* t, int discard)
+{
+	struct peers_task* pt = (struct peers_task*)t;
+	if (!discard)
+		event_base_loopexit(pt->peers->base, NULL);
+	free(pt);
+}
+
 static void
 on_listener_error(struct evconnlistener* l, void* arg)
 {
+	struct peers* p = arg;
+	struct peers_task* pt;
 	int err = EVUTIL_SOCKET_ERROR();
-	struct event_base *base = evconnlistener_get_base(l);
 	paxos_log_error("Listener error %d: %s. Shutting down event loop.", err,
 		evutil_socket_error_to_string(err));
-	event_base_loopexit(base, NULL);
+	if (p->io_count == 0) {
+		event_base_loopexit(p->base, NULL);
+		return;
+	}
+	pt = malloc(sizeof(struct peers_task));
+	pt->task.run = run_loopexit;
+	pt->peers = p;
+	task_queue_push(p->inbox, &pt->task);
+}
+
+/*
+	Returns the I/O thread running the given listener, if any.
+*/
+static struct io_thread*
+listener_io_thread(struct peers* p, struct evconnlistener* l)
+{
+	int i;
+	for (i = 0; i < p->listeners_count && p->io_count > 0; ++i)
+		if (p->listeners[i] == l)
+			return p->io[i];
+	return NULL;
 }
 
 static void
@@ -321,46 +1018,141 @@ on_accept(struct evconnlistener *l, evutil_socket_t fd,
 {
 	struct peer* peer;
 	struct peers* peers = arg;
+	struct io_thread* io = listener_io_thread(peers, l);
 
-	peers->clients = realloc(peers->clients,
-		sizeof(struct peer*) * (peers->clients_count+1));
-	peers->clients[peers->clients_count] =
-		make_peer(peers, peers->clients_count, (struct sockaddr_in*)addr);
-
-	peer = peers->clients[peers->clients_count];
+	peer = make_peer(peers, -1, (struct sockaddr_in*)addr, io);
 	bufferevent_setfd(peer->bev, fd);
 	bufferevent_setcb(peer->bev, on_read, NULL, on_client_event, peer);
+	cork_peer_output(peer);
 	bufferevent_enable(peer->bev, EV_READ|EV_WRITE);
 	socket_set_nodelay(fd);
+	send_paxos_hello(peer->bev);
 
 	paxos_log_info("Accepted connection from %s:%d",
 		inet_ntoa(((struct sockaddr_in*)addr)->sin_addr),
 		ntohs(((struct sockaddr_in*)addr)->sin_port));
 
-	peers->clients_count++;
+	if (io == NULL)
+		add_client(peers, peer);
+	else
+		task_queue_push(peers->inbox, peer_task_new(peer, run_add_client));
+}
+
+static int
+is_local_address(struct sockaddr_in* addr)
+{
+	return (ntohl(addr->sin_addr.s_addr) >> 24) == 127;
+}
+
+/*
+	Peers that may connect through shared memory are left to the event loop
+	of peers, even when I/O threads are configured, as shared memory
+	channels are. So are they when falling back to TCP.
+*/
+static int
+shm_candidate(struct sockaddr_in* addr)
+{
+	return paxos_config.shm_transport && is_local_address(addr);
+}
+
+/*
+	Replaces the unconnected socket of the peer with a shared memory
+	channel, if the acceptor is on this host and accepts them. The peer is
+	reported connected from a later turn of the event loop, once those
+	connecting to it are done setting it up.
+*/
+static int
+connect_peer_shm(struct peer* p)
+{
+	struct shm_channel* c;
+	if (!shm_candidate(&p->addr))
+		return 0;
+	c = shm_channel_connect(p->peers->base, ntohs(p->addr.sin_port));
+	if (c == NULL)
+		return 0;
+	bufferevent_free(p->bev);
+	p->shm = c;
+	p->bev = shm_channel_get_bufferevent(c);
+	bufferevent_setcb(p->bev, on_read, NULL, on_peer_event, p);
+	cork_peer_output(p);
+	bufferevent_enable(p->bev, EV_READ|EV_WRITE);
+	send_paxos_hello(p->bev);
+	paxos_log_info("Connect to %s:%d through shared memory",
+		inet_ntoa(p->addr.sin_addr), ntohs(p->addr.sin_port));
+	if (p->shm_ev == NULL)
+		p->shm_ev = event_new(p->peers->base, -1, 0, on_shm_connected, p);
+	event_active(p->shm_ev, EV_TIMEOUT, 1);
+	return 1;
+}
+
+static void
+on_shm_connected(evutil_socket_t fd, short ev, void* arg)
+{
+	struct peer* p = arg;
+	if (p->shm != NULL)
+		on_peer_event(p->bev, BEV_EVENT_CONNECTED, p);
+}
+
+static void
+on_shm_accept(struct shm_channel* c, void* arg)
+{
+	struct peer* peer;
+	struct peers* peers = arg;
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(struct sockaddr_in));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	peer = make_peer(peers, -1, &addr, NULL);
+	bufferevent_free(peer->bev);
+	peer->shm = c;
+	peer->bev = shm_channel_get_bufferevent(c);
+	bufferevent_setcb(peer->bev, on_read, NULL, on_client_event, peer);
+	cork_peer_output(peer);
+	bufferevent_enable(peer->bev, EV_READ|EV_WRITE);
+	send_paxos_hello(peer->bev);
+	paxos_log_info("Accepted connection through shared memory");
+	add_client(peers, peer);
 }
 
 static void
 connect_peer(struct peer* p)
 {
+	if (connect_peer_shm(p))
+		return;
 	bufferevent_enable(p->bev, EV_READ|EV_WRITE);
 	bufferevent_socket_connect(p->bev,
 		(struct sockaddr*)&p->addr, sizeof(p->addr));
 	socket_set_nodelay(bufferevent_getfd(p->bev));
+	send_paxos_hello(p->bev);
 	paxos_log_info("Connect to %s:%d",
 		inet_ntoa(p->addr.sin_addr), ntohs(p->addr.sin_port));
 }
 
 static struct peer*
-make_peer(struct peers* peers, int id, struct sockaddr_in* addr)
+make_peer(struct peers* peers, int id, struct sockaddr_in* addr,
+	struct io_thread* io)
 {
+	struct event_base* base = io ? io_thread_get_base(io) : peers->base;
 	struct peer* p = malloc(sizeof(struct peer));
 	p->id = id;
 	p->addr = *addr;
-	p->bev = bufferevent_socket_new(peers->base, -1, BEV_OPT_CLOSE_ON_FREE);
+	p->bev = bufferevent_socket_new(base, -1, BEV_OPT_CLOSE_ON_FREE);
+	p->corked = 0;
 	p->peers = peers;
+	p->io = io;
+	p->closed = 0;
+	p->refs = 1;
+	p->loopback = NULL;
+	p->shm = NULL;
+	p->shm_ev = NULL;
+	p->decoder = paxos_decoder_new();
 	p->reconnect_ev = NULL;
 	p->status = BEV_EVENT_EOF;
+	p->drained = NULL;
+	p->drained_arg = NULL;
+	p->drained_ev = io ? NULL : event_new(peers->base, -1, 0, on_drained, p);
+	p->drain_wanted = 0;
 	return p;
 }
 
@@ -377,10 +1169,80 @@ free_all_peers(struct peer** p, int count)
 static void
 free_peer(struct peer* p)
 {
-	bufferevent_free(p->bev);
+	p->closed = 1;
+	free_peer_bev(p);
+	paxos_decoder_free(p->decoder);
+	if (p->drained_ev != NULL)
+		event_free(p->drained_ev);
 	if (p->reconnect_ev != NULL)
 		event_free(p->reconnect_ev);
-	free(p);
+	if (p->shm_ev != NULL)
+		event_free(p->shm_ev);
+	peer_release(p);
+}
+
+static void
+free_peer_bev(struct peer* p)
+{
+	if (p->shm != NULL) {
+		shm_channel_free(p->shm);
+		p->shm = NULL;
+	} else {
+		bufferevent_free(p->bev);
+	}
+}
+
+/*
+	Writes to a peer are corked: the first message queued during a turn of
+	the event loop disables writing on the peer's bufferevent and schedules
+	a flush that runs after the callbacks already pending, so that everything
+	produced in between goes out with a single write. Peers owned by an I/O
+	thread are left alone, the thread runs all the sends handed over to it
+	before writing. The output of every peer is watched for it to drain as
+	well, for peer_on_drained.
+*/
+static void
+cork_peer_output(struct peer* p)
+{
+	p->corked = 0;
+	evbuffer_add_cb(bufferevent_get_output(p->bev), on_output, p);
+}
+
+static void
+on_output(struct evbuffer* b, const struct evbuffer_cb_info* info, void* arg)
+{
+	struct peer* p = arg;
+	if (info->n_deleted > 0 && evbuffer_get_length(b) == 0)
+		notify_drained(p);
+	if (info->n_added == 0 || p->corked || p->io != NULL)
+		return;
+	p->corked = 1;
+	bufferevent_disable(p->bev, EV_WRITE);
+	if (!p->peers->flush_pending) {
+		p->peers->flush_pending = 1;
+		event_active(p->peers->flush_ev, EV_TIMEOUT, 1);
+	}
+}
+
+static void
+uncork_peers(struct peer** peers, int count)
+{
+	int i;
+	for (i = 0; i < count; ++i) {
+		if (peers[i]->corked) {
+			peers[i]->corked = 0;
+			bufferevent_enable(peers[i]->bev, EV_WRITE);
+		}
+	}
+}
+
+static void
+on_flush(evutil_socket_t fd, short ev, void* arg)
+{
+	struct peers* p = arg;
+	p->flush_pending = 0;
+	uncork_peers(p->peers, p->peers_count);
+	uncork_peers(p->clients, p->clients_count);
 }
 
 static void
@@ -0,0 +1,475 @@
+/*
+ * Copyright (c) 2013-2015, University of Lugano
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holders nor the names of it
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#define _GNU_SOURCE
+#include "shm_channel.h"
+#include "paxos.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <event2/buffer.h>
+#include <event2/listener.h>
+
+#ifdef __linux__
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+
+#define SHM_RING_SIZE (1 << 20)
+#define SHM_FDS 3
+
+/*
+	Bytes are written at head and read from tail, both of them growing
+	forever and being reduced modulo the size of the ring when accessed.
+	Each counter is written by one side only. A writer finding the ring
+	full sets waiting, and the reader wakes it up once it made some room.
+*/
+struct shm_ring
+{
+	uint64_t head;
+	char pad1[56];
+	uint64_t tail;
+	char pad2[56];
+	int waiting;
+	char pad3[60];
+	char data[SHM_RING_SIZE];
+};
+
+/*
+	The memory shared by the two sides holds two rings, the one written by
+	the side that connected comes first. Each side has its own eventfd, the
+	doorbell rung by the other side when there is something to read or room
+	to write. The unix socket used to hand over the shared memory and the
+	eventfds stays open, so that each side notices when the other goes.
+*/
+struct shm_channel
+{
+	int sock;
+	int doorbell;
+	int remote;          /* Doorbell of the other side */
+	struct shm_ring* in;
+	struct shm_ring* out;
+	void* mem;
+	struct event* sock_ev;
+	struct event* doorbell_ev;
+	struct bufferevent* pair[2];  /* The first is handed to the user */
+};
+
+struct shm_handshake
+{
+	int fd;
+	struct event* ev;
+	struct shm_listener* listener;
+	struct shm_handshake* next;
+};
+
+struct shm_listener
+{
+	char path[108];
+	struct evconnlistener* l;
+	shm_accept_cb cb;
+	void* arg;
+	struct shm_handshake* handshakes;  /* Accepted, waiting for their fds */
+};
+
+static void on_pair_read(struct bufferevent* bev, void* arg);
+static void on_doorbell(evutil_socket_t fd, short ev, void* arg);
+static void on_socket(evutil_socket_t fd, short ev, void* arg);
+static void on_accept(struct evconnlistener* l, evutil_socket_t fd,
+	struct sockaddr* addr, int socklen, void* arg);
+static void on_handshake(evutil_socket_t fd, short ev, void* arg);
+
+
+static int
+shm_socket_path(int port, struct sockaddr_un* addr)
+{
+	memset(addr, 0, sizeof(struct sockaddr_un));
+	addr->sun_family = AF_UNIX;
+	return snprintf(addr->sun_path, sizeof(addr->sun_path), "%s.%d",
+		paxos_config.shm_path, port) < sizeof(addr->sun_path);
+}
+
+static void
+ring_doorbell(int fd)
+{
+	uint64_t one = 1;
+	if (write(fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		paxos_log_error("Failed to ring doorbell: %s", strerror(errno));
+}
+
+/*
+	Moves as much as fits of what the user wrote to the outgoing ring.
+*/
+static void
+ring_write(struct shm_channel* c)
+{
+	struct evbuffer* src = bufferevent_get_input(c->pair[1]);
+	struct shm_ring* r = c->out;
+	uint64_t head = r->head;
+	uint64_t tail;
+	size_t len, room, off, first;
+	int written = 0;
+
+	while ((len = evbuffer_get_length(src)) > 0) {
+		tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+		room = SHM_RING_SIZE - (head - tail);
+		if (room == 0) {
+			__atomic_store_n(&r->waiting, 1, __ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&r->tail, __ATOMIC_SEQ_CST) == tail)
+				break;
+			continue;
+		}
+		if (len > room)
+			len = room;
+		off = head & (SHM_RING_SIZE - 1);
+		first = SHM_RING_SIZE - off;
+		if (first > len)
+			first = len;
+		evbuffer_remove(src, r->data + off, first);
+		if (len > first)
+			evbuffer_remove(src, r->data, len - first);
+		head += len;
+		__atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+		written = 1;
+	}
+	if (written)
+		ring_doorbell(c->remote);
+}
+
+/*
+	Hands over what the other side wrote to the user's bufferevent.
+*/
+static void
+ring_read(struct shm_channel* c)
+{
+	struct evbuffer* dst = bufferevent_get_output(c->pair[1]);
+	struct shm_ring* r = c->in;
+	uint64_t tail = r->tail;
+	uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	size_t len = head - tail, off, first;
+
+	if (len == 0)
+		return;
+	off = tail & (SHM_RING_SIZE - 1);
+	first = SHM_RING_SIZE - off;
+	if (first > len)
+		first = len;
+	evbuffer_add(dst, r->data + off, first);
+	if (len > first)
+		evbuffer_add(dst, r->data, len - first);
+	__atomic_store_n(&r->tail, head, __ATOMIC_SEQ_CST);
+	if (__atomic_exchange_n(&r->waiting, 0, __ATOMIC_SEQ_CST))
+		ring_doorbell(c->remote);
+}
+
+static struct shm_channel*
+shm_channel_new(struct event_base* base, int sock, void* mem, int first,
+	int doorbell, int remote)
+{
+	struct shm_ring* rings = mem;
+	struct shm_channel* c = malloc(sizeof(struct shm_channel));
+	c->sock = sock;
+	c->doorbell = doorbell;
+	c->remote = remote;
+	c->mem = mem;
+	c->out = first ? &rings[0] : &rings[1];
+	c->in = first ? &rings[1] : &rings[0];
+	evutil_make_socket_nonblocking(sock);
+	bufferevent_pair_new(base, 0, c->pair);
+	bufferevent_setcb(c->pair[1], on_pair_read, NULL, NULL, c);
+	bufferevent_enable(c->pair[1], EV_READ|EV_WRITE);
+	c->sock_ev = event_new(base, sock, EV_READ|EV_PERSIST, on_socket, c);
+	event_add(c->sock_ev, NULL);
+	c->doorbell_ev = event_new(base, doorbell, EV_READ|EV_PERSIST,
+		on_doorbell, c);
+	event_add(c->doorbell_ev, NULL);
+	return c;
+}
+
+struct shm_channel*
+shm_channel_connect(struct event_base* base, int port)
+{
+	int i, sock, fds[SHM_FDS] = {-1, -1, -1};
+	void* mem = MAP_FAILED;
+	struct sockaddr_un addr;
+	struct iovec iov;
+	struct msghdr msg;
+	char byte = 0, cbuf[CMSG_SPACE(sizeof(fds))];
+	struct cmsghdr* cmsg;
+
+	if (!shm_socket_path(port, &addr))
+		return NULL;
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0)
+		return NULL;
+	if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+		goto error;
+
+	fds[0] = memfd_create("evpaxos", MFD_CLOEXEC);
+	fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	fds[2] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (fds[0] < 0 || fds[1] < 0 || fds[2] < 0 ||
+		ftruncate(fds[0], 2 * sizeof(struct shm_ring)) != 0)
+		goto error;
+	mem = mmap(NULL, 2 * sizeof(struct shm_ring), PROT_READ | PROT_WRITE,
+		MAP_SHARED, fds[0], 0);
+	if (mem == MAP_FAILED)
+		goto error;
+
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+	if (sendmsg(sock, &msg, 0) != 1)
+		goto error;
+
+	close(fds[0]);
+	return shm_channel_new(base, sock, mem, 1, fds[1], fds[2]);
+
+error:
+	if (mem != MAP_FAILED)
+		munmap(mem, 2 * sizeof(struct shm_ring));
+	for (i = 0; i < SHM_FDS; i++)
+		if (fds[i] >= 0)
+			close(fds[i]);
+	close(sock);
+	return NULL;
+}
+
+void
+shm_channel_free(struct shm_channel* c)
+{
+	event_free(c->sock_ev);
+	event_free(c->doorbell_ev);
+	bufferevent_free(c->pair[0]);
+	bufferevent_free(c->pair[1]);
+	munmap(c->mem, 2 * sizeof(struct shm_ring));
+	close(c->doorbell);
+	close(c->remote);
+	close(c->sock);
+	free(c);
+}
+
+struct bufferevent*
+shm_channel_get_bufferevent(struct shm_channel* c)
+{
+	return c->pair[0];
+}
+
+static void
+on_pair_read(struct bufferevent* bev, void* arg)
+{
+	ring_write(arg);
+}
+
+static void
+on_doorbell(evutil_socket_t fd, short ev, void* arg)
+{
+	uint64_t value;
+	struct shm_channel* c = arg;
+	if (read(fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+		paxos_log_error("Failed to read doorbell: %s", strerror(errno));
+	ring_read(c);
+	ring_write(c);
+}
+
+/*
+	Nothing but the handshake is ever sent through the socket, it becoming
+	readable means the other side went away. The user's event callback is
+	expected to free the channel.
+*/
+static void
+on_socket(evutil_socket_t fd, short ev, void* arg)
+{
+	char byte;
+	bufferevent_event_cb cb;
+	void* cbarg;
+	struct shm_channel* c = arg;
+	if (recv(fd, &byte, 1, 0) < 0 && errno == EAGAIN)
+		return;
+	event_del(c->sock_ev);
+	ring_read(c);
+	bufferevent_getcb(c->pair[0], NULL, NULL, &cb, &cbarg);
+	if (cb != NULL)
+		cb(c->pair[0], BEV_EVENT_EOF | BEV_EVENT_READING, cbarg);
+}
+
+struct shm_listener*
+shm_listener_new(struct event_base* base, int port, shm_accept_cb cb,
+	void* arg)
+{
+	struct sockaddr_un addr;
+	struct shm_listener* l;
+	if (!shm_socket_path(port, &addr)) {
+		paxos_log_error("Shared memory socket path too long");
+		return NULL;
+	}
+	unlink(addr.sun_path);
+	l = malloc(sizeof(struct shm_listener));
+	strcpy(l->path, addr.sun_path);
+	l->cb = cb;
+	l->arg = arg;
+	l->handshakes = NULL;
+	l->l = evconnlistener_new_bind(base, on_accept, l,
+		LEV_OPT_CLOSE_ON_EXEC | LEV_OPT_CLOSE_ON_FREE, -1,
+		(struct sockaddr*)&addr, sizeof(addr));
+	if (l->l == NULL) {
+		paxos_log_error("Failed to bind on %s", addr.sun_path);
+		free(l);
+		return NULL;
+	}
+	paxos_log_info("Listening on %s", addr.sun_path);
+	return l;
+}
+
+static void
+handshake_free(struct shm_handshake* h)
+{
+	struct shm_handshake** p = &h->listener->handshakes;
+	while (*p != h)
+		p = &(*p)->next;
+	*p = h->next;
+	event_free(h->ev);
+	free(h);
+}
+
+void
+shm_listener_free(struct shm_listener* l)
+{
+	while (l->handshakes != NULL) {
+		close(l->handshakes->fd);
+		handshake_free(l->handshakes);
+	}
+	evconnlistener_free(l->l);
+	unlink(l->path);
+	free(l);
+}
+
+static void
+on_accept(struct evconnlistener* el, evutil_socket_t fd,
+	struct sockaddr* addr, int socklen, void* arg)
+{
+	struct shm_listener* l = arg;
+	struct shm_handshake* h = malloc(sizeof(struct shm_handshake));
+	h->fd = fd;
+	h->listener = l;
+	h->ev = event_new(evconnlistener_get_base(el), fd, EV_READ,
+		on_handshake, h);
+	h->next = l->handshakes;
+	l->handshakes = h;
+	event_add(h->ev, NULL);
+}
+
+static void
+on_handshake(evutil_socket_t fd, short ev, void* arg)
+{
+	int fds[SHM_FDS];
+	void* mem;
+	char byte;
+	struct iovec iov = {&byte, 1};
+	struct msghdr msg;
+	struct cmsghdr* cmsg;
+	struct stat st;
+	char cbuf[CMSG_SPACE(sizeof(fds))];
+	struct shm_handshake* h = arg;
+	struct shm_listener* l = h->listener;
+	struct event_base* base = evconnlistener_get_base(l->l);
+
+	handshake_free(h);
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+	if (recvmsg(fd, &msg, MSG_CMSG_CLOEXEC) != 1 ||
+		(cmsg = CMSG_FIRSTHDR(&msg)) == NULL ||
+		cmsg->cmsg_type != SCM_RIGHTS ||
+		cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+		paxos_log_error("Invalid shared memory handshake");
+		close(fd);
+		return;
+	}
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+	mem = MAP_FAILED;
+	if (fstat(fds[0], &st) == 0 && st.st_size == 2 * sizeof(struct shm_ring))
+		mem = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			fds[0], 0);
+	close(fds[0]);
+	if (mem == MAP_FAILED) {
+		paxos_log_error("Failed to map shared memory: %s", strerror(errno));
+		close(fds[1]);
+		close(fds[2]);
+		close(fd);
+		return;
+	}
+	l->cb(shm_channel_new(base, fd, mem, 0, fds[2], fds[1]), l->arg);
+}
+
+#else
+
+struct shm_listener*
+shm_listener_new(struct event_base* base, int port, shm_accept_cb cb,
+	void* arg)
+{
+	paxos_log_error("Shared memory transport not supported");
+	return NULL;
+}
+
+void
+shm_listener_free(struct shm_listener* l) { }
+
+struct shm_channel*
+shm_channel_connect(struct event_base* base, int port)
+{
+	return NULL;
+}
+
+void
+shm_channel_free(struct shm_channel* c) { }
+
+struct bufferevent*
+shm_channel_get_bufferevent(struct shm_channel* c)
+{
+	return NULL;
+}
+
+#endif
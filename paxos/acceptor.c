@@ -31,10 +31,24 @@
 #include <stdlib.h>
 #include <string.h>
 
+/*
+	Promise made to the owner of the instances from, from + stride, ...
+	for all of them at once, with a single ranged prepare.
+*/
+struct range_promise
+{
+	iid_t from;
+	ballot_t ballot;
+	unsigned stride;
+};
+
 struct acceptor
 {
 	int id;
 	iid_t trim_iid;
+	iid_t fast_iid;
+	iid_t max_iid;       /* Highest instance holding a record */
+	struct range_promise ranges[MAX_N_OF_PROPOSERS]; /* One per owner */
 	struct storage store;
 };
 
@@ -46,9 +60,22 @@ static void paxos_accepted_to_preempted(int id, paxos_accepted* acc, paxos_messa
 struct acceptor*
 acceptor_new(int id)
 {
+	return acceptor_new_shard(id, 0, 0);
+}
+
+/*
+	Creates one of the shards of a sharded acceptor, each shard has its own
+	storage and accepts the instances assigned to it only. Acceptors of
+	different logs share the storage of their shard.
+*/
+struct acceptor*
+acceptor_new_shard(int id, int shard, uint32_t log)
+{
+	int i;
 	struct acceptor* a;
+	paxos_prepare_range range;
 	a = malloc(sizeof(struct acceptor));
-	storage_init(&a->store, id);
+	storage_init_shard(&a->store, id, shard, log);
 	if (storage_open(&a->store) != 0) {
 		free(a);
 		return NULL;
@@ -57,6 +84,13 @@ acceptor_new(int id)
 		return NULL;
 	a->id = id;
 	a->trim_iid = storage_get_trim_instance(&a->store);
+	a->fast_iid = a->trim_iid + 1;
+	a->max_iid = storage_get_max_instance(&a->store);
+	memset(a->ranges, 0, sizeof(a->ranges));
+	for (i = 0; i < MAX_N_OF_PROPOSERS; i++)
+		if (storage_get_range(&a->store, i, &range))
+			a->ranges[i] = (struct range_promise) {
+				range.from, range.ballot, range.stride };
 	if (storage_tx_commit(&a->store) != 0)
 		return NULL;
 	return a;
@@ -69,6 +103,43 @@ acceptor_free(struct acceptor* a)
 	free(a);
 }
 
+/*
+	Returns the ballot promised for the instance by a ranged prepare, if it
+	falls within the range of one of the owners, 0 otherwise.
+*/
+static ballot_t
+acceptor_range_ballot(struct acceptor* a, iid_t iid)
+{
+	int i;
+	struct range_promise* r;
+	for (i = 0; i < MAX_N_OF_PROPOSERS; i++) {
+		r = &a->ranges[i];
+		if (r->stride > 0 && iid >= r->from && (iid - r->from) % r->stride == 0)
+			return r->ballot;
+	}
+	return 0;
+}
+
+/*
+	Finds the record of the instance, if any, and tells whether the ballot
+	is at least the one promised for the instance, by a prepare for it or
+	a ranged prepare. Otherwise acc->ballot is the ballot promised.
+*/
+static int
+acceptor_get_promised(struct acceptor* a, iid_t iid, ballot_t ballot,
+	paxos_accepted* acc)
+{
+	ballot_t range = acceptor_range_ballot(a, iid);
+	memset(acc, 0, sizeof(paxos_accepted));
+	if (!storage_get_record(&a->store, iid, acc)) {
+		acc->aid = a->id;
+		acc->iid = iid;
+	}
+	if (acc->ballot < range)
+		acc->ballot = range;
+	return acc->ballot <= ballot;
+}
+
 int
 acceptor_receive_prepare(struct acceptor* a, 
 	paxos_prepare* req, paxos_message* out)
@@ -76,26 +147,68 @@ acceptor_receive_prepare(struct acceptor* a,
 	paxos_accepted acc;
 	if (req->iid <= a->trim_iid)
 		return 0;
-	memset(&acc, 0, sizeof(paxos_accepted));
 	if (storage_tx_begin(&a->store) != 0)
 		return 0;
-	int found = storage_get_record(&a->store, req->iid, &acc);
-	if (!found || acc.ballot <= req->ballot) {
+	if (acceptor_get_promised(a, req->iid, req->ballot, &acc)) {
 		paxos_log_debug("Preparing iid: %u, ballot: %u", req->iid, req->ballot);
 		acc.aid = a->id;
 		acc.iid = req->iid;
 		acc.ballot = req->ballot;
 		if (storage_put_record(&a->store, &acc) != 0) {
 			storage_tx_abort(&a->store);
+			paxos_accepted_destroy(&acc);
 			return 0;
 		}
+		if (req->iid > a->max_iid)
+			a->max_iid = req->iid;
 	}
-	if (storage_tx_commit(&a->store) != 0)
+	if (storage_tx_commit(&a->store) != 0) {
+		paxos_accepted_destroy(&acc);
 		return 0;
+	}
 	paxos_accepted_to_promise(&acc, out);
 	return 1;
 }
 
+/*
+	Promises the ballot for every instance of the owner of req->from, from
+	it on, unless a ballot at least as high was promised to it already, for
+	an owner never to reuse a ballot, even once restarted. Instances up to
+	the highest one the acceptor holds a record of, reported in the reply,
+	still need a prepare of their own, for the values accepted in them.
+	The promise is stored before it is replied, to outlive a restart.
+*/
+int
+acceptor_receive_prepare_range(struct acceptor* a, paxos_prepare_range* req,
+	paxos_message* out)
+{
+	int owner;
+	struct range_promise* r;
+	if (req->stride == 0 || req->from == 0 ||
+		(req->from - 1) % req->stride >= MAX_N_OF_PROPOSERS)
+		return 0;
+	owner = (req->from - 1) % req->stride;
+	r = &a->ranges[owner];
+	if (req->ballot > r->ballot) {
+		paxos_log_debug("Preparing iids from %u every %u, ballot: %u",
+			req->from, req->stride, req->ballot);
+		if (storage_tx_begin(&a->store) != 0)
+			return 0;
+		if (storage_put_range(&a->store, owner, req) != 0) {
+			storage_tx_abort(&a->store);
+			return 0;
+		}
+		if (storage_tx_commit(&a->store) != 0)
+			return 0;
+	}
+	out->type = PAXOS_PROMISE_RANGE;
+	out->u.promise_range = (paxos_promise_range) {
+		a->id, req->from, req->ballot, r->ballot, a->max_iid };
+	if (req->ballot > r->ballot)
+		*r = (struct range_promise) { req->from, req->ballot, req->stride };
+	return 1;
+}
+
 int
 acceptor_receive_accept(struct acceptor* a,
 	paxos_accept* req, paxos_message* out)
@@ -103,17 +216,19 @@ acceptor_receive_accept(struct acceptor* a,
 	paxos_accepted acc;
 	if (req->iid <= a->trim_iid)
 		return 0;
-	memset(&acc, 0, sizeof(paxos_accepted));
 	if (storage_tx_begin(&a->store) != 0)
 		return 0;
-	int found = storage_get_record(&a->store, req->iid, &acc);
-	if (!found || acc.ballot <= req->ballot) {
+	if (acceptor_get_promised(a, req->iid, req->ballot, &acc)) {
 		paxos_log_debug("Accepting iid: %u, ballot: %u", req->iid, req->ballot);
 		paxos_accept_to_accepted(a->id, req, out);
 		if (storage_put_record(&a->store, &(out->u.accepted)) != 0) {
 			storage_tx_abort(&a->store);
+			paxos_accepted_destroy(&acc);
+			paxos_accepted_destroy(&out->u.accepted);
 			return 0;
 		}
+		if (req->iid > a->max_iid)
+			a->max_iid = req->iid;
 	} else {
 		paxos_accepted_to_preempted(a->id, &acc, out);
 	}
@@ -123,6 +238,104 @@ acceptor_receive_accept(struct acceptor* a,
 	return 1;
 }
 
+/*
+	Accepts a value of the fast round, sent to the acceptors without an
+	instance id, for the first instance from fast_iid this acceptor holds
+	no record of, so that it never replaces a value accepted at the fast
+	ballot nor lands in an instance a proposer opened already.
+*/
+int
+acceptor_receive_fast_accept(struct acceptor* a,
+	paxos_accept* req, paxos_message* out)
+{
+	paxos_accepted acc;
+	paxos_accept fast = *req;
+	if (req->ballot != PAXOS_FAST_BALLOT)
+		return 0;
+	if (storage_tx_begin(&a->store) != 0)
+		return 0;
+	if (a->fast_iid <= a->trim_iid)
+		a->fast_iid = a->trim_iid + 1;
+	memset(&acc, 0, sizeof(paxos_accepted));
+	while (storage_get_record(&a->store, a->fast_iid, &acc)) {
+		paxos_accepted_destroy(&acc);
+		memset(&acc, 0, sizeof(paxos_accepted));
+		a->fast_iid++;
+	}
+	fast.iid = a->fast_iid;
+	paxos_log_debug("Accepting fast value for iid: %u", fast.iid);
+	paxos_accept_to_accepted(a->id, &fast, out);
+	if (storage_put_record(&a->store, &(out->u.accepted)) != 0) {
+		storage_tx_abort(&a->store);
+		paxos_accepted_destroy(&out->u.accepted);
+		return 0;
+	}
+	if (storage_tx_commit(&a->store) != 0) {
+		paxos_accepted_destroy(&out->u.accepted);
+		return 0;
+	}
+	if (fast.iid > a->max_iid)
+		a->max_iid = fast.iid;
+	a->fast_iid++;
+	return 1;
+}
+
+/*
+	Accepts all the entries of a batch within a single storage transaction.
+	The entries accepted are acknowledged by a single PAXOS_ACCEPTED_BATCH
+	in out, while the ones refused are stored in preempted, which must be
+	large enough to hold all the entries of the batch.
+*/
+int
+acceptor_receive_accept_batch(struct acceptor* a, paxos_accept_batch* req,
+	paxos_message* out, paxos_preempted* preempted, int* preempted_count)
+{
+	int i;
+	paxos_accepted acc;
+	paxos_accepted_batch* batch = &out->u.accepted_batch;
+	out->type = PAXOS_ACCEPTED_BATCH;
+	batch->aid = a->id;
+	batch->entries_len = 0;
+	batch->entries_val = NULL;
+	*preempted_count = 0;
+	if (req->entries_len == 0 || storage_tx_begin(&a->store) != 0)
+		return 0;
+	batch->entries_val = malloc(req->entries_len * sizeof(paxos_accepted_entry));
+	for (i = 0; i < req->entries_len; i++) {
+		paxos_accept_entry* e = &req->entries_val[i];
+		if (e->iid <= a->trim_iid)
+			continue;
+		if (acceptor_get_promised(a, e->iid, e->ballot, &acc)) {
+			paxos_log_debug("Accepting iid: %u, ballot: %u", e->iid, e->ballot);
+			paxos_accepted_destroy(&acc);
+			acc = (paxos_accepted) {a->id, e->iid, e->ballot, e->ballot, e->value,
+				e->timestamp};
+			if (storage_put_record(&a->store, &acc) != 0) {
+				storage_tx_abort(&a->store);
+				paxos_accepted_batch_destroy(batch);
+				return 0;
+			}
+			if (e->iid > a->max_iid)
+				a->max_iid = e->iid;
+			paxos_accepted_entry* ack = &batch->entries_val[batch->entries_len++];
+			ack->iid = e->iid;
+			ack->ballot = e->ballot;
+			ack->value_ballot = e->ballot;
+			ack->timestamp = e->timestamp;
+			paxos_value_copy(&ack->value, &e->value);
+		} else {
+			preempted[(*preempted_count)++] =
+				(paxos_preempted) { a->id, acc.iid, acc.ballot };
+			paxos_accepted_destroy(&acc);
+		}
+	}
+	if (storage_tx_commit(&a->store) != 0) {
+		paxos_accepted_batch_destroy(batch);
+		return 0;
+	}
+	return 1;
+}
+
 int
 acceptor_receive_repeat(struct acceptor* a, iid_t iid, paxos_accepted* out)
 {
@@ -132,7 +345,7 @@ acceptor_receive_repeat(struct acceptor* a, iid_t iid, paxos_accepted* out)
 	int found = storage_get_record(&a->store, iid, out);
 	if (storage_tx_commit(&a->store) != 0)
 		return 0;
-	return found && (out->value.paxos_value_len > 0);
+	return found && (out->value_ballot > 0);
 }
 
 int
@@ -156,6 +369,15 @@ acceptor_set_current_state(struct acceptor* a, paxos_acceptor_state* state)
 	state->trim_iid = a->trim_iid;
 }
 
+/*
+	Highest instance the acceptor holds a record of, accepted or promised.
+*/
+iid_t
+acceptor_get_max_instance(struct acceptor* a)
+{
+	return a->max_iid;
+}
+
 static void
 paxos_accepted_to_promise(paxos_accepted* acc, paxos_message* out)
 {
@@ -184,7 +406,8 @@ paxos_accept_to_accepted(int id, paxos_accept* acc, paxos_message* out)
 		acc->iid,
 		acc->ballot,
 		acc->ballot,
-		{value_size, value}
+		{value_size, value},
+		acc->timestamp
 	};
 }
 
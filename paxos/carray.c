@@ -77,6 +77,12 @@ carray_size(struct carray* a)
 	return a->size;
 }
 
+int
+carray_count(struct carray* a)
+{
+	return a->count;
+}
+
 int
 carray_push_back(struct carray* a, void* p)
 {
@@ -38,15 +38,23 @@ extern "C" {
 struct acceptor;
 
 struct acceptor* acceptor_new(int id);
+struct acceptor* acceptor_new_shard(int id, int shard, uint32_t log);
 void acceptor_free(struct acceptor* a);
 int acceptor_receive_prepare(struct acceptor* a,
 	paxos_prepare* req, paxos_message* out);
+int acceptor_receive_prepare_range(struct acceptor* a,
+	paxos_prepare_range* req, paxos_message* out);
 int acceptor_receive_accept(struct acceptor* a,
 	paxos_accept* req, paxos_message* out);
+int acceptor_receive_fast_accept(struct acceptor* a,
+	paxos_accept* req, paxos_message* out);
+int acceptor_receive_accept_batch(struct acceptor* a, paxos_accept_batch* req,
+	paxos_message* out, paxos_preempted* preempted, int* preempted_count);
 int acceptor_receive_repeat(struct acceptor* a,
 	iid_t iid, paxos_accepted* out);
 int acceptor_receive_trim(struct acceptor* a, paxos_trim* trim);
 void acceptor_set_current_state(struct acceptor* a, paxos_acceptor_state* out);
+iid_t acceptor_get_max_instance(struct acceptor* a);
 
 #ifdef __cplusplus
 }
@@ -39,6 +39,7 @@ struct carray* carray_new(int size);
 void carray_free(struct carray* a);
 int carray_empty(struct carray* a);
 int carray_size(struct carray* a);
+int carray_count(struct carray* a);
 int carray_push_back(struct carray* a, void* p);
 void carray_foreach(struct carray* a, void (*carray_cb)(void*));
 void* carray_pop_front(struct carray* a);
@@ -41,7 +41,9 @@ struct learner* learner_new(int acceptors);
 void learner_free(struct learner* l);
 void learner_set_instance_id(struct learner* l, iid_t iid);
 void learner_receive_accepted(struct learner* l, paxos_accepted* ack);
+void learner_receive_chosen(struct learner* l, paxos_chosen* chosen);
 int learner_deliver_next(struct learner* l, paxos_accepted* out);
+int learner_speculate_next(struct learner* l, paxos_accepted* out);
 int learner_has_holes(struct learner* l, iid_t* from, iid_t* to);
 
 #ifdef __cplusplus
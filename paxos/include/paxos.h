@@ -63,13 +63,35 @@ struct paxos_config
 	/* General configuration */
 	paxos_log_level verbosity;
 	int tcp_nodelay;
+	int io_threads;
+	int io_threads_pin;
+	int binary_codec;
+	size_t max_frame_size;
+	int replica_loopback;
+	int shm_transport;
+	char* shm_path;
 
 	/* Learner */
 	int learner_catch_up;
+	int learner_log_size;
+	char* learner_cursor_path;
+	int learner_cursor_interval;
+	int learner_cursor_sync;
+	int learner_stall_deadline;
+	size_t learner_snapshot_max_size;
 
 	/* Proposer */
 	int proposer_timeout;
 	int proposer_preexec_window;
+	int proposer_accept_batch;
+	int proposer_leader_timeout;
+	int proposer_takeover_backoff;
+	int proposer_lease;
+	int proposer_partition;
+	int proposer_max_requests;
+
+	/* Client */
+	int client_timeout;
 
 	/* Acceptor */
 	paxos_storage_backend storage_backend;
@@ -78,6 +100,10 @@ struct paxos_config
 	int quorum_2;
 	int group_1;
 	int group_2;
+	int fast_paxos;
+	size_t acceptor_cache_size;
+	int acceptor_shards;
+	int acceptor_ring;
 
 	/* lmdb storage configuration */
 	int lmdb_sync;
@@ -93,8 +119,13 @@ void paxos_value_free(paxos_value* v);
 void paxos_promise_destroy(paxos_promise* p);
 void paxos_accept_destroy(paxos_accept* a);
 void paxos_accepted_destroy(paxos_accepted* a);
+void paxos_accept_batch_destroy(paxos_accept_batch* b);
+void paxos_accepted_batch_destroy(paxos_accepted_batch* b);
 void paxos_message_destroy(paxos_message* m);
+void paxos_value_copy(paxos_value* dst, paxos_value* src);
+void paxos_message_copy(paxos_message* dst, paxos_message* src);
 void paxos_accepted_free(paxos_accepted* a);
+uint64_t paxos_timestamp(void);
 void paxos_log(int level, const char* format, va_list ap);
 void paxos_log_error(const char* format, ...);
 void paxos_log_info(const char* format, ...);
@@ -109,6 +140,13 @@ void paxos_log_debug(const char* format, ...);
 */
 #define MAX_N_OF_PROPOSERS 10
 
+/*
+	Ballot of the fast round, below those proposers take in phase 1, at
+	which acceptors accept values sent straight to them for instances that
+	no proposer opened.
+*/
+#define PAXOS_FAST_BALLOT 1
+
 #ifdef __cplusplus
 }
 #endif
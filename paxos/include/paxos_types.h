@@ -38,6 +38,25 @@ struct paxos_value
 };
 typedef struct paxos_value paxos_value;
 
+struct paxos_accept_entry
+{
+	uint32_t iid;
+	uint32_t ballot;
+	paxos_value value;
+	uint64_t timestamp;
+};
+typedef struct paxos_accept_entry paxos_accept_entry;
+
+struct paxos_accepted_entry
+{
+	uint32_t iid;
+	uint32_t ballot;
+	uint32_t value_ballot;
+	paxos_value value;
+	uint64_t timestamp;
+};
+typedef struct paxos_accepted_entry paxos_accepted_entry;
+
 struct paxos_prepare
 {
 	uint32_t iid;
@@ -60,6 +79,7 @@ struct paxos_accept
 	uint32_t iid;
 	uint32_t ballot;
 	paxos_value value;
+	uint64_t timestamp;
 };
 typedef struct paxos_accept paxos_accept;
 
@@ -70,6 +90,7 @@ struct paxos_accepted
 	uint32_t ballot;
 	uint32_t value_ballot;
 	paxos_value value;
+	uint64_t timestamp;
 };
 typedef struct paxos_accepted paxos_accepted;
 
@@ -103,10 +124,112 @@ typedef struct paxos_acceptor_state paxos_acceptor_state;
 
 struct paxos_client_value
 {
+	uint32_t id;
 	paxos_value value;
 };
 typedef struct paxos_client_value paxos_client_value;
 
+struct paxos_snapshot_request
+{
+	uint32_t iid;
+};
+typedef struct paxos_snapshot_request paxos_snapshot_request;
+
+struct paxos_snapshot_chunk
+{
+	uint32_t iid;
+	uint32_t offset;
+	uint32_t size;
+	paxos_value data;
+};
+typedef struct paxos_snapshot_chunk paxos_snapshot_chunk;
+
+struct paxos_catchup
+{
+	uint32_t from;
+	uint32_t to;
+};
+typedef struct paxos_catchup paxos_catchup;
+
+struct paxos_chosen
+{
+	uint32_t iid;
+	uint32_t ballot;
+	paxos_value value;
+	uint64_t timestamp;
+};
+typedef struct paxos_chosen paxos_chosen;
+
+struct paxos_replica_state
+{
+	uint32_t rid;
+	uint32_t checkpoint_iid;
+};
+typedef struct paxos_replica_state paxos_replica_state;
+
+struct paxos_accept_batch
+{
+	int entries_len;
+	paxos_accept_entry *entries_val;
+};
+typedef struct paxos_accept_batch paxos_accept_batch;
+
+struct paxos_accepted_batch
+{
+	uint32_t aid;
+	int entries_len;
+	paxos_accepted_entry *entries_val;
+};
+typedef struct paxos_accepted_batch paxos_accepted_batch;
+
+struct paxos_client_reply
+{
+	uint32_t id;
+	uint32_t iid;
+	uint32_t leader;
+};
+typedef struct paxos_client_reply paxos_client_reply;
+
+struct paxos_heartbeat
+{
+	uint32_t seq;
+	uint32_t ballot;
+};
+typedef struct paxos_heartbeat paxos_heartbeat;
+
+struct paxos_heartbeat_ack
+{
+	uint32_t aid;
+	uint32_t seq;
+	uint32_t accepted_iid;
+};
+typedef struct paxos_heartbeat_ack paxos_heartbeat_ack;
+
+struct paxos_prepare_range
+{
+	uint32_t from;
+	uint32_t ballot;
+	uint32_t stride;
+};
+typedef struct paxos_prepare_range paxos_prepare_range;
+
+struct paxos_promise_range
+{
+	uint32_t aid;
+	uint32_t from;
+	uint32_t ballot;
+	uint32_t prev_ballot;
+	uint32_t max_iid;
+};
+typedef struct paxos_promise_range paxos_promise_range;
+
+struct paxos_safe_time
+{
+	uint32_t iid;
+	uint64_t timestamp;
+};
+typedef struct paxos_safe_time paxos_safe_time;
+
 enum paxos_message_type
 {
 	PAXOS_PREPARE,
@@ -117,13 +240,27 @@ enum paxos_message_type
 	PAXOS_REPEAT,
 	PAXOS_TRIM,
 	PAXOS_ACCEPTOR_STATE,
-	PAXOS_CLIENT_VALUE
+	PAXOS_CLIENT_VALUE,
+	PAXOS_SNAPSHOT_REQUEST,
+	PAXOS_SNAPSHOT_CHUNK,
+	PAXOS_CATCHUP,
+	PAXOS_CHOSEN,
+	PAXOS_REPLICA_STATE,
+	PAXOS_ACCEPT_BATCH,
+	PAXOS_ACCEPTED_BATCH,
+	PAXOS_CLIENT_REPLY,
+	PAXOS_HEARTBEAT,
+	PAXOS_HEARTBEAT_ACK,
+	PAXOS_PREPARE_RANGE,
+	PAXOS_PROMISE_RANGE,
+	PAXOS_SAFE_TIME
 };
 typedef enum paxos_message_type paxos_message_type;
 
 struct paxos_message
 {
 	paxos_message_type type;
+	uint32_t log;
 	union
 	{
 		paxos_prepare prepare;
@@ -135,6 +272,19 @@ struct paxos_message
 		paxos_trim trim;
 		paxos_acceptor_state state;
 		paxos_client_value client_value;
+		paxos_snapshot_request snapshot_request;
+		paxos_snapshot_chunk snapshot_chunk;
+		paxos_catchup catchup;
+		paxos_chosen chosen;
+		paxos_replica_state replica_state;
+		paxos_accept_batch accept_batch;
+		paxos_accepted_batch accepted_batch;
+		paxos_client_reply client_reply;
+		paxos_heartbeat heartbeat;
+		paxos_heartbeat_ack heartbeat_ack;
+		paxos_prepare_range prepare_range;
+		paxos_promise_range promise_range;
+		paxos_safe_time safe_time;
 	} u;
 };
 typedef struct paxos_message paxos_message;
@@ -41,17 +41,30 @@ struct timeout_iterator;
 struct proposer* proposer_new(int id, int acceptors, int q1, int q2);
 void proposer_free(struct proposer* p);
 void proposer_propose(struct proposer* p, const char* value, size_t size);
+void proposer_propose_request(struct proposer* p, const char* value,
+	size_t size, unsigned request);
+int proposer_take_decided(struct proposer* p, unsigned* request, iid_t* iid);
+iid_t proposer_commit_iid(struct proposer* p);
 int proposer_prepared_count(struct proposer* p);
+int proposer_queued_count(struct proposer* p);
 void proposer_set_instance_id(struct proposer* p, iid_t iid);
+void proposer_set_partition(struct proposer* p, int owners);
+int proposer_range_prepared(struct proposer* p);
 
 // phase 1
-void proposer_prepare(struct proposer* p, paxos_prepare* out);
+int proposer_prepare(struct proposer* p, paxos_prepare* out);
+int proposer_prepare_fill(struct proposer* p, iid_t iid, paxos_prepare* out);
 int proposer_receive_promise(struct proposer* p, paxos_promise* ack,
 	paxos_prepare* out);
+int proposer_prepare_range(struct proposer* p, paxos_prepare_range* out);
+int proposer_receive_promise_range(struct proposer* p,
+	paxos_promise_range* ack, paxos_prepare_range* out);
 
 // phase 2
 int proposer_accept(struct proposer* p, paxos_accept* out);
 int proposer_receive_accepted(struct proposer* p, paxos_accepted* ack);
+int proposer_receive_chosen(struct proposer* p, paxos_chosen* chosen);
+int proposer_receive_fast_accepted(struct proposer* p, paxos_accepted* ack);
 int proposer_receive_preempted(struct proposer* p, paxos_preempted* ack,
 	paxos_prepare* out);
 
@@ -63,6 +76,9 @@ void proposer_receive_acceptor_state(struct proposer* p,
 struct timeout_iterator* proposer_timeout_iterator(struct proposer* p);
 int timeout_iterator_prepare(struct timeout_iterator* iter, paxos_prepare* out);
 int timeout_iterator_accept(struct timeout_iterator* iter, paxos_accept* out);
+int timeout_iterator_fast(struct timeout_iterator* iter, iid_t* iid);
+int timeout_iterator_range(struct timeout_iterator* iter,
+	paxos_prepare_range* out);
 void timeout_iterator_free(struct timeout_iterator* iter);
 
 #ifdef __cplusplus
@@ -34,10 +34,12 @@ extern "C" {
 #endif
 
 #include "paxos.h"
+#include "storage_cache.h"
 
 struct storage
 {
 	void* handle;
+	struct storage_cache* cache;
 	struct
 	{
 		int (*open) (void* handle);
@@ -49,10 +51,15 @@ struct storage
 		int (*put) (void* handle, paxos_accepted* acc);
 		int (*trim) (void* handle, iid_t iid);
 		iid_t (*get_trim_instance) (void* handle);
+		iid_t (*get_max_instance) (void* handle);
+		int (*get_range) (void* handle, int owner, paxos_prepare_range* out);
+		int (*put_range) (void* handle, int owner, paxos_prepare_range* range);
 	} api;
 };
 
 void storage_init(struct storage* store, int acceptor_id);
+void storage_init_shard(struct storage* store, int acceptor_id, int shard,
+	uint32_t log);
 int storage_open(struct storage* store);
 void storage_close(struct storage* store);
 int storage_tx_begin(struct storage* store);
@@ -62,9 +69,15 @@ int storage_get_record(struct storage* store, iid_t iid, paxos_accepted* out);
 int storage_put_record(struct storage* store, paxos_accepted* acc);
 int storage_trim(struct storage* store, iid_t iid);
 iid_t storage_get_trim_instance(struct storage* store);
+iid_t storage_get_max_instance(struct storage* store);
+int storage_get_range(struct storage* store, int owner,
+	paxos_prepare_range* out);
+int storage_put_range(struct storage* store, int owner,
+	paxos_prepare_range* range);
 
 void storage_init_mem(struct storage* s, int acceptor_id);
-void storage_init_lmdb(struct storage* s, int acceptor_id);
+void storage_init_lmdb(struct storage* s, int acceptor_id, int shard,
+	uint32_t log);
 
 #ifdef __cplusplus
 }
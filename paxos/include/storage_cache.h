@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2013-2015, University of Lugano
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holders nor the names of it
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef _STORAGE_CACHE_H_
+#define _STORAGE_CACHE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "paxos.h"
+#include <stddef.h>
+
+struct storage_cache;
+
+struct storage_cache* storage_cache_new(size_t max_size);
+void storage_cache_free(struct storage_cache* c);
+int storage_cache_get(struct storage_cache* c, iid_t iid, paxos_accepted* out);
+void storage_cache_put(struct storage_cache* c, paxos_accepted* acc);
+void storage_cache_trim(struct storage_cache* c, iid_t iid);
+void storage_cache_clear(struct storage_cache* c);
+size_t storage_cache_size(struct storage_cache* c);
+unsigned long storage_cache_hits(struct storage_cache* c);
+unsigned long storage_cache_misses(struct storage_cache* c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
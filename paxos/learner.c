@@ -60,9 +60,10 @@ static struct instance* instance_new(int acceptors);
 static void instance_free(struct instance* i, int acceptors);
 static void instance_update(struct instance* i, paxos_accepted* ack, int acceptors, int quorum_size);
 static int instance_has_quorum(struct instance* i, int acceptors, int quorum_size);
+static int instance_has_fast_quorum(struct instance* i, int acceptors);
 static void instance_add_accept(struct instance* i, paxos_accepted* ack);
 static paxos_accepted* paxos_accepted_dup(paxos_accepted* ack);
-static void paxos_value_copy(paxos_value* dst, paxos_value* src);
+static int paxos_value_cmp(paxos_value* v1, paxos_value* v2);
 
 
 struct learner*
@@ -91,6 +92,19 @@ learner_free(struct learner* l)
 void
 learner_set_instance_id(struct learner* l, iid_t iid)
 {
+	khiter_t k;
+	struct instance* inst;
+	// drop pending instances that will never be delivered
+	for (k = kh_begin(l->instances); k != kh_end(l->instances); ++k) {
+		if (!kh_exist(l->instances, k))
+			continue;
+		inst = kh_value(l->instances, k);
+		if (inst->iid <= iid) {
+			kh_del_instance(l->instances, k);
+			instance_free(inst, l->acceptors);
+		}
+	}
+	l->late_start = 0;
 	l->current_iid = iid + 1;
 	l->highest_iid_closed = iid;
 }
@@ -119,6 +133,34 @@ learner_receive_accepted(struct learner* l, paxos_accepted* ack)
 		l->highest_iid_closed = inst->iid;
 }
 
+/*
+	Called when another learner tells us the value chosen for an instance,
+	the instance is closed right away, regardless of the acks received so far.
+*/
+void
+learner_receive_chosen(struct learner* l, paxos_chosen* chosen)
+{
+	if (chosen->iid < l->current_iid) {
+		paxos_log_debug("Dropped paxos_chosen for iid %u. Already delivered.",
+			chosen->iid);
+		return;
+	}
+
+	struct instance* inst;
+	inst = learner_get_instance_or_create(l, chosen->iid);
+	if (instance_has_quorum(inst, l->acceptors, l->quorum_size))
+		return;
+
+	paxos_accepted ack = {0, chosen->iid, chosen->ballot, chosen->ballot,
+		chosen->value, chosen->timestamp};
+	inst->iid = chosen->iid;
+	instance_add_accept(inst, &ack);
+	inst->final_value = inst->acks[0];
+
+	if (inst->iid > l->highest_iid_closed)
+		l->highest_iid_closed = inst->iid;
+}
+
 int
 learner_deliver_next(struct learner* l, paxos_accepted* out)
 {
@@ -132,6 +174,30 @@ learner_deliver_next(struct learner* l, paxos_accepted* out)
 	return 1;
 }
 
+/*
+	Copies to out a value accepted at the highest ballot seen for the next
+	instance to be delivered, while the instance is not closed yet. Values
+	accepted at a lower ballot are no longer worth speculating on.
+	Returns 1 if some acceptor accepted a value for it, 0 otherwise.
+*/
+int
+learner_speculate_next(struct learner* l, paxos_accepted* out)
+{
+	int i;
+	struct instance* inst = learner_get_current_instance(l);
+	if (inst == NULL || instance_has_quorum(inst, l->acceptors, l->quorum_size))
+		return 0;
+	for (i = 0; i < l->acceptors; i++) {
+		paxos_accepted* ack = inst->acks[i];
+		if (ack != NULL && ack->ballot == inst->last_update_ballot) {
+			memcpy(out, ack, sizeof(paxos_accepted));
+			paxos_value_copy(&out->value, &ack->value);
+			return 1;
+		}
+	}
+	return 0;
+}
+
 int
 learner_has_holes(struct learner* l, iid_t* from, iid_t* to)
 {
@@ -245,6 +311,10 @@ instance_has_quorum(struct instance* inst, int acceptors, int quorum_size)
 	if (inst->final_value != NULL)
 		return 1;
 
+	if (paxos_config.fast_paxos &&
+		inst->last_update_ballot == PAXOS_FAST_BALLOT)
+		return instance_has_fast_quorum(inst, acceptors);
+
 	for (i = 0; i < acceptors; i++) {
 		curr_ack = inst->acks[i];
 
@@ -266,6 +336,28 @@ instance_has_quorum(struct instance* inst, int acceptors, int quorum_size)
 	return 0;
 }
 
+/*
+	Values of the fast round are sent to the acceptors by clients, which
+	may accept different ones for the same instance. The instance is closed
+	only once all the acceptors accepted the same value at the fast ballot,
+	otherwise the proposer decides it in a classic round.
+*/
+static int
+instance_has_fast_quorum(struct instance* inst, int acceptors)
+{
+	int i;
+	paxos_accepted* first = inst->acks[0];
+	for (i = 0; i < acceptors; i++) {
+		paxos_accepted* ack = inst->acks[i];
+		if (ack == NULL || ack->ballot != PAXOS_FAST_BALLOT ||
+			paxos_value_cmp(&ack->value, &first->value) != 0)
+			return 0;
+	}
+	paxos_log_debug("Reached fast quorum, iid: %u is closed!", inst->iid);
+	inst->final_value = first;
+	return 1;
+}
+
 /*
 	Adds the given paxos_accepted to the given instance,
 	replacing the previous paxos_accepted, if any.
@@ -293,13 +385,10 @@ paxos_accepted_dup(paxos_accepted* ack)
 	return copy;
 }
 
-static void
-paxos_value_copy(paxos_value* dst, paxos_value* src)
+static int
+paxos_value_cmp(paxos_value* v1, paxos_value* v2)
 {
-	int len = src->paxos_value_len;
-	dst->paxos_value_len = len;
-	if (src->paxos_value_val != NULL) {
-		dst->paxos_value_val = malloc(len);
-		memcpy(dst->paxos_value_val, src->paxos_value_val, len);
-	}
+	if (v1->paxos_value_len != v2->paxos_value_len)
+		return -1;
+	return memcmp(v1->paxos_value_val, v2->paxos_value_val, v1->paxos_value_len);
 }
@@ -37,9 +37,29 @@ struct paxos_config paxos_config =
 {
 	.verbosity = PAXOS_LOG_INFO,
 	.tcp_nodelay = 1,
+	.io_threads = 0,
+	.io_threads_pin = 0,
+	.binary_codec = 1,
+	.max_frame_size = 64*1024*1024,
+	.replica_loopback = 1,
+	.shm_transport = 0,
+	.shm_path = "/tmp/evpaxos",
 	.learner_catch_up = 1,
+	.learner_log_size = 0,
+	.learner_cursor_path = NULL,
+	.learner_cursor_interval = 1,
+	.learner_cursor_sync = 0,
+	.learner_stall_deadline = 1000,
+	.learner_snapshot_max_size = 1024*1024*1024,
 	.proposer_timeout = 1,
 	.proposer_preexec_window = 128,
+	.proposer_accept_batch = 32,
+	.proposer_leader_timeout = 3000,
+	.proposer_takeover_backoff = 200,
+	.proposer_lease = 0,
+	.proposer_partition = 0,
+	.proposer_max_requests = 65536,
+	.client_timeout = 5,
 	.storage_backend = PAXOS_MEM_STORAGE,
 	.trash_files = 0,
 	.lmdb_sync = 0,
@@ -47,6 +67,10 @@ struct paxos_config paxos_config =
 	.quorum_2 = 2,
 	.group_1 = 2,
 	.group_2 = 2,
+	.fast_paxos = 0,
+	.acceptor_cache_size = 0,
+	.acceptor_shards = 1,
+	.acceptor_ring = 0,
 	.lmdb_env_path = "/tmp/acceptor",
 	.lmdb_mapsize = 10*1024*1024
 };
@@ -108,6 +132,36 @@ paxos_client_value_destroy(paxos_client_value* p)
 	paxos_value_destroy(&p->value);
 }
 
+void
+paxos_snapshot_chunk_destroy(paxos_snapshot_chunk* p)
+{
+	paxos_value_destroy(&p->data);
+}
+
+void
+paxos_chosen_destroy(paxos_chosen* p)
+{
+	paxos_value_destroy(&p->value);
+}
+
+void
+paxos_accept_batch_destroy(paxos_accept_batch* p)
+{
+	int i;
+	for (i = 0; i < p->entries_len; i++)
+		paxos_value_destroy(&p->entries_val[i].value);
+	free(p->entries_val);
+}
+
+void
+paxos_accepted_batch_destroy(paxos_accepted_batch* p)
+{
+	int i;
+	for (i = 0; i < p->entries_len; i++)
+		paxos_value_destroy(&p->entries_val[i].value);
+	free(p->entries_val);
+}
+
 void
 paxos_message_destroy(paxos_message* m)
 {
@@ -124,22 +178,114 @@ paxos_message_destroy(paxos_message* m)
 	case PAXOS_CLIENT_VALUE:
 		paxos_client_value_destroy(&m->u.client_value);
 		break;
+	case PAXOS_SNAPSHOT_CHUNK:
+		paxos_snapshot_chunk_destroy(&m->u.snapshot_chunk);
+		break;
+	case PAXOS_CHOSEN:
+		paxos_chosen_destroy(&m->u.chosen);
+		break;
+	case PAXOS_ACCEPT_BATCH:
+		paxos_accept_batch_destroy(&m->u.accept_batch);
+		break;
+	case PAXOS_ACCEPTED_BATCH:
+		paxos_accepted_batch_destroy(&m->u.accepted_batch);
+		break;
+	default: break;
+	}
+}
+
+void
+paxos_value_copy(paxos_value* dst, paxos_value* src)
+{
+	dst->paxos_value_len = src->paxos_value_len;
+	dst->paxos_value_val = NULL;
+	if (src->paxos_value_len > 0) {
+		dst->paxos_value_val = malloc(src->paxos_value_len);
+		memcpy(dst->paxos_value_val, src->paxos_value_val,
+			src->paxos_value_len);
+	}
+}
+
+/*
+	Makes a deep copy of the message, to be released with
+	paxos_message_destroy().
+*/
+void
+paxos_message_copy(paxos_message* dst, paxos_message* src)
+{
+	int i;
+	*dst = *src;
+	switch (src->type) {
+	case PAXOS_PROMISE:
+		paxos_value_copy(&dst->u.promise.value, &src->u.promise.value);
+		break;
+	case PAXOS_ACCEPT:
+		paxos_value_copy(&dst->u.accept.value, &src->u.accept.value);
+		break;
+	case PAXOS_ACCEPTED:
+		paxos_value_copy(&dst->u.accepted.value, &src->u.accepted.value);
+		break;
+	case PAXOS_CLIENT_VALUE:
+		paxos_value_copy(&dst->u.client_value.value,
+			&src->u.client_value.value);
+		break;
+	case PAXOS_SNAPSHOT_CHUNK:
+		paxos_value_copy(&dst->u.snapshot_chunk.data,
+			&src->u.snapshot_chunk.data);
+		break;
+	case PAXOS_CHOSEN:
+		paxos_value_copy(&dst->u.chosen.value, &src->u.chosen.value);
+		break;
+	case PAXOS_ACCEPT_BATCH:
+		dst->u.accept_batch.entries_val = malloc(
+			src->u.accept_batch.entries_len * sizeof(paxos_accept_entry));
+		for (i = 0; i < src->u.accept_batch.entries_len; i++) {
+			dst->u.accept_batch.entries_val[i] =
+				src->u.accept_batch.entries_val[i];
+			paxos_value_copy(&dst->u.accept_batch.entries_val[i].value,
+				&src->u.accept_batch.entries_val[i].value);
+		}
+		break;
+	case PAXOS_ACCEPTED_BATCH:
+		dst->u.accepted_batch.entries_val = malloc(
+			src->u.accepted_batch.entries_len * sizeof(paxos_accepted_entry));
+		for (i = 0; i < src->u.accepted_batch.entries_len; i++) {
+			dst->u.accepted_batch.entries_val[i] =
+				src->u.accepted_batch.entries_val[i];
+			paxos_value_copy(&dst->u.accepted_batch.entries_val[i].value,
+				&src->u.accepted_batch.entries_val[i].value);
+		}
+		break;
 	default: break;
 	}
 }
 
+/*
+	Returns the current time in milliseconds since the epoch, as used for
+	the commit timestamps of the values.
+*/
+uint64_t
+paxos_timestamp(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
 void
 paxos_log(int level, const char* format, va_list ap)
 {
 	int off;
 	char msg[1024];
+	struct tm tm;
 	struct timeval tv;
 
 	if (level > paxos_config.verbosity)
 		return;
 
 	gettimeofday(&tv,NULL);
-	off = strftime(msg, sizeof(msg), "%d %b %H:%M:%S. ", localtime(&tv.tv_sec));
+	localtime_r(&tv.tv_sec, &tm);
+	off = strftime(msg, sizeof(msg), "%d %b %H:%M:%S. ", &tm);
 	vsnprintf(msg+off, sizeof(msg)-off, format, ap);
 	fprintf(stdout,"%s\n", msg);
 }
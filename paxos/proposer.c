@@ -44,9 +44,30 @@ struct instance
 	ballot_t value_ballot;
 	struct quorum quorum;
 	struct timeval created_at;
+	uint64_t timestamp;       /* Commit timestamp of the value */
+	int fill;                 /* Decide the accepted value or a no-op */
+	int noop;                 /* The value is a no-op, not a client's */
+	int owned;                /* Promised by the owner's ranged phase 1 */
 };
 KHASH_MAP_INIT_INT(instance, struct instance*)
 
+/*
+	Values proposed on behalf of a client request carry its id, which is
+	reported back once the value is decided. They are freed as any other
+	paxos_value, the request id being laid out after it.
+*/
+struct request_value
+{
+	paxos_value value;
+	unsigned request;
+};
+
+struct decided_request
+{
+	unsigned request;
+	iid_t iid;
+};
+
 struct proposer
 {
 	int id;
@@ -56,13 +77,27 @@ struct proposer
 	struct carray* values;
 	iid_t max_trim_iid;
 	iid_t next_prepare_iid;
+	int owners;                           /* Proposers sharing the iids */
+	ballot_t range_ballot;                /* Ballot of the owned instances */
+	iid_t range_from;                     /* First of them, in phase 1 */
+	iid_t range_max;                      /* Up to it they need a prepare */
+	int range_prepared;
+	struct quorum range_quorum;
+	struct timeval range_sent;
+	iid_t seen_iid;                       /* Highest iid seen accepted */
+	iid_t commit_iid;                     /* Highest iid known accepted */
+	uint64_t timestamp;                   /* Last commit timestamp given */
 	khash_t(instance)* prepare_instances; /* Waiting for prepare acks */
 	khash_t(instance)* accept_instances;  /* Waiting for accept acks */
+	khash_t(instance)* fast_instances;    /* Accepted in the fast round */
+	int decided_count;
+	int decided_size;
+	struct decided_request* decided;      /* Not yet taken */
 };
 
 struct timeout_iterator
 {
-	khiter_t pi, ai;
+	khiter_t pi, ai, fi;
 	struct timeval timeout;
 	struct proposer* proposer;
 };
@@ -79,6 +114,8 @@ static void instance_free(struct instance* inst);
 static int instance_has_value(struct instance* inst);
 static int instance_has_promised_value(struct instance* inst);
 static int instance_has_timedout(struct instance* inst, struct timeval* now);
+static int instance_has_client_value(struct instance* inst);
+static int instance_prepared(struct instance* inst);
 static void instance_to_accept(struct instance* inst, paxos_accept* acc);
 static void carray_paxos_value_free(void* v);
 static int paxos_value_cmp(struct paxos_value* v1, struct paxos_value* v2);
@@ -95,9 +132,22 @@ proposer_new(int id, int acceptors, int q1, int q2)
 	p->q2 = q2;
 	p->max_trim_iid = 0;
 	p->next_prepare_iid = 0;
+	p->owners = 1;
+	p->range_ballot = 0;
+	p->range_from = 0;
+	p->range_max = 0;
+	p->range_prepared = 0;
+	quorum_init(&p->range_quorum, acceptors, q1);
+	p->seen_iid = 0;
+	p->commit_iid = 0;
+	p->timestamp = 0;
 	p->values = carray_new(128);
 	p->prepare_instances = kh_init(instance);
 	p->accept_instances = kh_init(instance);
+	p->fast_instances = kh_init(instance);
+	p->decided_count = 0;
+	p->decided_size = 0;
+	p->decided = NULL;
 	return p;
 }
 
@@ -107,19 +157,74 @@ proposer_free(struct proposer* p)
 	struct instance* inst;
 	kh_foreach_value(p->prepare_instances, inst, instance_free(inst));
 	kh_foreach_value(p->accept_instances, inst, instance_free(inst));
+	kh_foreach_value(p->fast_instances, inst, instance_free(inst));
 	kh_destroy(instance, p->prepare_instances);
 	kh_destroy(instance, p->accept_instances);
+	kh_destroy(instance, p->fast_instances);
 	carray_foreach(p->values, carray_paxos_value_free);
 	carray_free(p->values);
+	quorum_destroy(&p->range_quorum);
+	free(p->decided);
 	free(p);
 }
 
 void
 proposer_propose(struct proposer* p, const char* value, size_t size)
 {
-	paxos_value* v;
-	v = paxos_value_new(value, size);
-	carray_push_back(p->values, v);
+	proposer_propose_request(p, value, size, 0);
+}
+
+/*
+	Proposes a value on behalf of the given client request, if not 0, whose
+	id is returned by proposer_take_decided() once the value is decided.
+*/
+void
+proposer_propose_request(struct proposer* p, const char* value, size_t size,
+	unsigned request)
+{
+	struct request_value* v = malloc(sizeof(struct request_value));
+	v->value.paxos_value_len = size;
+	v->value.paxos_value_val = malloc(size);
+	memcpy(v->value.paxos_value_val, value, size);
+	v->request = request;
+	carray_push_back(p->values, &v->value);
+}
+
+int
+proposer_take_decided(struct proposer* p, unsigned* request, iid_t* iid)
+{
+	if (p->decided_count == 0)
+		return 0;
+	p->decided_count--;
+	*request = p->decided[p->decided_count].request;
+	*iid = p->decided[p->decided_count].iid;
+	return 1;
+}
+
+static void
+proposer_add_decided(struct proposer* p, struct instance* inst)
+{
+	struct request_value* v = (struct request_value*)inst->value;
+	if (v->request == 0)
+		return;
+	if (p->decided_count == p->decided_size) {
+		p->decided_size = p->decided_size ? 2 * p->decided_size : 16;
+		p->decided = realloc(p->decided,
+			p->decided_size * sizeof(struct decided_request));
+	}
+	p->decided[p->decided_count++] =
+		(struct decided_request) { v->request, inst->iid };
+}
+
+/*
+	Returns the highest instance id decided by the proposer, or found bound
+	to an accepted value in phase 1, which learners must reach to reflect
+	every value decided so far.
+*/
+iid_t
+proposer_commit_iid(struct proposer* p)
+{
+	return p->commit_iid;
 }
 
 int
@@ -128,6 +233,12 @@ proposer_prepared_count(struct proposer* p)
 	return kh_size(p->prepare_instances);
 }
 
+int
+proposer_queued_count(struct proposer* p)
+{
+	return carray_count(p->values);
+}
+
 void
 proposer_set_instance_id(struct proposer* p, iid_t iid)
 {
@@ -136,20 +247,181 @@ proposer_set_instance_id(struct proposer* p, iid_t iid)
 		// remove instances older than iid
 		proposer_trim_instances(p, p->prepare_instances, iid);
 		proposer_trim_instances(p, p->accept_instances, iid);
+		proposer_trim_instances(p, p->fast_instances, iid);
 	}
 }
 
+/*
+	Partitions the instances round-robin among the given number of
+	proposers, this one deciding those with (iid - 1) % owners equal to its
+	id. No instance is opened until a single ranged phase 1 for all the
+	owned ones is over, see proposer_prepare_range().
+*/
 void
+proposer_set_partition(struct proposer* p, int owners)
+{
+	p->owners = owners;
+}
+
+static int
+proposer_owns(struct proposer* p, iid_t iid)
+{
+	return p->owners == 1 || (iid - 1) % p->owners == p->id;
+}
+
+/*
+	Whether instances can be opened, that is, unless partitioned, or once
+	the ranged phase 1 of the owned instances is over.
+*/
+int
+proposer_range_prepared(struct proposer* p)
+{
+	return p->owners == 1 || p->range_prepared;
+}
+
+/*
+	Starts the ranged phase 1 of the owned instances, from the next one
+	on, at a ballot higher than any the proposer tried before. Acceptors
+	promise it only if higher than any they promised to this owner, so
+	that an owner that restarts never reuses the ballot it had.
+	Returns 1 if the prepare in out is to be sent.
+*/
+int
+proposer_prepare_range(struct proposer* p, paxos_prepare_range* out)
+{
+	if (proposer_range_prepared(p))
+		return 0;
+	p->range_from = p->next_prepare_iid + 1;
+	while (!proposer_owns(p, p->range_from))
+		p->range_from++;
+	/* the next ballot of ours, those of owners may not collide */
+	p->range_ballot = (p->range_ballot / MAX_N_OF_PROPOSERS + 1) *
+		MAX_N_OF_PROPOSERS + p->id;
+	p->range_max = 0;
+	quorum_clear(&p->range_quorum);
+	gettimeofday(&p->range_sent, NULL);
+	*out = (paxos_prepare_range) {p->range_from, p->range_ballot, p->owners};
+	return 1;
+}
+
+/*
+	Once a quorum promised the ranged ballot, owned instances above the
+	highest instance any of them holds a record of skip phase 1, the ones
+	below are prepared one by one, for the values accepted in them.
+	Returns 1 if the ranged phase 1 is to be started again with out.
+*/
+int
+proposer_receive_promise_range(struct proposer* p, paxos_promise_range* ack,
+	paxos_prepare_range* out)
+{
+	if (proposer_range_prepared(p) || ack->from != p->range_from ||
+		ack->ballot != p->range_ballot)
+		return 0;
+	if (ack->prev_ballot >= ack->ballot) {
+		paxos_log_debug("Ranged prepare preempted: ballot %d ack ballot %d",
+			ack->ballot, ack->prev_ballot);
+		p->range_ballot = ack->prev_ballot;
+		return proposer_prepare_range(p, out);
+	}
+	if (!quorum_add(&p->range_quorum, ack->aid))
+		return 0;
+	if (ack->max_iid > p->range_max)
+		p->range_max = ack->max_iid;
+	if (quorum_reached(&p->range_quorum)) {
+		paxos_log_debug("Ranged phase 1 over, owned iids above %u prepared",
+			p->range_max);
+		p->range_prepared = 1;
+	}
+	return 0;
+}
+
+/*
+	Values that were accepted for instances above the given one, which then
+	must not stay undecided for later instances to be delivered. Partitioned
+	proposers skip their own instances once another one is seen ahead.
+*/
+static int
+proposer_has_later_value(struct proposer* p, iid_t iid)
+{
+	struct instance* inst;
+	if (p->owners > 1 && p->seen_iid > iid)
+		return 1;
+	kh_foreach_value(p->accept_instances, inst, {
+		if (inst->iid > iid)
+			return 1;
+	});
+	kh_foreach_value(p->prepare_instances, inst, {
+		if (inst->iid > iid && instance_has_promised_value(inst))
+			return 1;
+	});
+	return 0;
+}
+
+static paxos_value*
+proposer_noop_value()
+{
+	struct request_value* v = malloc(sizeof(struct request_value));
+	v->value.paxos_value_len = 0;
+	v->value.paxos_value_val = NULL;
+	v->request = 0;
+	return &v->value;
+}
+
+/*
+	Opens the next instance. Returns 1 if the prepare in out is to be sent,
+	0 if the instance is owned by this proposer and prepared already.
+*/
+int
 proposer_prepare(struct proposer* p, paxos_prepare* out)
 {
 	int rv;
+	assert(proposer_range_prepared(p));
 	iid_t iid = ++(p->next_prepare_iid);
+	while (!proposer_owns(p, iid))
+		iid++;
+	p->next_prepare_iid = iid;
 	ballot_t bal = proposer_next_ballot(p, 0);
+	if (p->owners > 1)
+		bal = p->range_ballot;
 	struct instance* inst = instance_new(iid, bal, p->acceptors, p->q1);
+	inst->owned = p->owners > 1 && iid > p->range_max;
 	khiter_t k = kh_put_instance(p->prepare_instances, iid, &rv);
 	assert(rv > 0);
 	kh_value(p->prepare_instances, k) = inst;
 	*out = (paxos_prepare) {inst->iid, inst->ballot};
+	return !inst->owned;
+}
+
+/*
+	Opens the given instance once more, for it to be decided with the value
+	accepted by the acceptors, if any, or with a no-op otherwise. Used for
+	instances that block the delivery of later ones. An instance pending in
+	phase 1 already is just marked to be filled the same way.
+	Returns 1 if the prepare in out is to be sent.
+*/
+int
+proposer_prepare_fill(struct proposer* p, iid_t iid, paxos_prepare* out)
+{
+	int rv;
+	khiter_t k;
+	struct instance* inst;
+	if (iid <= p->max_trim_iid ||
+		kh_get_instance(p->accept_instances, iid) != kh_end(p->accept_instances))
+		return 0;
+	k = kh_get_instance(p->prepare_instances, iid);
+	if (k != kh_end(p->prepare_instances)) {
+		kh_value(p->prepare_instances, k)->fill = 1;
+		return 0;
+	}
+	inst = instance_new(iid, proposer_next_ballot(p, 0), p->acceptors, p->q1);
+	inst->fill = 1;
+	k = kh_put_instance(p->prepare_instances, iid, &rv);
+	assert(rv > 0);
+	kh_value(p->prepare_instances, k) = inst;
+	if (iid > p->next_prepare_iid && proposer_owns(p, iid))
+		p->next_prepare_iid = iid;
+	*out = (paxos_prepare) {inst->iid, inst->ballot};
+	return 1;
 }
 
 int
@@ -185,8 +457,10 @@ proposer_receive_promise(struct proposer* p, paxos_promise* ack,
 	paxos_log_debug("Received valid promise from: %d, iid: %u",
 		ack->aid, inst->iid);
 
-	if (ack->value.paxos_value_len > 0) {
+	if (ack->value_ballot > 0) {
 		paxos_log_debug("Promise has value");
+		if (ack->iid > p->commit_iid)
+			p->commit_iid = ack->iid;
 		if (ack->value_ballot > inst->value_ballot) {
 			if (instance_has_promised_value(inst))
 				paxos_value_free(inst->promised_value);
@@ -216,31 +490,65 @@ proposer_accept(struct proposer* p, paxos_accept* out)
 			inst = kh_value(h, k);
 	}
 
-	if (inst == NULL || !quorum_reached(&inst->quorum))
+	if (inst == NULL || !instance_prepared(inst))
 		return 0;
 
 	paxos_log_debug("Trying to accept iid %u", inst->iid);
 
 	// Is there a value to accept?
-	if (!instance_has_value(inst))
+	if (!instance_has_value(inst) && !inst->fill)
 		inst->value = carray_pop_front(p->values);
 	if (!instance_has_value(inst) && !instance_has_promised_value(inst)) {
-		paxos_log_debug("Proposer: No value to accept");
-		return 0;
+		if (!inst->fill && !proposer_has_later_value(p, inst->iid)) {
+			paxos_log_debug("Proposer: No value to accept");
+			return 0;
+		}
+		// Later instances wait for this one, fill it with a no-op
+		paxos_log_debug("Proposer: Filling iid %u with a no-op", inst->iid);
+		inst->fill = 1;
+		inst->noop = 1;
+		inst->value = proposer_noop_value();
 	}
 
-	// We have both a prepared instance and a value
+	// We have both a prepared instance and a value, stamp it no earlier
+	// than the values accepted before
+	inst->timestamp = paxos_timestamp();
+	if (inst->timestamp < p->timestamp)
+		inst->timestamp = p->timestamp;
+	p->timestamp = inst->timestamp;
+	inst->owned = 0;
 	proposer_move_instance(p->prepare_instances, p->accept_instances, inst, p->q2);
 	instance_to_accept(inst, out);
 
 	return 1;
 }
 
+static void
+proposer_instance_chosen(struct proposer* p, khiter_t k, struct instance* inst)
+{
+	if (inst->iid > p->commit_iid)
+		p->commit_iid = inst->iid;
+	if (instance_has_client_value(inst)) {
+		if (instance_has_promised_value(inst) &&
+			paxos_value_cmp(inst->value, inst->promised_value) != 0) {
+			carray_push_back(p->values, inst->value);
+			inst->value = NULL;
+		} else {
+			proposer_add_decided(p, inst);
+		}
+	}
+	kh_del_instance(p->accept_instances, k);
+	instance_free(inst);
+}
+
 int
 proposer_receive_accepted(struct proposer* p, paxos_accepted* ack)
 {
 	khiter_t k = kh_get_instance(p->accept_instances, ack->iid);
 
+	if (ack->iid > p->seen_iid)
+		p->seen_iid = ack->iid;
+
 	if (k == kh_end(p->accept_instances)) {
 		paxos_log_debug("Accept ack dropped, iid: %u not pending", ack->iid);
 		return 0;
@@ -257,14 +565,7 @@ proposer_receive_accepted(struct proposer* p, paxos_accepted* ack)
 
 		if (quorum_reached(&inst->quorum)) {
 			paxos_log_debug("Proposer: Quorum reached for instance %u", inst->iid);
-			if (instance_has_promised_value(inst)) {
-				if (inst->value != NULL && paxos_value_cmp(inst->value, inst->promised_value) != 0) {
-					carray_push_back(p->values, inst->value);
-					inst->value = NULL;
-				}
-			}
-			kh_del_instance(p->accept_instances, k);
-			instance_free(inst);
+			proposer_instance_chosen(p, k, inst);
 		}
 
 		return 1;
@@ -273,6 +574,70 @@ proposer_receive_accepted(struct proposer* p, paxos_accepted* ack)
 	}
 }
 
+/*
+	Received the value chosen for an instance, from the last acceptor of a
+	ring, which stands for the accepteds of all the acceptors before it.
+*/
+int
+proposer_receive_chosen(struct proposer* p, paxos_chosen* chosen)
+{
+	khiter_t k = kh_get_instance(p->accept_instances, chosen->iid);
+
+	if (chosen->iid > p->seen_iid)
+		p->seen_iid = chosen->iid;
+
+	if (k == kh_end(p->accept_instances)) {
+		paxos_log_debug("Chosen dropped, iid: %u not pending", chosen->iid);
+		return 0;
+	}
+
+	struct instance* inst = kh_value(p->accept_instances, k);
+	if (chosen->ballot != inst->ballot)
+		return 0;
+	proposer_instance_chosen(p, k, inst);
+	return 1;
+}
+
+/*
+	Tracks the accepteds of the fast round, which no proposer is waiting
+	for, until every acceptor accepted the same value. Acceptors that
+	accepted different values for the same instance collided, and none of
+	those values can be chosen unless a proposer decides it in a classic
+	round, as evproposer_fill() does.
+	Returns 1 if the instance collided, 0 otherwise.
+*/
+int
+proposer_receive_fast_accepted(struct proposer* p, paxos_accepted* ack)
+{
+	int rv;
+	khiter_t k;
+	struct instance* inst;
+	if (ack->ballot != PAXOS_FAST_BALLOT || ack->iid <= p->max_trim_iid)
+		return 0;
+	k = kh_get_instance(p->fast_instances, ack->iid);
+	if (k == kh_end(p->fast_instances)) {
+		inst = instance_new(ack->iid, ack->ballot, p->acceptors, p->acceptors);
+		inst->promised_value = paxos_value_new(ack->value.paxos_value_val,
+			ack->value.paxos_value_len);
+		k = kh_put_instance(p->fast_instances, ack->iid, &rv);
+		assert(rv > 0);
+		kh_value(p->fast_instances, k) = inst;
+	}
+	inst = kh_value(p->fast_instances, k);
+	if (paxos_value_cmp(inst->promised_value, &ack->value) != 0) {
+		paxos_log_debug("Collision in the fast round, iid: %u", inst->iid);
+		kh_del_instance(p->fast_instances, k);
+		instance_free(inst);
+		return 1;
+	}
+	quorum_add(&inst->quorum, ack->aid);
+	if (quorum_reached(&inst->quorum)) {
+		kh_del_instance(p->fast_instances, k);
+		instance_free(inst);
+	}
+	return 0;
+}
+
 int
 proposer_receive_preempted(struct proposer* p, paxos_preempted* ack,
 	paxos_prepare* out)
@@ -315,6 +680,7 @@ proposer_timeout_iterator(struct proposer* p)
 	iter = malloc(sizeof(struct timeout_iterator));
 	iter->pi = kh_begin(p->prepare_instances);
 	iter->ai = kh_begin(p->accept_instances);
+	iter->fi = kh_begin(p->fast_instances);
 	iter->proposer = p;
 	gettimeofday(&iter->timeout, NULL);
 	return iter;
@@ -327,7 +693,7 @@ next_timedout(khash_t(instance)* h, khiter_t* k, struct timeval* t)
 		if (!kh_exist(h, *k))
 			continue;
 		struct instance* inst = kh_value(h, *k);
-		if (quorum_reached(&inst->quorum))
+		if (instance_prepared(inst))
 			continue;
 		if (instance_has_timedout(inst, t))
 			return inst;
@@ -361,6 +727,38 @@ timeout_iterator_accept(struct timeout_iterator* iter, paxos_accept* out)
 	return 1;
 }
 
+/*
+	Instances of the fast round that not every acceptor accepted in time,
+	which then are no longer tracked, and are to be decided in a classic
+	round.
+*/
+int
+timeout_iterator_fast(struct timeout_iterator* iter, iid_t* iid)
+{
+	struct instance* inst;
+	struct proposer* p = iter->proposer;
+	inst = next_timedout(p->fast_instances, &iter->fi, &iter->timeout);
+	if (inst == NULL)
+		return 0;
+	*iid = inst->iid;
+	kh_del_instance(p->fast_instances, iter->fi);
+	instance_free(inst);
+	return 1;
+}
+
+/*
+	Starts the ranged phase 1 over, at a higher ballot, if not over in time.
+*/
+int
+timeout_iterator_range(struct timeout_iterator* iter, paxos_prepare_range* out)
+{
+	struct proposer* p = iter->proposer;
+	if (proposer_range_prepared(p) || iter->timeout.tv_sec -
+		p->range_sent.tv_sec < paxos_config.proposer_timeout)
+		return 0;
+	return proposer_prepare_range(p, out);
+}
+
 void
 timeout_iterator_free(struct timeout_iterator* iter)
 {
@@ -370,7 +768,7 @@ timeout_iterator_free(struct timeout_iterator* iter)
 static ballot_t
 proposer_next_ballot(struct proposer* p, ballot_t b)
 {
-	if (b > 0)
+	if (b >= MAX_N_OF_PROPOSERS)
 		return MAX_N_OF_PROPOSERS + b;
 	else
 		return MAX_N_OF_PROPOSERS + p->id;
@@ -380,6 +778,7 @@ static void
 proposer_preempt(struct proposer* p, struct instance* inst, paxos_prepare* out)
 {
 	inst->ballot = proposer_next_ballot(p, inst->ballot);
+	inst->owned = 0;
 	inst->value_ballot = 0;
 	inst->promised_value = NULL;
 	quorum_clear(&inst->quorum);
@@ -411,7 +810,7 @@ proposer_trim_instances(struct proposer* p, khash_t(instance)* h, iid_t iid)
 			continue;
 		struct instance* inst = kh_value(h,k);
 		if (inst->iid <= iid) {
-			if (instance_has_value(inst)) {
+			if (instance_has_client_value(inst)) {
 				carray_push_back(p->values, inst->value);
 				inst->value = NULL;
 			}
@@ -431,6 +830,9 @@ instance_new(iid_t iid, ballot_t ballot, int acceptors, int q1)
 	inst->value_ballot = 0;
 	inst->value = NULL;
 	inst->promised_value = NULL;
+	inst->fill = 0;
+	inst->noop = 0;
+	inst->owned = 0;
 	gettimeofday(&inst->created_at, NULL);
 	quorum_init(&inst->quorum, acceptors,q1);
 	assert(inst->iid > 0);
@@ -460,6 +862,27 @@ instance_has_promised_value(struct instance* inst)
 	return inst->promised_value != NULL;
 }
 
+/*
+	Whether the instance holds a value taken from the queue of values to be
+	proposed, to be put back there if the instance does not decide it. An
+	instance being filled may still hold one, taken before it was preempted.
+*/
+static int
+instance_has_client_value(struct instance* inst)
+{
+	return inst->value != NULL && !inst->noop;
+}
+
+/*
+	Whether phase 1 is over for the instance, or not needed. For instances
+	in phase 2, whether a quorum of acceptors accepted the value.
+*/
+static int
+instance_prepared(struct instance* inst)
+{
+	return inst->owned || quorum_reached(&inst->quorum);
+}
+
 static int
 instance_has_timedout(struct instance* inst, struct timeval* now)
 {
@@ -477,7 +900,8 @@ instance_to_accept(struct instance* inst, paxos_accept* accept)
 		inst->iid,
 		inst->ballot,
 		{ v->paxos_value_len,
-		  v->paxos_value_val }
+		  v->paxos_value_val },
+		inst->timestamp
 	};
 }
 
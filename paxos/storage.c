@@ -31,6 +31,18 @@
 
 void
 storage_init(struct storage* store, int acceptor_id)
+{
+	storage_init_shard(store, acceptor_id, 0, 0);
+}
+
+/*
+	Initializes the storage of one of the shards of an acceptor, shards
+	other than the first one are kept apart from it. The records of each
+	log are kept apart within the storage of a shard.
+*/
+void
+storage_init_shard(struct storage* store, int acceptor_id, int shard,
+	uint32_t log)
 {
 	switch(paxos_config.storage_backend) {
 		case PAXOS_MEM_STORAGE:
@@ -38,13 +50,16 @@ storage_init(struct storage* store, int acceptor_id)
 			break;
 		#ifdef HAS_LMDB
 		case PAXOS_LMDB_STORAGE:
-			storage_init_lmdb(store, acceptor_id);
+			storage_init_lmdb(store, acceptor_id, shard, log);
 			break;
 		#endif
 		default:
 		paxos_log_error("Storage backend not available");
 		exit(0);
 	}
+	store->cache = NULL;
+	if (paxos_config.acceptor_cache_size > 0)
+		store->cache = storage_cache_new(paxos_config.acceptor_cache_size);
 }
 
 int
@@ -57,6 +72,12 @@ void
 storage_close(struct storage* store)
 {
 	store->api.close(store->handle);
+	if (store->cache != NULL) {
+		paxos_log_info("Storage cache: %lu hits, %lu misses",
+			storage_cache_hits(store->cache),
+			storage_cache_misses(store->cache));
+		storage_cache_free(store->cache);
+	}
 }
 
 int
@@ -68,30 +89,47 @@ storage_tx_begin(struct storage* store)
 int
 storage_tx_commit(struct storage* store)
 {
-	return store->api.tx_commit(store->handle);
+	int rv = store->api.tx_commit(store->handle);
+	// the cache may hold records of the failed transaction
+	if (rv != 0 && store->cache != NULL)
+		storage_cache_clear(store->cache);
+	return rv;
 }
 
 void
 storage_tx_abort(struct storage* store)
 {
 	store->api.tx_abort(store->handle);
+	if (store->cache != NULL)
+		storage_cache_clear(store->cache);
 }
 
 int
 storage_get_record(struct storage* store, iid_t iid, paxos_accepted* out)
 {
-	return store->api.get(store->handle, iid, out);
+	int found;
+	if (store->cache != NULL && storage_cache_get(store->cache, iid, out))
+		return 1;
+	found = store->api.get(store->handle, iid, out);
+	if (found && store->cache != NULL)
+		storage_cache_put(store->cache, out);
+	return found;
 }
 
 int
 storage_put_record(struct storage* store, paxos_accepted* acc)
 {
-	return store->api.put(store->handle, acc);
+	int rv = store->api.put(store->handle, acc);
+	if (rv == 0 && store->cache != NULL)
+		storage_cache_put(store->cache, acc);
+	return rv;
 }
 
 int
 storage_trim(struct storage* store, iid_t iid)
 {
+	if (store->cache != NULL)
+		storage_cache_trim(store->cache, iid);
 	return store->api.trim(store->handle, iid);
 }
 
@@ -100,3 +138,29 @@ storage_get_trim_instance(struct storage* store)
 {
 	return store->api.get_trim_instance(store->handle);
 }
+
+/*
+	Returns the highest instance id a record was stored for, or the trim
+	instance id if there is none left.
+*/
+iid_t
+storage_get_max_instance(struct storage* store)
+{
+	return store->api.get_max_instance(store->handle);
+}
+
+/*
+	Reads the ranged prepare last promised to the owner, returns 1 if there
+	is one, 0 otherwise.
+*/
+int
+storage_get_range(struct storage* store, int owner, paxos_prepare_range* out)
+{
+	return store->api.get_range(store->handle, owner, out);
+}
+
+int
+storage_put_range(struct storage* store, int owner, paxos_prepare_range* range)
+{
+	return store->api.put_range(store->handle, owner, range);
+}
@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2013-2015, University of Lugano
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holders nor the names of it
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "storage_cache.h"
+#include "khash.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+	A bounded cache of the most recently accepted records, sitting in front
+	of the storage backend. Entries are kept in a doubly linked list in LRU
+	order, and indexed by iid. The size of an entry accounts for its value.
+*/
+
+struct cache_entry
+{
+	paxos_accepted accepted;
+	struct cache_entry* prev;
+	struct cache_entry* next;
+};
+KHASH_MAP_INIT_INT(entry, struct cache_entry*)
+
+struct storage_cache
+{
+	size_t size;
+	size_t max_size;
+	unsigned long hits;
+	unsigned long misses;
+	struct cache_entry* head; /* least recently used */
+	struct cache_entry* tail; /* most recently used */
+	khash_t(entry)* entries;
+};
+
+static void storage_cache_remove(struct storage_cache* c,
+	struct cache_entry* e);
+static void storage_cache_evict(struct storage_cache* c);
+static void entry_unlink(struct storage_cache* c, struct cache_entry* e);
+static void entry_append(struct storage_cache* c, struct cache_entry* e);
+static size_t entry_size(paxos_accepted* acc);
+static void paxos_accepted_copy(paxos_accepted* dst, paxos_accepted* src);
+
+
+struct storage_cache*
+storage_cache_new(size_t max_size)
+{
+	struct storage_cache* c = malloc(sizeof(struct storage_cache));
+	if (c == NULL)
+		return NULL;
+	c->size = 0;
+	c->max_size = max_size;
+	c->hits = 0;
+	c->misses = 0;
+	c->head = NULL;
+	c->tail = NULL;
+	c->entries = kh_init(entry);
+	return c;
+}
+
+void
+storage_cache_free(struct storage_cache* c)
+{
+	storage_cache_clear(c);
+	kh_destroy(entry, c->entries);
+	free(c);
+}
+
+int
+storage_cache_get(struct storage_cache* c, iid_t iid, paxos_accepted* out)
+{
+	khiter_t k = kh_get_entry(c->entries, iid);
+	if (k == kh_end(c->entries)) {
+		c->misses++;
+		return 0;
+	}
+	struct cache_entry* e = kh_value(c->entries, k);
+	entry_unlink(c, e);
+	entry_append(c, e);
+	paxos_accepted_copy(out, &e->accepted);
+	c->hits++;
+	return 1;
+}
+
+void
+storage_cache_put(struct storage_cache* c, paxos_accepted* acc)
+{
+	int rv;
+	khiter_t k;
+	struct cache_entry* e;
+
+	if (entry_size(acc) > c->max_size)
+		return;
+
+	k = kh_put_entry(c->entries, acc->iid, &rv);
+	if (rv == -1)
+		return;
+	if (rv == 0) { // key is already present
+		e = kh_value(c->entries, k);
+		entry_unlink(c, e);
+		c->size -= entry_size(&e->accepted);
+		paxos_accepted_destroy(&e->accepted);
+	} else {
+		e = malloc(sizeof(struct cache_entry));
+		kh_value(c->entries, k) = e;
+	}
+	paxos_accepted_copy(&e->accepted, acc);
+	c->size += entry_size(&e->accepted);
+	entry_append(c, e);
+	storage_cache_evict(c);
+}
+
+void
+storage_cache_trim(struct storage_cache* c, iid_t iid)
+{
+	struct cache_entry* e = c->head;
+	while (e != NULL) {
+		struct cache_entry* next = e->next;
+		if (e->accepted.iid <= iid)
+			storage_cache_remove(c, e);
+		e = next;
+	}
+}
+
+void
+storage_cache_clear(struct storage_cache* c)
+{
+	while (c->head != NULL)
+		storage_cache_remove(c, c->head);
+}
+
+size_t
+storage_cache_size(struct storage_cache* c)
+{
+	return c->size;
+}
+
+unsigned long
+storage_cache_hits(struct storage_cache* c)
+{
+	return c->hits;
+}
+
+unsigned long
+storage_cache_misses(struct storage_cache* c)
+{
+	return c->misses;
+}
+
+static void
+storage_cache_remove(struct storage_cache* c, struct cache_entry* e)
+{
+	khiter_t k = kh_get_entry(c->entries, e->accepted.iid);
+	kh_del_entry(c->entries, k);
+	entry_unlink(c, e);
+	c->size -= entry_size(&e->accepted);
+	paxos_accepted_destroy(&e->accepted);
+	free(e);
+}
+
+static void
+storage_cache_evict(struct storage_cache* c)
+{
+	while (c->size > c->max_size && c->head != NULL)
+		storage_cache_remove(c, c->head);
+}
+
+static void
+entry_unlink(struct storage_cache* c, struct cache_entry* e)
+{
+	if (e->prev != NULL)
+		e->prev->next = e->next;
+	else
+		c->head = e->next;
+	if (e->next != NULL)
+		e->next->prev = e->prev;
+	else
+		c->tail = e->prev;
+	e->prev = e->next = NULL;
+}
+
+static void
+entry_append(struct storage_cache* c, struct cache_entry* e)
+{
+	e->prev = c->tail;
+	e->next = NULL;
+	if (c->tail != NULL)
+		c->tail->next = e;
+	else
+		c->head = e;
+	c->tail = e;
+}
+
+static size_t
+entry_size(paxos_accepted* acc)
+{
+	return sizeof(struct cache_entry) + acc->value.paxos_value_len;
+}
+
+static void
+paxos_accepted_copy(paxos_accepted* dst, paxos_accepted* src)
+{
+	memcpy(dst, src, sizeof(paxos_accepted));
+	if (dst->value.paxos_value_len > 0) {
+		dst->value.paxos_value_val = malloc(src->value.paxos_value_len);
+		memcpy(dst->value.paxos_value_val, src->value.paxos_value_val,
+			src->value.paxos_value_len);
+	}
+}
@@ -36,30 +36,95 @@
 #include <errno.h>
 #include <sys/stat.h>
 #include <assert.h>
+#include <pthread.h>
+
+/*
+	The acceptors of all logs of a shard share the same environment, which
+	is opened once and reference counted.
+*/
+struct lmdb_env
+{
+	char* path;
+	MDB_env* env;
+	MDB_dbi dbi;
+	int refs;
+	struct lmdb_env* next;
+};
 
 struct lmdb_storage
 {
+	struct lmdb_env* shared;
 	MDB_env* env;
 	MDB_txn* txn;
 	MDB_dbi dbi;
 	int acceptor_id;
+	int shard;
+	uint32_t log;
 };
 
+/*
+	Records of log 0 are keyed by iid alone, those of other logs by iid
+	prefixed with the log id. Key iid 0 of each log holds its trim iid,
+	followed by the ranged prepares promised to the owners.
+*/
+struct lmdb_key
+{
+	uint32_t log;
+	iid_t iid;
+};
+
+struct lmdb_meta
+{
+	iid_t trim_iid;
+	paxos_prepare_range ranges[MAX_N_OF_PROPOSERS];
+};
+
+static struct lmdb_env* lmdb_envs = NULL;
+static pthread_mutex_t lmdb_envs_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static void lmdb_storage_close(void* handle);
 
+static void
+lmdb_key_parse(const MDB_val* v, struct lmdb_key* k)
+{
+	assert(v->mv_size == sizeof(iid_t) || v->mv_size == sizeof(*k));
+	if (v->mv_size == sizeof(iid_t)) {
+		k->log = 0;
+		memcpy(&k->iid, v->mv_data, sizeof(iid_t));
+	} else {
+		memcpy(k, v->mv_data, sizeof(*k));
+	}
+}
+
+static MDB_val
+lmdb_key_init(struct lmdb_storage* s, iid_t iid, struct lmdb_key* k)
+{
+	MDB_val key;
+	k->log = s->log;
+	k->iid = iid;
+	if (s->log == 0) {
+		key.mv_data = &k->iid;
+		key.mv_size = sizeof(iid_t);
+	} else {
+		key.mv_data = k;
+		key.mv_size = sizeof(*k);
+	}
+	return key;
+}
+
 static int
 lmdb_compare_iid(const MDB_val* lhs, const MDB_val* rhs)
 {
-	iid_t lid, rid;
-	assert(lhs->mv_size == sizeof(iid_t));
-	assert(rhs->mv_size == sizeof(iid_t));
-	lid = *((iid_t*) lhs->mv_data);
-	rid = *((iid_t*) rhs->mv_data);
-	return (lid == rid) ? 0 : (lid < rid) ? -1 : 1;
+	struct lmdb_key l, r;
+	lmdb_key_parse(lhs, &l);
+	lmdb_key_parse(rhs, &r);
+	if (l.log != r.log)
+		return (l.log < r.log) ? -1 : 1;
+	return (l.iid == r.iid) ? 0 : (l.iid < r.iid) ? -1 : 1;
 }
 
 static int
-lmdb_storage_init(struct lmdb_storage* s, char* db_env_path)
+lmdb_storage_init(struct lmdb_env* s, char* db_env_path)
 {
 	int result;
 	MDB_env* env = NULL;
@@ -121,26 +186,54 @@ lmdb_storage_init(struct lmdb_storage* s, char* db_env_path)
 }
 
 static struct lmdb_storage*
-lmdb_storage_new(int acceptor_id)
+lmdb_storage_new(int acceptor_id, int shard, uint32_t log)
 {
 	struct lmdb_storage* s = malloc(sizeof(struct lmdb_storage));
 	memset(s, 0, sizeof(struct lmdb_storage));
 	s->acceptor_id = acceptor_id;
+	s->shard = shard;
+	s->log = log;
 	return s;
 }
 
-static int
-lmdb_storage_open(void* handle)
+static struct lmdb_env*
+lmdb_env_find(char* path)
 {
-	struct lmdb_storage* s = handle;
-	char* lmdb_env_path = NULL;
-	struct stat sb;
-	int dir_exists, result;
-	size_t lmdb_env_path_length = strlen(paxos_config.lmdb_env_path) + 16;
+	struct lmdb_env* e;
+	for (e = lmdb_envs; e != NULL; e = e->next)
+		if (strcmp(e->path, path) == 0)
+			return e;
+	return NULL;
+}
 
-	lmdb_env_path = malloc(lmdb_env_path_length);
-	snprintf(lmdb_env_path, lmdb_env_path_length, "%s_%d",
-	  paxos_config.lmdb_env_path, s->acceptor_id);
+static void
+lmdb_env_release(struct lmdb_env* e)
+{
+	struct lmdb_env** p;
+	pthread_mutex_lock(&lmdb_envs_lock);
+	if (--e->refs > 0) {
+		pthread_mutex_unlock(&lmdb_envs_lock);
+		return;
+	}
+	for (p = &lmdb_envs; *p != e; p = &(*p)->next);
+	*p = e->next;
+	pthread_mutex_unlock(&lmdb_envs_lock);
+	mdb_close(e->env, e->dbi);
+	mdb_env_close(e->env);
+	free(e->path);
+	free(e);
+}
+
+/*
+	Opens the environment at the given path, to be called with the list of
+	environments locked.
+*/
+static struct lmdb_env*
+lmdb_env_open(char* lmdb_env_path)
+{
+	struct lmdb_env* e;
+	struct stat sb;
+	int dir_exists;
 
 	// Trash files -- testing only
 	if (paxos_config.trash_files) {
@@ -154,25 +247,56 @@ lmdb_storage_open(void* handle)
 	if (!dir_exists && (mkdir(lmdb_env_path, S_IRWXU) != 0)) {
 		paxos_log_error("Failed to create env dir %s: %s",
 			lmdb_env_path, strerror(errno));
-		result = -1;
-		goto error;
+		return NULL;
 	}
 
-	if ((result = lmdb_storage_init(s, lmdb_env_path) != 0)) {
+	e = calloc(1, sizeof(struct lmdb_env));
+	if (lmdb_storage_init(e, lmdb_env_path) != 0) {
 		paxos_log_error("Failed to open DB handle");
-	} else {
-		paxos_log_info("lmdb storage opened successfully");
-		goto cleanup_exit;
+		free(e);
+		return NULL;
 	}
 
-error:
-	if (s) {
-		lmdb_storage_close(s);
-	}
+	paxos_log_info("lmdb storage opened successfully");
+	e->path = strdup(lmdb_env_path);
+	e->next = lmdb_envs;
+	lmdb_envs = e;
+	return e;
+}
+
+static int
+lmdb_storage_open(void* handle)
+{
+	struct lmdb_storage* s = handle;
+	struct lmdb_env* e;
+	char* lmdb_env_path = NULL;
+	size_t lmdb_env_path_length = strlen(paxos_config.lmdb_env_path) + 32;
 
-cleanup_exit:
+	lmdb_env_path = malloc(lmdb_env_path_length);
+	if (s->shard == 0)
+		snprintf(lmdb_env_path, lmdb_env_path_length, "%s_%d",
+		  paxos_config.lmdb_env_path, s->acceptor_id);
+	else
+		snprintf(lmdb_env_path, lmdb_env_path_length, "%s_%d.%d",
+		  paxos_config.lmdb_env_path, s->acceptor_id, s->shard);
+
+	pthread_mutex_lock(&lmdb_envs_lock);
+	if ((e = lmdb_env_find(lmdb_env_path)) == NULL)
+		e = lmdb_env_open(lmdb_env_path);
+	if (e != NULL) {
+		e->refs++;
+		s->shared = e;
+		s->env = e->env;
+		s->dbi = e->dbi;
+	}
+	pthread_mutex_unlock(&lmdb_envs_lock);
 	free(lmdb_env_path);
-	return result;
+
+	if (e == NULL) {
+		lmdb_storage_close(s);
+		return -1;
+	}
+	return 0;
 }
 
 static void
@@ -182,11 +306,8 @@ lmdb_storage_close(void* handle)
 	if (s->txn) {
 		mdb_txn_abort(s->txn);
 	}
-	if (s->dbi) {
-		mdb_close(s->env, s->dbi);
-	}
-	if (s->env) {
-		mdb_env_close(s->env);
+	if (s->shared) {
+		lmdb_env_release(s->shared);
 	}
 	free(s);
 	paxos_log_info("lmdb storage closed successfully");
@@ -226,12 +347,12 @@ lmdb_storage_get(void* handle, iid_t iid, paxos_accepted* out)
 {
 	struct lmdb_storage* s = handle;
 	int result;
+	struct lmdb_key k;
 	MDB_val key, data;
 
 	memset(&data, 0, sizeof(data));
 
-	key.mv_data = &iid;
-	key.mv_size = sizeof(iid_t);
+	key = lmdb_key_init(s, iid, &k);
 
 	if ((result = mdb_get(s->txn, s->dbi, &key, &data)) != 0) {
 		if (result == MDB_NOTFOUND) {
@@ -254,11 +375,11 @@ lmdb_storage_put(void* handle, paxos_accepted* acc)
 {
 	struct lmdb_storage* s = handle;
 	int result;
+	struct lmdb_key k;
 	MDB_val key, data;
 	char* buffer = paxos_accepted_to_buffer(acc);
 
-	key.mv_data = &acc->iid;
-	key.mv_size = sizeof(iid_t);
+	key = lmdb_key_init(s, acc->iid, &k);
 
 	data.mv_data = buffer;
 	data.mv_size = sizeof(paxos_accepted) + acc->value.paxos_value_len;
@@ -268,48 +389,102 @@ lmdb_storage_put(void* handle, paxos_accepted* acc)
 	return result;
 }
 
-static iid_t
-lmdb_storage_get_trim_instance(void* handle)
+/*
+	Reads the record at key iid 0, records written before ranged prepares
+	were kept hold the trim iid only.
+*/
+static void
+lmdb_storage_get_meta(struct lmdb_storage* s, struct lmdb_meta* out)
 {
-	struct lmdb_storage* s = handle;
 	int result;
-	iid_t iid = 0, k = 0;
+	struct lmdb_key k;
 	MDB_val key, data;
 
-	key.mv_data = &k;
-	key.mv_size = sizeof(iid_t);
+	memset(out, 0, sizeof(struct lmdb_meta));
+	key = lmdb_key_init(s, 0, &k);
 
 	if ((result = mdb_get(s->txn, s->dbi, &key, &data)) != 0) {
 		if (result != MDB_NOTFOUND) {
 			paxos_log_error("mdb_get failed: %s", mdb_strerror(result));
 			assert(result == 0);
-		} else {
-			iid = 0;
 		}
-	} else {
-		iid = *(iid_t*)data.mv_data;
+		return;
 	}
-
-	return iid;
+	memcpy(out, data.mv_data, data.mv_size < sizeof(struct lmdb_meta) ?
+		data.mv_size : sizeof(struct lmdb_meta));
 }
 
 static int
-lmdb_storage_put_trim_instance(void* handle, iid_t iid)
+lmdb_storage_put_meta(struct lmdb_storage* s, struct lmdb_meta* meta)
 {
-	struct lmdb_storage* s = handle;
-	iid_t k = 0;
 	int result;
+	struct lmdb_key k;
 	MDB_val key, data;
 
-	key.mv_data = &k;
-	key.mv_size = sizeof(iid_t);
+	key = lmdb_key_init(s, 0, &k);
 
-	data.mv_data = &iid;
-	data.mv_size = sizeof(iid_t);
+	data.mv_data = meta;
+	data.mv_size = sizeof(struct lmdb_meta);
 
 	result = mdb_put(s->txn, s->dbi, &key, &data, 0);
 	if (result != 0)
 		paxos_log_error("%s\n", mdb_strerror(result));
+	return result;
+}
+
+static iid_t
+lmdb_storage_get_trim_instance(void* handle)
+{
+	struct lmdb_meta meta;
+	lmdb_storage_get_meta(handle, &meta);
+	return meta.trim_iid;
+}
+
+/*
+	The records of a log end right before the first key of the next log,
+	if any, or at the last key otherwise.
+*/
+static iid_t
+lmdb_storage_get_max_instance(void* handle)
+{
+	struct lmdb_storage* s = handle;
+	int result;
+	iid_t iid = 0;
+	struct lmdb_key k = {s->log + 1, 0};
+	MDB_cursor* cursor = NULL;
+	MDB_val key = {sizeof(k), &k}, data;
+
+	if ((result = mdb_cursor_open(s->txn, s->dbi, &cursor)) != 0) {
+		paxos_log_error("Could not create cursor. %s", mdb_strerror(result));
+		return lmdb_storage_get_trim_instance(handle);
+	}
+
+	result = mdb_cursor_get(cursor, &key, &data, MDB_SET_RANGE);
+	if (result == 0)
+		result = mdb_cursor_get(cursor, &key, &data, MDB_PREV);
+	else
+		result = mdb_cursor_get(cursor, &key, &data, MDB_LAST);
+	if (result == 0) {
+		lmdb_key_parse(&key, &k);
+		if (k.log == s->log)
+			iid = k.iid;
+	}
+	mdb_cursor_close(cursor);
+
+	if (iid == 0)
+		iid = lmdb_storage_get_trim_instance(handle);
+	return iid;
+}
+
+static int
+lmdb_storage_put_trim_instance(void* handle, iid_t iid)
+{
+	struct lmdb_meta meta;
+	int result;
+
+	lmdb_storage_get_meta(handle, &meta);
+	meta.trim_iid = iid;
+	result = lmdb_storage_put_meta(handle, &meta);
 	assert(result == 0);
 
 	return 0;
@@ -320,7 +495,7 @@ lmdb_storage_trim(void* handle, iid_t iid)
 {
 	struct lmdb_storage* s = handle;
 	int result;
-	iid_t min = 0;
+	struct lmdb_key k;
 	MDB_cursor* cursor = NULL;
 	MDB_val key, data;
 
@@ -334,25 +509,20 @@ lmdb_storage_trim(void* handle, iid_t iid)
 		goto cleanup_exit;
 	}
 
-	key.mv_data = &min;
-	key.mv_size = sizeof(iid_t);
+	key = lmdb_key_init(s, 0, &k);
+	result = mdb_cursor_get(cursor, &key, &data, MDB_SET_RANGE);
 
-	do {
-		if ((result = mdb_cursor_get(cursor, &key, &data, MDB_NEXT)) == 0) {
-			assert(key.mv_size = sizeof(iid_t));
-			min = *(iid_t*)key.mv_data;
-		} else {
+	while (result == 0) {
+		lmdb_key_parse(&key, &k);
+		if (k.log != s->log || k.iid > iid)
+			break;
+		if (k.iid != 0 && (result = mdb_cursor_del(cursor, 0)) != 0) {
+			paxos_log_error("mdb_cursor_del failed. %s",
+			mdb_strerror(result));
 			goto cleanup_exit;
 		}
-
-		if (min != 0 && min <= iid) {
-			if (mdb_cursor_del(cursor, 0) != 0) {
-				paxos_log_error("mdb_cursor_del failed. %s",
-				mdb_strerror(result));
-				goto cleanup_exit;
-			}
-		}
-	} while (min <= iid);
+		result = mdb_cursor_get(cursor, &key, &data, MDB_NEXT);
+	}
 
 	cleanup_exit:
 	if (cursor) {
@@ -361,10 +531,31 @@ lmdb_storage_trim(void* handle, iid_t iid)
 	return 0;
 }
 
+static int
+lmdb_storage_get_range(void* handle, int owner, paxos_prepare_range* out)
+{
+	struct lmdb_meta meta;
+	lmdb_storage_get_meta(handle, &meta);
+	if (meta.ranges[owner].stride == 0)
+		return 0;
+	*out = meta.ranges[owner];
+	return 1;
+}
+
+static int
+lmdb_storage_put_range(void* handle, int owner, paxos_prepare_range* range)
+{
+	struct lmdb_meta meta;
+	lmdb_storage_get_meta(handle, &meta);
+	meta.ranges[owner] = *range;
+	return lmdb_storage_put_meta(handle, &meta);
+}
+
 void
-storage_init_lmdb(struct storage* s, int acceptor_id)
+storage_init_lmdb(struct storage* s, int acceptor_id, int shard,
+	uint32_t log)
 {
-	s->handle = lmdb_storage_new(acceptor_id);
+	s->handle = lmdb_storage_new(acceptor_id, shard, log);
 	s->api.open = lmdb_storage_open;
 	s->api.close = lmdb_storage_close;
 	s->api.tx_begin = lmdb_storage_tx_begin;
@@ -374,4 +565,7 @@ storage_init_lmdb(struct storage* s, int acceptor_id)
 	s->api.put = lmdb_storage_put;
 	s->api.trim = lmdb_storage_trim;
 	s->api.get_trim_instance = lmdb_storage_get_trim_instance;
+	s->api.get_max_instance = lmdb_storage_get_max_instance;
+	s->api.get_range = lmdb_storage_get_range;
+	s->api.put_range = lmdb_storage_put_range;
 }
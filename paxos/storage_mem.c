@@ -34,7 +34,9 @@ KHASH_MAP_INIT_INT(record, paxos_accepted*);
 struct mem_storage
 {
 	iid_t trim_iid;
+	iid_t max_iid;
 	kh_record_t* records;
+	paxos_prepare_range ranges[MAX_N_OF_PROPOSERS];
 };
 
 static void paxos_accepted_copy(paxos_accepted* dst, paxos_accepted* src);
@@ -46,7 +48,9 @@ mem_storage_new(int acceptor_id)
 	if (s == NULL)
 		return s;
 	s->trim_iid = 0;
+	s->max_iid = 0;
 	s->records = kh_init(record);
+	memset(s->ranges, 0, sizeof(s->ranges));
 	return s;
 }
 
@@ -110,6 +114,8 @@ mem_storage_put(void* handle, paxos_accepted* acc)
 		paxos_accepted_free(kh_value(s->records, k));
 	}
 	kh_value(s->records, k) = record;
+	if (acc->iid > s->max_iid)
+		s->max_iid = acc->iid;
 	return 0;
 }
 
@@ -128,6 +134,8 @@ mem_storage_trim(void* handle, iid_t iid)
 		}
 	}
 	s->trim_iid = iid;
+	if (iid > s->max_iid)
+		s->max_iid = iid;
 	return 0;
 }
 
@@ -138,6 +146,31 @@ mem_storage_get_trim_instance(void* handle)
 	return s->trim_iid;
 }
 
+static iid_t
+mem_storage_get_max_instance(void* handle)
+{
+	struct mem_storage* s = handle;
+	return s->max_iid;
+}
+
+static int
+mem_storage_get_range(void* handle, int owner, paxos_prepare_range* out)
+{
+	struct mem_storage* s = handle;
+	if (s->ranges[owner].stride == 0)
+		return 0;
+	*out = s->ranges[owner];
+	return 1;
+}
+
+static int
+mem_storage_put_range(void* handle, int owner, paxos_prepare_range* range)
+{
+	struct mem_storage* s = handle;
+	s->ranges[owner] = *range;
+	return 0;
+}
+
 static void
 paxos_accepted_copy(paxos_accepted* dst, paxos_accepted* src)
 {
@@ -162,4 +195,7 @@ storage_init_mem(struct storage* s, int acceptor_id)
 	s->api.put = mem_storage_put;
 	s->api.trim = mem_storage_trim;
 	s->api.get_trim_instance = mem_storage_get_trim_instance;
+	s->api.get_max_instance = mem_storage_get_max_instance;
+	s->api.get_range = mem_storage_get_range;
+	s->api.put_range = mem_storage_put_range;
 }
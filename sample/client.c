@@ -34,7 +34,6 @@
 #include <string.h>
 #include <signal.h>
 #include <event2/event.h>
-#include <netinet/tcp.h>
 
 #define MAX_VALUE_SIZE 8192
 
@@ -63,12 +62,12 @@ struct client
 	int outstanding;
 	char* send_buffer;
 	struct stats stats;
+	struct timeval* sent;  /* Send time of each outstanding value */
 	struct event_base* base;
-	struct bufferevent* bev;
+	struct evpaxos_client* client;
 	struct event* stats_ev;
 	struct timeval stats_interval;
 	struct event* sig;
-	struct evlearner* learner;
 };
 
 static void
@@ -91,7 +90,7 @@ random_string(char *s, const int len)
 }
 
 static void
-client_submit_value(struct client* c)
+client_submit_value(struct client* c, struct timeval* sent)
 {
 	struct client_value* v = (struct client_value*)c->send_buffer;
 	v->client_id = c->id;
@@ -99,7 +98,8 @@ client_submit_value(struct client* c)
 	v->size = c->value_size;
 	random_string(v->value, v->size);
 	size_t size = sizeof(struct client_value) + v->size;
-	paxos_submit(c->bev, c->send_buffer, size);
+	*sent = v->t;
+	evpaxos_client_submit(c->client, c->send_buffer, size, sent);
 }
 
 // Returns t2 - t1 in microseconds.
@@ -114,11 +114,11 @@ timeval_diff(struct timeval* t1, struct timeval* t2)
 }
 
 static void
-update_stats(struct stats* stats, struct client_value* delivered, size_t size)
+update_stats(struct stats* stats, struct timeval* sent, size_t size)
 {
 	struct timeval tv;
 	gettimeofday(&tv, NULL);
-	long lat = timeval_diff(&delivered->t, &tv);
+	long lat = timeval_diff(sent, &tv);
 	stats->delivered_count++;
 	stats->delivered_bytes += size;
 	stats->avg_latency = stats->avg_latency +
@@ -130,14 +130,12 @@ update_stats(struct stats* stats, struct client_value* delivered, size_t size)
 }
 
 static void
-on_deliver(unsigned iid, char* value, size_t size, void* arg)
+on_reply(unsigned iid, void* request, void* arg)
 {
 	struct client* c = arg;
-	struct client_value* v = (struct client_value*)value;
-	if (v->client_id == c->id) {
-		update_stats(&c->stats, v, size);
-		client_submit_value(c);
-	}
+	struct timeval* sent = request;
+	update_stats(&c->stats, sent, sizeof(struct client_value) + c->value_size);
+	client_submit_value(c, sent);
 }
 
 static void
@@ -152,62 +150,33 @@ on_stats(evutil_socket_t fd, short event, void *arg)
 	event_add(c->stats_ev, &c->stats_interval);
 }
 
-static void
-on_connect(struct bufferevent* bev, short events, void* arg)
-{
-	int i;
-	struct client* c = arg;
-	if (events & BEV_EVENT_CONNECTED) {
-		printf("Connected to proposer\n");
-		for (i = 0; i < c->outstanding; ++i)
-			client_submit_value(c);
-	} else {
-		printf("%s\n", evutil_socket_error_to_string(EVUTIL_SOCKET_ERROR()));
-	}
-}
-
-static struct bufferevent*
-connect_to_proposer(struct client* c, const char* config, int proposer_id)
-{
-	struct bufferevent* bev;
-	struct evpaxos_config* conf = evpaxos_config_read(config);
-	if (conf == NULL) {
-		printf("Failed to read config file %s\n", config);
-		return NULL;
-	}
-	struct sockaddr_in addr = evpaxos_proposer_address(conf, proposer_id);
-	bev = bufferevent_socket_new(c->base, -1, BEV_OPT_CLOSE_ON_FREE);
-	bufferevent_setcb(bev, NULL, NULL, on_connect, c);
-	bufferevent_enable(bev, EV_READ|EV_WRITE);
-	bufferevent_socket_connect(bev, (struct sockaddr*)&addr, sizeof(addr));
-	int flag = 1;
-	setsockopt(bufferevent_getfd(bev), IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(int));
-	return bev;
-}
-
 static struct client*
 make_client(const char* config, int proposer_id, int outstanding, int value_size)
 {
+	int i;
 	struct client* c;
 	c = malloc(sizeof(struct client));
 	c->base = event_base_new();
 
 	memset(&c->stats, 0, sizeof(struct stats));
-	c->bev = connect_to_proposer(c, config, proposer_id);
-	if (c->bev == NULL)
+	c->client = evpaxos_client_init(config, proposer_id, on_reply, c, c->base);
+	if (c->client == NULL) {
+		printf("Could not start the client\n");
 		exit(1);
+	}
 
 	c->id = rand();
 	c->value_size = value_size;
 	c->outstanding = outstanding;
 	c->send_buffer = malloc(sizeof(struct client_value) + value_size);
+	c->sent = calloc(outstanding, sizeof(struct timeval));
 
 	c->stats_interval = (struct timeval){1, 0};
 	c->stats_ev = evtimer_new(c->base, on_stats, c);
 	event_add(c->stats_ev, &c->stats_interval);
 
-	paxos_config.learner_catch_up = 0;
-	c->learner = evlearner_init(config, on_deliver, c, c->base);
+	for (i = 0; i < c->outstanding; ++i)
+		client_submit_value(c, &c->sent[i]);
 
 	c->sig = evsignal_new(c->base, SIGINT, handle_sigint, c->base);
 	evsignal_add(c->sig, NULL);
@@ -219,12 +188,11 @@ static void
 client_free(struct client* c)
 {
 	free(c->send_buffer);
-	bufferevent_free(c->bev);
+	evpaxos_client_free(c->client);
+	free(c->sent);
 	event_free(c->stats_ev);
 	event_free(c->sig);
 	event_base_free(c->base);
-	if (c->learner)
-		evlearner_free(c->learner);
 	free(c);
 }
 
@@ -34,19 +34,11 @@
 
 struct timeval count_interval = {0, 100000};
 
-struct trim_info
-{
-	int count;
-	int last_trim;
-	int instances[16];
-};
-
 struct counter_replica
 {
 	int id;
 	int count;
 	unsigned instance_id;
-	struct trim_info trim;
 	struct event* client_ev;
 	struct evpaxos_replica* paxos_replica;
 };
@@ -86,48 +78,40 @@ static void
 update_state(struct counter_replica* replica, unsigned iid)
 {
 	replica->count++;
-	replica->instance_id = iid;
 }
 
-static void
-update_trim_info(struct counter_replica* replica, int replica_id, int trim_id)
+static int
+save_snapshot(unsigned* iid, char** value, size_t* size, void* arg)
 {
-	if (trim_id <= replica->trim.instances[replica_id])
-		return;
-	int i, min = replica->trim.instances[0];
-	replica->trim.instances[replica_id] = trim_id;
-	for (i = 0; i < replica->trim.count; i++)
-		if (replica->trim.instances[i] < min)
-			min = replica->trim.instances[i];
-	if (min > replica->trim.last_trim) {
-		replica->trim.last_trim = min;
-		evpaxos_replica_send_trim(replica->paxos_replica, min);
-	}
+	struct counter_replica* replica = (struct counter_replica*)arg;
+	*value = malloc(32);
+	*size = snprintf(*value, 32, "%d", replica->count) + 1;
+	*iid = replica->instance_id;
+	return 0;
 }
 
 static void
-submit_trim(struct counter_replica* replica)
+load_snapshot(unsigned iid, char* value, size_t size, void* arg)
 {
-	char trim[64];
-	snprintf(trim, sizeof(trim), "TRIM %d %d", replica->id, replica->instance_id);
-	evpaxos_replica_submit(replica->paxos_replica, trim, strlen(trim)+1);
+	struct counter_replica* replica = (struct counter_replica*)arg;
+	replica->count = atoi(value);
+	replica->instance_id = iid;
+	checkpoint_state(replica);
+	evpaxos_replica_checkpoint(replica->paxos_replica, iid);
+	printf("Loaded snapshot at instance %u, count %d\n", iid, replica->count);
 }
 
 static void
 on_deliver(unsigned iid, char* value, size_t size, void* arg)
 {
-	int replica_id, trim_id;
 	struct counter_replica* replica = (struct counter_replica*)arg;
 	
-	if (sscanf(value, "TRIM %d %d", &replica_id, &trim_id) == 2) {
-		update_trim_info(replica, replica_id, trim_id);
-	} else {
-		update_state(replica, iid);	
-	}
+	update_state(replica, iid);
+	replica->instance_id = iid;
 	
 	if (iid % 100 == 0) {
 		checkpoint_state(replica);
-		submit_trim(replica);
+		evpaxos_replica_checkpoint(replica->paxos_replica, iid);
 	}
 }
 
@@ -159,10 +143,9 @@ start_replica(int id, const char* config)
 	
 	init_state(&replica);
 	evpaxos_replica_set_instance_id(replica.paxos_replica, replica.instance_id);
-	
-	memset(&replica.trim, 0, sizeof(struct trim_info));
-	int replica_count = evpaxos_replica_count(replica.paxos_replica);
-	replica.trim.count = replica_count;
+	evpaxos_replica_set_snapshot(replica.paxos_replica, save_snapshot,
+		load_snapshot);
+	evpaxos_replica_checkpoint(replica.paxos_replica, replica.instance_id);
 	
 	sig = evsignal_new(base, SIGINT, handle_sigint, base);
 	evsignal_add(sig, NULL);
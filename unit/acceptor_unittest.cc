@@ -46,6 +46,17 @@ protected:
 	virtual void TearDown() {
 		acceptor_free(a);
 	}
+
+	// in-memory storage does not outlive the acceptor, there is nothing
+	// to restart from
+	void Restart() {
+		if (GetParam() == PAXOS_MEM_STORAGE)
+			return;
+		acceptor_free(a);
+		paxos_config.trash_files = 0;
+		a = acceptor_new(id);
+		paxos_config.trash_files = 1;
+	}
 };
 
 #define CHECK_PROMISE(msg, id, bal, vbal, val) {            \
@@ -120,6 +131,18 @@ TEST_P(AcceptorTest, Accept) {
 	paxos_message_destroy(&msg);
 }
 
+TEST_P(AcceptorTest, AcceptTimestamp) {
+	paxos_message msg;
+	paxos_accepted acc;
+	paxos_accept ar = {1, 101, {4, (char*)"foo"}, 1500000000123ULL};
+	acceptor_receive_accept(a, &ar, &msg);
+	ASSERT_EQ(1500000000123ULL, msg.u.accepted.timestamp);
+	paxos_message_destroy(&msg);
+	ASSERT_TRUE(acceptor_receive_repeat(a, 1, &acc));
+	ASSERT_EQ(1500000000123ULL, acc.timestamp);
+	paxos_accepted_destroy(&acc);
+}
+
 TEST_P(AcceptorTest, AcceptPrepared) {
 	paxos_prepare pr = {1, 101};
 	paxos_accept ar = {1, 101, {8 , (char*)"foo bar"}};
@@ -185,6 +208,18 @@ TEST_P(AcceptorTest, Repeat) {
 	paxos_accepted_destroy(&acc);
 }
 
+TEST_P(AcceptorTest, RepeatNoop) {
+	paxos_message msg;
+	paxos_accepted acc;
+	paxos_accept ar = {10, 101, {0, NULL}};
+
+	acceptor_receive_accept(a, &ar, &msg);
+	paxos_message_destroy(&msg);
+	ASSERT_TRUE(acceptor_receive_repeat(a, 10, &acc));
+	ASSERT_EQ(0, acc.value.paxos_value_len);
+	paxos_accepted_destroy(&acc);
+}
+
 TEST_P(AcceptorTest, RepeatEmpty) {
 	paxos_accepted acc;
 	ASSERT_FALSE(acceptor_receive_repeat(a, 1, &acc));
@@ -238,6 +273,113 @@ TEST_P(AcceptorTest, TrimmedInstances) {
 	}
 }
 
+TEST_P(AcceptorTest, AcceptBatch) {
+	int count;
+	paxos_message msg;
+	paxos_preempted preempted[3];
+	paxos_prepare pre = {2, 201};
+	acceptor_receive_prepare(a, &pre, &msg);
+	
+	paxos_accept_entry entries[] = {
+		{1, 101, {4, (char*)"foo"}},
+		{2, 101, {4, (char*)"bar"}},
+		{3, 101, {4, (char*)"baz"}},
+	};
+	paxos_accept_batch batch = {3, entries};
+	ASSERT_TRUE(acceptor_receive_accept_batch(a, &batch, &msg,
+		preempted, &count));
+	ASSERT_EQ(PAXOS_ACCEPTED_BATCH, msg.type);
+	ASSERT_EQ(id, msg.u.accepted_batch.aid);
+	ASSERT_EQ(2, msg.u.accepted_batch.entries_len);
+	paxos_accepted_entry* e = msg.u.accepted_batch.entries_val;
+	ASSERT_EQ(1, e[0].iid);
+	ASSERT_EQ(101, e[0].value_ballot);
+	ASSERT_STREQ("foo", e[0].value.paxos_value_val);
+	ASSERT_EQ(3, e[1].iid);
+	ASSERT_STREQ("baz", e[1].value.paxos_value_val);
+	paxos_message_destroy(&msg);
+	
+	ASSERT_EQ(1, count);
+	ASSERT_EQ(2, preempted[0].iid);
+	ASSERT_EQ(201, preempted[0].ballot);
+	
+	paxos_accepted accepted;
+	ASSERT_TRUE(acceptor_receive_repeat(a, 3, &accepted));
+	ASSERT_STREQ("baz", accepted.value.paxos_value_val);
+	paxos_accepted_destroy(&accepted);
+}
+
+TEST_P(AcceptorTest, FastAccept) {
+	paxos_message msg;
+	paxos_prepare pre = {2, 201};
+	paxos_accept ar = {1, 101, {4, (char*)"foo"}};
+	acceptor_receive_accept(a, &ar, &msg);
+	paxos_message_destroy(&msg);
+	acceptor_receive_prepare(a, &pre, &msg);
+	paxos_message_destroy(&msg);
+	
+	// only the fast ballot is accepted without an instance
+	paxos_accept fast = {0, 101, {4, (char*)"bar"}};
+	ASSERT_FALSE(acceptor_receive_fast_accept(a, &fast, &msg));
+	
+	// instances holding a value or a promise are skipped
+	fast.ballot = PAXOS_FAST_BALLOT;
+	ASSERT_TRUE(acceptor_receive_fast_accept(a, &fast, &msg));
+	CHECK_ACCEPTED(msg, 3, PAXOS_FAST_BALLOT, PAXOS_FAST_BALLOT, "bar");
+	paxos_message_destroy(&msg);
+	
+	fast.value.paxos_value_val = (char*)"baz";
+	ASSERT_TRUE(acceptor_receive_fast_accept(a, &fast, &msg));
+	CHECK_ACCEPTED(msg, 4, PAXOS_FAST_BALLOT, PAXOS_FAST_BALLOT, "baz");
+	paxos_message_destroy(&msg);
+	
+	// a proposer may still decide the instance in a classic round
+	pre = (paxos_prepare) {3, 201};
+	acceptor_receive_prepare(a, &pre, &msg);
+	CHECK_PROMISE(msg, 3, 201, PAXOS_FAST_BALLOT, "bar");
+	paxos_message_destroy(&msg);
+}
+
+TEST_P(AcceptorTest, PrepareRange) {
+	paxos_message msg;
+	paxos_accept ar = {4, 101, {4, (char*)"foo"}};
+	acceptor_receive_accept(a, &ar, &msg);
+	paxos_message_destroy(&msg);
+
+	// promised for instances 3, 6, 9... reporting the highest one held
+	paxos_prepare_range range = {3, 201, 3};
+	ASSERT_TRUE(acceptor_receive_prepare_range(a, &range, &msg));
+	ASSERT_EQ(PAXOS_PROMISE_RANGE, msg.type);
+	ASSERT_EQ(3, msg.u.promise_range.from);
+	ASSERT_EQ(201, msg.u.promise_range.ballot);
+	ASSERT_EQ(0, msg.u.promise_range.prev_ballot);
+	ASSERT_EQ(4, msg.u.promise_range.max_iid);
+
+	// the promise holds once the acceptor restarts
+	Restart();
+
+	// the same ballot is not promised twice to the owner
+	ASSERT_TRUE(acceptor_receive_prepare_range(a, &range, &msg));
+	ASSERT_EQ(201, msg.u.promise_range.prev_ballot);
+
+	// lower ballots are refused for owned instances only
+	paxos_prepare pre = {9, 101};
+	acceptor_receive_prepare(a, &pre, &msg);
+	CHECK_PROMISE(msg, 9, 201, 0, NULL);
+	pre = (paxos_prepare) {8, 101};
+	acceptor_receive_prepare(a, &pre, &msg);
+	CHECK_PROMISE(msg, 8, 101, 0, NULL);
+
+	ar = (paxos_accept) {6, 201, {4, (char*)"bar"}};
+	acceptor_receive_accept(a, &ar, &msg);
+	CHECK_ACCEPTED(msg, 6, 201, 201, "bar");
+	paxos_message_destroy(&msg);
+	ar = (paxos_accept) {12, 101, {4, (char*)"baz"}};
+	acceptor_receive_accept(a, &ar, &msg);
+	CHECK_PREEMPTED(msg, 12, 201);
+	paxos_message_destroy(&msg);
+}
+
 
 const paxos_storage_backend backends[] = {
 	PAXOS_MEM_STORAGE,
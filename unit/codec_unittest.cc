@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2013-2015, University of Lugano
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holders nor the names of it
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "paxos_types_binary.h"
+#include "message.h"
+#include "gtest/gtest.h"
+#include <event2/event.h>
+
+TEST(BinaryCodecTest, Accept) {
+	char buffer[64];
+	char value[] = "hello";
+	paxos_message out, msg = {PAXOS_ACCEPT};
+	msg.u.accept = (paxos_accept) {3, 101, {sizeof(value), value}};
+	
+	size_t size = paxos_binary_size(&msg);
+	ASSERT_EQ(6*sizeof(uint32_t) + sizeof(value), size);
+	paxos_binary_encode(&msg, buffer);
+	ASSERT_TRUE(paxos_binary_decode(buffer, size, &out));
+	ASSERT_EQ(PAXOS_ACCEPT, out.type);
+	ASSERT_EQ(3, out.u.accept.iid);
+	ASSERT_EQ(101, out.u.accept.ballot);
+	ASSERT_EQ(sizeof(value), out.u.accept.value.paxos_value_len);
+	ASSERT_STREQ(value, out.u.accept.value.paxos_value_val);
+	// values are decoded in place
+	ASSERT_EQ(buffer + 6*sizeof(uint32_t), out.u.accept.value.paxos_value_val);
+}
+
+TEST(BinaryCodecTest, Accepted) {
+	char buffer[64];
+	paxos_message out, msg = {PAXOS_ACCEPTED};
+	msg.u.accepted = (paxos_accepted) {2, 7, 201, 101, {0, NULL},
+		1500000000123ULL};
+	
+	size_t size = paxos_binary_size(&msg);
+	paxos_binary_encode(&msg, buffer);
+	ASSERT_TRUE(paxos_binary_decode(buffer, size, &out));
+	ASSERT_EQ(PAXOS_ACCEPTED, out.type);
+	ASSERT_EQ(2, out.u.accepted.aid);
+	ASSERT_EQ(7, out.u.accepted.iid);
+	ASSERT_EQ(201, out.u.accepted.ballot);
+	ASSERT_EQ(101, out.u.accepted.value_ballot);
+	ASSERT_EQ(1500000000123ULL, out.u.accepted.timestamp);
+	ASSERT_EQ(0, out.u.accepted.value.paxos_value_len);
+	ASSERT_EQ(NULL, out.u.accepted.value.paxos_value_val);
+}
+
+TEST(BinaryCodecTest, RejectMalformed) {
+	char buffer[64];
+	char value[] = "hello";
+	paxos_message out, msg = {PAXOS_ACCEPT};
+	msg.u.accept = (paxos_accept) {3, 101, {sizeof(value), value}};
+	
+	size_t size = paxos_binary_size(&msg);
+	paxos_binary_encode(&msg, buffer);
+	ASSERT_FALSE(paxos_binary_decode(buffer, size - 1, &out));
+	ASSERT_FALSE(paxos_binary_decode(buffer, 2*sizeof(uint32_t), &out));
+	
+	msg.type = PAXOS_TRIM;
+	ASSERT_EQ(0, paxos_binary_size(&msg));
+}
+
+TEST(FrameTest, LogId) {
+	int i;
+	paxos_codec codecs[] = {PAXOS_CODEC_MSGPACK, PAXOS_CODEC_BINARY};
+	struct bufferevent* pair[2];
+	struct event_base* base = event_base_new();
+	bufferevent_pair_new(base, 0, pair);
+	bufferevent_enable(pair[1], EV_READ);
+	struct bufferevent* bev = pair[0];
+	struct evbuffer* out = bufferevent_get_input(pair[1]);
+	struct paxos_decoder* d = paxos_decoder_new();
+	paxos_message rcv, msg = {PAXOS_ACCEPTED, 7};
+	msg.u.accepted = (paxos_accepted) {2, 7, 201, 101, {0, NULL}};
+	
+	for (i = 0; i < 2; i++) {
+		msg.log = 7;
+		struct paxos_frame* f = paxos_frame_new(&msg, codecs[i]);
+		send_paxos_frame(bev, f);
+		paxos_frame_release(f);
+		ASSERT_TRUE(recv_paxos_message(d, out, &rcv));
+		ASSERT_EQ(7, rcv.log);
+		ASSERT_EQ(PAXOS_ACCEPTED, rcv.type);
+		ASSERT_EQ(201, rcv.u.accepted.ballot);
+		paxos_decoder_release(d, out, &rcv);
+		
+		msg.log = 0;
+		f = paxos_frame_new(&msg, codecs[i]);
+		send_paxos_frame(bev, f);
+		paxos_frame_release(f);
+		ASSERT_TRUE(recv_paxos_message(d, out, &rcv));
+		ASSERT_EQ(0, rcv.log);
+		paxos_decoder_release(d, out, &rcv);
+	}
+	
+	paxos_decoder_free(d);
+	bufferevent_free(pair[0]);
+	bufferevent_free(pair[1]);
+	event_base_free(base);
+}
+
+TEST(FrameTest, RejectOversized) {
+	paxos_message rcv;
+	struct evbuffer* in = evbuffer_new();
+	struct paxos_decoder* d = paxos_decoder_new();
+	
+	// an unframed msgpack array read as a length prefix
+	unsigned char unframed[] = {0x94, 0x01, 0x02, 0x03, 0x04, 0x05};
+	evbuffer_add(in, unframed, sizeof(unframed));
+	ASSERT_EQ(-1, recv_paxos_message(d, in, &rcv));
+	
+	// a frame not complete yet, within the bound
+	uint32_t size = htonl(16);
+	evbuffer_drain(in, evbuffer_get_length(in));
+	evbuffer_add(in, &size, sizeof(size));
+	evbuffer_add(in, unframed, sizeof(unframed));
+	ASSERT_EQ(0, recv_paxos_message(d, in, &rcv));
+	
+	paxos_decoder_free(d);
+	evbuffer_free(in);
+}
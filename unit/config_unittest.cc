@@ -1,3 +1,4 @@
+#include "paxos.h"
 #include "evpaxos.h"
 #include "gtest/gtest.h"
 
@@ -29,3 +30,11 @@ TEST(ConfigTest, Replicas) {
 	ASSERT_EQ(8801, evpaxos_acceptor_listen_port(config, 1));
 	ASSERT_EQ(8802, evpaxos_acceptor_listen_port(config, 2));
 }
+
+TEST(ConfigTest, FastPaxosWithShards) {
+	struct evpaxos_config* config;
+	config = evpaxos_config_read("config/fast-shards.conf");
+	ASSERT_EQ(NULL, config);
+	paxos_config.fast_paxos = 0;
+	paxos_config.acceptor_shards = 1;
+}
@@ -220,3 +220,168 @@ TEST_F(LearnerTest, ManyHoles) {
 	ASSERT_EQ(1, from);
 	ASSERT_EQ(100, to);
 }
+
+TEST_F(LearnerTest, SetInstanceId) {
+	int delivered;
+	paxos_accepted a, deliver;
+	iid_t from, to;
+	
+	a =	(paxos_accepted) {0, 1, 1, 101, 0, 0};
+	learner_receive_accepted(l, &a);
+	a =	(paxos_accepted) {0, 3, 1, 101, 0, 0};
+	learner_receive_accepted(l, &a);
+	
+	// instances up to 2 are covered by a snapshot
+	learner_set_instance_id(l, 2);
+	
+	a =	(paxos_accepted) {1, 1, 1, 101, 0, 0};
+	learner_receive_accepted(l, &a);
+	delivered = learner_deliver_next(l, &deliver);
+	ASSERT_FALSE(delivered);
+	ASSERT_EQ(0, learner_has_holes(l, &from, &to));
+	
+	a =	(paxos_accepted) {1, 3, 1, 101, 0, 0};
+	learner_receive_accepted(l, &a);
+	delivered = learner_deliver_next(l, &deliver);
+	ASSERT_TRUE(delivered);
+	ASSERT_EQ(3, deliver.iid);
+	paxos_accepted_destroy(&deliver);
+}
+
+TEST_F(LearnerTest, ReceiveChosen) {
+	int delivered;
+	paxos_accepted a, deliver;
+	paxos_chosen c;
+	
+	a =	(paxos_accepted) {0, 1, 1, 101, 0, 0};
+	learner_receive_accepted(l, &a);
+	
+	// iid, ballot, size, value, timestamp
+	c = (paxos_chosen) {1, 2, 0, 0, 1234};
+	learner_receive_chosen(l, &c);
+	delivered = learner_deliver_next(l, &deliver);
+	ASSERT_TRUE(delivered);
+	ASSERT_EQ(1, deliver.iid);
+	ASSERT_EQ(2, deliver.ballot);
+	ASSERT_EQ(1234, deliver.timestamp);
+	paxos_accepted_destroy(&deliver);
+	
+	// already delivered
+	learner_receive_chosen(l, &c);
+	delivered = learner_deliver_next(l, &deliver);
+	ASSERT_FALSE(delivered);
+}
+
+TEST_F(LearnerTest, SetInstanceIdOverridesLateStart) {
+	int delivered;
+	paxos_accepted a, deliver;
+	
+	paxos_config.learner_catch_up = 0;
+	struct learner* late = learner_new(acceptors);
+	paxos_config.learner_catch_up = 1;
+	learner_set_instance_id(late, 4);
+	
+	// instance 9 must not become the starting point
+	a =	(paxos_accepted) {0, 9, 1, 101, 0, 0};
+	learner_receive_accepted(late, &a);
+	a =	(paxos_accepted) {1, 9, 1, 101, 0, 0};
+	learner_receive_accepted(late, &a);
+	delivered = learner_deliver_next(late, &deliver);
+	ASSERT_FALSE(delivered);
+	
+	a =	(paxos_accepted) {0, 5, 1, 101, 0, 0};
+	learner_receive_accepted(late, &a);
+	a =	(paxos_accepted) {1, 5, 1, 101, 0, 0};
+	learner_receive_accepted(late, &a);
+	delivered = learner_deliver_next(late, &deliver);
+	ASSERT_TRUE(delivered);
+	ASSERT_EQ(5, deliver.iid);
+	paxos_accepted_destroy(&deliver);
+	learner_free(late);
+}
+
+TEST_F(LearnerTest, FastQuorum) {
+	int i, delivered;
+	paxos_accepted a, deliver;
+	
+	paxos_config.fast_paxos = 1;
+	
+	// a quorum of the classic round is not enough at the fast ballot
+	for (i = 0; i < acceptors - 1; i++) {
+		a = (paxos_accepted) {i, 1, PAXOS_FAST_BALLOT, PAXOS_FAST_BALLOT,
+			{4, (char*)"foo"}, 0};
+		learner_receive_accepted(l, &a);
+	}
+	delivered = learner_deliver_next(l, &deliver);
+	ASSERT_FALSE(delivered);
+	
+	// acceptors disagree
+	a = (paxos_accepted) {i, 1, PAXOS_FAST_BALLOT, PAXOS_FAST_BALLOT,
+		{4, (char*)"bar"}, 0};
+	learner_receive_accepted(l, &a);
+	delivered = learner_deliver_next(l, &deliver);
+	ASSERT_FALSE(delivered);
+	
+	// all of them accepted the same value
+	for (i = 0; i < acceptors; i++) {
+		a = (paxos_accepted) {i, 2, PAXOS_FAST_BALLOT, PAXOS_FAST_BALLOT,
+			{4, (char*)"baz"}, 0};
+		learner_receive_accepted(l, &a);
+	}
+	
+	// the first instance is decided in a classic round
+	for (i = 0; i < 2; i++) {
+		a = (paxos_accepted) {i, 1, 11, 11, {4, (char*)"bar"}, 0};
+		learner_receive_accepted(l, &a);
+	}
+	delivered = learner_deliver_next(l, &deliver);
+	ASSERT_TRUE(delivered);
+	ASSERT_EQ(1, deliver.iid);
+	ASSERT_STREQ("bar", deliver.value.paxos_value_val);
+	paxos_accepted_destroy(&deliver);
+	delivered = learner_deliver_next(l, &deliver);
+	ASSERT_TRUE(delivered);
+	ASSERT_EQ(2, deliver.iid);
+	ASSERT_STREQ("baz", deliver.value.paxos_value_val);
+	paxos_accepted_destroy(&deliver);
+	
+	paxos_config.fast_paxos = 0;
+}
+
+TEST_F(LearnerTest, SpeculateNext) {
+	paxos_accepted a, speculated, deliver;
+	
+	ASSERT_FALSE(learner_speculate_next(l, &speculated));
+	
+	// a later instance is not speculated on
+	a = (paxos_accepted) {0, 2, 101, 101, {4, (char*)"bar"}, 0};
+	learner_receive_accepted(l, &a);
+	ASSERT_FALSE(learner_speculate_next(l, &speculated));
+	
+	// the first value accepted for the next instance is
+	a = (paxos_accepted) {0, 1, 101, 101, {4, (char*)"foo"}, 0};
+	learner_receive_accepted(l, &a);
+	ASSERT_TRUE(learner_speculate_next(l, &speculated));
+	ASSERT_EQ(1, speculated.iid);
+	ASSERT_STREQ("foo", speculated.value.paxos_value_val);
+	paxos_accepted_destroy(&speculated);
+	
+	// a value accepted at a higher ballot replaces it
+	a = (paxos_accepted) {1, 1, 202, 202, {4, (char*)"baz"}, 0};
+	learner_receive_accepted(l, &a);
+	ASSERT_TRUE(learner_speculate_next(l, &speculated));
+	ASSERT_STREQ("baz", speculated.value.paxos_value_val);
+	paxos_accepted_destroy(&speculated);
+	
+	// not once the instance is closed
+	a = (paxos_accepted) {2, 1, 202, 202, {4, (char*)"baz"}, 0};
+	learner_receive_accepted(l, &a);
+	ASSERT_FALSE(learner_speculate_next(l, &speculated));
+	ASSERT_TRUE(learner_deliver_next(l, &deliver));
+	ASSERT_STREQ("baz", deliver.value.paxos_value_val);
+	paxos_accepted_destroy(&deliver);
+	
+	ASSERT_TRUE(learner_speculate_next(l, &speculated));
+	ASSERT_EQ(2, speculated.iid);
+	paxos_accepted_destroy(&speculated);
+}
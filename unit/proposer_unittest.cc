@@ -155,6 +155,84 @@ TEST_F(ProposerTest, PrepareAndAccept) {
 	TestAcceptAckFromQuorum(ar.iid, ar.ballot);
 }
 
+TEST_F(ProposerTest, AcceptTimestamps) {
+	paxos_prepare pr;
+	paxos_accept ar1, ar2;
+	char value[] = "a value";
+	int value_size = strlen(value) + 1;
+
+	proposer_prepare(p, &pr);
+	TestPrepareAckFromQuorum(pr.iid, pr.ballot);
+	proposer_prepare(p, &pr);
+	TestPrepareAckFromQuorum(pr.iid, pr.ballot);
+
+	proposer_propose(p, value, value_size);
+	proposer_propose(p, value, value_size);
+	ASSERT_TRUE(proposer_accept(p, &ar1));
+	ASSERT_TRUE(proposer_accept(p, &ar2));
+	ASSERT_EQ(1, ar1.iid);
+	ASSERT_GT(ar1.timestamp, 0);
+	ASSERT_GE(ar2.timestamp, ar1.timestamp);
+}
+
+TEST_F(ProposerTest, PartitionedInstances) {
+	paxos_prepare pr;
+	paxos_accept ar;
+	paxos_prepare_range prr;
+	paxos_promise_range pra;
+	char value[] = "a value";
+	int value_size = strlen(value) + 1;
+	proposer_set_partition(p, 3);
+
+	// owned instances are prepared at once, by a ranged phase 1
+	ASSERT_FALSE(proposer_range_prepared(p));
+	ASSERT_TRUE(proposer_prepare_range(p, &prr));
+	ASSERT_EQ(3, prr.from);
+	ASSERT_EQ(MAX_N_OF_PROPOSERS + id, prr.ballot);
+	ASSERT_EQ(3, prr.stride);
+
+	// refused, as promised to this owner before, it starts over higher
+	pra = (paxos_promise_range) {0, 3, prr.ballot, 2*MAX_N_OF_PROPOSERS+id, 0};
+	ASSERT_TRUE(proposer_receive_promise_range(p, &pra, &prr));
+	ASSERT_EQ(3*MAX_N_OF_PROPOSERS + id, prr.ballot);
+
+	// acceptor 1 holds a record of instance 3
+	for (size_t i = 0; i < quorum; ++i) {
+		pra = (paxos_promise_range) {i, 3, prr.ballot, 0, i == 1 ? 3 : 0};
+		ASSERT_FALSE(proposer_receive_promise_range(p, &pra, &prr));
+	}
+	ASSERT_TRUE(proposer_range_prepared(p));
+
+	// up to the highest instance reported, phase 1 runs at the range ballot
+	ASSERT_TRUE(proposer_prepare(p, &pr));
+	ASSERT_EQ(3, pr.iid);
+	ASSERT_EQ(prr.ballot, pr.ballot);
+	TestPrepareAckFromQuorum(3, prr.ballot);
+
+	// later owned instances need no phase 1
+	ASSERT_FALSE(proposer_prepare(p, &pr));
+	ASSERT_EQ(6, pr.iid);
+	ASSERT_EQ(prr.ballot, pr.ballot);
+
+	proposer_propose(p, value, value_size);
+	ASSERT_TRUE(proposer_accept(p, &ar));
+	CHECK_ACCEPT(ar, 3, prr.ballot, value, value_size);
+	ASSERT_FALSE(proposer_accept(p, &ar));
+
+	// instance 6 is skipped once a later one is seen accepted
+	paxos_accepted aa = (paxos_accepted) {0, 7, 1, 1};
+	ASSERT_EQ(0, proposer_receive_accepted(p, &aa));
+	ASSERT_TRUE(proposer_accept(p, &ar));
+	ASSERT_EQ(6, ar.iid);
+	ASSERT_EQ(0, ar.value.paxos_value_len);
+
+	// once preempted, an owned instance goes through phase 1
+	paxos_preempted pe = (paxos_preempted) {0, 6, 4*MAX_N_OF_PROPOSERS + 1};
+	ASSERT_TRUE(proposer_receive_preempted(p, &pe, &pr));
+	ASSERT_EQ(6, pr.iid);
+	ASSERT_GT(pr.ballot, prr.ballot);
+}
+
 TEST_F(ProposerTest, PreparePreempted) {
 	paxos_accept ar;
 	paxos_prepare pr, preempted;
@@ -436,3 +514,213 @@ TEST_F(ProposerTest, SetInstanceId) {
 	proposer_prepare(p, &pr);
 	ASSERT_EQ(pr.iid, iid + 1);
 }
+
+TEST_F(ProposerTest, DecidedRequests) {
+	iid_t iid;
+	unsigned request;
+	paxos_prepare pr;
+	paxos_accept ar;
+
+	// values not proposed on behalf of a request are not reported
+	proposer_prepare(p, &pr);
+	TestPrepareAckFromQuorum(pr.iid, pr.ballot);
+	proposer_propose(p, "value", strlen("value")+1);
+	ASSERT_TRUE(proposer_accept(p, &ar));
+	TestAcceptAckFromQuorum(ar.iid, ar.ballot);
+	ASSERT_FALSE(proposer_take_decided(p, &request, &iid));
+
+	proposer_prepare(p, &pr);
+	TestPrepareAckFromQuorum(pr.iid, pr.ballot);
+	proposer_propose_request(p, "value", strlen("value")+1, 42);
+	ASSERT_TRUE(proposer_accept(p, &ar));
+	ASSERT_FALSE(proposer_take_decided(p, &request, &iid));
+	TestAcceptAckFromQuorum(ar.iid, ar.ballot);
+	ASSERT_TRUE(proposer_take_decided(p, &request, &iid));
+	ASSERT_EQ(42, request);
+	ASSERT_EQ(pr.iid, iid);
+	ASSERT_FALSE(proposer_take_decided(p, &request, &iid));
+}
+
+TEST_F(ProposerTest, DecidedWhenChosen) {
+	iid_t iid;
+	unsigned request;
+	paxos_prepare pr;
+	paxos_accept ar;
+
+	proposer_prepare(p, &pr);
+	TestPrepareAckFromQuorum(pr.iid, pr.ballot);
+	proposer_propose_request(p, "value", strlen("value")+1, 42);
+	ASSERT_TRUE(proposer_accept(p, &ar));
+
+	// chosen at some other ballot
+	paxos_chosen chosen = {ar.iid, ar.ballot + 1, ar.value, 0};
+	ASSERT_EQ(0, proposer_receive_chosen(p, &chosen));
+	ASSERT_FALSE(proposer_take_decided(p, &request, &iid));
+
+	// a single chosen stands for a quorum of accepteds
+	chosen.ballot = ar.ballot;
+	ASSERT_EQ(1, proposer_receive_chosen(p, &chosen));
+	ASSERT_TRUE(proposer_take_decided(p, &request, &iid));
+	ASSERT_EQ(42, request);
+	ASSERT_EQ(ar.iid, iid);
+	ASSERT_EQ(ar.iid, proposer_commit_iid(p));
+
+	// the instance is closed already
+	ASSERT_EQ(0, proposer_receive_chosen(p, &chosen));
+	TestAcceptAckFromQuorum(ar.iid, ar.ballot, 0);
+}
+
+TEST_F(ProposerTest, RequestNotDecidedWhenPromisedValueChosen) {
+	iid_t iid;
+	unsigned request;
+	paxos_prepare pr;
+	paxos_accept ar;
+
+	proposer_prepare(p, &pr);
+	proposer_propose_request(p, "mine", strlen("mine")+1, 7);
+	TestPrepareAckFromQuorum(pr.iid, pr.ballot, "theirs", 1);
+	ASSERT_TRUE(proposer_accept(p, &ar));
+	CHECK_ACCEPT(ar, pr.iid, pr.ballot, "theirs", strlen("theirs")+1);
+	TestAcceptAckFromQuorum(ar.iid, ar.ballot);
+	ASSERT_FALSE(proposer_take_decided(p, &request, &iid));
+
+	// the request is proposed again in the next instance
+	proposer_prepare(p, &pr);
+	TestPrepareAckFromQuorum(pr.iid, pr.ballot);
+	ASSERT_TRUE(proposer_accept(p, &ar));
+	CHECK_ACCEPT(ar, pr.iid, pr.ballot, "mine", strlen("mine")+1);
+	TestAcceptAckFromQuorum(ar.iid, ar.ballot);
+	ASSERT_TRUE(proposer_take_decided(p, &request, &iid));
+	ASSERT_EQ(7, request);
+	ASSERT_EQ(pr.iid, iid);
+}
+
+TEST_F(ProposerTest, FillWithNoop) {
+	paxos_prepare pr;
+	paxos_accept ar;
+
+	proposer_propose(p, "value", strlen("value")+1);
+	ASSERT_TRUE(proposer_prepare_fill(p, 5, &pr));
+	ASSERT_EQ(5, pr.iid);
+	ASSERT_FALSE(proposer_prepare_fill(p, 5, &pr));
+	TestPrepareAckFromQuorum(pr.iid, pr.ballot);
+	ASSERT_TRUE(proposer_accept(p, &ar));
+	ASSERT_EQ(5, ar.iid);
+	ASSERT_EQ(0, ar.value.paxos_value_len);
+	TestAcceptAckFromQuorum(ar.iid, ar.ballot);
+
+	// the value is left for the instances that follow
+	proposer_prepare(p, &pr);
+	ASSERT_EQ(6, pr.iid);
+	TestPrepareAckFromQuorum(pr.iid, pr.ballot);
+	ASSERT_TRUE(proposer_accept(p, &ar));
+	CHECK_ACCEPT(ar, pr.iid, pr.ballot, "value", strlen("value")+1);
+}
+
+TEST_F(ProposerTest, FillPreemptedWithOtherValue) {
+	iid_t iid;
+	unsigned request;
+	paxos_prepare pr;
+	paxos_accept ar;
+
+	proposer_prepare(p, &pr);
+	proposer_propose_request(p, "mine", strlen("mine")+1, 7);
+	TestPrepareAckFromQuorum(pr.iid, pr.ballot);
+	ASSERT_TRUE(proposer_accept(p, &ar));
+
+	// preempted, the instance goes back to phase 1 with our value, and
+	// is then to be filled
+	paxos_preempted preempted = (paxos_preempted) {1, ar.iid, ar.ballot+1};
+	ASSERT_EQ(1, proposer_receive_preempted(p, &preempted, &pr));
+	ASSERT_FALSE(proposer_prepare_fill(p, pr.iid, &pr));
+	TestPrepareAckFromQuorum(pr.iid, pr.ballot, "theirs", ar.ballot+1);
+	ASSERT_TRUE(proposer_accept(p, &ar));
+	CHECK_ACCEPT(ar, pr.iid, pr.ballot, "theirs", strlen("theirs")+1);
+	TestAcceptAckFromQuorum(ar.iid, ar.ballot);
+	ASSERT_FALSE(proposer_take_decided(p, &request, &iid));
+
+	// our value is proposed again, and only then reported decided
+	proposer_prepare(p, &pr);
+	TestPrepareAckFromQuorum(pr.iid, pr.ballot);
+	ASSERT_TRUE(proposer_accept(p, &ar));
+	CHECK_ACCEPT(ar, pr.iid, pr.ballot, "mine", strlen("mine")+1);
+	TestAcceptAckFromQuorum(ar.iid, ar.ballot);
+	ASSERT_TRUE(proposer_take_decided(p, &request, &iid));
+	ASSERT_EQ(7, request);
+	ASSERT_EQ(pr.iid, iid);
+}
+
+TEST_F(ProposerTest, FillPrepared) {
+	paxos_prepare pr;
+	paxos_accept ar;
+
+	proposer_prepare(p, &pr);
+	TestPrepareAckFromQuorum(pr.iid, pr.ballot);
+	ASSERT_FALSE(proposer_accept(p, &ar));
+	ASSERT_FALSE(proposer_prepare_fill(p, pr.iid, &pr));
+	ASSERT_TRUE(proposer_accept(p, &ar));
+	ASSERT_EQ(0, ar.value.paxos_value_len);
+}
+
+TEST_F(ProposerTest, FillWithAcceptedValue) {
+	paxos_prepare pr;
+	paxos_accept ar;
+
+	ASSERT_TRUE(proposer_prepare_fill(p, 1, &pr));
+	TestPrepareAckFromQuorum(pr.iid, pr.ballot, "accepted", 1);
+	ASSERT_TRUE(proposer_accept(p, &ar));
+	CHECK_ACCEPT(ar, pr.iid, pr.ballot, "accepted", strlen("accepted")+1);
+}
+
+TEST_F(ProposerTest, NoopBeforeAcceptedValue) {
+	paxos_prepare pr1, pr2;
+	paxos_accept ar;
+
+	// with no value to propose, the first instance is only filled because
+	// the second one is bound to an accepted value
+	proposer_prepare(p, &pr1);
+	proposer_prepare(p, &pr2);
+	TestPrepareAckFromQuorum(pr1.iid, pr1.ballot);
+	ASSERT_FALSE(proposer_accept(p, &ar));
+	TestPrepareAckFromQuorum(pr2.iid, pr2.ballot, "accepted", 1);
+	ASSERT_TRUE(proposer_accept(p, &ar));
+	ASSERT_EQ(pr1.iid, ar.iid);
+	ASSERT_EQ(0, ar.value.paxos_value_len);
+	ASSERT_TRUE(proposer_accept(p, &ar));
+	CHECK_ACCEPT(ar, pr2.iid, pr2.ballot, "accepted", strlen("accepted")+1);
+}
+
+TEST_F(ProposerTest, FastCollision) {
+	size_t i;
+	iid_t iid;
+	struct timeout_iterator* iter;
+	paxos_accepted a = {0, 1, PAXOS_FAST_BALLOT, PAXOS_FAST_BALLOT,
+		{4, (char*)"foo"}, 0};
+	
+	// every acceptor accepted the same value
+	for (i = 0; i < acceptors; i++) {
+		a.aid = i;
+		ASSERT_EQ(0, proposer_receive_fast_accepted(p, &a));
+	}
+	
+	// acceptors disagree
+	a.iid = 2;
+	a.aid = 0;
+	ASSERT_EQ(0, proposer_receive_fast_accepted(p, &a));
+	a.aid = 1;
+	a.value.paxos_value_val = (char*)"bar";
+	ASSERT_EQ(1, proposer_receive_fast_accepted(p, &a));
+	
+	// one acceptor did not accept the value in time
+	a.iid = 3;
+	for (i = 0; i < acceptors - 1; i++) {
+		a.aid = i;
+		ASSERT_EQ(0, proposer_receive_fast_accepted(p, &a));
+	}
+	sleep(paxos_config.proposer_timeout);
+	iter = proposer_timeout_iterator(p);
+	ASSERT_TRUE(timeout_iterator_fast(iter, &iid));
+	ASSERT_EQ(3, iid);
+	ASSERT_FALSE(timeout_iterator_fast(iter, &iid));
+	timeout_iterator_free(iter);
+}
@@ -37,11 +37,92 @@
 static void
 replica_thread_deliver(unsigned iid, char* value, size_t size, void* arg)
 {
-	struct replica_thread* self = arg;
+	struct replica_log* log = arg;
+	struct replica_thread* self = log->thread;
 	assert(size == sizeof(int));
-	self->delivery_values[iid-1] = *(int*)value;
-	if (iid == self->delivery_count)
-		pthread_exit(NULL);
+	__atomic_add_fetch(&self->delivered, 1, __ATOMIC_RELEASE);
+	log->iid = iid;
+	if (iid > self->delivery_count)
+		return;
+	log->delivery_values[iid-1] = *(int*)value;
+	if (iid != self->delivery_count)
+		return;
+	/* Keep the loop running once done, so that the other replicas still get
+	 * the messages this one has queued for them. */
+	pthread_mutex_lock(&self->lock);
+	if (++self->logs_done == self->logs_count)
+		pthread_cond_broadcast(&self->done);
+	pthread_mutex_unlock(&self->lock);
+}
+
+/*
+	Snapshots hold the values delivered so far, followed by enough padding
+	for them to span several chunks.
+*/
+#define SNAPSHOT_PADDING (1024*1024)
+
+static int
+replica_thread_save(unsigned* iid, char** value, size_t* size, void* arg)
+{
+	struct replica_log* log = arg;
+	unsigned count = log->iid;
+	if (count > log->thread->delivery_count)
+		count = log->thread->delivery_count;
+	*iid = log->iid;
+	*size = count * sizeof(int) + SNAPSHOT_PADDING;
+	*value = calloc(1, *size);
+	memcpy(*value, log->delivery_values, count * sizeof(int));
+	return 0;
+}
+
+static void
+replica_thread_load(unsigned iid, char* value, size_t size, void* arg)
+{
+	struct replica_log* log = arg;
+	struct replica_thread* self = log->thread;
+	size_t len = size - SNAPSHOT_PADDING;
+	assert(size >= SNAPSHOT_PADDING);
+	memcpy(log->delivery_values, value, len);
+	__atomic_store_n(&self->delivered, len / sizeof(int), __ATOMIC_RELEASE);
+	log->iid = iid;
+}
+
+static void
+replica_thread_read_done(unsigned iid, void* arg)
+{
+	struct replica_thread* self = arg;
+	pthread_mutex_lock(&self->lock);
+	self->read_iid = iid;
+	self->read_done = 1;
+	pthread_cond_broadcast(&self->done);
+	pthread_mutex_unlock(&self->lock);
+}
+
+static void
+replica_thread_check_stop(evutil_socket_t fd, short event, void* arg)
+{
+	struct replica_thread* self = arg;
+	if (__atomic_load_n(&self->stop, __ATOMIC_ACQUIRE))
+		event_base_loopexit(self->base, NULL);
+	switch (__atomic_exchange_n(&self->read, 0, __ATOMIC_ACQ_REL)) {
+	case 1:
+		if (evpaxos_replica_read(self->logs[0].replica,
+			replica_thread_read_done, self) != 0)
+			replica_thread_read_done(0, self);
+		break;
+	case 2:
+		replica_thread_read_done(evpaxos_replica_read_stale(
+			self->logs[0].replica, self->read_staleness), self);
+		break;
+	case 3:
+		evpaxos_replica_send_trim(self->logs[0].replica, self->request_iid);
+		replica_thread_read_done(self->request_iid, self);
+		break;
+	case 4:
+		evpaxos_replica_checkpoint(self->logs[0].replica, self->request_iid);
+		replica_thread_read_done(self->request_iid, self);
+		break;
+	}
 }
 
 static void*
@@ -56,14 +137,68 @@ void
 replica_thread_create(struct replica_thread* self, int id, const char* config, 
 	int delivery_count)
 {
+	replica_thread_create_logs(self, id, config, delivery_count, 1);
+}
+
+static void
+replica_thread_start(struct replica_thread* self, int id, const char* config,
+	int delivery_count, int logs_count, int snapshots)
+{
+	int i;
+	struct replica_log* log;
 	self->delivery_count = delivery_count;
-	self->delivery_values = calloc(delivery_count, sizeof(int));
+	self->delivered = 0;
+	self->logs_count = logs_count;
+	self->logs_done = 0;
+	self->logs = calloc(logs_count, sizeof(struct replica_log));
+	self->stop = 0;
+	self->read = 0;
+	self->read_staleness = 0;
+	self->request_iid = 0;
+	self->read_done = 0;
+	self->read_iid = 0;
+	pthread_mutex_init(&self->lock, NULL);
+	pthread_cond_init(&self->done, NULL);
 	self->base = event_base_new();
-	self->replica = evpaxos_replica_init(id, config, replica_thread_deliver,
-		self, self->base);
+	struct timeval tv = {0, 10000};
+	self->stop_ev = event_new(self->base, -1, EV_PERSIST,
+		replica_thread_check_stop, self);
+	event_add(self->stop_ev, &tv);
+	for (i = 0; i < logs_count; i++) {
+		log = &self->logs[i];
+		log->thread = self;
+		log->delivery_values = calloc(delivery_count, sizeof(int));
+		if (i == 0)
+			log->replica = evpaxos_replica_init(id, config,
+				replica_thread_deliver, log, self->base);
+		else
+			log->replica = evpaxos_replica_init_log(self->logs[0].replica, i,
+				replica_thread_deliver, log);
+		if (snapshots)
+			evpaxos_replica_set_snapshot(log->replica, replica_thread_save,
+				replica_thread_load);
+	}
 	pthread_create(&self->thread, NULL, replica_thread_run, self);
 }
 
+void
+replica_thread_create_logs(struct replica_thread* self, int id,
+	const char* config, int delivery_count, int logs_count)
+{
+	replica_thread_start(self, id, config, delivery_count, logs_count, 0);
+}
+
+/*
+	Creates a replica that serves snapshots of the values it delivered, and
+	loads them in place of the values it missed.
+*/
+void
+replica_thread_create_snapshots(struct replica_thread* self, int id,
+	const char* config, int delivery_count)
+{
+	replica_thread_start(self, id, config, delivery_count, 1, 1);
+}
+
 void
 replica_thread_stop(struct replica_thread* self)
 {
@@ -73,14 +208,94 @@ replica_thread_stop(struct replica_thread* self)
 int*
 replica_thread_wait_deliveries(struct replica_thread* self)
 {
-	pthread_join(self->thread, NULL);
-	return self->delivery_values;
+	pthread_mutex_lock(&self->lock);
+	while (self->logs_done < self->logs_count)
+		pthread_cond_wait(&self->done, &self->lock);
+	pthread_mutex_unlock(&self->lock);
+	return self->logs[0].delivery_values;
+}
+
+/*
+	Returns the number of values delivered so far, no-ops excluded, whatever
+	the iids they were delivered at.
+*/
+int
+replica_thread_delivered(struct replica_thread* self)
+{
+	return __atomic_load_n(&self->delivered, __ATOMIC_ACQUIRE);
+}
+
+int*
+replica_thread_log_deliveries(struct replica_thread* self, int log)
+{
+	return self->logs[log].delivery_values;
+}
+
+static unsigned
+replica_thread_request(struct replica_thread* self, int kind)
+{
+	unsigned iid;
+	pthread_mutex_lock(&self->lock);
+	self->read_done = 0;
+	__atomic_store_n(&self->read, kind, __ATOMIC_RELEASE);
+	while (!self->read_done)
+		pthread_cond_wait(&self->done, &self->lock);
+	iid = self->read_iid;
+	pthread_mutex_unlock(&self->lock);
+	return iid;
+}
+
+/*
+	Reads from the first replica on its own thread, and returns the iid its
+	state reflects, or 0 if the read failed.
+*/
+unsigned
+replica_thread_read(struct replica_thread* self)
+{
+	return replica_thread_request(self, 1);
+}
+
+unsigned
+replica_thread_read_stale(struct replica_thread* self, unsigned max_staleness)
+{
+	self->read_staleness = max_staleness;
+	return replica_thread_request(self, 2);
+}
+
+/*
+	Has the first replica trim the acceptors up to iid, on its own thread.
+*/
+void
+replica_thread_trim(struct replica_thread* self, unsigned iid)
+{
+	self->request_iid = iid;
+	replica_thread_request(self, 3);
+}
+
+/*
+	Tells the first replica that its state is checkpointed up to iid, on its
+	own thread.
+*/
+void
+replica_thread_checkpoint(struct replica_thread* self, unsigned iid)
+{
+	self->request_iid = iid;
+	replica_thread_request(self, 4);
 }
 
 void
 replica_thread_destroy(struct replica_thread* self)
 {
-	free(self->delivery_values);
-	evpaxos_replica_free(self->replica);
+	int i;
+	__atomic_store_n(&self->stop, 1, __ATOMIC_RELEASE);
+	pthread_join(self->thread, NULL);
+	for (i = self->logs_count - 1; i >= 0; i--) {
+		free(self->logs[i].delivery_values);
+		evpaxos_replica_free(self->logs[i].replica);
+	}
+	free(self->logs);
+	event_free(self->stop_ev);
 	event_base_free(self->base);
+	pthread_cond_destroy(&self->done);
+	pthread_mutex_destroy(&self->lock);
 }
@@ -33,18 +33,47 @@
 extern "C" {
 #endif
 
+struct replica_log {
+	struct replica_thread* thread;
+	struct evpaxos_replica* replica;
+	int* delivery_values;
+	unsigned iid;  /* Last instance delivered or loaded */
+};
+
 struct replica_thread {
 	pthread_t thread;
 	struct event_base* base;
-	struct evpaxos_replica* replica;
 	int delivery_count;
-	int* delivery_values;
+	int delivered;
+	int logs_count;
+	int logs_done;
+	struct replica_log* logs;
+	int stop;
+	int read;
+	unsigned read_staleness;
+	int read_done;
+	unsigned read_iid;
+	unsigned request_iid;
+	struct event* stop_ev;
+	pthread_mutex_t lock;
+	pthread_cond_t done;
 };
 
 void replica_thread_create(struct replica_thread* self, int id,
 	const char* config, int delivery_count);
+void replica_thread_create_logs(struct replica_thread* self, int id,
+	const char* config, int delivery_count, int logs_count);
+void replica_thread_create_snapshots(struct replica_thread* self, int id,
+	const char* config, int delivery_count);
 void replica_thread_stop(struct replica_thread* self);
 int* replica_thread_wait_deliveries(struct replica_thread* self);
+int* replica_thread_log_deliveries(struct replica_thread* self, int log);
+int replica_thread_delivered(struct replica_thread* self);
+unsigned replica_thread_read(struct replica_thread* self);
+unsigned replica_thread_read_stale(struct replica_thread* self,
+	unsigned max_staleness);
+void replica_thread_trim(struct replica_thread* self, unsigned iid);
+void replica_thread_checkpoint(struct replica_thread* self, unsigned iid);
 void replica_thread_destroy(struct replica_thread* self);
 
 #ifdef __cplusplus
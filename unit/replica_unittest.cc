@@ -27,9 +27,11 @@
 
 
 #include "gtest/gtest.h"
+#include "paxos.h"
 #include "evpaxos.h"
 #include "test_client.h"
 #include "replica_thread.h"
+#include <unistd.h>
 
 
 int start_replicas_from_config(const char* config_file, 
@@ -45,13 +47,14 @@ int start_replicas_from_config(const char* config_file,
 	return count;
 }
 
-TEST(ReplicaTest, TotalOrderDelivery) {
+static void
+check_total_order_delivery(const char* config, int deliveries)
+{
 	struct replica_thread* threads;
-	int i, j, replicas, deliveries = 100000;
+	int i, j, replicas;
 		
-	replicas = start_replicas_from_config("config/replicas.conf", 
-		&threads, deliveries);
-	test_client* client = test_client_new("config/replicas.conf", 0);
+	replicas = start_replicas_from_config(config, &threads, deliveries);
+	test_client* client = test_client_new(config, 0);
 
 	for (i = 0; i < deliveries; i++)
 		test_client_submit_value(client, i);
@@ -68,3 +71,717 @@ TEST(ReplicaTest, TotalOrderDelivery) {
 	for (i = 0; i < replicas; i++)
 		replica_thread_destroy(&threads[i]);
 }
+
+TEST(ReplicaTest, TotalOrderDelivery) {
+	check_total_order_delivery("config/replicas.conf", 100000);
+}
+
+TEST(ReplicaTest, TotalOrderDeliveryWithIOThreads) {
+	check_total_order_delivery("config/replicas-io.conf", 10000);
+	paxos_config.io_threads = 0;
+}
+
+TEST(ReplicaTest, TotalOrderDeliveryWithAcceptorShards) {
+	check_total_order_delivery("config/replicas-shards.conf", 10000);
+	paxos_config.acceptor_shards = 1;
+}
+
+TEST(ReplicaTest, TotalOrderDeliveryWithoutLoopback) {
+	check_total_order_delivery("config/replicas-tcp.conf", 10000);
+	paxos_config.replica_loopback = 1;
+}
+
+TEST(ReplicaTest, TotalOrderDeliveryThroughSharedMemory) {
+	check_total_order_delivery("config/replicas-shm.conf", 10000);
+	paxos_config.shm_transport = 0;
+}
+
+TEST(ReplicaTest, TotalOrderDeliveryAlongRing) {
+	check_total_order_delivery("config/replicas-ring.conf", 10000);
+	paxos_config.acceptor_ring = 0;
+	paxos_config.group_2 = 2;
+}
+
+TEST(ReplicaTest, TotalOrderDeliveryPerLog) {
+	int i, j, k, replicas, logs = 2, deliveries = 1000;
+	const char* config = "config/replicas-logs.conf";
+	struct evpaxos_config* conf = evpaxos_config_read(config);
+	replicas = evpaxos_acceptor_count(conf);
+	evpaxos_config_free(conf);
+
+	struct replica_thread threads[replicas];
+	for (i = 0; i < replicas; i++)
+		replica_thread_create_logs(&threads[i], i, config, deliveries, logs);
+	test_client* client = test_client_new(config, 0);
+
+	for (i = 0; i < deliveries; i++)
+		for (k = 0; k < logs; k++)
+			test_client_submit_log_value(client, k, i * logs + k);
+
+	for (i = 0; i < replicas; i++)
+		replica_thread_wait_deliveries(&threads[i]);
+
+	for (i = 0; i < replicas; i++)
+		for (k = 0; k < logs; k++) {
+			int* values = replica_thread_log_deliveries(&threads[i], k);
+			for (j = 0; j < deliveries; j++)
+				ASSERT_EQ(values[j], j * logs + k);
+		}
+
+	test_client_free(client);
+	for (i = 0; i < replicas; i++)
+		replica_thread_destroy(&threads[i]);
+}
+
+static void
+count_reply(unsigned iid, void* request, void* arg)
+{
+	int* replies = (int*)arg;
+	ASSERT_GT(iid, 0);
+	replies[(long)request]++;
+}
+
+static void
+stop_client(evutil_socket_t fd, short ev, void* arg)
+{
+	event_base_loopexit((struct event_base*)arg, NULL);
+}
+
+/*
+	Replicas with an id lower than first are never started, the client values
+	get through once the remaining replicas have elected a leader.
+*/
+static void
+check_client_replies(const char* config, int proposer_id, int first)
+{
+	long i;
+	int count = 1000, replies[1000] = {0};
+	struct evpaxos_config* conf = evpaxos_config_read(config);
+	int replicas = evpaxos_acceptor_count(conf);
+	evpaxos_config_free(conf);
+	struct replica_thread threads[replicas];
+	for (i = first; i < replicas; i++)
+		replica_thread_create(&threads[i], i, config, count);
+
+	struct event_base* base = event_base_new();
+	struct evpaxos_client* client = evpaxos_client_init(config, proposer_id,
+		count_reply, replies, base);
+	ASSERT_TRUE(client != NULL);
+	for (i = 0; i < count; i++)
+		evpaxos_client_submit(client, (char*)&i, sizeof(int), (void*)i);
+	ASSERT_EQ(count, evpaxos_client_outstanding(client));
+
+	struct timeval tv = {0, 10000};
+	struct event* ev = event_new(base, -1, EV_PERSIST, stop_client, base);
+	while (evpaxos_client_outstanding(client) > 0) {
+		event_add(ev, &tv);
+		event_base_dispatch(base);
+	}
+	for (i = 0; i < count; i++)
+		ASSERT_EQ(1, replies[i]);
+
+	for (i = first; i < replicas; i++)
+		replica_thread_wait_deliveries(&threads[i]);
+	event_free(ev);
+	evpaxos_client_free(client);
+	event_base_free(base);
+	for (i = first; i < replicas; i++)
+		replica_thread_destroy(&threads[i]);
+}
+
+TEST(ReplicaTest, ClientReplies) {
+	check_client_replies("config/replicas-client.conf", 0, 0);
+}
+
+TEST(ReplicaTest, ClientRepliesForwardedByFollower) {
+	check_client_replies("config/replicas-client.conf", 2, 0);
+}
+
+// shared memory peers stay in the event loop, whatever the I/O threads
+TEST(ReplicaTest, ClientRepliesThroughSharedMemory) {
+	check_client_replies("config/replicas-shm-io.conf", 2, 0);
+	paxos_config.shm_transport = 0;
+	paxos_config.io_threads = 0;
+}
+
+/*
+	The proposer keeps track of a few requests at a time only, the values
+	it drops get through once the client submits them again.
+*/
+TEST(ReplicaTest, ClientResubmitsDroppedValues) {
+	paxos_config.client_timeout = 1;
+	paxos_config.proposer_max_requests = 500;
+	check_client_replies("config/replicas-client.conf", 0, 0);
+	paxos_config.client_timeout = 5;
+	paxos_config.proposer_max_requests = 65536;
+}
+
+TEST(ReplicaTest, ClientResubmitsDroppedForwards) {
+	paxos_config.client_timeout = 1;
+	paxos_config.proposer_max_requests = 500;
+	check_client_replies("config/replicas-client.conf", 2, 0);
+	paxos_config.client_timeout = 5;
+	paxos_config.proposer_max_requests = 65536;
+}
+
+/*
+	Values are submitted before any replica is up, they are sent once the
+	client connects to one, well before the client timeout.
+*/
+TEST(ReplicaTest, ClientSubmitsBeforeConnected) {
+	long i;
+	int replicas = 3, count = 100, replies[100] = {0};
+	const char* config = "config/replicas-client.conf";
+	struct replica_thread threads[replicas];
+	struct timeval start, end, tv = {0, 10000};
+	paxos_config.client_timeout = 60;
+
+	struct event_base* base = event_base_new();
+	struct evpaxos_client* client = evpaxos_client_init(config, 0,
+		count_reply, replies, base);
+	ASSERT_TRUE(client != NULL);
+	for (i = 0; i < count; i++)
+		evpaxos_client_submit(client, (char*)&i, sizeof(int), (void*)i);
+	gettimeofday(&start, NULL);
+	for (i = 0; i < replicas; i++)
+		replica_thread_create(&threads[i], i, config, count);
+
+	struct event* ev = event_new(base, -1, EV_PERSIST, stop_client, base);
+	while (evpaxos_client_outstanding(client) > 0) {
+		event_add(ev, &tv);
+		event_base_dispatch(base);
+	}
+	gettimeofday(&end, NULL);
+	ASSERT_LT(end.tv_sec - start.tv_sec, 10);
+	for (i = 0; i < count; i++)
+		ASSERT_EQ(1, replies[i]);
+
+	for (i = 0; i < replicas; i++)
+		replica_thread_wait_deliveries(&threads[i]);
+	event_free(ev);
+	evpaxos_client_free(client);
+	event_base_free(base);
+	for (i = 0; i < replicas; i++)
+		replica_thread_destroy(&threads[i]);
+	paxos_config.client_timeout = 5;
+}
+
+TEST(ReplicaTest, ClientRepliesAfterLeaderFailure) {
+	check_client_replies("config/replicas-election.conf", 2, 1);
+	paxos_config.client_timeout = 5;
+	paxos_config.proposer_leader_timeout = 3000;
+	paxos_config.group_1 = paxos_config.group_2 = 2;
+}
+
+/*
+	Instance 2 is accepted straight by the acceptors, as if by a proposer that
+	then failed, instance 1 stays empty until the leader fills it.
+*/
+TEST(ReplicaTest, StalledInstanceFilled) {
+	int i, replicas;
+	const char* config = "config/replicas-stall.conf";
+	struct replica_thread* threads;
+	replicas = start_replicas_from_config(config, &threads, 2);
+
+	test_client* clients[replicas];
+	for (i = 0; i < replicas; i++) {
+		clients[i] = test_client_new(config, i);
+		test_client_send_accept(clients[i], 2, 1000, 42);
+	}
+
+	for (i = 0; i < replicas; i++) {
+		int* values = replica_thread_wait_deliveries(&threads[i]);
+		ASSERT_EQ(0, values[0]);
+		ASSERT_EQ(42, values[1]);
+	}
+
+	for (i = 0; i < replicas; i++) {
+		test_client_free(clients[i]);
+		replica_thread_destroy(&threads[i]);
+	}
+	free(threads);
+	paxos_config.learner_stall_deadline = 1000;
+}
+
+/*
+	Replica 2 starts once the acceptors are trimmed past the values decided
+	so far, these can only reach it from the logs of the other learners.
+*/
+TEST(ReplicaTest, CatchUpFromOtherLearners) {
+	int i, j, replicas = 3, count = 100;
+	const char* config = "config/replicas-catchup.conf";
+	struct replica_thread threads[replicas];
+	for (i = 0; i < replicas - 1; i++)
+		replica_thread_create(&threads[i], i, config, count + 1);
+	test_client* client = test_client_new(config, 0);
+	for (i = 0; i < count; i++)
+		test_client_submit_value(client, i);
+	for (i = 0; i < replicas - 1; i++)
+		while (replica_thread_delivered(&threads[i]) < count)
+			usleep(10000);
+
+	replica_thread_trim(&threads[0], count);
+	replica_thread_create(&threads[replicas - 1], replicas - 1, config,
+		count + 1);
+	sleep(1);
+	test_client_submit_value(client, count);
+
+	for (i = 0; i < replicas; i++) {
+		int* values = replica_thread_wait_deliveries(&threads[i]);
+		for (j = 0; j <= count; j++)
+			ASSERT_EQ(j, values[j]);
+	}
+
+	test_client_free(client);
+	for (i = 0; i < replicas; i++)
+		replica_thread_destroy(&threads[i]);
+	paxos_config.learner_log_size = 0;
+}
+
+/*
+	Replica 2 starts once the acceptors are trimmed past the values decided
+	so far, and the learners keep no log of them: it can only install a
+	snapshot of another replica, spanning many chunks, then deliver the
+	values decided after it.
+*/
+static void
+check_snapshot_install(const char* config)
+{
+	int i, j, replicas = 3, count = 100;
+	struct replica_thread threads[replicas];
+	for (i = 0; i < replicas - 1; i++)
+		replica_thread_create_snapshots(&threads[i], i, config, count + 1);
+	test_client* client = test_client_new(config, 0);
+	for (i = 0; i < count; i++)
+		test_client_submit_value(client, i);
+	for (i = 0; i < replicas - 1; i++)
+		while (replica_thread_delivered(&threads[i]) < count)
+			usleep(10000);
+
+	replica_thread_trim(&threads[0], count);
+	replica_thread_create_snapshots(&threads[replicas - 1], replicas - 1,
+		config, count + 1);
+	while (replica_thread_delivered(&threads[replicas - 1]) < count)
+		usleep(10000);
+	test_client_submit_value(client, count);
+
+	for (i = 0; i < replicas; i++) {
+		int* values = replica_thread_wait_deliveries(&threads[i]);
+		for (j = 0; j <= count; j++)
+			ASSERT_EQ(j, values[j]);
+	}
+
+	test_client_free(client);
+	for (i = 0; i < replicas; i++)
+		replica_thread_destroy(&threads[i]);
+}
+
+TEST(ReplicaTest, InstallSnapshotAfterTrim) {
+	check_snapshot_install("config/replicas-snapshot.conf");
+}
+
+// learners starting late still recover from a snapshot
+TEST(ReplicaTest, InstallSnapshotWithoutCatchUp) {
+	paxos_config.learner_catch_up = 0;
+	check_snapshot_install("config/replicas-snapshot.conf");
+	paxos_config.learner_catch_up = 1;
+}
+
+/*
+	Replica 2 refuses the snapshots larger than it accepts, and stays behind
+	until it is allowed to take them.
+*/
+TEST(ReplicaTest, RefuseSnapshotOverLimit) {
+	int i, j, replicas = 3, count = 100;
+	const char* config = "config/replicas-snapshot-limit.conf";
+	struct replica_thread threads[replicas];
+	for (i = 0; i < replicas - 1; i++)
+		replica_thread_create_snapshots(&threads[i], i, config, count + 1);
+	test_client* client = test_client_new(config, 0);
+	for (i = 0; i < count; i++)
+		test_client_submit_value(client, i);
+	for (i = 0; i < replicas - 1; i++)
+		while (replica_thread_delivered(&threads[i]) < count)
+			usleep(10000);
+
+	replica_thread_trim(&threads[0], count);
+	paxos_config.learner_snapshot_max_size = 64*1024;
+	replica_thread_create_snapshots(&threads[replicas - 1], replicas - 1,
+		config, count + 1);
+	sleep(2);
+	ASSERT_EQ(0, replica_thread_delivered(&threads[replicas - 1]));
+
+	paxos_config.learner_snapshot_max_size = 1024*1024*1024;
+	while (replica_thread_delivered(&threads[replicas - 1]) < count)
+		usleep(10000);
+	test_client_submit_value(client, count);
+	for (i = 0; i < replicas; i++) {
+		int* values = replica_thread_wait_deliveries(&threads[i]);
+		for (j = 0; j <= count; j++)
+			ASSERT_EQ(j, values[j]);
+	}
+
+	test_client_free(client);
+	for (i = 0; i < replicas; i++)
+		replica_thread_destroy(&threads[i]);
+}
+
+/*
+	Replicas 0 and 1 checkpoint all the values, replica 2 only half of them:
+	the acceptors are trimmed up to the lowest checkpoint, and further once
+	replica 2 catches up.
+*/
+TEST(ReplicaTest, TrimToLowestCheckpoint) {
+	int i, replicas = 3, count = 100;
+	const char* config = "config/replicas-trim.conf";
+	struct replica_thread threads[replicas];
+	for (i = 0; i < replicas; i++)
+		replica_thread_create(&threads[i], i, config, count);
+	test_client* client = test_client_new(config, 0);
+	for (i = 0; i < count; i++)
+		test_client_submit_value(client, i);
+	for (i = 0; i < replicas; i++)
+		replica_thread_wait_deliveries(&threads[i]);
+
+	replica_thread_checkpoint(&threads[0], count);
+	replica_thread_checkpoint(&threads[1], count);
+	replica_thread_checkpoint(&threads[2], count / 2);
+	while (test_client_acceptor_trim(client) < count / 2);
+	for (i = 0; i < 3; i++)
+		ASSERT_EQ(count / 2, test_client_acceptor_trim(client));
+
+	replica_thread_checkpoint(&threads[2], count);
+	while (test_client_acceptor_trim(client) < count);
+
+	test_client_free(client);
+	for (i = 0; i < replicas; i++)
+		replica_thread_destroy(&threads[i]);
+}
+
+struct cursor_learner
+{
+	struct event_base* base;
+	int count;
+	unsigned first_iid;
+	int* values;
+	int delivered;
+};
+
+static void
+cursor_learner_deliver(unsigned iid, char* value, size_t size, void* arg)
+{
+	struct cursor_learner* l = (struct cursor_learner*)arg;
+	if (l->delivered == 0)
+		l->first_iid = iid;
+	l->values[l->delivered++] = *(int*)value;
+	if (l->delivered == l->count)
+		event_base_loopbreak(l->base);
+}
+
+/*
+	A learner with a cursor is stopped once it learned the first values,
+	started again it resumes right after them instead of from instance 1.
+*/
+TEST(ReplicaTest, LearnerResumesFromCursor) {
+	int i, j, replicas = 3, count = 50;
+	const char* config = "config/replicas-cursor.conf";
+	const char* path = "/tmp/evpaxos-unit-cursor";
+	struct replica_thread threads[replicas];
+	struct timeval connect_tv = {0, 200000};
+	unlink(path);
+	paxos_config.learner_cursor_path = (char*)path;
+	for (i = 0; i < replicas; i++)
+		replica_thread_create(&threads[i], i, config, count * 2);
+	test_client* client = test_client_new(config, 0);
+
+	for (j = 0; j < 2; j++) {
+		int values[count];
+		struct cursor_learner l = { event_base_new(), count, 0, values, 0 };
+		struct evlearner* learner = evlearner_init(config,
+			cursor_learner_deliver, &l, l.base);
+		ASSERT_TRUE(learner != NULL);
+		event_base_loopexit(l.base, &connect_tv);
+		event_base_dispatch(l.base);
+		for (i = 0; i < count; i++)
+			test_client_submit_value(client, j * count + i);
+		event_base_dispatch(l.base);
+		evlearner_free(learner);
+		event_base_free(l.base);
+		ASSERT_EQ(j * count + 1, l.first_iid);
+		for (i = 0; i < count; i++)
+			ASSERT_EQ(j * count + i, values[i]);
+	}
+
+	test_client_free(client);
+	for (i = 0; i < replicas; i++)
+		replica_thread_destroy(&threads[i]);
+	paxos_config.learner_cursor_path = NULL;
+	unlink(path);
+}
+
+/*
+	Reads are served by the leader, replica 0, once it has delivered every
+	value decided before them, the other replicas refuse them.
+*/
+static void
+check_reads(const char* config)
+{
+	int i, replicas, count = 100;
+	struct replica_thread* threads;
+	replicas = start_replicas_from_config(config, &threads, count);
+	test_client* client = test_client_new(config, 0);
+	for (i = 0; i < count; i++)
+		test_client_submit_value(client, i);
+	for (i = 0; i < replicas; i++)
+		replica_thread_wait_deliveries(&threads[i]);
+
+	ASSERT_GE(replica_thread_read(&threads[0]), count);
+	ASSERT_GE(replica_thread_read(&threads[0]), count);
+	for (i = 1; i < replicas; i++)
+		ASSERT_EQ(0, replica_thread_read(&threads[i]));
+
+	test_client_free(client);
+	for (i = 0; i < replicas; i++)
+		replica_thread_destroy(&threads[i]);
+	free(threads);
+}
+
+TEST(ReplicaTest, LinearizableReads) {
+	check_reads("config/replicas-reads.conf");
+}
+
+TEST(ReplicaTest, LinearizableReadsWithLease) {
+	check_reads("config/replicas-lease.conf");
+	paxos_config.proposer_lease = 0;
+}
+
+/*
+	Under the lease of replica 0, another proposer heartbeating with a higher
+	ballot takes over no acceptor, which drop its accepts as well: the value
+	it tries to decide never is, and the leader keeps serving reads.
+*/
+TEST(ReplicaTest, LeaseHeldAgainstOtherProposer) {
+	int i, j, replicas = 3, count = 10;
+	unsigned ballot = 1 << 20;
+	const char* config = "config/replicas-takeover.conf";
+	struct replica_thread threads[replicas];
+	test_client* others[replicas];
+	for (i = 0; i < replicas; i++)
+		replica_thread_create(&threads[i], i, config, count + 1);
+	test_client* client = test_client_new(config, 0);
+	for (i = 0; i < count; i++)
+		test_client_submit_value(client, i);
+	for (i = 0; i < replicas; i++)
+		while (replica_thread_delivered(&threads[i]) < count)
+			usleep(10000);
+	ASSERT_GE(replica_thread_read(&threads[0]), count);
+
+	for (i = 0; i < replicas; i++) {
+		others[i] = test_client_new(config, i);
+		test_client_send_heartbeat(others[i], 1, ballot);
+		test_client_send_accept(others[i], count + 1, ballot, 999);
+	}
+	usleep(100000);
+	ASSERT_GE(replica_thread_read(&threads[0]), count);
+	test_client_submit_value(client, count);
+
+	for (i = 0; i < replicas; i++) {
+		int* values = replica_thread_wait_deliveries(&threads[i]);
+		for (j = 0; j <= count; j++)
+			ASSERT_EQ(j, values[j]);
+	}
+
+	for (i = 0; i < replicas; i++)
+		test_client_free(others[i]);
+	test_client_free(client);
+	for (i = 0; i < replicas; i++)
+		replica_thread_destroy(&threads[i]);
+	paxos_config.proposer_lease = 0;
+}
+
+static unsigned
+wait_read(struct replica_thread* thread)
+{
+	unsigned iid;
+	while ((iid = replica_thread_read(thread)) == 0)
+		usleep(100000);
+	return iid;
+}
+
+static void
+wait_delivered(struct replica_thread* threads, int from, int to, int count)
+{
+	int i;
+	for (i = from; i < to; i++)
+		while (replica_thread_delivered(&threads[i]) < count)
+			usleep(10000);
+}
+
+/*
+	Replica 0 restarts once replica 1 took over, and gets its leadership
+	back with ballots lower than those of replica 1, its reads are served
+	only once the acceptors acknowledge its heartbeats again.
+*/
+TEST(ReplicaTest, LinearizableReadsAfterLeaderRestart) {
+	int i, replicas = 3, count = 100;
+	const char* config = "config/replicas-reelection.conf";
+	struct replica_thread threads[replicas];
+	for (i = 0; i < replicas; i++)
+		replica_thread_create(&threads[i], i, config, count * 2);
+
+	test_client* client = test_client_new(config, 0);
+	for (i = 0; i < count; i++)
+		test_client_submit_value(client, i);
+	wait_delivered(threads, 0, replicas, count);
+	ASSERT_GE(wait_read(&threads[0]), count);
+	test_client_free(client);
+	replica_thread_destroy(&threads[0]);
+	sleep(3);
+
+	client = test_client_new(config, 1);
+	for (i = count; i < count * 2; i++)
+		test_client_submit_value(client, i);
+	wait_delivered(threads, 1, replicas, count * 2);
+	ASSERT_GE(wait_read(&threads[1]), count * 2);
+
+	replica_thread_create(&threads[0], 0, config, count * 2);
+	wait_delivered(threads, 0, 1, count * 2);
+	ASSERT_GE(wait_read(&threads[0]), count * 2);
+
+	test_client_free(client);
+	for (i = 0; i < replicas; i++)
+		replica_thread_destroy(&threads[i]);
+	paxos_config.proposer_leader_timeout = 3000;
+	paxos_config.group_1 = paxos_config.group_2 = 2;
+}
+
+/*
+	Any replica serves reads within a staleness bound, until its state is
+	older than the bound, as it gets between the heartbeats of the leader.
+*/
+TEST(ReplicaTest, BoundedStalenessReads) {
+	int i, replicas, count = 100;
+	const char* config = "config/replicas-reads.conf";
+	struct replica_thread* threads;
+	replicas = start_replicas_from_config(config, &threads, count);
+	test_client* client = test_client_new(config, 0);
+	for (i = 0; i < count; i++)
+		test_client_submit_value(client, i);
+	for (i = 0; i < replicas; i++)
+		replica_thread_wait_deliveries(&threads[i]);
+
+	for (i = 0; i < replicas; i++)
+		ASSERT_GE(replica_thread_read_stale(&threads[i], 60000), count);
+	usleep(50000);
+	for (i = 0; i < replicas; i++)
+		ASSERT_EQ(0, replica_thread_read_stale(&threads[i], 1));
+
+	test_client_free(client);
+	for (i = 0; i < replicas; i++)
+		replica_thread_destroy(&threads[i]);
+	free(threads);
+}
+
+/*
+	The heartbeats of the leader keep the state of every replica within the
+	staleness bound long after the last value was decided.
+*/
+TEST(ReplicaTest, BoundedStalenessReadsWhenIdle) {
+	int i, replicas, count = 100;
+	const char* config = "config/replicas-idle.conf";
+	struct replica_thread* threads;
+	replicas = start_replicas_from_config(config, &threads, count);
+	test_client* client = test_client_new(config, 0);
+	for (i = 0; i < count; i++)
+		test_client_submit_value(client, i);
+	for (i = 0; i < replicas; i++)
+		replica_thread_wait_deliveries(&threads[i]);
+
+	sleep(4);
+	for (i = 0; i < replicas; i++)
+		ASSERT_GE(replica_thread_read_stale(&threads[i], 2500), count);
+
+	test_client_free(client);
+	for (i = 0; i < replicas; i++)
+		replica_thread_destroy(&threads[i]);
+	free(threads);
+}
+
+/*
+	Every replica proposes the values submitted to it in its own instances,
+	the others fill their idle instances with no-ops. Values are counted
+	rather than waited for by iid, as any instance may turn out a no-op.
+*/
+TEST(ReplicaTest, TotalOrderDeliveryPartitioned) {
+	int i, j, replicas, count = 100;
+	const char* config = "config/replicas-partition.conf";
+	struct replica_thread* threads;
+	struct evpaxos_config* conf = evpaxos_config_read(config);
+	replicas = evpaxos_acceptor_count(conf);
+	evpaxos_config_free(conf);
+	int slots = replicas * count * 10, total = 0;
+	replicas = start_replicas_from_config(config, &threads, slots);
+
+	/* Replicas started before the others were listening reconnect later,
+	   the accepteds broadcast until then are not repeated to them unless
+	   some later instance is closed, and none follows the last values. */
+	sleep(3);
+
+	test_client* clients[replicas];
+	for (i = 0; i < replicas; i++) {
+		clients[i] = test_client_new(config, i);
+		for (j = 1; j <= count; j++)
+			test_client_submit_value(clients[i], i * count + j);
+	}
+
+	for (i = 0; i < replicas; i++)
+		while (replica_thread_delivered(&threads[i]) < replicas * count)
+			usleep(10000);
+
+	int* values = replica_thread_log_deliveries(&threads[0], 0);
+	for (i = 1; i < replicas; i++) {
+		int* other = replica_thread_log_deliveries(&threads[i], 0);
+		for (j = 0; j < slots; j++)
+			ASSERT_EQ(values[j], other[j]);
+	}
+	for (j = 0; j < slots; j++)
+		if (values[j] != 0)
+			total++;
+	ASSERT_EQ(replicas * count, total);
+
+	for (i = 0; i < replicas; i++) {
+		test_client_free(clients[i]);
+		replica_thread_destroy(&threads[i]);
+	}
+	free(threads);
+	paxos_config.proposer_partition = 0;
+}
+
+TEST(ReplicaTest, TotalOrderDeliveryFast) {
+	int i, j, replicas, deliveries = 1000;
+	const char* config = "config/replicas-fast.conf";
+	struct replica_thread* threads;
+	replicas = start_replicas_from_config(config, &threads, deliveries);
+
+	/* Values relayed before every replica reached every acceptor would
+	   be accepted by some of them only, and decided in a classic round. */
+	sleep(3);
+
+	test_client* client = test_client_new(config, 0);
+	for (i = 0; i < deliveries; i++)
+		test_client_submit_value(client, i);
+
+	int* values[replicas];
+	for (i = 0; i < replicas; i++)
+		values[i] = replica_thread_wait_deliveries(&threads[i]);
+
+	for (i = 0; i < replicas; i++)
+		for (j = 0; j < deliveries; j++)
+			ASSERT_EQ(values[i][j], j);
+
+	test_client_free(client);
+	for (i = 0; i < replicas; i++)
+		replica_thread_destroy(&threads[i]);
+	free(threads);
+	paxos_config.fast_paxos = 0;
+}
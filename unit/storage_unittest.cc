@@ -37,12 +37,21 @@ protected:
 		paxos_config.verbosity = PAXOS_LOG_ERROR;
 		paxos_config.storage_backend = GetParam();
 		paxos_config.trash_files = 1;
+		paxos_config.acceptor_cache_size = 0;
 		storage_init(&store, 0);
 		storage_open(&store);
 	}
 	
 	virtual void TearDown() {
 		storage_close(&store);
+		paxos_config.acceptor_cache_size = 0;
+	}
+
+	void EnableCache(size_t size) {
+		storage_close(&store);
+		paxos_config.acceptor_cache_size = size;
+		storage_init(&store, 0);
+		storage_open(&store);
 	}
 	
 	void TestPutManyInstances(iid_t from, iid_t to) {
@@ -151,6 +160,74 @@ TEST_P(StorageTest, TrimWithHoles) {
 	TestCheckInstancesExist(501, 600);
 }
 
+TEST_P(StorageTest, CacheHitsRecentRecords) {
+	paxos_accepted accepted;
+	EnableCache(1024*1024);
+	TestPutManyInstances(1, 100);
+	TestCheckInstancesExist(1, 100);
+	ASSERT_EQ(storage_cache_hits(store.cache), 100);
+	ASSERT_EQ(storage_cache_misses(store.cache), 0);
+
+	storage_tx_begin(&store);
+	ASSERT_EQ(storage_get_record(&store, 101, &accepted), 0);
+	storage_tx_commit(&store);
+	ASSERT_EQ(storage_cache_misses(store.cache), 1);
+}
+
+TEST_P(StorageTest, CacheKeepsValues) {
+	paxos_accepted accepted = {0, 1, 101, 101, {5, (char*)"test"}};
+	EnableCache(1024*1024);
+
+	storage_tx_begin(&store);
+	storage_put_record(&store, &accepted);
+	accepted.ballot = 202;
+	accepted.value = (paxos_value) {6, (char*)"test2"};
+	storage_put_record(&store, &accepted);
+	storage_tx_commit(&store);
+
+	storage_tx_begin(&store);
+	ASSERT_EQ(storage_get_record(&store, 1, &accepted), 1);
+	storage_tx_commit(&store);
+	ASSERT_EQ(storage_cache_hits(store.cache), 1);
+	ASSERT_EQ(accepted.ballot, 202);
+	ASSERT_STREQ(accepted.value.paxos_value_val, "test2");
+	paxos_accepted_destroy(&accepted);
+}
+
+TEST_P(StorageTest, CacheIsBounded) {
+	size_t max_size = 64*1024;
+	EnableCache(max_size);
+	TestPutManyInstances(1, 10000);
+	ASSERT_LE(storage_cache_size(store.cache), max_size);
+
+	// evicted records are still found in storage
+	TestCheckInstancesExist(1, 10);
+	ASSERT_EQ(storage_cache_misses(store.cache), 10);
+	TestCheckInstancesExist(9991, 10000);
+	ASSERT_EQ(storage_cache_hits(store.cache), 10);
+}
+
+TEST_P(StorageTest, CacheTrim) {
+	EnableCache(1024*1024);
+	TestPutManyInstances(1, 1000);
+
+	storage_tx_begin(&store);
+	storage_trim(&store, 500);
+	storage_tx_commit(&store);
+
+	TestCheckInstancesDeleted(1, 500);
+	TestCheckInstancesExist(501, 1000);
+	ASSERT_EQ(storage_cache_hits(store.cache), 500);
+}
+
+TEST_P(StorageTest, CacheDroppedOnAbort) {
+	EnableCache(1024*1024);
+	TestPutManyInstances(1, 10);
+	storage_tx_begin(&store);
+	storage_tx_abort(&store);
+	ASSERT_EQ(storage_cache_size(store.cache), 0);
+}
+
 paxos_storage_backend backends[] = {
 	PAXOS_MEM_STORAGE,
 #if HAS_LMDB
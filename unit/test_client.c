@@ -27,6 +27,7 @@
 
 
 #include <evpaxos.h>
+#include <message.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
@@ -58,16 +59,77 @@ connect_to_proposer(struct test_client* c, const char* config, int proposer_id)
 void
 test_client_submit_value(struct test_client* c, int value)
 {
-	paxos_submit(c->bev, (char*)&value, sizeof(int));
+	test_client_submit_log_value(c, 0, value);
+}
+
+void
+test_client_submit_log_value(struct test_client* c, unsigned log, int value)
+{
+	paxos_submit_log(c->bev, log, (char*)&value, sizeof(int));
+	event_base_dispatch(c->base);
+}
+
+/*
+	Sends an accept straight to the acceptor, as a proposer would.
+*/
+void
+test_client_send_accept(struct test_client* c, unsigned iid, unsigned ballot,
+	int value)
+{
+	paxos_accept accept = {iid, ballot, {sizeof(int), (char*)&value}};
+	send_paxos_accept(c->bev, &accept);
 	event_base_dispatch(c->base);
 }
 
+/*
+	Sends a heartbeat straight to the acceptor, as a leader would.
+*/
+void
+test_client_send_heartbeat(struct test_client* c, unsigned seq,
+	unsigned ballot)
+{
+	paxos_message msg = {
+		.type = PAXOS_HEARTBEAT,
+		.u.heartbeat = {seq, ballot} };
+	send_paxos_message(c->bev, &msg);
+	event_base_dispatch(c->base);
+}
+
+/*
+	Waits for the next state advertised by the acceptor the client is
+	connected to, and returns the instance id it is trimmed up to. States
+	are read in order, the first ones may have been queued for a while.
+*/
+unsigned
+test_client_acceptor_trim(struct test_client* c)
+{
+	paxos_message msg;
+	unsigned iid = 0;
+	int found = 0;
+	struct evbuffer* in = bufferevent_get_input(c->bev);
+	bufferevent_enable(c->bev, EV_READ);
+	while (!found) {
+		while (!found && recv_paxos_message(c->decoder, in, &msg) > 0) {
+			if (msg.type == PAXOS_ACCEPTOR_STATE) {
+				iid = msg.u.state.trim_iid;
+				found = 1;
+			}
+			paxos_decoder_release(c->decoder, in, &msg);
+		}
+		if (!found)
+			event_base_loop(c->base, EVLOOP_ONCE);
+	}
+	bufferevent_disable(c->bev, EV_READ);
+	return iid;
+}
+
 struct test_client*
 test_client_new(const char* config, int proposer_id)
 {
 	struct test_client* c;
 	c = malloc(sizeof(struct test_client));
 	c->base = event_base_new();
+	c->decoder = paxos_decoder_new();
 	c->bev = connect_to_proposer(c, config, proposer_id);
 	if (c->bev == NULL)
 		return NULL;
@@ -78,6 +140,7 @@ void
 test_client_free(struct test_client* c)
 {
 	bufferevent_free(c->bev);
+	paxos_decoder_free(c->decoder);
 	event_base_free(c->base);
 	free(c);
 }
@@ -37,11 +37,19 @@ struct test_client
 {
 	struct bufferevent* bev;
 	struct event_base* base;
+	struct paxos_decoder* decoder;
 };
 
 struct test_client* test_client_new(const char* config, int proposer_id);
 void test_client_free(struct test_client* c);
 void test_client_submit_value(struct test_client* c, int value);
+void test_client_submit_log_value(struct test_client* c, unsigned log,
+	int value);
+void test_client_send_accept(struct test_client* c, unsigned iid,
+	unsigned ballot, int value);
+void test_client_send_heartbeat(struct test_client* c, unsigned seq,
+	unsigned ballot);
+unsigned test_client_acceptor_trim(struct test_client* c);
 
 #ifdef __cplusplus
 }
@@ -55,6 +55,12 @@ module GenPack
         pack_typedef(f, type)
         unpack_typedef(f, type)
       end
+      schema.structs.each do |type|
+        pack_struct(f, type)
+        unpack_struct(f, type)
+        pack_struct_array(f, type)
+        unpack_struct_array(f, type)
+      end
       schema.messages.each do |msg|
         pack_message(f, msg)
         unpack_message(f, msg)
@@ -74,6 +80,39 @@ module GenPack
         msg.fields.each {|field| f.write indent(field.unpack("&v->"))}
       end
     end
+    def pack_struct(f, msg)
+      wrap_function(f, msg.pack_signature) do
+        f.write indent("msgpack_pack_array(p, #{msg.total_fields});")
+        msg.fields.each {|field| f.write indent(field.pack)}
+      end
+    end
+    def unpack_struct(f, msg)
+      wrap_function(f, msg.unpack_signature) do
+        f.write indent("int i = 0;")
+        msg.fields.each {|field| f.write indent(field.unpack("&v->"))}
+      end
+    end
+    def pack_struct_array(f, msg)
+      wrap_function(f, msg.pack_array_signature) do
+        f.write indent("int k;")
+        f.write indent("msgpack_pack_array(p, len);")
+        f.write indent("for (k = 0; k < len; k++)")
+        f.write indent("msgpack_pack_#{msg.name}(p, &v[k]);", 2)
+      end
+    end
+    def unpack_struct_array(f, msg)
+      wrap_function(f, msg.unpack_array_signature) do
+        f.write indent("int k;")
+        f.write indent("msgpack_object* a = &o->via.array.ptr[*i];")
+        f.write indent("*len = a->via.array.size;")
+        f.write indent("*v = NULL;")
+        f.write indent("if (*len > 0)")
+        f.write indent("*v = malloc(*len * sizeof(#{msg.name}));", 2)
+        f.write indent("for (k = 0; k < *len; k++)")
+        f.write indent("msgpack_unpack_#{msg.name}(&a->via.array.ptr[k], &(*v)[k]);", 2)
+        f.write indent("(*i)++;")
+      end
+    end
     def pack_message(f, msg)
       wrap_function(f, msg.pack_signature) do
         f.write indent("msgpack_pack_array(p, #{msg.total_fields+1});")
@@ -161,7 +200,7 @@ module GenPack
       f.puts "#endif\n"
     end
     def declare_types(f)      
-      (schema.typedefs + schema.messages).each do |type|
+      (schema.typedefs + schema.structs + schema.messages).each do |type|
         declare_struct(f, type)
       end
       schema.unions.each do |union|
@@ -188,6 +227,9 @@ module GenPack
     def declare_union(f, type)
       wrap_struct(f, type) do
         f.write indent("#{type.name}_type type;")
+        type.header_fields.each do |field|
+          f.write indent("#{field.var_type.declare(field.name)}")
+        end
         f.write indent("union\n\t{")
         type.fields.each {|field| f.puts "\t\t#{field.var_type.declare(field.name)}\n"}
         f.write indent("} u;")
@@ -229,6 +271,12 @@ static void msgpack_unpack_uint32_at(msgpack_object* o, uint32_t* v, int* i)
 \t(*i)++;
 }
 
+static void msgpack_unpack_uint64_at(msgpack_object* o, uint64_t* v, int* i)
+{
+\t*v = MSGPACK_OBJECT_AT(o,*i).u64;
+\t(*i)++;
+}
+
 static void msgpack_unpack_string_at(msgpack_object* o, char** buffer, int* len, int* i)
 {
 \t*buffer = NULL;
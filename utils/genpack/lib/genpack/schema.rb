@@ -47,6 +47,11 @@ module GenPack
       message.instance_eval(&block)
       types << message
     end
+    def struct(name, &block)
+      struct = Struct.new(self, name)
+      struct.instance_eval(&block)
+      types << struct
+    end
     def union(name, &block)
       union = Union.new(self, name)
       union.instance_eval(&block)
@@ -55,6 +60,9 @@ module GenPack
     def typedefs
       types.select {|t| t.is_a?(TypeDef)}
     end
+    def structs
+      types.select {|t| t.is_a?(Struct)}
+    end
     def messages
       types.select {|t| t.is_a?(Message)}
     end
@@ -76,9 +84,15 @@ module GenPack
     def uint(name)
       fields << Field.new(Types::UInt.new, name)
     end
+    def uint64(name)
+      fields << Field.new(Types::UInt64.new, name)
+    end
     def string(name)
       fields << Field.new(Types::String.new, name)
     end
+    def array(name, type)
+      fields << Field.new(Types::Array.new(type), name)
+    end
     def method_missing(method, *arguments, &block)
       t = schema.types.detect {|t| t.name == method}
       if t.nil?
@@ -112,7 +126,30 @@ module GenPack
   end
   
   class Message < Compound; end
-  class Union < Compound; end
+  class Struct < Compound
+    def pack_signature
+      "static void msgpack_pack_#{name}(msgpack_packer* p, #{name}* v)"
+    end
+    def unpack_signature
+      "static void msgpack_unpack_#{name}(msgpack_object* o, #{name}* v)"
+    end
+    def pack_array_signature
+      "static void msgpack_pack_#{name}_array(msgpack_packer* p, #{name}* v, int len)"
+    end
+    def unpack_array_signature
+      "static void msgpack_unpack_#{name}_array_at(msgpack_object* o, #{name}** v, int* len, int* i)"
+    end
+  end
+  class Union < Compound
+    # Fields carried outside of the encoded message, e.g. in the frame
+    def header(&block)
+      @header = Compound.new(schema, name)
+      @header.instance_eval(&block)
+    end
+    def header_fields
+      @header.nil? ? [] : @header.fields
+    end
+  end
   class TypeDef < Compound;
     def pack_signature
       "static void msgpack_pack_#{name}(msgpack_packer* p, #{name}* v)"
@@ -162,6 +199,9 @@ module GenPack
     class UInt < Int
       def ctype; "uint32"; end
     end
+    class UInt64 < Int
+      def ctype; "uint64"; end
+    end
     class String < Type
       def pack(name, access)
         "msgpack_pack_string(p, #{access}#{name}_val, #{access}#{name}_len);"
@@ -185,6 +225,21 @@ module GenPack
         "msgpack_unpack_#{ctype}(o, #{access}#{name});"
       end
     end
+    class Array < Type
+      attr_accessor :ctype
+      def initialize(ctype)
+        @ctype = ctype
+      end
+      def pack(name, access)
+        "msgpack_pack_#{ctype}_array(p, #{access}#{name}_val, #{access}#{name}_len);"
+      end
+      def unpack(name, access)
+        "msgpack_unpack_#{ctype}_array_at(o, #{access}#{name}_val, #{access}#{name}_len, &i);"
+      end
+      def declare(name)
+        "int #{name.to_s}_len;\n\t#{ctype} *#{name.to_s}_val;"
+      end
+    end
     class CustomTypeDef < Type
       attr_accessor :ctype
       def initialize(ctype)
@@ -21,6 +21,7 @@ schema = GenPack::Schema.define "paxos_types" do
     uint :iid
     uint :ballot
     paxos_value :value
+    uint64 :timestamp
   }
   message(:paxos_accepted) {
     uint :aid
@@ -28,6 +29,7 @@ schema = GenPack::Schema.define "paxos_types" do
     uint :ballot
     uint :value_ballot
     paxos_value :value
+    uint64 :timestamp
   }
   message(:paxos_preempted) {
     uint :aid
@@ -46,9 +48,86 @@ schema = GenPack::Schema.define "paxos_types" do
     uint :trim_iid
   }
   message(:paxos_client_value) {
+    uint :id
     paxos_value :value
   }
+  message(:paxos_snapshot_request) {
+    uint :iid
+  }
+  message(:paxos_snapshot_chunk) {
+    uint :iid
+    uint :offset
+    uint :size
+    paxos_value :data
+  }
+  message(:paxos_catchup) {
+    uint :from
+    uint :to
+  }
+  message(:paxos_chosen) {
+    uint :iid
+    uint :ballot
+    paxos_value :value
+    uint64 :timestamp
+  }
+  message(:paxos_replica_state) {
+    uint :rid
+    uint :checkpoint_iid
+  }
+  struct(:paxos_accept_entry) {
+    uint :iid
+    uint :ballot
+    paxos_value :value
+    uint64 :timestamp
+  }
+  message(:paxos_accept_batch) {
+    array :entries, :paxos_accept_entry
+  }
+  struct(:paxos_accepted_entry) {
+    uint :iid
+    uint :ballot
+    uint :value_ballot
+    paxos_value :value
+    uint64 :timestamp
+  }
+  message(:paxos_accepted_batch) {
+    uint :aid
+    array :entries, :paxos_accepted_entry
+  }
+  message(:paxos_client_reply) {
+    uint :id
+    uint :iid
+    uint :leader
+  }
+  message(:paxos_heartbeat) {
+    uint :seq
+    uint :ballot
+  }
+  message(:paxos_heartbeat_ack) {
+    uint :aid
+    uint :seq
+    uint :accepted_iid
+  }
+  message(:paxos_prepare_range) {
+    uint :from
+    uint :ballot
+    uint :stride
+  }
+  message(:paxos_promise_range) {
+    uint :aid
+    uint :from
+    uint :ballot
+    uint :prev_ballot
+    uint :max_iid
+  }
+  message(:paxos_safe_time) {
+    uint :iid
+    uint64 :timestamp
+  }
   union(:paxos_message) {
+    header {
+      uint :log
+    }
     paxos_prepare :prepare
     paxos_promise :promise
     paxos_accept :accept
@@ -58,6 +137,19 @@ schema = GenPack::Schema.define "paxos_types" do
     paxos_trim :trim
     paxos_acceptor_state :state
     paxos_client_value :client_value
+    paxos_snapshot_request :snapshot_request
+    paxos_snapshot_chunk :snapshot_chunk
+    paxos_catchup :catchup
+    paxos_chosen :chosen
+    paxos_replica_state :replica_state
+    paxos_accept_batch :accept_batch
+    paxos_accepted_batch :accepted_batch
+    paxos_client_reply :client_reply
+    paxos_heartbeat :heartbeat
+    paxos_heartbeat_ack :heartbeat_ack
+    paxos_prepare_range :prepare_range
+    paxos_promise_range :promise_range
+    paxos_safe_time :safe_time
   }
 end
 